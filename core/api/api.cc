@@ -4,6 +4,9 @@
 
 #include "api.h"
 #include "hal.h"
+#include "monitor.h"
+#include "scurve.h"
+#include "control.h"
 #include "log.h"
 #include "dictionaries.h"
 #include <algorithm>
@@ -18,6 +21,66 @@
 
 using namespace pxar;
 
+namespace {
+
+  /** Asynchronous call of a DAC scan with all its arguments
+   */
+  template <typename R> class asyncDacScan : public asyncTest {
+  public:
+    typedef bool (api::*function)(R &, std::string, uint8_t, uint8_t, uint16_t, uint32_t);
+  asyncDacScan(api * instance, function fn, R & result, std::string dacName, uint8_t dacMin, uint8_t dacMax, uint16_t flags, uint32_t nTriggers) :
+    _api(instance), _fn(fn), _result(result), _dacName(dacName), _dacMin(dacMin), _dacMax(dacMax), _flags(flags), _nTriggers(nTriggers) {};
+    bool run() { return (_api->*_fn)(_result, _dacName, _dacMin, _dacMax, _flags, _nTriggers); };
+  private:
+    api * _api;
+    function _fn;
+    R & _result;
+    std::string _dacName;
+    uint8_t _dacMin, _dacMax;
+    uint16_t _flags;
+    uint32_t _nTriggers;
+  };
+
+  /** Asynchronous call of a DacDac scan with all its arguments
+   */
+  template <typename R> class asyncDacDacScan : public asyncTest {
+  public:
+    typedef bool (api::*function)(R &, std::string, uint8_t, uint8_t, std::string, uint8_t, uint8_t, uint16_t, uint32_t);
+  asyncDacDacScan(api * instance, function fn, R & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+		  std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers) :
+    _api(instance), _fn(fn), _result(result), _dac1name(dac1name), _dac1min(dac1min), _dac1max(dac1max),
+      _dac2name(dac2name), _dac2min(dac2min), _dac2max(dac2max), _flags(flags), _nTriggers(nTriggers) {};
+    bool run() { return (_api->*_fn)(_result, _dac1name, _dac1min, _dac1max, _dac2name, _dac2min, _dac2max, _flags, _nTriggers); };
+  private:
+    api * _api;
+    function _fn;
+    R & _result;
+    std::string _dac1name;
+    uint8_t _dac1min, _dac1max;
+    std::string _dac2name;
+    uint8_t _dac2min, _dac2max;
+    uint16_t _flags;
+    uint32_t _nTriggers;
+  };
+
+  /** Asynchronous call of a chip map with all its arguments
+   */
+  template <typename R> class asyncMap : public asyncTest {
+  public:
+    typedef bool (api::*function)(R &, uint16_t, uint32_t);
+  asyncMap(api * instance, function fn, R & result, uint16_t flags, uint32_t nTriggers) :
+    _api(instance), _fn(fn), _result(result), _flags(flags), _nTriggers(nTriggers) {};
+    bool run() { return (_api->*_fn)(_result, _flags, _nTriggers); };
+  private:
+    api * _api;
+    function _fn;
+    R & _result;
+    uint16_t _flags;
+    uint32_t _nTriggers;
+  };
+
+}
+
 api::api(std::string usbId, std::string logLevel) {
 
   LOG(logQUIET) << "Instanciating API for " << PACKAGE_STRING;
@@ -29,12 +92,31 @@ api::api(std::string usbId, std::string logLevel) {
   // Get a new HAL instance with the DTB USB ID passed to the API constructor:
   _hal = new hal(usbId);
 
+  // Prepare the background sampler for the power telemetry, not started yet:
+  _monitor = new powerMonitor(_hal);
+
   // Get the DUT up and running:
   _dut = new dut();
   _dut->_initialized = false;
+
+  // No asynchronous test running yet:
+  _control = NULL;
+  _asyncTest = NULL;
+  _asyncRunning = false;
+  _asyncJoinable = false;
+  pthread_mutex_init(&_asyncMutex, NULL);
 }
 
 api::~api() {
+  // Cancel a running asynchronous test and wait for its thread:
+  pthread_mutex_lock(&_asyncMutex);
+  if(_asyncRunning) _control->cancel();
+  pthread_mutex_unlock(&_asyncMutex);
+  if(_asyncJoinable) pthread_join(_asyncThread, NULL);
+  pthread_mutex_destroy(&_asyncMutex);
+
+  // The monitor thread needs to be stopped before the HAL goes away:
+  delete _monitor;
   delete _dut;
   delete _hal;
 }
@@ -43,6 +125,8 @@ bool api::initTestboard(std::vector<std::pair<std::string,uint8_t> > sig_delays,
                        std::vector<std::pair<std::string,double> > power_settings,
 			std::vector<std::pair<uint16_t,uint8_t> > pg_setup) {
 
+  if(asyncBusy()) return false;
+
   // Collect and check the testboard configuration settings
 
   // Read the power settings and make sure we got all:
@@ -178,13 +262,11 @@ bool api::initDUT(std::string tbmtype,
       uint8_t dacRegister, dacValue = dacIt->second;
       if(!verifyRegister(dacIt->first, dacRegister, dacValue, ROC_REG)) continue;
 
-      std::pair<std::map<uint8_t,uint8_t>::iterator,bool> ret;
-      ret = newroc.dacs.insert( std::make_pair(dacRegister,dacValue) );
-      if(ret.second == false) {
+      uint8_t oldValue = newroc.getDAC(dacRegister);
+      if(newroc.setDAC(dacRegister,dacValue)) {
 	LOG(logWARNING) << "Overwriting existing DAC \"" << dacIt->first 
-			<< "\" value " << (int)ret.first->second
+			<< "\" value " << (int)oldValue
 			<< " with " << (int)dacValue;
-	newroc.dacs[dacRegister] = dacValue;
       }
     }
 
@@ -195,8 +277,10 @@ bool api::initDUT(std::string tbmtype,
 	LOG(logWARNING) << "Pixel " << (int)(*pixIt).column << ", " << (int)(*pixIt).row << " trim value " << (int)(*pixIt).trim << " exceeds limit. Set to 15.";
 	(*pixIt).trim = 15;
       }
-      // Push the pixelConfigs into the rocConfig:
-      newroc.pixels.push_back(*pixIt);
+      // Store the pixelConfigs in the rocConfig:
+      if(!newroc.setPixel(*pixIt)) {
+	LOG(logWARNING) << "Pixel " << (int)(*pixIt).column << ", " << (int)(*pixIt).row << " does not exist on the ROC, skipping.";
+      }
     }
 
     // Done. Enable bit is already set by rocConfig constructor.
@@ -211,6 +295,7 @@ bool api::initDUT(std::string tbmtype,
 
 bool api::programDUT() {
 
+  if(asyncBusy()) return false;
   if(!_dut->_initialized) {
     LOG(logERROR) << "DUT not initialized, unable to program it.";
     return false;
@@ -220,21 +305,16 @@ bool api::programDUT() {
 
   // FIXME Device types not transmitted yet!
 
-  std::vector<tbmConfig> enabledTbms = _dut->getEnabledTbms();
-  if(!enabledTbms.empty()) {LOG(logDEBUGAPI) << "Programming TBMs...";}
-  for (std::vector<tbmConfig>::iterator tbmit = enabledTbms.begin(); tbmit != enabledTbms.end(); ++tbmit){
-    _hal->initTBM((uint8_t)(tbmit - enabledTbms.begin()),(*tbmit).dacs);
-  }
-
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  if(!enabledRocs.empty()) {LOG(logDEBUGAPI) << "Programming ROCs...";}
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    _hal->initROC((uint8_t)(rocit - enabledRocs.begin()),(*rocit).dacs);
+  // Collect all TBM registers, ROC DACs and mask/trim information into one plan
+  // and send it to the testboard in a single transfer:
+  programmingPlan plan;
+  buildProgrammingPlan(plan);
+  LOG(logDEBUGAPI) << "Programming DUT with " << plan.commands.size() << " commands...";
+  if(!_hal->programDUT(plan)) {
+    LOG(logERROR) << "Programming the DUT failed.";
+    return false;
   }
 
-  // As last step, write all the mask and trim information to the devices:
-  MaskAndTrim();
-
   // The DUT is programmed, everything all right:
   _dut->_programmed = true;
 
@@ -243,10 +323,24 @@ bool api::programDUT() {
 
 // API status function, checks HAL and DUT statuses
 bool api::status() {
+
+  if(asyncBusy()) return false;
   if(_hal->status() && _dut->status()) return true;
   return false;
 }
 
+bool api::asyncBusy() {
+
+  // While an asynchronous test is running, only its own thread may use the hardware:
+  pthread_mutex_lock(&_asyncMutex);
+  bool busy = _asyncRunning && !pthread_equal(pthread_self(), _asyncThread);
+  pthread_mutex_unlock(&_asyncMutex);
+  if(busy) {
+    LOG(logERROR) << "An asynchronous test is running, wait for it to finish or cancel it first.";
+  }
+  return busy;
+}
+
 // Check if the given value lies within the valid range of the DAC. If value lies above/below valid range
 // return the upper/lower bondary. If value lies wqithin the range, return the value
 bool api::verifyRegister(std::string name, uint8_t &id, uint8_t &value, uint8_t type) {
@@ -328,49 +422,79 @@ bool api::flashTB(std::string filename) {
 }
 
 double api::getTBia() {
-  if(!_hal->status()) {return 0;}
+  if(asyncBusy() || !_hal->status()) {return 0;}
   return _hal->getTBia();
 }
 
 double api::getTBva() {
-  if(!_hal->status()) {return 0;}
+  if(asyncBusy() || !_hal->status()) {return 0;}
   return _hal->getTBva();
 }
 
 double api::getTBid() {
-  if(!_hal->status()) {return 0;}
+  if(asyncBusy() || !_hal->status()) {return 0;}
   return _hal->getTBid();
 }
 
 double api::getTBvd() {
-  if(!_hal->status()) {return 0;}
+  if(asyncBusy() || !_hal->status()) {return 0;}
   return _hal->getTBvd();
 }
 
 
 void api::HVoff() {
+  if(asyncBusy()) return;
   _hal->HVoff();
 }
 
 void api::HVon() {
+  if(asyncBusy()) return;
   _hal->HVon();
 }
 
 void api::Poff() {
+  if(asyncBusy()) return;
   _hal->Poff();
   // Reset the programmed state of the DUT (lost by turning off power)
   _dut->_programmed = false;
 }
 
 void api::Pon() {
+  if(asyncBusy()) return;
   _hal->Pon();
   // Re-program the DUT after power has been switched on:
   programDUT();
 }
 
+bool api::startMonitor(double rate) {
+  if(!_hal->status()) return false;
+  return _monitor->start(rate);
+}
+
+void api::stopMonitor() {
+  _monitor->stop();
+}
+
+void api::markMonitorPhase(std::string phase) {
+  LOG(logDEBUGAPI) << "Monitor phase \"" << phase << "\" started.";
+  _monitor->markPhase(phase);
+}
+
+bool api::getMonitorReading(powerReading & reading) {
+  return _monitor->getLatest(reading);
+}
+
+std::vector<powerReading> api::getMonitorReadings() {
+  return _monitor->getReadings();
+}
+
+std::vector<powerSummary> api::getMonitorSummaries() {
+  return _monitor->getSummaries();
+}
+
 bool api::SignalProbe(std::string probe, std::string name) {
 
-  if(!_hal->status()) {return false;}
+  if(asyncBusy() || !_hal->status()) {return false;}
 
   // Convert the probe name to lower case for comparison:
   std::transform(probe.begin(), probe.end(), probe.begin(), ::tolower);
@@ -439,36 +563,31 @@ bool api::setDAC(std::string dacName, uint8_t dacValue, int8_t rocid) {
   uint8_t dacRegister;
   if(!verifyRegister(dacName, dacRegister, dacValue, ROC_REG)) return false;
 
-  std::pair<std::map<uint8_t,uint8_t>::iterator,bool> ret;
   if(rocid < 0) {
     // Set the DAC for all active ROCs:
     // FIXME maybe go over expandLoop here?
-    std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-    for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit) {
+    size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+    for (size_t roc = 0; roc < nEnabledRocs; roc++) {
 
       // Update the DUT DAC Value:
-      ret = _dut->roc.at((uint8_t)(rocit - enabledRocs.begin())).dacs.insert( std::make_pair(dacRegister,dacValue) );
-      if(ret.second == true) {
+      if(!_dut->roc.at(roc).setDAC(dacRegister,dacValue)) {
 	LOG(logWARNING) << "DAC \"" << dacName << "\" was not initialized. Created with value " << (int)dacValue;
       }
       else {
-	_dut->roc.at((uint8_t)(rocit - enabledRocs.begin())).dacs[dacRegister] = dacValue;
 	LOG(logDEBUGAPI) << "DAC \"" << dacName << "\" updated with value " << (int)dacValue;
       }
 
-      _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dacRegister,dacValue);
+      _hal->rocSetDAC((uint8_t)roc,dacRegister,dacValue);
     }
   }
   else if(_dut->roc.size() > (unsigned)rocid) {
     // Set the DAC only in the given ROC (even if that is disabled!)
 
     // Update the DUT DAC Value:
-    ret = _dut->roc.at(rocid).dacs.insert( std::make_pair(dacRegister,dacValue) );
-    if(ret.second == true) {
+    if(!_dut->roc.at(rocid).setDAC(dacRegister,dacValue)) {
       LOG(logWARNING) << "DAC \"" << dacName << "\" was not initialized. Created with value " << (int)dacValue;
     }
     else {
-      _dut->roc.at(rocid).dacs[dacRegister] = dacValue;
 	LOG(logDEBUGAPI) << "DAC \"" << dacName << "\" updated with value " << (int)dacValue;
     }
 
@@ -534,8 +653,15 @@ bool api::setTbmReg(std::string regName, uint8_t regValue, int8_t tbmid) {
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 										uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  getPulseheightVsDAC(result, dacName, dacMin, dacMax, flags, nTriggers);
+  return result;
+}
+
+bool api::getPulseheightVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+										uint16_t flags, uint32_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+  if(!status()) {result.clear(); return false;}
 
   // Check DAC range
   if(dacMin > dacMax) {
@@ -549,48 +675,52 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getPulseheightVsDAC(
   // Get the register number and check the range from dictionary:
   uint8_t dacRegister;
   if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+    result.clear(); return false;
   }
 
   // Setup the correct _hal calls for this test
-  HalMemFnPixel pixelfn = &hal::PixelCalibrateDacScan;
-  HalMemFnRoc rocfn = NULL;
-  HalMemFnModule modulefn = NULL;
+  HalMemFn<dacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Roc rocfn = &hal::RocCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Module modulefn = &hal::ModuleCalibrateDacScan;
 
   // We want the pulse height back from the Map function, no internal flag needed.
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dacRegister));  
-  param.push_back(static_cast<int32_t>(dacMin));
-  param.push_back(static_cast<int32_t>(dacMax));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  // Load the test parameters:
+  dacScanParameters param(dacRegister, dacMin, dacMax, flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-  // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > >* result = repackDacScanData(data,dacMin,dacMax);
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::vector<pixel> > > sink(result, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacScanData(result, dacMin); }
+  else { result.clear(); }
 
   // Reset the original value for the scanned DAC:
   // FIXME maybe go over expandLoop here?
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDacValue = _dut->getDAC((size_t)(rocit - enabledRocs.begin()),dacName);
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDacValue = _dut->getDAC(roc,dacName);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << (int)oldDacValue;
-    _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dacRegister,oldDacValue);
+    _hal->rocSetDAC((uint8_t)roc,dacRegister,oldDacValue);
   }
 
-  delete data;
-  return *result;
+  return success;
 }
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getDebugVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 										uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  getDebugVsDAC(result, dacName, dacMin, dacMax, flags, nTriggers);
+  return result;
+}
+
+bool api::getDebugVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+										uint16_t flags, uint32_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+  if(!status()) {result.clear(); return false;}
   
   // Check DAC range
   if(dacMin > dacMax) {
@@ -604,37 +734,41 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getDebugVsDAC(std::s
   // Get the register number and check the range from dictionary:
   uint8_t dacRegister;
   if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+    result.clear(); return false;
   }
   
   // Setup the correct _hal calls for this test (FIXME:DUMMYONLY)
-  HalMemFnPixel pixelfn = &hal::DummyPixelTestSkeleton;
-  HalMemFnRoc rocfn = &hal::DummyRocTestSkeleton;
-  HalMemFnModule modulefn = &hal::DummyModuleTestSkeleton;
-
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dacRegister));  
-  param.push_back(static_cast<int32_t>(dacMin));
-  param.push_back(static_cast<int32_t>(dacMax));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  HalMemFn<dacScanParameters>::Pixel pixelfn = &hal::DummyPixelTestSkeleton;
+  HalMemFn<dacScanParameters>::MultiPixel multipixelfn = NULL;
+  HalMemFn<dacScanParameters>::Roc rocfn = &hal::DummyRocTestSkeleton;
+  HalMemFn<dacScanParameters>::Module modulefn = &hal::DummyModuleTestSkeleton;
+
+  // Load the test parameters:
+  dacScanParameters param(dacRegister, dacMin, dacMax, flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-  // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > >* result = repackDacScanData(data,dacMin,dacMax);
-  delete data;
-  return *result;
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::vector<pixel> > > sink(result, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacScanData(result, dacMin); }
+  else { result.clear(); }
+  return success;
 
 } // getPulseheightVsDAC
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 									       uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  getEfficiencyVsDAC(result, dacName, dacMin, dacMax, flags, nTriggers);
+  return result;
+}
+
+bool api::getEfficiencyVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+									       uint16_t flags, uint32_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+  if(!status()) {result.clear(); return false;}
 
   // Check DAC range
   if(dacMin > dacMax) {
@@ -648,13 +782,14 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(s
   // Get the register number and check the range from dictionary:
   uint8_t dacRegister;
   if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::vector<pixel> > >();
+    result.clear(); return false;
   }
 
   // Setup the correct _hal calls for this test
-  HalMemFnPixel pixelfn = &hal::PixelCalibrateDacScan;
-  HalMemFnRoc rocfn = NULL;
-  HalMemFnModule modulefn = NULL;
+  HalMemFn<dacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Roc rocfn = &hal::RocCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Module modulefn = &hal::ModuleCalibrateDacScan;
 
  // We want the efficiency back from the Map function, so let's set the internal flag:
   int32_t internal_flags = 0;
@@ -662,47 +797,110 @@ std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getEfficiencyVsDAC(s
   internal_flags |= FLAG_INTERNAL_GET_EFFICIENCY;
   LOG(logDEBUGAPI) << "Efficiency flag set, flags now at " << internal_flags;
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dacRegister));  
-  param.push_back(static_cast<int32_t>(dacMin));
-  param.push_back(static_cast<int32_t>(dacMax));
-  param.push_back(static_cast<int32_t>(internal_flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  // Load the test parameters:
+  dacScanParameters param(dacRegister, dacMin, dacMax, internal_flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = internal_flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-  // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::vector<pixel> > >* result = repackDacScanData(data,dacMin,dacMax);
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::vector<pixel> > > sink(result, (internal_flags & FLAG_INTERNAL_GET_EFFICIENCY), expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacScanData(result, dacMin); }
+  else { result.clear(); }
 
   // Reset the original value for the scanned DAC:
   // FIXME maybe go over expandLoop here?
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDacValue = _dut->getDAC((size_t)(rocit - enabledRocs.begin()),dacName);
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDacValue = _dut->getDAC(roc,dacName);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << (int)oldDacValue;
-    _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dacRegister,oldDacValue);
+    _hal->rocSetDAC((uint8_t)roc,dacRegister,oldDacValue);
   }
 
-  delete data;
-  return *result;
+  return success;
 
 }
 
 std::vector< std::pair<uint8_t, std::vector<pixel> > > api::getThresholdVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 									      uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > result;
+  getThresholdVsDAC(result, dacName, dacMin, dacMax, flags, nTriggers);
+  return result;
+}
+
+bool api::getThresholdVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+									      uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::vector<pixel> > >();}
+  // Check DAC range
+  if(dacMin > dacMax) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dacMin;
+    dacMin = dacMax;
+    dacMax = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dacRegister;
+  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+    result.clear(); return false;
+  }
+
+  // Load the test parameters, the threshold is searched for every DAC value:
+  thresholdParameters param;
+  if(!thresholdParameterSet(param, flags, nTriggers)) {
+    result.clear(); return false;
+  }
+  if(dacRegister == param.thrReg) {
+    LOG(logERROR) << "Cannot scan the threshold DAC \"" << dacName << "\" itself.";
+    result.clear(); return false;
+  }
+  param.scanDac(dacRegister, dacMin, dacMax);
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<thresholdParameters>::Pixel pixelfn = &hal::PixelThresholdMap;
+  HalMemFn<thresholdParameters>::MultiPixel multipixelfn = &hal::MultiPixelThresholdMap;
+  HalMemFn<thresholdParameters>::Roc rocfn = &hal::RocThresholdMap;
+  HalMemFn<thresholdParameters>::Module modulefn = &hal::ModuleThresholdMap;
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = flags & FLAG_FORCE_SERIAL;
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::vector<pixel> > > sink(result, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacScanData(result, dacMin); }
+  else { result.clear(); }
+
+  // Reset the original values of the threshold and the scanned DAC:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDacValue = _dut->getDAC(roc,dacName);
+    uint8_t oldThrValue = _dut->getDAC(roc,param.thrName);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << (int)oldDacValue;
+    _hal->rocSetDAC((uint8_t)roc,dacRegister,oldDacValue);
+    _hal->rocSetDAC((uint8_t)roc,param.thrReg,oldThrValue);
+  }
+
+  return success;
 }
 
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::getPulseheightVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
 													std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
-													uint16_t flags, uint32_t nTriggers){
+													uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+  getPulseheightVsDACDAC(result, dac1name, dac1min, dac1max, dac2name, dac2min, dac2max, flags, nTriggers);
+  return result;
+}
+
+bool api::getPulseheightVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
+													std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
+													uint16_t flags, uint32_t nTriggers) {
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
+  if(!status()) {result.clear(); return false;}
 
   // Check DAC ranges
   if(dac1min > dac1max) {
@@ -723,58 +921,60 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   // Get the register number and check the range from dictionary:
   uint8_t dac1register, dac2register;
   if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    result.clear(); return false;
   }
   if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    result.clear(); return false;
   }
 
   // Setup the correct _hal calls for this test
-  HalMemFnPixel pixelfn = &hal::PixelCalibrateDacDacScan;
-  HalMemFnRoc rocfn = NULL;
-  HalMemFnModule modulefn = NULL;
+  HalMemFn<dacDacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::MultiPixel multipixelfn = NULL;
+  HalMemFn<dacDacScanParameters>::Roc rocfn = &hal::RocCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::Module modulefn = NULL;
 
  // We want the pulse height back from the DacDac function, so no internal flags needed.
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dac1register));  
-  param.push_back(static_cast<int32_t>(dac1min));
-  param.push_back(static_cast<int32_t>(dac1max));
-  param.push_back(static_cast<int32_t>(dac2register));  
-  param.push_back(static_cast<int32_t>(dac2min));
-  param.push_back(static_cast<int32_t>(dac2max));
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  // Load the test parameters:
+  dacDacScanParameters param(dac1register, dac1min, dac1max, dac2register, dac2min, dac2max, flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-  // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >* result = repackDacDacScanData(data,dac1min,dac1max,dac2min,dac2max);
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > sink(result, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacDacScanData(result, dac1min, dac2min, dac2max); }
+  else { result.clear(); }
 
   // Reset the original value for the scanned DAC:
   // FIXME maybe go over expandLoop here?
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDac1Value = _dut->getDAC((size_t)(rocit - enabledRocs.begin()),dac1name);
-    uint8_t oldDac2Value = _dut->getDAC((size_t)(rocit - enabledRocs.begin()),dac2name);
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDac1Value = _dut->getDAC(roc,dac1name);
+    uint8_t oldDac2Value = _dut->getDAC(roc,dac2name);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << (int)oldDac1Value;
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << (int)oldDac2Value;
-    _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dac2register,oldDac2Value);
+    _hal->rocSetDAC((uint8_t)roc,dac1register,oldDac1Value);
+    _hal->rocSetDAC((uint8_t)roc,dac2register,oldDac2Value);
   }
 
-  delete data;
-  return *result;
+  return success;
 }
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::getEfficiencyVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
 												       std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
 												       uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+  getEfficiencyVsDACDAC(result, dac1name, dac1min, dac1max, dac2name, dac2min, dac2max, flags, nTriggers);
+  return result;
+}
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
+bool api::getEfficiencyVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
+												       std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
+												       uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
 
   // Check DAC ranges
   if(dac1min > dac1max) {
@@ -795,16 +995,17 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   // Get the register number and check the range from dictionary:
   uint8_t dac1register, dac2register;
   if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    result.clear(); return false;
   }
   if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
-    return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+    result.clear(); return false;
   }
 
   // Setup the correct _hal calls for this test
-  HalMemFnPixel pixelfn = &hal::PixelCalibrateDacDacScan;
-  HalMemFnRoc rocfn = NULL;
-  HalMemFnModule modulefn = NULL;
+  HalMemFn<dacDacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::MultiPixel multipixelfn = NULL;
+  HalMemFn<dacDacScanParameters>::Roc rocfn = &hal::RocCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::Module modulefn = NULL;
 
  // We want the efficiency back from the Map function, so let's set the internal flag:
   int32_t internal_flags = 0;
@@ -812,81 +1013,317 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api:
   internal_flags |= FLAG_INTERNAL_GET_EFFICIENCY;
   LOG(logDEBUGAPI) << "Efficiency flag set, flags now at " << internal_flags;
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(dac1register));  
-  param.push_back(static_cast<int32_t>(dac1min));
-  param.push_back(static_cast<int32_t>(dac1max));
-  param.push_back(static_cast<int32_t>(dac2register));  
-  param.push_back(static_cast<int32_t>(dac2min));
-  param.push_back(static_cast<int32_t>(dac2max));
-  param.push_back(static_cast<int32_t>(internal_flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  // Load the test parameters:
+  dacDacScanParameters param(dac1register, dac1min, dac1max, dac2register, dac2min, dac2max, internal_flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = internal_flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-  // repack data into the expected return format
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >* result = repackDacDacScanData(data,dac1min,dac1max,dac2min,dac2max);
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > sink(result, (internal_flags & FLAG_INTERNAL_GET_EFFICIENCY), expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacDacScanData(result, dac1min, dac2min, dac2max); }
+  else { result.clear(); }
 
   // Reset the original value for the scanned DAC:
   // FIXME maybe go over expandLoop here?
-  std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-  for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-    uint8_t oldDac1Value = _dut->getDAC((size_t)(rocit - enabledRocs.begin()),dac1name);
-    uint8_t oldDac2Value = _dut->getDAC((size_t)(rocit - enabledRocs.begin()),dac2name);
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDac1Value = _dut->getDAC(roc,dac1name);
+    uint8_t oldDac2Value = _dut->getDAC(roc,dac2name);
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << (int)oldDac1Value;
     LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << (int)oldDac2Value;
-    _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dac1register,oldDac1Value);
-    _hal->rocSetDAC((uint8_t) (rocit - enabledRocs.begin()),dac2register,oldDac2Value);
+    _hal->rocSetDAC((uint8_t)roc,dac1register,oldDac1Value);
+    _hal->rocSetDAC((uint8_t)roc,dac2register,oldDac2Value);
   }
 
-  delete data;
-  return *result;
+  return success;
 }
 
 std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > api::getThresholdVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
 												      std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
 												      uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > result;
+  getThresholdVsDACDAC(result, dac1name, dac1min, dac1max, dac2name, dac2min, dac2max, flags, nTriggers);
+  return result;
+}
+
+bool api::getThresholdVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
+												      std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
+												      uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
 
-  if(!status()) {return std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();}
+  // Check DAC ranges
+  if(dac1min > dac1max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac1min;
+    dac1min = dac1max;
+    dac1max = temp;
+  }
+  if(dac2min > dac2max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac2min;
+    dac2min = dac2max;
+    dac2max = temp;
+  }
 
+  // Get the register number and check the range from dictionary:
+  uint8_t dac1register, dac2register;
+  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
+    result.clear(); return false;
+  }
+  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+    result.clear(); return false;
+  }
+
+  // Load the test parameters, the threshold is searched for every DAC pair:
+  thresholdParameters param;
+  if(!thresholdParameterSet(param, flags, nTriggers)) {
+    result.clear(); return false;
+  }
+  if(dac1register == param.thrReg || dac2register == param.thrReg) {
+    LOG(logERROR) << "Cannot scan the threshold DAC itself.";
+    result.clear(); return false;
+  }
+  param.scanDacDac(dac1register, dac1min, dac1max, dac2register, dac2min, dac2max);
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<thresholdParameters>::Pixel pixelfn = &hal::PixelThresholdMap;
+  HalMemFn<thresholdParameters>::MultiPixel multipixelfn = &hal::MultiPixelThresholdMap;
+  HalMemFn<thresholdParameters>::Roc rocfn = &hal::RocThresholdMap;
+  HalMemFn<thresholdParameters>::Module modulefn = &hal::ModuleThresholdMap;
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = flags & FLAG_FORCE_SERIAL;
+  // The sink writes directly into the caller's storage:
+  blockSink< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > sink(result, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacDacScanData(result, dac1min, dac2min, dac2max); }
+  else { result.clear(); }
+
+  // Reset the original values of the threshold and the scanned DACs:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDac1Value = _dut->getDAC(roc,dac1name);
+    uint8_t oldDac2Value = _dut->getDAC(roc,dac2name);
+    uint8_t oldThrValue = _dut->getDAC(roc,param.thrName);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << (int)oldDac1Value;
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << (int)oldDac2Value;
+    _hal->rocSetDAC((uint8_t)roc,dac1register,oldDac1Value);
+    _hal->rocSetDAC((uint8_t)roc,dac2register,oldDac2Value);
+    _hal->rocSetDAC((uint8_t)roc,param.thrReg,oldThrValue);
+  }
+
+  return success;
+}
+
+bool api::getPulseheightVsDAC(scanConsumer & consumer, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			      uint16_t flags, uint32_t nTriggers) {
+  return streamDacScan(consumer, false, dacName, dacMin, dacMax, flags, nTriggers);
+}
+
+bool api::getEfficiencyVsDAC(scanConsumer & consumer, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			     uint16_t flags, uint32_t nTriggers) {
+  return streamDacScan(consumer, true, dacName, dacMin, dacMax, flags, nTriggers);
+}
+
+bool api::getPulseheightVsDACDAC(scanConsumer & consumer, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				 std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+				 uint16_t flags, uint32_t nTriggers) {
+  return streamDacDacScan(consumer, false, dac1name, dac1min, dac1max, dac2name, dac2min, dac2max, flags, nTriggers);
+}
+
+bool api::getEfficiencyVsDACDAC(scanConsumer & consumer, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+				uint16_t flags, uint32_t nTriggers) {
+  return streamDacDacScan(consumer, true, dac1name, dac1min, dac1max, dac2name, dac2min, dac2max, flags, nTriggers);
+}
+
+bool api::streamDacScan(scanConsumer & consumer, bool efficiency, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {return false;}
+
+  // Check DAC range
+  if(dacMin > dacMax) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dacMin;
+    dacMin = dacMax;
+    dacMax = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dacRegister;
+  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+    return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<dacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Roc rocfn = &hal::RocCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Module modulefn = &hal::ModuleCalibrateDacScan;
+
+  int32_t internal_flags = flags;
+  if(efficiency) internal_flags |= FLAG_INTERNAL_GET_EFFICIENCY;
+
+  // Load the test parameters:
+  dacScanParameters param(dacRegister, dacMin, dacMax, internal_flags, nTriggers);
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = internal_flags & FLAG_FORCE_SERIAL;
+  // The sink hands every chunk to the consumer as soon as it is complete:
+  streamSink<dacScanParameters> sink(consumer, param, efficiency);
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { sink.flush(); }
+
+  // Reset the original value for the scanned DAC:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDacValue = _dut->getDAC(roc,dacName);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << (int)oldDacValue;
+    _hal->rocSetDAC((uint8_t)roc,dacRegister,oldDacValue);
+  }
+
+  return success;
+}
+
+bool api::streamDacDacScan(scanConsumer & consumer, bool efficiency, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+			   std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {return false;}
+
+  // Check DAC ranges
+  if(dac1min > dac1max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac1min;
+    dac1min = dac1max;
+    dac1max = temp;
+  }
+  if(dac2min > dac2max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac2min;
+    dac2min = dac2max;
+    dac2max = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dac1register, dac2register;
+  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
+    return false;
+  }
+  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+    return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<dacDacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::MultiPixel multipixelfn = NULL;
+  HalMemFn<dacDacScanParameters>::Roc rocfn = &hal::RocCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::Module modulefn = NULL;
+
+  int32_t internal_flags = flags;
+  if(efficiency) internal_flags |= FLAG_INTERNAL_GET_EFFICIENCY;
+
+  // Load the test parameters:
+  dacDacScanParameters param(dac1register, dac1min, dac1max, dac2register, dac2min, dac2max, internal_flags, nTriggers);
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = internal_flags & FLAG_FORCE_SERIAL;
+  // The sink hands every chunk to the consumer as soon as it is complete:
+  streamSink<dacDacScanParameters> sink(consumer, param, efficiency);
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { sink.flush(); }
+
+  // Reset the original values for the scanned DACs:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDac1Value = _dut->getDAC(roc,dac1name);
+    uint8_t oldDac2Value = _dut->getDAC(roc,dac2name);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << (int)oldDac1Value;
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << (int)oldDac2Value;
+    _hal->rocSetDAC((uint8_t)roc,dac1register,oldDac1Value);
+    _hal->rocSetDAC((uint8_t)roc,dac2register,oldDac2Value);
+  }
+
+  return success;
+}
+
+std::vector<scurveResult> api::fitSCurves(const std::vector< std::pair<uint8_t, std::vector<pixel> > > & data,
+					  uint32_t nTriggers, size_t nThreads) {
+
+  // The fit runs on the host only, no testboard access needed:
+  if(nTriggers == 0) {
+    LOG(logERROR) << "Cannot fit S-curves taken with zero triggers.";
+    return std::vector<scurveResult>();
+  }
+
+  scurveFitter fitter(nThreads);
+  std::vector<scurveResult> result = fitter.fit(data, nTriggers);
+
+  size_t failed = 0;
+  for(std::vector<scurveResult>::iterator it = result.begin(); it != result.end(); ++it) {
+    if(it->flags & ~SCURVE_FALLING) failed++;
+  }
+  LOG(logDEBUGAPI) << "Fitted " << result.size() << " S-curves, " << failed << " flagged.";
+  return result;
 }
 
 std::vector<pixel> api::getPulseheightMap(uint16_t flags, uint32_t nTriggers) {
+  std::vector<pixel> result;
+  getPulseheightMap(result, flags, nTriggers);
+  return result;
+}
 
-  if(!status()) {return std::vector<pixel>();}
+bool api::getPulseheightMap(std::vector<pixel> & result, uint16_t flags, uint32_t nTriggers) {
 
-  // Setup the correct _hal calls for this test (ROC wide only)
-  HalMemFnPixel pixelfn = &hal::PixelCalibrateMap;
-  HalMemFnRoc rocfn = &hal::RocCalibrateMap;
-  HalMemFnModule modulefn = NULL; //&hal::DummyModuleTestSkeleton; FIXME parallel later?
+  if(!status()) {result.clear(); return false;}
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<calibrateParameters>::Pixel pixelfn = &hal::PixelCalibrateMap;
+  HalMemFn<calibrateParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateMap;
+  HalMemFn<calibrateParameters>::Roc rocfn = &hal::RocCalibrateMap;
+  HalMemFn<calibrateParameters>::Module modulefn = &hal::ModuleCalibrateMap;
 
   // We want the pulse height back from the Map function, no flag needed.
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  // Load the test parameters:
+  calibrateParameters param(flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-
-  // FIXME do proper repacking instead of just returning the first vector entry!
-  return data->at(0);
+  // The map consists of a single data block containing all ROCs, written
+  // into the caller's storage:
+  std::vector< std::vector<pixel> > data(1);
+  data.front().swap(result);
+  blockSink<> sink(data, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial) && !data.empty();
+  if(success) { result.swap(data.front()); }
+  return success;
 }
 
 std::vector<pixel> api::getEfficiencyMap(uint16_t flags, uint32_t nTriggers) {
+  std::vector<pixel> result;
+  getEfficiencyMap(result, flags, nTriggers);
+  return result;
+}
+
+bool api::getEfficiencyMap(std::vector<pixel> & result, uint16_t flags, uint32_t nTriggers) {
 
-  if(!status()) {return std::vector<pixel>();}
+  if(!status()) {result.clear(); return false;}
 
-  // Setup the correct _hal calls for this test (ROC wide only)
-  HalMemFnPixel pixelfn = &hal::PixelCalibrateMap;
-  HalMemFnRoc rocfn = &hal::RocCalibrateMap;
-  HalMemFnModule modulefn = NULL; //&hal::DummyModuleTestSkeleton; FIXME parallel later?
+  // Setup the correct _hal calls for this test
+  HalMemFn<calibrateParameters>::Pixel pixelfn = &hal::PixelCalibrateMap;
+  HalMemFn<calibrateParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateMap;
+  HalMemFn<calibrateParameters>::Roc rocfn = &hal::RocCalibrateMap;
+  HalMemFn<calibrateParameters>::Module modulefn = &hal::ModuleCalibrateMap;
 
   // We want the efficiency back from the Map function, so let's set the internal flag:
   int32_t internal_flags = 0;
@@ -894,26 +1331,349 @@ std::vector<pixel> api::getEfficiencyMap(uint16_t flags, uint32_t nTriggers) {
   internal_flags |= FLAG_INTERNAL_GET_EFFICIENCY;
   LOG(logDEBUGAPI) << "Efficiency flag set, flags now at " << internal_flags;
 
-  // Load the test parameters into vector
-  std::vector<int32_t> param;
-  param.push_back(static_cast<int32_t>(internal_flags));
-  param.push_back(static_cast<int32_t>(nTriggers));
+  // Load the test parameters:
+  calibrateParameters param(internal_flags, nTriggers);
 
   // check if the flags indicate that the user explicitly asks for serial execution of test:
   // FIXME: FLAGS NOT YET CHECKED!
   bool forceSerial = internal_flags & FLAG_FORCE_SERIAL;
-  std::vector< std::vector<pixel> >* data = expandLoop(pixelfn, rocfn, modulefn, param, forceSerial);
-
-  // FIXME do proper repacking instead of just returning the first vector entry!
-  return data->at(0);
+  // The map consists of a single data block containing all ROCs, written
+  // into the caller's storage:
+  std::vector< std::vector<pixel> > data(1);
+  data.front().swap(result);
+  blockSink<> sink(data, (internal_flags & FLAG_INTERNAL_GET_EFFICIENCY), expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial) && !data.empty();
+  if(success) { result.swap(data.front()); }
+  return success;
 }
 
 std::vector<pixel> api::getThresholdMap(uint16_t flags, uint32_t nTriggers) {
+  std::vector<pixel> result;
+  getThresholdMap(result, flags, nTriggers);
+  return result;
+}
+
+bool api::getThresholdMap(std::vector<pixel> & result, uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
+
+  // Load the test parameters:
+  thresholdParameters param;
+  if(!thresholdParameterSet(param, flags, nTriggers)) { result.clear(); return false; }
 
-  if(!status()) {std::vector<pixel>();}
+  // Setup the correct _hal calls for this test
+  HalMemFn<thresholdParameters>::Pixel pixelfn = &hal::PixelThresholdMap;
+  HalMemFn<thresholdParameters>::MultiPixel multipixelfn = &hal::MultiPixelThresholdMap;
+  HalMemFn<thresholdParameters>::Roc rocfn = &hal::RocThresholdMap;
+  HalMemFn<thresholdParameters>::Module modulefn = &hal::ModuleThresholdMap;
 
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = flags & FLAG_FORCE_SERIAL;
+  // The map consists of a single data block containing all ROCs, written
+  // into the caller's storage:
+  std::vector< std::vector<pixel> > data(1);
+  data.front().swap(result);
+  blockSink<> sink(data, false, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial) && !data.empty();
+  if(success) { result.swap(data.front()); }
+
+  // Reset the original value of the threshold DAC:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldThrValue = _dut->getDAC(roc,param.thrName);
+    _hal->rocSetDAC((uint8_t)roc,param.thrReg,oldThrValue);
+  }
+
+  return success;
 }
   
+std::vector<pixelCalibration> api::getCalibrationMap(uint16_t flags, uint32_t nTriggers) {
+  std::vector<pixelCalibration> result;
+  getCalibrationMap(result, flags, nTriggers);
+  return result;
+}
+
+bool api::getCalibrationMap(std::vector<pixelCalibration> & result, uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<calibrateParameters>::Pixel pixelfn = &hal::PixelCalibrateMap;
+  HalMemFn<calibrateParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateMap;
+  HalMemFn<calibrateParameters>::Roc rocfn = &hal::RocCalibrateMap;
+  HalMemFn<calibrateParameters>::Module modulefn = &hal::ModuleCalibrateMap;
+
+  // We want both the efficiency and the pulse height, so the calibration sink is used.
+
+  // Load the test parameters:
+  calibrateParameters param(flags, nTriggers);
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = flags & FLAG_FORCE_SERIAL;
+  // The map consists of a single data block containing all ROCs, written
+  // into the caller's storage:
+  std::vector< std::vector<pixelCalibration> > data(1);
+  data.front().swap(result);
+  calibrationSink<> sink(data, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial) && !data.empty();
+  if(success) { result.swap(data.front()); }
+  return success;
+}
+
+std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > api::getCalibrationVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+											  uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > result;
+  getCalibrationVsDAC(result, dacName, dacMin, dacMax, flags, nTriggers);
+  return result;
+}
+
+bool api::getCalibrationVsDAC(std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+											  uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
+
+  // Check DAC range
+  if(dacMin > dacMax) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dacMin;
+    dacMin = dacMax;
+    dacMax = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dacRegister;
+  if(!verifyRegister(dacName, dacRegister, dacMax, ROC_REG)) {
+    result.clear(); return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<dacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::MultiPixel multipixelfn = &hal::MultiPixelCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Roc rocfn = &hal::RocCalibrateDacScan;
+  HalMemFn<dacScanParameters>::Module modulefn = &hal::ModuleCalibrateDacScan;
+
+  // Load the test parameters:
+  dacScanParameters param(dacRegister, dacMin, dacMax, flags, nTriggers);
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = flags & FLAG_FORCE_SERIAL;
+  // The sink writes directly into the caller's storage:
+  calibrationSink< std::pair<uint8_t, std::vector<pixelCalibration> > > sink(result, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacScanData(result, dacMin); }
+  else { result.clear(); }
+
+  // Reset the original value for the scanned DAC:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDacValue = _dut->getDAC(roc,dacName);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dacName << "\" to original value " << (int)oldDacValue;
+    _hal->rocSetDAC((uint8_t)roc,dacRegister,oldDacValue);
+  }
+
+  return success;
+}
+
+std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > api::getCalibrationVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
+														  std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
+														  uint16_t flags, uint32_t nTriggers) {
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > result;
+  getCalibrationVsDACDAC(result, dac1name, dac1min, dac1max, dac2name, dac2min, dac2max, flags, nTriggers);
+  return result;
+}
+
+bool api::getCalibrationVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
+														  std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
+														  uint16_t flags, uint32_t nTriggers) {
+
+  if(!status()) {result.clear(); return false;}
+
+  // Check DAC ranges
+  if(dac1min > dac1max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac1min;
+    dac1min = dac1max;
+    dac1max = temp;
+  }
+  if(dac2min > dac2max) {
+    // Swapping the range:
+    LOG(logWARNING) << "Swapping upper and lower bound.";
+    uint8_t temp = dac2min;
+    dac2min = dac2max;
+    dac2max = temp;
+  }
+
+  // Get the register number and check the range from dictionary:
+  uint8_t dac1register, dac2register;
+  if(!verifyRegister(dac1name, dac1register, dac1max, ROC_REG)) {
+    result.clear(); return false;
+  }
+  if(!verifyRegister(dac2name, dac2register, dac2max, ROC_REG)) {
+    result.clear(); return false;
+  }
+
+  // Setup the correct _hal calls for this test
+  HalMemFn<dacDacScanParameters>::Pixel pixelfn = &hal::PixelCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::MultiPixel multipixelfn = NULL;
+  HalMemFn<dacDacScanParameters>::Roc rocfn = &hal::RocCalibrateDacDacScan;
+  HalMemFn<dacDacScanParameters>::Module modulefn = NULL;
+
+  // Load the test parameters:
+  dacDacScanParameters param(dac1register, dac1min, dac1max, dac2register, dac2min, dac2max, flags, nTriggers);
+
+  // check if the flags indicate that the user explicitly asks for serial execution of test:
+  bool forceSerial = flags & FLAG_FORCE_SERIAL;
+  // The sink writes directly into the caller's storage:
+  calibrationSink< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > sink(result, expectedPixels());
+  bool success = expandLoop(pixelfn, multipixelfn, rocfn, modulefn, param, sink, forceSerial);
+  if(success) { labelDacDacScanData(result, dac1min, dac2min, dac2max); }
+  else { result.clear(); }
+
+  // Reset the original value for the scanned DAC:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t oldDac1Value = _dut->getDAC(roc,dac1name);
+    uint8_t oldDac2Value = _dut->getDAC(roc,dac2name);
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac1name << "\" to original value " << (int)oldDac1Value;
+    LOG(logDEBUGAPI) << "Reset DAC \"" << dac2name << "\" to original value " << (int)oldDac2Value;
+    _hal->rocSetDAC((uint8_t)roc,dac1register,oldDac1Value);
+    _hal->rocSetDAC((uint8_t)roc,dac2register,oldDac2Value);
+  }
+
+  return success;
+}
+
+bool api::getPulseheightVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			       uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacScan< std::vector< std::pair<uint8_t, std::vector<pixel> > > >(this, &api::getPulseheightVsDAC, result, dacName, dacMin, dacMax, flags, nTriggers), control);
+}
+
+bool api::getEfficiencyVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			       uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacScan< std::vector< std::pair<uint8_t, std::vector<pixel> > > >(this, &api::getEfficiencyVsDAC, result, dacName, dacMin, dacMax, flags, nTriggers), control);
+}
+
+bool api::getThresholdVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			       uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacScan< std::vector< std::pair<uint8_t, std::vector<pixel> > > >(this, &api::getThresholdVsDAC, result, dacName, dacMin, dacMax, flags, nTriggers), control);
+}
+
+bool api::getCalibrationVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			       uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacScan< std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > >(this, &api::getCalibrationVsDAC, result, dacName, dacMin, dacMax, flags, nTriggers), control);
+}
+
+bool api::getPulseheightVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				  std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacDacScan< std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >(this, &api::getPulseheightVsDACDAC, result, dac1name, dac1min, dac1max,
+									  dac2name, dac2min, dac2max, flags, nTriggers), control);
+}
+
+bool api::getEfficiencyVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				  std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacDacScan< std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >(this, &api::getEfficiencyVsDACDAC, result, dac1name, dac1min, dac1max,
+									  dac2name, dac2min, dac2max, flags, nTriggers), control);
+}
+
+bool api::getThresholdVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				  std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacDacScan< std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > >(this, &api::getThresholdVsDACDAC, result, dac1name, dac1min, dac1max,
+									  dac2name, dac2min, dac2max, flags, nTriggers), control);
+}
+
+bool api::getCalibrationVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				  std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncDacDacScan< std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > >(this, &api::getCalibrationVsDACDAC, result, dac1name, dac1min, dac1max,
+									  dac2name, dac2min, dac2max, flags, nTriggers), control);
+}
+
+bool api::getPulseheightMapAsync(testControl & control, std::vector<pixel> & result, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncMap< std::vector<pixel> >(this, &api::getPulseheightMap, result, flags, nTriggers), control);
+}
+
+bool api::getEfficiencyMapAsync(testControl & control, std::vector<pixel> & result, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncMap< std::vector<pixel> >(this, &api::getEfficiencyMap, result, flags, nTriggers), control);
+}
+
+bool api::getThresholdMapAsync(testControl & control, std::vector<pixel> & result, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncMap< std::vector<pixel> >(this, &api::getThresholdMap, result, flags, nTriggers), control);
+}
+
+bool api::getCalibrationMapAsync(testControl & control, std::vector<pixelCalibration> & result, uint16_t flags, uint32_t nTriggers) {
+  return runAsync(new asyncMap< std::vector<pixelCalibration> >(this, &api::getCalibrationMap, result, flags, nTriggers), control);
+}
+
+bool api::runAsync(asyncTest * test, testControl & control) {
+
+  // Refuses to start while another asynchronous test is running:
+  if(!status()) {
+    delete test;
+    return false;
+  }
+
+  // Clean up the thread of the previous test:
+  if(_asyncJoinable) {
+    pthread_join(_asyncThread, NULL);
+    _asyncJoinable = false;
+  }
+
+  control.begin();
+
+  // Hold the lock until the thread ID is known, the test thread needs it
+  // to pass the status check:
+  pthread_mutex_lock(&_asyncMutex);
+  _control = &control;
+  _asyncTest = test;
+  _asyncRunning = true;
+  if(pthread_create(&_asyncThread, NULL, &api::asyncThread, this) != 0) {
+    _control = NULL;
+    _asyncTest = NULL;
+    _asyncRunning = false;
+    pthread_mutex_unlock(&_asyncMutex);
+    LOG(logERROR) << "Could not start the test thread.";
+    delete test;
+    control.finish(false);
+    return false;
+  }
+  _asyncJoinable = true;
+  pthread_mutex_unlock(&_asyncMutex);
+
+  LOG(logDEBUGAPI) << "Asynchronous test started.";
+  return true;
+}
+
+void * api::asyncThread(void * instance) {
+
+  api * self = static_cast<api*>(instance);
+
+  pthread_mutex_lock(&self->_asyncMutex);
+  testControl * control = self->_control;
+  asyncTest * test = self->_asyncTest;
+  pthread_mutex_unlock(&self->_asyncMutex);
+
+  self->_hal->setTestControl(control);
+  bool success = runGuarded(*test);
+  self->_hal->setTestControl(NULL);
+  delete test;
+
+  pthread_mutex_lock(&self->_asyncMutex);
+  self->_control = NULL;
+  self->_asyncTest = NULL;
+  self->_asyncRunning = false;
+  pthread_mutex_unlock(&self->_asyncMutex);
+
+  LOG(logDEBUGAPI) << "Asynchronous test " << (success ? "finished." : "failed or cancelled.");
+  // The caller may destroy the control as soon as the test is finished:
+  control->finish(success);
+  return NULL;
+}
+
+bool api::testCancelled() {
+  return (_control != NULL && _control->cancelled());
+}
+
 int32_t api::getReadbackValue(std::string parameterName) {
 
   if(!status()) {return -1;}
@@ -933,161 +1693,261 @@ bool api::daqStart(std::vector<std::pair<uint16_t, uint8_t> > pg_setup) {
 
   if(!status()) {return false;}
 
+  // Module readout runs through the TBM, all ROCs of the module send their
+  // headers with every event:
+  bool tbm = (_dut->getNEnabledTbms() > 0);
+  uint8_t nRocs = static_cast<uint8_t>(tbm ? _dut->roc.size() : 1);
+
+  // Analog ROCs are read out via the ADC, the address levels of every enabled
+  // ROC are calibrated with the current DAC settings and the test Pattern
+  // Generator first:
+  bool analog = (!_dut->roc.empty() && _dut->roc.front().type < ROC_PSI46DIG);
+  if(analog && tbm) {
+    LOG(logERROR) << "Analog readout is only supported for single ROCs.";
+    return false;
+  }
+  int32_t analogRoc = -1;
+  for(std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); analog && rocit != _dut->roc.end(); ++rocit) {
+    if(!rocit->enable) continue;
+    uint8_t rocid = static_cast<uint8_t>(rocit - _dut->roc.begin());
+    if(!_hal->RocCalibrateAnalogLevels(rocid, ANALOG_CALIBRATION_TRIGGERS)) {
+      LOG(logERROR) << "Analog level calibration of ROC " << static_cast<int>(rocid) << " failed, cannot start the DAQ.";
+      return false;
+    }
+    // The first enabled ROC is the one read out:
+    if(analogRoc < 0) analogRoc = rocid;
+  }
+  if(analog && analogRoc < 0) {
+    LOG(logERROR) << "No ROC enabled, cannot start the DAQ.";
+    return false;
+  }
+
   if(!pg_setup.empty()) {
-    // Prepare new Pattern Generator:
+    // Prepare new Pattern Generator, kept as DAQ program next to the test one:
     if(!verifyPatternGenerator(pg_setup)) return false;
-    _hal->SetupPatternGenerator(pg_setup);
+    _hal->DefinePatternGenerator("daq", pg_setup);
+    _hal->SelectPatternGenerator("daq");
   }
   
-  // FIXME still not doing anything here...
-  return false;
+  // Both TBM cores read out half of the ROCs on their own channel, decode
+  // them in parallel if the module uses both of them:
+  uint8_t nChannels = (tbm && nRocs > MOD_NUMROCS/2) ? 2 : 1;
+
+  if(!_hal->daqStart(tbm, nRocs, nChannels, analog, static_cast<uint8_t>(std::max<int32_t>(analogRoc, 0)))) {
+    // Restore the test Pattern Generator setup:
+    if(!pg_setup.empty()) _hal->SelectPatternGenerator("test");
+    return false;
+  }
+  return true;
 }
     
-std::vector<pixel> api::daqGetEvent() {}
+std::vector<pixel> api::daqGetEvent() {
+
+  event ev;
+  if(!_hal->daqEvent(ev)) {
+    LOG(logDEBUGAPI) << "No more events buffered, DAQ is not running.";
+    return std::vector<pixel>();
+  }
+
+  // Corrupt events are passed on, the consumer decides what to do with them:
+  if(ev.corrupt()) {
+    LOG(logWARNING) << "Event " << static_cast<int>(ev.counter) << " is corrupt (flags 0x"
+		    << std::hex << static_cast<int>(ev.flags) << std::dec << ", "
+		    << static_cast<int>(ev.nRocHeaders) << " ROC headers)";
+  }
+  return ev.pixels;
+}
+
+void api::daqTrigger() {
+
+  if(!status()) {return;}
+  _hal->daqTrigger();
+}
 
 bool api::daqStop() {
 
   if(!status()) {return false;}
 
-  // FIXME still not doing anything here...
+  bool stopped = _hal->daqStop();
 
-  // Re-program the old Pattern Generator setup which is stored in the DUT.
-  // Since these patterns are verified already, just write them:
-  _hal->SetupPatternGenerator(_dut->pg_setup);
+  // Re-select the test Pattern Generator program, which is still known to
+  // the HAL. Nothing is written if the DAQ used the same patterns:
+  _hal->SelectPatternGenerator("test");
   
-  return false;
+  return stopped;
 }
 
 
-std::vector< std::vector<pixel> >* api::expandLoop(HalMemFnPixel pixelfn, HalMemFnRoc rocfn, HalMemFnModule modulefn, std::vector<int32_t> param,  bool forceSerial){
+template <typename P> bool api::expandLoop(typename HalMemFn<P>::Pixel pixelfn, typename HalMemFn<P>::MultiPixel multipixelfn, typename HalMemFn<P>::Roc rocfn, typename HalMemFn<P>::Module modulefn, const P & param, pixelSink & sink, bool forceSerial){
   
-  // pointer to vector to hold our data
-  std::vector< std::vector<pixel> >* data = NULL;
-
+  // Prepare the output for the data blocks of this test. The HAL functions
+  // merge the data of all ROCs into these blocks in calling order:
+  sink.prepare(param.blocks());
 
   // Do the masking/unmasking&trimming for all ROCs first
   MaskAndTrim();
 
-  // check if we might use parallel routine on whole module: 16 ROCs
-  // must be enabled and parallel execution not disabled by user
-  if (_dut->getModuleEnable() && !forceSerial && modulefn != NULL){
-
-    LOG(logDEBUGAPI) << "\"The Loop\" contains one call to \'modulefn\'";
-    // execute call to HAL layer routine
-    data = CALL_MEMBER_FN(*_hal,modulefn)(param);
-  } 
-  else {
+  // Plan the loop: estimate the cost of every available strategy for the
+  // enabled pixels of each ROC and pick the cheapest one. ROC maps also
+  // serve partially enabled ROCs, the surplus pixels are filtered out.
+  // The enabled pixels are used as bitsets of the DUT configuration, only
+  // the multi-pixel functions need them as a list:
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  bool multipixel = (multipixelfn != NULL && !forceSerial);
+  std::vector< std::vector<pixelConfig> > pixelLists(multipixel ? nEnabledRocs : 0);
+  std::vector<uint8_t> strategy(nEnabledRocs, LOOP_NONE);
+  filterSink filter(sink);
+  bool filtered = false;
+  uint64_t total = 0;
+  size_t count[LOOP_MODULE+1] = {0};
+
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    const rocConfig & config = _dut->roc.at(roc);
+    size_t nPixels = config.nEnabledPixels();
+    if(nPixels == 0) continue;
+    if(multipixel) config.getPixels(config.enabledPixels(), pixelLists[roc]);
+
+    uint64_t cheapest = 0;
+    uint8_t candidates[] = {LOOP_ROC, LOOP_MULTIPIXEL, LOOP_PIXEL};
+    for(size_t c = 0; c < sizeof(candidates)/sizeof(candidates[0]); c++) {
+      if(candidates[c] == LOOP_ROC && rocfn == NULL) continue;
+      if(candidates[c] == LOOP_MULTIPIXEL && !multipixel) continue;
+      if(candidates[c] == LOOP_PIXEL && pixelfn == NULL) continue;
+
+      uint64_t cost = (candidates[c] == LOOP_MULTIPIXEL) ?
+	_hal->EstimateLoopCost(candidates[c], pixelLists[roc], param.blocks(), param.probes(), param.pipelined(), param.nTriggers)
+	: _hal->EstimateLoopCost(candidates[c], nPixels, param.blocks(), param.probes(), param.pipelined(), param.nTriggers);
+      if(strategy[roc] != LOOP_NONE && cost >= cheapest) continue;
+      strategy[roc] = candidates[c];
+      cheapest = cost;
+    }
 
-    // -> single ROC / ROC-by-ROC operation
-    // check if all pixels are enabled
-    // if so, use routine that accesses whole ROC
-    if (_dut->getAllPixelEnable() && rocfn != NULL){
-
-      // loop over all enabled ROCs
-      std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-
-      LOG(logDEBUGAPI) << "\"The Loop\" contains " << enabledRocs.size() << " calls to \'rocfn\'";
-
-      for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-	// execute call to HAL layer routine and save returned data in buffer
-	std::vector< std::vector<pixel> >* rocdata = CALL_MEMBER_FN(*_hal,rocfn)((uint8_t) (rocit - enabledRocs.begin()), param); // rocit - enabledRocs.begin() == index
-	// append rocdata to main data storage vector
-	if (!data) data = rocdata;
-	else {
-	  data->reserve( data->size() + rocdata->size());
-	  data->insert(data->end(), rocdata->begin(), rocdata->end());
-	  delete rocdata;
-	}
-      } // roc loop
-    } 
-    else if (pixelfn != NULL){
-
-      // -> we operate on single pixels
-      // loop over all enabled ROCs
-      std::vector<rocConfig> enabledRocs = _dut->getEnabledRocs();
-
-      LOG(logDEBUGAPI) << "\"The Loop\" contains " << enabledRocs.size() << " enabled ROCs.";
-
-      for (std::vector<rocConfig>::iterator rocit = enabledRocs.begin(); rocit != enabledRocs.end(); ++rocit){
-	std::vector< std::vector<pixel> >* rocdata = NULL;
-	std::vector<pixelConfig> enabledPixels = _dut->getEnabledPixels((uint8_t)(rocit - enabledRocs.begin()));
-
-
-	LOG(logDEBUGAPI) << "\"The Loop\" for the current ROC contains " \
-			 << enabledPixels.size() << " calls to \'pixelfn\'";
-
-	for (std::vector<pixelConfig>::iterator pixit = enabledPixels.begin(); pixit != enabledPixels.end(); ++pixit) {
-	  // execute call to HAL layer routine and store data in buffer
-	  std::vector< std::vector<pixel> >* buffer = CALL_MEMBER_FN(*_hal,pixelfn)((uint8_t) (rocit - enabledRocs.begin()), pixit->column, pixit->row, param);
-	  // merge pixel data into roc data storage vector
-	  if (!rocdata){
-	    rocdata = buffer; // for first time call
-	  } else {
-	    // loop over all entries in outer vector (i.e. over vectors of pixel)
-	    for (std::vector<std::vector<pixel> >::iterator vecit = buffer->begin(); vecit != buffer->end(); ++vecit){
-	      std::vector<pixel>::iterator pixelit = vecit->begin();
-	      // loop over all entries in buffer and add fired pixels to existing pixel vector
-	      while (pixelit != vecit->end()){
-		rocdata->at(vecit-buffer->begin()).push_back(*pixelit);
-		pixelit++;
-	      }
-	    }
-	    delete buffer;
-	  }
-	} // pixel loop
-	// append rocdata to main data storage vector
-	if (!data) data = rocdata;
-	else {
-	  data->reserve( data->size() + rocdata->size());
-	  data->insert(data->end(), rocdata->begin(), rocdata->end());
-	  delete rocdata;
-	}
-      } // roc loop
-    }// single pixel fnc
-    else {
+    if(strategy[roc] == LOOP_NONE) {
       // FIXME: THIS SHOULD THROW A CUSTOM EXCEPTION
       LOG(logCRITICAL) << "LOOP EXPANSION FAILED -- NO MATCHING FUNCTION TO CALL?!";
-      return NULL;
+      return false;
     }
-  } // single roc fnc
-  // now repack the data to join the individual ROC segments and return
-  std::vector< std::vector<pixel> >* compactdata = compactRocLoopData(data, _dut->getNEnabledRocs());
-  delete data; // clean up
-  return compactdata;
-} // expandLoop()
+    if(strategy[roc] == LOOP_ROC && nPixels < ROC_NUMCOLS*ROC_NUMROWS) {
+      filter.select(static_cast<uint8_t>(roc), config.enabledPixels());
+      filtered = true;
+    }
+    count[strategy[roc]]++;
+    total += cheapest;
+  }
 
+  // Progress is counted in data blocks per ROC:
+  size_t blocks = param.blocks();
+
+  // Running the whole module at once requires exactly MOD_NUMROCS ROCs, all
+  // of them enabled, and no forced serial execution:
+  if (_dut->getModuleEnable() && nEnabledRocs == MOD_NUMROCS && !forceSerial && modulefn != NULL){
+    uint64_t cost = _hal->EstimateLoopCost(LOOP_MODULE, 0, param.blocks(), param.probes(), param.pipelined(), param.nTriggers, nEnabledRocs);
+    if(cost < total) {
+      LOG(logDEBUGAPI) << "\"The Loop\" contains one call to \'modulefn\', estimated " << cost/1000 << " ms instead of " << total/1000 << " ms";
+      // Restrict the output to the enabled pixels of all ROCs:
+      for (size_t roc = 0; roc < nEnabledRocs; roc++){
+	const rocConfig & config = _dut->roc.at(roc);
+	if(config.nEnabledPixels() < ROC_NUMCOLS*ROC_NUMROWS) {
+	  filter.select(static_cast<uint8_t>(roc), config.enabledPixels());
+	  filtered = true;
+	}
+      }
+      if(_control != NULL) _control->plan(nEnabledRocs*blocks);
+      CALL_MEMBER_FN(*_hal,modulefn)(param, filtered ? static_cast<pixelSink&>(filter) : sink);
+      if(testCancelled()) {
+	LOG(logINFO) << "Test cancelled, restoring masks and trims.";
+	MaskAndTrim();
+	return false;
+      }
+      if(_control != NULL) _control->reach(nEnabledRocs*blocks);
+      return true;
+    }
+  }
 
+  LOG(logDEBUGAPI) << "\"The Loop\" contains " << count[LOOP_ROC] << " calls to \'rocfn\', "
+		   << count[LOOP_MULTIPIXEL] << " calls to \'multipixelfn\' and "
+		   << count[LOOP_PIXEL] << " ROCs with calls to \'pixelfn\', estimated " << total/1000 << " ms";
 
-std::vector< std::pair<uint8_t, std::vector<pixel> > >* api::repackDacScanData (std::vector< std::vector<pixel> >* data, uint8_t dacMin, uint8_t dacMax){
-  std::vector< std::pair<uint8_t, std::vector<pixel> > >* result = new std::vector< std::pair<uint8_t, std::vector<pixel> > >();
-  uint8_t currentDAC = dacMin;
-  for (std::vector<std::vector<pixel> >::iterator vecit = data->begin(); vecit!=data->end();++vecit){
-    result->push_back(std::make_pair(currentDAC, *vecit));
-    currentDAC++;
-  }
+  pixelSink & target = filtered ? static_cast<pixelSink&>(filter) : sink;
+  size_t nRocs = nEnabledRocs - std::count(strategy.begin(), strategy.end(), LOOP_NONE);
+  size_t done = 0;
+  if(_control != NULL) _control->plan(nRocs*blocks);
+
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    uint8_t rocid = static_cast<uint8_t>(roc);
+    if(strategy[roc] == LOOP_NONE) continue;
+    if(testCancelled()) break;
+
+    if(strategy[roc] == LOOP_ROC) {
+      // execute call to HAL layer routine, data is written directly to the sink
+      CALL_MEMBER_FN(*_hal,rocfn)(rocid, param, target);
+    }
+    else if(strategy[roc] == LOOP_MULTIPIXEL) {
+      // -> we operate on groups of pixels pulsed in parallel
+      CALL_MEMBER_FN(*_hal,multipixelfn)(rocid, pixelLists[roc], param, target);
+    }
+    else if(strategy[roc] == LOOP_PIXEL) {
+      // -> we operate on single pixels. The pixels of all consecutive pixel
+      // ROCs share one schedule, ordered by double column with the ROCs
+      // taking turns pixel by pixel. Requests are sent back to back, the HAL
+      // collects the replies and merges them into the sink while the next
+      // ones are sent:
+      pixelSchedule schedule;
+      size_t last = roc;
+      for(; last < nEnabledRocs && strategy[last] == LOOP_PIXEL; last++) {
+	schedule.add(static_cast<uint8_t>(last), _dut->roc.at(last).enabledPixels());
+      }
+      schedule.build();
+      LOG(logDEBUGAPI) << "Scheduled " << schedule.entries.size() << " pixels of " << (last - roc) << " ROCs.";
+
+      size_t runBlocks = (last - roc)*blocks;
+      _hal->beginPipeline();
+      for (std::vector<pixelSchedule::entry>::iterator pixit = schedule.entries.begin(); pixit != schedule.entries.end(); ++pixit) {
+	if(testCancelled()) break;
+	CALL_MEMBER_FN(*_hal,pixelfn)(pixit->roc, pixit->column, pixit->row, param, target);
+	if(_control != NULL) _control->reach(done + runBlocks*(pixit - schedule.entries.begin() + 1)/schedule.entries.size());
+      } // pixel loop
+      // A cancelled test still collects the requests in flight:
+      _hal->endPipeline();
+
+      // Continue after the scheduled ROCs, the last one is counted below:
+      done += runBlocks - blocks;
+      roc = last - 1;
+    }
 
-  LOG(logDEBUGAPI) << "Repack end: current " << (int)currentDAC << " (max " << (int)dacMax << ")";
-  if (currentDAC!=dacMax){
-    // FIXME: THIS SHOULD THROW A CUSTOM EXCEPTION
-    LOG(logCRITICAL) << "data structure size not as expected! " << data->size() << " data blocks do not fit to " << dacMax-dacMin << " DAC values!";
-    delete result;
-    return NULL;
+    if(testCancelled()) break;
+    done += blocks;
+    if(_control != NULL) _control->reach(done);
+  } // roc loop
+
+  if(testCancelled()) {
+    LOG(logINFO) << "Test cancelled, restoring masks and trims.";
+    MaskAndTrim();
+    return false;
   }
+  return true;
+} // expandLoop()
 
-  LOG(logDEBUGAPI) << "Correctly repacked DacScan data for delivery.";
-  return result;
-}
 
-std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >* api::repackDacDacScanData (std::vector< std::vector<pixel> >* data, uint8_t dac1min, uint8_t dac1max, uint8_t dac2min, uint8_t dac2max) {
 
-  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >* result = new std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >();
+template <typename T> void api::labelDacScanData(std::vector< std::pair<uint8_t, std::vector<T> > > & result, uint8_t dacMin) {
 
-  uint8_t current1dac = dac1min;
-  uint8_t current2dac = dac2min;
+  // The data blocks are filled in place, only the DAC values are missing:
+  uint8_t currentDAC = dacMin;
+  for (typename std::vector< std::pair<uint8_t, std::vector<T> > >::iterator vecit = result.begin(); vecit != result.end(); ++vecit) {
+    vecit->first = currentDAC++;
+  }
+  LOG(logDEBUGAPI) << "Labelled " << result.size() << " DacScan data blocks for delivery.";
+}
 
-  for (std::vector<std::vector<pixel> >::iterator vecit = data->begin(); vecit!=data->end();++vecit){
+template <typename T> void api::labelDacDacScanData(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<T> > > > & result, uint8_t dac1min, uint8_t dac2min, uint8_t dac2max) {
 
-    result->push_back(std::make_pair(current1dac, std::make_pair(current2dac, *vecit)));
+  // The second DAC runs fastest:
+  uint8_t current1dac = dac1min;
+  uint8_t current2dac = dac2min;
+  for (typename std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<T> > > >::iterator vecit = result.begin(); vecit != result.end(); ++vecit) {
+    vecit->first = current1dac;
+    vecit->second.first = current2dac;
 
     if(current2dac == dac2max-1) {
       current2dac = dac2min;
@@ -1095,49 +1955,55 @@ std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >* api
     }
     else current2dac++;
   }
+  LOG(logDEBUGAPI) << "Labelled " << result.size() << " DacDacScan data blocks for delivery.";
+}
 
-  LOG(logDEBUGAPI) << "Repack end: current1 " << (int)current1dac << " (max " << (int)dac1max << "), current2 " 
-		   << (int)current2dac << " (max" << (int)dac2max << ")";
+size_t api::expectedPixels() {
 
-  if (current1dac != dac1max){
-    // FIXME: THIS SHOULD THROW A CUSTOM EXCEPTION
-    LOG(logCRITICAL) << "data structure size not as expected! " << data->size() << " data blocks do not fit to " << (dac1max-dac1min)*(dac2max-dac2min) << " DAC values!";
-    delete result;
-    return NULL;
+  // Number of pixels a full data block holds, used to size the blocks once:
+  size_t pixels = 0;
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    pixels += _dut->roc.at(roc).nEnabledPixels();
   }
-  
-  LOG(logDEBUGAPI) << "Correctly repacked DacDacScan data for delivery.";
-  return result;
+  return pixels;
 }
 
-std::vector< std::vector<pixel> >* api::compactRocLoopData (std::vector< std::vector<pixel> >* data, uint8_t nRocs){
-  if (data->size() % nRocs != 0) {
-    // FIXME: THIS SHOULD THROW A CUSTOM EXCEPTION
-    LOG(logCRITICAL) << "data structure size not as expected! " << data->size() << " data blocks do not fit to " << nRocs << " active ROCs!";
-    return NULL;
-  }
 
-  // the size of the data blocks of each ROC
-  int segmentsize = data->size()/nRocs;
+// Function to collect the full DUT configuration into one programming plan
+void api::buildProgrammingPlan(programmingPlan & plan) {
 
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
-  // copy data segment of first ROC into the main data vector
-  result->insert(result->end(), data->begin(), data->begin()+segmentsize);
+  plan.clear();
 
-  // loop over all remaining rocs to merge their data segments into one
-  for (uint8_t rocid = 1; rocid<nRocs;rocid++){
-    std::vector<pixel> pixjoined;
-    // loop over each data segment belonging to this roc
-    for (int segment = 0; segment<segmentsize;segment++){
-      // copy pixel over
-      pixjoined.reserve(pixjoined.size() + data->at(segment+segmentsize*rocid).size());
-      pixjoined.insert(pixjoined.end(), data->at(segment+segmentsize*rocid).begin(),data->at(segment+segmentsize*rocid).end());
+  std::vector<tbmConfig> enabledTbms = _dut->getEnabledTbms();
+  for (std::vector<tbmConfig>::iterator tbmit = enabledTbms.begin(); tbmit != enabledTbms.end(); ++tbmit){
+    for(std::map< uint8_t,uint8_t >::iterator regit = tbmit->dacs.begin(); regit != tbmit->dacs.end(); ++regit) {
+      plan.addTbmRegister((uint8_t)(tbmit - enabledTbms.begin()),regit->first,regit->second);
     }
-    result->push_back(pixjoined);
   }
-  return result;
-}
 
+  size_t nEnabledRocs = (size_t)_dut->getNEnabledRocs();
+  for (size_t roc = 0; roc < nEnabledRocs; roc++){
+    std::vector< std::pair<uint8_t,uint8_t> > dacs = _dut->roc.at(roc).getDACs();
+    for(std::vector< std::pair<uint8_t,uint8_t> >::iterator dacit = dacs.begin(); dacit != dacs.end(); ++dacit) {
+      plan.addRocDac((uint8_t)roc,dacit->first,dacit->second);
+    }
+  }
+
+  // Mask all ROCs first and then unmask and trim the required pixels, this
+  // way only the unmasked pixels need to be sent:
+  for (std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); rocit != _dut->roc.end(); ++rocit) {
+    uint8_t rocid = (uint8_t)(rocit - _dut->roc.begin());
+    plan.addRocMask(rocid);
+    pixelBits unmasked = rocit->unmaskedPixels();
+    for(pixelBits::iterator px = unmasked.begin(); px != unmasked.end(); ++px) {
+      plan.addPixelTrim(rocid,px.column(),px.row(),rocit->getTrim(px.index()));
+    }
+  }
+
+  LOG(logDEBUGAPI) << "Programming plan contains " << plan.commands.size() << " commands for " 
+		   << enabledTbms.size() << " TBMs and " << nEnabledRocs << " ROCs.";
+}
 
 // Function to program the device with all the needed trimming and masking stuff
 void api::MaskAndTrim() {
@@ -1146,13 +2012,13 @@ void api::MaskAndTrim() {
   for (std::vector<rocConfig>::iterator rocit = _dut->roc.begin(); rocit != _dut->roc.end(); ++rocit) {
 
     // Check if we can run on full ROCs:
-    uint16_t masked = _dut->getNMaskedPixels((uint8_t)(rocit-_dut->roc.begin()));
+    uint16_t masked = rocit->nMaskedPixels();
     LOG(logDEBUGAPI) << "ROC " << (int)(rocit-_dut->roc.begin()) << " features " << masked << " masked pixels.";
 
     // This ROC is completely unmasked, let's trim it:
     if(masked == 0) {
       LOG(logDEBUGAPI) << "Unmasking and trimming ROC " << (int)(rocit-_dut->roc.begin()) << " in one go.";
-      _hal->RocSetMask((int)(rocit-_dut->roc.begin()),false,rocit->pixels);
+      _hal->RocSetMask((int)(rocit-_dut->roc.begin()),false,&(*rocit));
       continue;
     }
     else if(masked == ROC_NUMROWS*ROC_NUMCOLS) {
@@ -1164,11 +2030,12 @@ void api::MaskAndTrim() {
     else if(masked <= ROC_NUMROWS*ROC_NUMCOLS/2) {
       // We have more unmasked than masked pixels:
       LOG(logDEBUGAPI) << "Unmasking and trimming ROC " << (int)(rocit-_dut->roc.begin()) << " before masking single pixels.";
-      _hal->RocSetMask((int)(rocit-_dut->roc.begin()),false,rocit->pixels);
+      _hal->RocSetMask((int)(rocit-_dut->roc.begin()),false,&(*rocit));
       
       // And then mask the required pixels:
-      for(std::vector<pixelConfig>::iterator pxit = rocit->pixels.begin(); pxit != rocit->pixels.end(); ++pxit) {
-	if(pxit->mask == true) {_hal->PixelSetMask((int)(rocit-_dut->roc.begin()),pxit->column,pxit->row,true);}
+      const pixelBits & maskedPixels = rocit->maskedPixels();
+      for(pixelBits::iterator px = maskedPixels.begin(); px != maskedPixels.end(); ++px) {
+	_hal->PixelSetMask((int)(rocit-_dut->roc.begin()),px.column(),px.row(),true);
       }
     }
     else {
@@ -1177,8 +2044,9 @@ void api::MaskAndTrim() {
       _hal->RocSetMask((int)(rocit-_dut->roc.begin()),true);
       
       // And then unmask the required pixels with their trim values:
-      for(std::vector<pixelConfig>::iterator pxit = rocit->pixels.begin(); pxit != rocit->pixels.end(); ++pxit) {
-	if(pxit->mask == false) {_hal->PixelSetMask((int)(rocit-_dut->roc.begin()),pxit->column,pxit->row,false,pxit->trim);}
+      pixelBits unmasked = rocit->unmaskedPixels();
+      for(pixelBits::iterator px = unmasked.begin(); px != unmasked.end(); ++px) {
+	_hal->PixelSetMask((int)(rocit-_dut->roc.begin()),px.column(),px.row(),false,rocit->getTrim(px.index()));
       }
     }
   }
@@ -1186,6 +2054,21 @@ void api::MaskAndTrim() {
 }
 
 
+bool api::thresholdParameterSet(thresholdParameters & param, uint16_t flags, uint32_t nTriggers) {
+
+  // Thresholds are measured in units of the calibrate pulse height over
+  // the full range of the DAC, including its highest value:
+  std::string thrName = "vcal";
+  uint8_t thrRegister, thrMax = 255;
+  if(!verifyRegister(thrName, thrRegister, thrMax, ROC_REG)) return false;
+
+  param = thresholdParameters(thrRegister, 0, thrMax, flags, nTriggers);
+  param.thrName = thrName;
+  LOG(logDEBUGAPI) << "Threshold search in DAC \"" << thrName << "\" (" << (int)thrRegister << ") up to " << (int)thrMax
+		   << ", " << param.level() << " of " << nTriggers << " readouts required.";
+  return true;
+}
+
 bool api::verifyPatternGenerator(std::vector<std::pair<uint16_t,uint8_t> > &pg_setup) {
   
   for(std::vector<std::pair<uint16_t,uint8_t> >::iterator it = pg_setup.begin(); it != pg_setup.end(); ++it) {
@@ -10,6 +10,7 @@
 #include <vector>
 #include <map>
 #include <stdint.h>
+#include <pthread.h>
 
 #include "config.h"
 
@@ -37,12 +38,50 @@ namespace pxar {
       column = (address>>8)&63;
       row = (address)&127;
     };
+
+    /** Function to fill the pixel with the raw 24bit hit information read out
+     *  from the digital ROC (column/row address and pulse height)
+     */
+    inline void decodeRaw(uint8_t rocId, uint32_t raw) {
+      // 24 bits:
+      // CCCcccRR RrrrRRRP PPP0PPPP
+      // Double column and row address are encoded as 3bit digits (base 6):
+      value = (raw & 0x0f) + ((raw >> 1) & 0xf0);
+      int32_t c = ((raw >> 21) & 7)*6 + ((raw >> 18) & 7);
+      int32_t r = ((raw >> 15) & 7)*36 + ((raw >> 12) & 7)*6 + ((raw >> 9) & 7);
+
+      roc_id = rocId;
+      row = 80 - r/2;
+      column = 2*c + (r&1);
+    };
+
     uint8_t roc_id;
     uint8_t column;
     uint8_t row;
     int32_t value;
   };
 
+  /** Class for storing the full calibration result of a pixel
+   *  Contains both the number of readouts (hits) and the pulse height sum
+   *  as measured in the same calibration run.
+   */
+  class pixelCalibration {
+  public:
+  pixelCalibration() : roc_id(0), column(0), row(0), nhits(0), phsum(0) {};
+
+    /** Returns the mean pulse height of all recorded hits
+     */
+    inline double meanPulseheight() const {
+      return (nhits > 0) ? static_cast<double>(phsum)/nhits : 0.;
+    };
+
+    uint8_t roc_id;
+    uint8_t column;
+    uint8_t row;
+    int16_t nhits;
+    int32_t phsum;
+  };
+
   /** Class to store the configuration for single pixels (i.e. their mask state, trim bit settings
    *  and whether they belong to the currently run test ("enable"). By default, pixels are masked.
    */
@@ -58,17 +97,203 @@ namespace pxar {
     bool enable;
   };
 
+  /** Class for a set of pixels of one ROC, one bit per pixel
+   *  The pixels are indexed by column*rows+row as the ROC maps of the HAL,
+   *  the dimensions have to match ROC_NUMCOLS and ROC_NUMROWS. Counting the
+   *  set pixels and searching the next one work on whole 32 bit words.
+   */
+  class pixelBits {
+  public:
+    enum { columns = 52, rows = 80, size = columns*rows, words = (size+31)/32 };
+
+    pixelBits() { clear(); };
+
+    /** Return the linear position of the given pixel
+     */
+    static inline size_t index(uint8_t column, uint8_t row) { return column*rows + row; };
+
+    /** Check if the given pixel coordinates exist on a ROC
+     */
+    static inline bool valid(uint8_t column, uint8_t row) { return column < columns && row < rows; };
+
+    inline bool test(size_t index) const { return (_bits[index/32] >> (index%32)) & 0x1; };
+    inline void set(size_t index, bool value = true) {
+      if(value) _bits[index/32] |= (0x1u << (index%32));
+      else _bits[index/32] &= ~(0x1u << (index%32));
+    };
+
+    /** Clear all bits
+     */
+    inline void clear() { for(size_t w = 0; w < words; w++) { _bits[w] = 0; } };
+
+    /** Set all pixels of the ROC
+     */
+    void fill();
+
+    /** Set or clear all pixels of one column
+     */
+    void setColumn(uint8_t column, bool value);
+
+    /** Swap set and cleared pixels
+     */
+    void invert();
+
+    /** Number of set pixels
+     */
+    size_t count() const;
+
+    /** Position of the first set pixel at or after index, size if there is none
+     */
+    size_t next(size_t index) const;
+
+    /** Bitwise combination with another set of pixels
+     */
+    pixelBits & operator&=(const pixelBits & other);
+    pixelBits & operator|=(const pixelBits & other);
+
+    /** Clear all pixels which are set in the other set of pixels
+     */
+    pixelBits & remove(const pixelBits & other);
+
+    /** Iterator over the set pixels, in order of their index
+     */
+    class iterator {
+    public:
+    iterator(const pixelBits & bits, size_t index) : _bits(&bits), _index(bits.next(index)) {};
+      inline size_t index() const { return _index; };
+      inline uint8_t column() const { return static_cast<uint8_t>(_index/rows); };
+      inline uint8_t row() const { return static_cast<uint8_t>(_index%rows); };
+      inline iterator & operator++() { _index = _bits->next(_index+1); return *this; };
+      inline bool operator==(const iterator & other) const { return _index == other._index; };
+      inline bool operator!=(const iterator & other) const { return _index != other._index; };
+    private:
+      const pixelBits * _bits;
+      size_t _index;
+    };
+
+    inline iterator begin() const { return iterator(*this, 0); };
+    inline iterator end() const { return iterator(*this, size); };
+
+    /** Regions of pixels to enable or mask in one go (see dut::testPixels
+     *  and dut::maskPixels), they can be combined with the operators above.
+     *  All ranges include both limits, limits outside the ROC are clipped.
+     */
+
+    /** All pixels with colMin <= column <= colMax and rowMin <= row <= rowMax
+     */
+    static pixelBits rectangle(uint8_t colMin, uint8_t colMax, uint8_t rowMin, uint8_t rowMax);
+
+    /** Both columns of the given double column
+     */
+    static pixelBits doubleColumn(uint8_t dcol);
+
+    /** Every step-th pixel in column/row indexing, starting at offset
+     */
+    static pixelBits stride(size_t step, size_t offset = 0);
+
+    /** All pixels with (column+row)%2 == parity
+     */
+    static pixelBits checkerboard(uint8_t parity = 0);
+
+  private:
+    uint32_t _bits[words];
+  };
+
   /** Class for ROC states
-   *  Contains a DAC vector for their settings, a type flag and an enable switch
-   *  and a vector for pixelConfig
+   *  Contains a DAC array for their settings, a type flag and an enable switch
+   *  and the configuration of its pixels. Only pixels which have been
+   *  configured exist in the DUT, their enable and mask bits are kept as
+   *  bitsets and their trim values as packed nibbles. Single pixels and DACs
+   *  are found without searching and the copy of a ROC is a flat memory copy.
    */
   class rocConfig {
   public:
-  rocConfig() : pixels(), dacs(), type(0), enable(true) {};
-    std::vector< pixelConfig > pixels;
-    std::map< uint8_t,uint8_t > dacs;
+    rocConfig();
+
+    /** Store the configuration of a pixel, overwriting an existing one.
+     *  Returns false for pixels outside the ROC.
+     */
+    bool setPixel(const pixelConfig & config);
+
+    /** Configuration of the given pixel, the default pixelConfig if the
+     *  pixel does not exist
+     */
+    pixelConfig getPixel(uint8_t column, uint8_t row) const;
+
+    /** Check if the given pixel has been configured
+     */
+    inline bool hasPixel(uint8_t column, uint8_t row) const {
+      return pixelBits::valid(column, row) && _configured.test(pixelBits::index(column, row));
+    };
+
+    /** Change the enable or mask bit of an existing pixel. Returns false if
+     *  the pixel does not exist.
+     */
+    bool setPixelEnable(uint8_t column, uint8_t row, bool enable);
+    bool setPixelMask(uint8_t column, uint8_t row, bool mask);
+
+    /** Change the enable or mask bits of all existing pixels, or of all
+     *  existing pixels in one column
+     */
+    void setAllPixelsEnable(bool enable);
+    void setAllPixelsMask(bool mask);
+    void setColumnMask(uint8_t column, bool mask);
+
+    /** Change the enable or mask bits of all existing pixels of a region,
+     *  pixels of the region which do not exist are ignored
+     */
+    void setPixelsEnable(const pixelBits & region, bool enable);
+    void setPixelsMask(const pixelBits & region, bool mask);
+
+    /** Trim value of the given pixel
+     */
+    inline uint8_t getTrim(size_t index) const { return (_trims[index/2] >> (4*(index%2))) & 0xf; };
+
+    /** Sets of the existing, enabled, masked and unmasked pixels. The
+     *  references stay valid as long as the ROC configuration.
+     */
+    inline const pixelBits & configuredPixels() const { return _configured; };
+    inline const pixelBits & enabledPixels() const { return _enabled; };
+    inline const pixelBits & maskedPixels() const { return _masked; };
+    pixelBits unmaskedPixels() const;
+
+    /** Numbers of existing, enabled and masked pixels
+     */
+    inline size_t nPixels() const { return _configured.count(); };
+    inline size_t nEnabledPixels() const { return _enabled.count(); };
+    inline size_t nMaskedPixels() const { return _masked.count(); };
+
+    /** Append the configuration of all pixels of the given set to the vector
+     */
+    void getPixels(const pixelBits & selection, std::vector<pixelConfig> & pixels) const;
+
+    /** Store a DAC value. Returns false if the DAC had not been set before.
+     */
+    bool setDAC(uint8_t reg, uint8_t value);
+
+    /** Value of a DAC, zero if it has not been set
+     */
+    inline uint8_t getDAC(uint8_t reg) const { return _dacValues[reg]; };
+    inline bool hasDAC(uint8_t reg) const { return _dacSet[reg]; };
+
+    /** All DACs which have been set as pairs of register and value, ordered
+     *  by register
+     */
+    std::vector< std::pair<uint8_t,uint8_t> > getDACs() const;
+    size_t nDACs() const;
+
     uint8_t type;
     bool enable;
+
+  private:
+    void setTrim(size_t index, uint8_t trim);
+
+    pixelBits _configured;
+    pixelBits _enabled;
+    pixelBits _masked;
+    uint8_t _trims[(pixelBits::size+1)/2];
+    uint8_t _dacValues[256];
+    bool _dacSet[256];
   };
 
   /** Class for TBM states
@@ -82,6 +307,79 @@ namespace pxar {
     bool enable;
   };
 
+  /** Class for a single reading of the testboard power supply telemetry
+   *  Contains the time of the reading (in seconds since the epoch) and the
+   *  analog/digital voltages (V) and currents (A).
+   */
+  class powerReading {
+  public:
+  powerReading() : timestamp(0), va(0), vd(0), ia(0), id(0) {};
+    double timestamp;
+    double va;
+    double vd;
+    double ia;
+    double id;
+  };
+
+  /** Class for the S-curve fit result of a single pixel
+   *  Contains the threshold (50% point, in DAC units), the width (noise, in
+   *  DAC units) and the fit quality. The flags (SCURVE_*) mark pathological
+   *  curves: if the fit failed, threshold and width hold the estimates taken
+   *  directly from the data.
+   */
+  class scurveResult {
+  public:
+  scurveResult() : roc_id(0), column(0), row(0), threshold(0), width(0), chi2ndf(0), flags(0) {};
+    uint8_t roc_id;
+    uint8_t column;
+    uint8_t row;
+    double threshold;
+    double width;
+    double chi2ndf;
+    uint8_t flags;
+  };
+
+  /** Interface for the streaming delivery of scan results
+   *  The consumer receives the data of a scan in chunks while the scan is
+   *  running, from the thread executing the test.
+   */
+  class scanConsumer {
+  public:
+    virtual ~scanConsumer() {};
+
+    /** Receives a chunk of pixels measured at the given DAC values (dac2
+     *  is 0 for one-dimensional scans). The data is only valid during the call.
+     */
+    virtual void consume(uint8_t dac1, uint8_t dac2, const std::vector<pixel> & data) = 0;
+  };
+
+  /** Class for the statistics of one telemetry quantity
+   */
+  class powerStatistics {
+  public:
+  powerStatistics() : min(0), max(0), mean(0) {};
+    double min;
+    double max;
+    double mean;
+  };
+
+  /** Class for the telemetry summary of a test phase
+   *  Contains the phase name, its start and stop time and the statistics
+   *  of all readings taken during the phase.
+   */
+  class powerSummary {
+  public:
+  powerSummary() : phase(), start(0), stop(0), nReadings(0), va(), vd(), ia(), id() {};
+    std::string phase;
+    double start;
+    double stop;
+    size_t nReadings;
+    powerStatistics va;
+    powerStatistics vd;
+    powerStatistics ia;
+    powerStatistics id;
+  };
+
   /** Forward declaration, implementation follows below...
    */
   class dut;
@@ -89,13 +387,26 @@ namespace pxar {
   /** Forward declaration, not including the header file!
    */
   class hal;
+  class pixelSink;
+  class programmingPlan;
+  class thresholdParameters;
+  class powerMonitor;
+  class testControl;
+  class asyncTest;
+
   /** Define typedefs to allow easy passing of member function
    *   addresses from the HAL class, used e.g. in loop expansion routines.
    *   Follows advice of http://www.parashift.com/c++-faq/typedef-for-ptr-to-memfn.html
+   *
+   *   The HAL functions take a typed parameter set P (see datatypes.h) and
+   *   write their results into the output sink provided by the caller.
    */
-  typedef  std::vector< std::vector<pixel> >* (hal::*HalMemFnPixel)(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
-  typedef  std::vector< std::vector<pixel> >* (hal::*HalMemFnRoc)(uint8_t rocid, std::vector<int32_t> parameter);
-  typedef  std::vector< std::vector<pixel> >* (hal::*HalMemFnModule)(std::vector<int32_t> parameter);
+  template <typename P> struct HalMemFn {
+    typedef void (hal::*Pixel)(uint8_t rocid, uint8_t column, uint8_t row, const P & parameter, pixelSink & sink);
+    typedef void (hal::*MultiPixel)(uint8_t rocid, const std::vector<pixelConfig> & pixels, const P & parameter, pixelSink & sink);
+    typedef void (hal::*Roc)(uint8_t rocid, const P & parameter, pixelSink & sink);
+    typedef void (hal::*Module)(const P & parameter, pixelSink & sink);
+  };
 
 
 
@@ -195,7 +506,37 @@ namespace pxar {
      */
     void Poff();
 
-     /** Selects "signal" as output for the DTB probe channel "probe"
+     /** Start the background sampler for the testboard power telemetry
+     *  VA, VD, IA and ID are read at the given rate (in Hz) in a separate
+     *  thread and stored in a ring buffer. Returns true if the sampler runs.
+     */
+    bool startMonitor(double rate = 1.0);
+
+    /** Stop the background sampler for the testboard power telemetry
+     */
+    void stopMonitor();
+
+    /** Mark the start of a new test phase for the telemetry summaries
+     *  The previous phase ends with the start of the new one.
+     */
+    void markMonitorPhase(std::string phase);
+
+    /** Get the most recent telemetry reading from the sampler
+     *  This does not access the testboard. Returns false if no reading is available.
+     */
+    bool getMonitorReading(powerReading & reading);
+
+    /** Get all telemetry readings currently stored in the sampler ring buffer,
+     *  ordered by time. This does not access the testboard.
+     */
+    std::vector<powerReading> getMonitorReadings();
+
+    /** Get the min/max/mean telemetry summaries for all marked test phases
+     *  This does not access the testboard.
+     */
+    std::vector<powerSummary> getMonitorSummaries();
+
+    /** Selects "signal" as output for the DTB probe channel "probe"
       *  (digital or analog)
       *
       *  The signal identifier is checked against a dictionary to be valid.
@@ -242,11 +583,23 @@ namespace pxar {
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getPulseheightVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 									       uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getPulseheightVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** DEBUG ROUTINE DELME FIXME WHATEVER
      */
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getDebugVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 									 uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getDebugVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to scan a DAC and measure the efficiency
      *
      *  Returns a std vector of pairs containing set dac value and pixels, with the value of the pixel struct being
@@ -255,6 +608,12 @@ namespace pxar {
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getEfficiencyVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 					  uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getEfficiencyVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to scan a DAC and measure the pixel threshold
      *
      *  Returns a std vector of pairs containing set dac value and pixels, with the value of the pixel struct being
@@ -263,6 +622,12 @@ namespace pxar {
     std::vector< std::pair<uint8_t, std::vector<pixel> > > getThresholdVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
 					 uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getThresholdVsDAC(std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2)  and measure the pulse height
      *
      *  Returns a std vector containing pairs of DAC1 values and pais of DAC2 values with a pixel vector
@@ -272,6 +637,13 @@ namespace pxar {
 					      std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
 					      uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getPulseheightVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2)  and measure the efficiency
      *
      *  Returns a std vector containing pairs of DAC1 values and pais of DAC2 values with a pixel vector
@@ -282,6 +654,13 @@ namespace pxar {
 					     std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
 					     uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getEfficiencyVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2)  and measure the threshold
      *
      *  Returns a std vector containing pairs of DAC1 values and pais of DAC2 values with a pixel vector
@@ -291,27 +670,157 @@ namespace pxar {
 					    std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
 					    uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getThresholdVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** Streaming variants of the pulse height and efficiency scans above
+     *  The data is handed to the consumer while the scan is running, in chunks
+     *  of pixels measured at the same DAC values. All pixels of a chunk
+     *  belong to one ROC, the data of one DAC setting can arrive in several
+     *  chunks. Only the chunk being delivered is held in memory. Returns
+     *  false if the test failed, chunks delivered before stay valid.
+     */
+    bool getPulseheightVsDAC(scanConsumer & consumer, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getEfficiencyVsDAC(scanConsumer & consumer, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+			    uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getPulseheightVsDACDAC(scanConsumer & consumer, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+				std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+				uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getEfficiencyVsDACDAC(scanConsumer & consumer, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+			       std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+			       uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** Method to fit the S-curves of an efficiency scan
+     *
+     *  Takes the output of getEfficiencyVsDAC (taken with nTriggers triggers
+     *  per DAC value) and fits the curve of every pixel with an error
+     *  function. Returns one result per pixel, ordered by ROC, column and
+     *  row. The fits run on nThreads threads, 0 uses all CPU cores.
+     */
+    std::vector<scurveResult> fitSCurves(const std::vector< std::pair<uint8_t, std::vector<pixel> > > & data,
+					 uint32_t nTriggers = 16, size_t nThreads = 0);
+
     /** Method to get a chip map of the pulse height
      *
      *  Returns a std vector of pixels, with the value of the pixel struct being
-     *  the averaged pulse height over nTriggers triggers
+     *  the averaged pulse height over nTriggers triggers. The pixels of all
+     *  enabled ROCs are returned in the one vector, told apart by their roc_id.
      */
     std::vector<pixel> getPulseheightMap(uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getPulseheightMap(std::vector<pixel> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to get a chip map of the efficiency
      *
      *  Returns a std vector of pixels, with the value of the pixel struct being
-     *  the number of hits in that pixel. Efficiency == 1 for nhits == nTriggers
+     *  the number of hits in that pixel. Efficiency == 1 for nhits == nTriggers.
+     *  The pixels of all enabled ROCs are returned in the one vector, told
+     *  apart by their roc_id.
      */
     std::vector<pixel> getEfficiencyMap(uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getEfficiencyMap(std::vector<pixel> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+
     /** Method to get a chip map of the pixel threshold
      *
      *  Returns a std vector of pixels, with the value of the pixel struct being
-     *  the threshold value of that pixel
+     *  the threshold value (Vcal) of that pixel. The threshold is the lowest
+     *  (FLAG_THRSCAN_RISING) or highest Vcal value with at least half of the
+     *  triggers read out. Pixels without threshold are not returned.
      */
     std::vector<pixel> getThresholdMap(uint16_t flags = 0, uint32_t nTriggers=16);
 
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getThresholdMap(std::vector<pixel> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** Method to get a chip map of both efficiency and pulse height
+     *
+     *  Returns a std vector of pixel calibrations, containing the number of hits and the
+     *  pulse height sum over nTriggers triggers, both measured in one single run
+     */
+    std::vector<pixelCalibration> getCalibrationMap(uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getCalibrationMap(std::vector<pixelCalibration> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** Method to scan a DAC and measure both efficiency and pulse height
+     *
+     *  Returns a std vector of pairs containing set dac value and pixel calibrations with
+     *  the number of hits and the pulse height sum, both measured in one single scan
+     */
+    std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > getCalibrationVsDAC(std::string dacName, uint8_t dacMin, uint8_t dacMax, 
+											uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getCalibrationVsDAC(std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** Method to scan a 2D DAC-Range (DAC1 vs. DAC2) and measure both efficiency and pulse height
+     *
+     *  Returns a std vector containing pairs of DAC1 values and pais of DAC2 values with pixel
+     *  calibrations with the number of hits and the pulse height sum, both measured in one single scan
+     */
+    std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > getCalibrationVsDACDAC(std::string dac1name, uint8_t dac1min, uint8_t dac1max, 
+													    std::string dac2name, uint8_t dac2min, uint8_t dac2max, 
+													    uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** As above, writing into the given result vector. The storage of a
+     *  previous result is reused. Returns false if the test failed.
+     */
+    bool getCalibrationVsDACDAC(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+
+    /** Asynchronous variants of the DAC scans and maps above
+     *  The test is started in a separate thread and the function returns
+     *  immediately, true if the test has been started. The control handle
+     *  reports the progress of the test and allows to cancel it, its wait()
+     *  returns the success of the test. The result is written when the test
+     *  has finished, it has to stay valid until then. No other API function
+     *  can be used while the test is running.
+     */
+    bool getPulseheightVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getEfficiencyVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getThresholdVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixel> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getCalibrationVsDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::vector<pixelCalibration> > > & result, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getPulseheightVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getEfficiencyVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getThresholdVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getCalibrationVsDACDACAsync(testControl & control, std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > & result, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+	     std::string dac2name, uint8_t dac2min, uint8_t dac2max,
+	     uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getPulseheightMapAsync(testControl & control, std::vector<pixel> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getEfficiencyMapAsync(testControl & control, std::vector<pixel> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getThresholdMapAsync(testControl & control, std::vector<pixel> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+    bool getCalibrationMapAsync(testControl & control, std::vector<pixelCalibration> & result, uint16_t flags = 0, uint32_t nTriggers=16);
+
     int32_t getReadbackValue(std::string parameterName);
 
     /** DEBUG METHOD -- FIXME/DELME
@@ -366,22 +875,73 @@ namespace pxar {
      */
     hal * _hal;
 
+    /** Private background sampler for the testboard power telemetry
+     */
+    powerMonitor * _monitor;
+
+    /** State of the asynchronous test: its control handle and call, the
+     *  thread executing it and whether it is still running. _control,
+     *  _asyncTest and _asyncRunning are protected by _asyncMutex.
+     */
+    testControl * _control;
+    asyncTest * _asyncTest;
+    pthread_t _asyncThread;
+    bool _asyncRunning;
+    bool _asyncJoinable;
+    pthread_mutex_t _asyncMutex;
+
+    /** Start the given test call in a separate thread, controlled by the
+     *  given handle. Takes ownership of the test call.
+     */
+    bool runAsync(asyncTest * test, testControl & control);
+
+    /** Entry point for the thread of an asynchronous test
+     */
+    static void * asyncThread(void * instance);
+
+    /** Returns true (and logs an error) if an asynchronous test is running
+     *  in another thread, which then owns the testboard and the DUT
+     */
+    bool asyncBusy();
+
+    /** Returns true if the running test has been cancelled
+     */
+    bool testCancelled();
+
     /** Routine to loop over all active ROCs/pixels and call the
      *  appropriate pixel, ROC or module HAL methods for execution
+     *  If available, the multi-pixel method is preferred over the single pixel method
+     *  for partially enabled ROCs unless serial execution is requested.
+     *  The data of all ROCs is merged into the data blocks of the sink
+     *  (e.g. one block per DAC value). Returns false if no function could be called.
+     *  The progress is reported to the control of an asynchronous test. If it is
+     *  cancelled, the loop stops after the current step, restores the masks and
+     *  trims and returns false.
+     */
+    template <typename P> bool expandLoop(typename HalMemFn<P>::Pixel pixelfn, typename HalMemFn<P>::MultiPixel multipixelfn, typename HalMemFn<P>::Roc rocfn, typename HalMemFn<P>::Module modulefn, const P & param, pixelSink & sink, bool forceSerial = false);
+
+    /** Run a DAC scan (DacDac scan) delivering its pulse heights or efficiencies
+     *  to the consumer, see the streaming get* functions
      */
-    std::vector< std::vector<pixel> >* expandLoop(HalMemFnPixel pixelfn, HalMemFnRoc rocfn, HalMemFnModule modulefn, std::vector<int32_t> param, bool forceSerial = false);
+    bool streamDacScan(scanConsumer & consumer, bool efficiency, std::string dacName, uint8_t dacMin, uint8_t dacMax,
+		       uint16_t flags, uint32_t nTriggers);
+    bool streamDacDacScan(scanConsumer & consumer, bool efficiency, std::string dac1name, uint8_t dac1min, uint8_t dac1max,
+			  std::string dac2name, uint8_t dac2min, uint8_t dac2max, uint16_t flags, uint32_t nTriggers);
 
-    /** repacks Dac scan data into pairs of Dac values with fired pixel vectors
+    /** Sets the Dac values of Dac scan data filled in place by the sink,
+     *  block 0 corresponds to dacMin
      */
-    std::vector< std::pair<uint8_t, std::vector<pixel> > >* repackDacScanData (std::vector< std::vector<pixel> >* data, uint8_t dacMin, uint8_t dacMax);
+    template <typename T> void labelDacScanData(std::vector< std::pair<uint8_t, std::vector<T> > > & result, uint8_t dacMin);
 
-    /** repacks DacDac scan data into pairs of Dac values with fired pixel vectors
+    /** Sets the Dac values of DacDac scan data filled in place by the sink,
+     *  the second Dac running fastest
      */
-    std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > >* repackDacDacScanData (std::vector< std::vector<pixel> >* data, uint8_t dac1min, uint8_t dac1max, uint8_t dac2min, uint8_t dac2max);
+    template <typename T> void labelDacDacScanData(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<T> > > > & result, uint8_t dac1min, uint8_t dac2min, uint8_t dac2max);
 
-    /** compacts data over ROC loops (ROC0<data>,ROC1<data>, ...) into (data(roc0,roc1)) where the data blocks can be subdivided into e.g. DAC ranges
+    /** Number of enabled pixels on all enabled ROCs, the size of a fully
+     *  populated data block
      */
-    std::vector< std::vector<pixel> >* compactRocLoopData (std::vector< std::vector<pixel> >* data, uint8_t nRocs);
+    size_t expectedPixels();
 
     /** Helper function for conversion from string to register value
      *  Type tells it whether it is a DTB, TBM or ROC register to look for
@@ -401,6 +961,16 @@ namespace pxar {
      */
     void MaskAndTrim();
 
+    /** Routine to collect all TBM registers, ROC DACs and the mask and trim
+     *  information of all ROCs as stored in the DUT struct into one programming plan
+     */
+    void buildProgrammingPlan(programmingPlan & plan);
+
+    /** Helper function to set up the threshold search (threshold DAC and its
+     *  range) for the threshold tests
+     */
+    bool thresholdParameterSet(thresholdParameters & param, uint16_t flags, uint32_t nTriggers);
+
     /** Helper function to check validity of the pattern generator settings coming from the user space
      */
     bool verifyPatternGenerator(std::vector<std::pair<uint16_t,uint8_t> > &pg_setup);
@@ -506,6 +1076,15 @@ namespace pxar {
      */
     void testAllPixels(bool enable, int8_t rocid = -1);
 
+    /** Function to enable all pixels of a region (e.g. pixelBits::rectangle)
+     *  on a specific ROC or on all ROCs, masking them accordingly:
+     */
+    void testPixels(const pixelBits & region, bool enable, int8_t rocid = -1);
+
+    /** Function to mask all pixels of a region on a specific ROC or on all ROCs:
+     */
+    void maskPixels(const pixelBits & region, bool mask, int8_t rocid = -1);
+
     /** Function to enable all pixels on all ROCs:
      */
     void maskAllPixels(bool mask, int8_t rocid = -1);
@@ -0,0 +1,121 @@
+/**
+ * pxar test control class implementation
+ */
+
+#include "control.h"
+#include "log.h"
+
+using namespace pxar;
+
+testControl::testControl(testProgress * callback) :
+  _callback(callback), _done(0), _total(0), _cancelled(false), _running(false), _success(false) {
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_finished, NULL);
+}
+
+testControl::~testControl() {
+  pthread_cond_destroy(&_finished);
+  pthread_mutex_destroy(&_mutex);
+}
+
+void testControl::cancel() {
+  pthread_mutex_lock(&_mutex);
+  _cancelled = true;
+  pthread_mutex_unlock(&_mutex);
+}
+
+bool testControl::cancelled() const {
+  pthread_mutex_lock(&_mutex);
+  bool isCancelled = _cancelled;
+  pthread_mutex_unlock(&_mutex);
+  return isCancelled;
+}
+
+bool testControl::running() const {
+  pthread_mutex_lock(&_mutex);
+  bool isRunning = _running;
+  pthread_mutex_unlock(&_mutex);
+  return isRunning;
+}
+
+size_t testControl::done() const {
+  pthread_mutex_lock(&_mutex);
+  size_t steps = _done;
+  pthread_mutex_unlock(&_mutex);
+  return steps;
+}
+
+size_t testControl::total() const {
+  pthread_mutex_lock(&_mutex);
+  size_t steps = _total;
+  pthread_mutex_unlock(&_mutex);
+  return steps;
+}
+
+bool testControl::wait() {
+  pthread_mutex_lock(&_mutex);
+  while(_running) { pthread_cond_wait(&_finished, &_mutex); }
+  bool success = _success;
+  pthread_mutex_unlock(&_mutex);
+  return success;
+}
+
+void testControl::begin() {
+  pthread_mutex_lock(&_mutex);
+  _done = 0;
+  _total = 0;
+  _cancelled = false;
+  _running = true;
+  _success = false;
+  pthread_mutex_unlock(&_mutex);
+}
+
+void testControl::plan(size_t total) {
+  pthread_mutex_lock(&_mutex);
+  _done = 0;
+  _total = total;
+  pthread_mutex_unlock(&_mutex);
+  report(0, total);
+}
+
+void testControl::advance(size_t steps) {
+  pthread_mutex_lock(&_mutex);
+  // Never report more than the planned steps:
+  _done += steps;
+  if(_done > _total) _done = _total;
+  size_t done = _done, total = _total;
+  pthread_mutex_unlock(&_mutex);
+  report(done, total);
+}
+
+void testControl::reach(size_t done) {
+  pthread_mutex_lock(&_mutex);
+  if(done > _total) done = _total;
+  bool advanced = (done > _done);
+  if(advanced) _done = done;
+  size_t total = _total;
+  pthread_mutex_unlock(&_mutex);
+  if(advanced) report(done, total);
+}
+
+void testControl::finish(bool success) {
+  pthread_mutex_lock(&_mutex);
+  _running = false;
+  _success = success;
+  pthread_cond_broadcast(&_finished);
+  pthread_mutex_unlock(&_mutex);
+}
+
+void testControl::report(size_t done, size_t total) {
+  if(_callback != NULL) _callback->progress(done, total);
+}
+
+bool pxar::runGuarded(asyncTest & test) {
+  try { return test.run(); }
+  catch(...) {
+    // An exception must not leave the start function of a thread: no caller
+    // exists there to catch it, so the whole process would be terminated.
+    LOG(logCRITICAL) << "Test aborted by an exception.";
+  }
+  return false;
+}
@@ -0,0 +1,130 @@
+/**
+ * pxar test control class header
+ * progress reporting and cancellation of running tests
+ */
+
+#ifndef PXAR_CONTROL_H
+#define PXAR_CONTROL_H
+
+#include <cstddef>
+#include <pthread.h>
+
+namespace pxar {
+
+  /** Interface for the progress reports of a running test
+   *  The callback is executed by the thread running the test, it must not
+   *  call other API functions but may cancel the test.
+   */
+  class testProgress {
+  public:
+    virtual ~testProgress() {};
+
+    /** Called whenever the test advanced, done out of total steps. One step
+     *  is one data block (e.g. one DAC value) of one ROC.
+     */
+    virtual void progress(size_t done, size_t total) = 0;
+  };
+
+  /** Handle of an asynchronous test (e.g. api::getEfficiencyVsDACAsync)
+   *  The handle reports the progress of the test and allows to cancel it.
+   *  All functions are thread-safe. A cancelled test stops after the
+   *  current step, the DAC and mask settings of the DUT are restored and the
+   *  test returns no data.
+   *
+   *  The handle and the result storage passed to the test have to stay
+   *  valid until the test has finished.
+   */
+  class testControl {
+
+    /** Allow the API and HAL to drive the test state
+     */
+    friend class api;
+    friend class hal;
+
+  public:
+    /** Create a new handle, the optional callback receives all progress reports
+     */
+    testControl(testProgress * callback = NULL);
+    ~testControl();
+
+    /** Request the cancellation of the running test
+     */
+    void cancel();
+
+    /** Returns true if the cancellation has been requested
+     */
+    bool cancelled() const;
+
+    /** Returns true while the test is running
+     */
+    bool running() const;
+
+    /** Number of steps done and total number of steps of the test
+     */
+    size_t done() const;
+    size_t total() const;
+
+    /** Wait for the test to finish. Returns true if it finished successfully,
+     *  false if it failed or has been cancelled.
+     */
+    bool wait();
+
+  protected:
+    /** Mark the start of a new test, resets the state of the handle
+     */
+    void begin();
+
+    /** Set the total number of steps of the test
+     */
+    void plan(size_t total);
+
+    /** Advance the test by the given number of steps
+     */
+    void advance(size_t steps);
+
+    /** Advance the test to at least the given number of steps done
+     */
+    void reach(size_t done);
+
+    /** Mark the end of the test and wake up all waiting threads
+     */
+    void finish(bool success);
+
+  private:
+    /** Call the progress callback, without holding the lock
+     */
+    void report(size_t done, size_t total);
+
+    testProgress * _callback;
+
+    size_t _done;
+    size_t _total;
+    bool _cancelled;
+    bool _running;
+    bool _success;
+
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t _finished;
+
+    testControl(const testControl&);
+    testControl& operator=(const testControl&);
+  };
+
+  /** A test call with all its arguments, executed by the thread of an
+   *  asynchronous test
+   */
+  class asyncTest {
+  public:
+    virtual ~asyncTest() {};
+    virtual bool run() = 0;
+  };
+
+  /** Run a test in the thread calling this function, returns the result of
+   *  the test. Used by the functions started with pthread_create: exceptions
+   *  thrown by the test are logged and make the test fail.
+   */
+  bool runGuarded(asyncTest & test);
+
+} //namespace pxar
+
+#endif /* PXAR_CONTROL_H */
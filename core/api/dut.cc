@@ -28,38 +28,224 @@ public:
   }
 };
 
-/** Helper class to search vectors of pixelConfig for 'mask' bit
+/** Number of set bits of a 32 bit word
  */
-class configMaskSet
-{
-  const bool _isMasked;
+static inline size_t popcount(uint32_t word) {
+  word = word - ((word >> 1) & 0x55555555);
+  word = (word & 0x33333333) + ((word >> 2) & 0x33333333);
+  return (((word + (word >> 4)) & 0x0f0f0f0f) * 0x01010101) >> 24;
+}
 
-public:
-  configMaskSet(const bool pMask) : _isMasked(pMask) {}
 
-  template<class ConfigType>
-  bool operator()(const ConfigType &config) const
-  {
-    return config.mask == _isMasked;
+/* =========================================================================== */
+
+/** Pixel set functions **/
+
+void pixelBits::fill() {
+  for(size_t w = 0; w < words; w++) { _bits[w] = 0xffffffffu; }
+  // Keep the bits beyond the last pixel cleared:
+  if(size%32) _bits[words-1] = (0x1u << (size%32)) - 1;
+}
+
+void pixelBits::setColumn(uint8_t column, bool value) {
+  for(size_t i = index(column,0); i < index(column,0) + rows; i++) { set(i,value); }
+}
+
+void pixelBits::invert() {
+  for(size_t w = 0; w < words; w++) { _bits[w] = ~_bits[w]; }
+  if(size%32) _bits[words-1] &= (0x1u << (size%32)) - 1;
+}
+
+size_t pixelBits::count() const {
+  size_t n = 0;
+  for(size_t w = 0; w < words; w++) { n += popcount(_bits[w]); }
+  return n;
+}
+
+size_t pixelBits::next(size_t index) const {
+  if(index >= size) return size;
+
+  // Look at the rest of the current word first, then skip empty words:
+  size_t w = index/32;
+  uint32_t word = _bits[w] & (0xffffffffu << (index%32));
+  while(word == 0) {
+    if(++w == words) return size;
+    word = _bits[w];
   }
-};
 
-/** Helper class to search vectors of pixel or pixelConfig for 'column' and 'row' values
- */
-class findPixelXY
-{
-  const uint8_t _column;
-  const uint8_t _row;
+  size_t bit = 0;
+  while(!(word & 0x1)) { word >>= 1; bit++; }
+  return w*32 + bit;
+}
 
-public:
-  findPixelXY(const uint8_t pColumn, const uint8_t pRow) : _column(pColumn), _row(pRow) {}
+pixelBits & pixelBits::operator&=(const pixelBits & other) {
+  for(size_t w = 0; w < words; w++) { _bits[w] &= other._bits[w]; }
+  return *this;
+}
 
-  template<class ConfigType>
-  bool operator()(const ConfigType &config) const
-  {
-    return (config.row == _row) && (config.column == _column);
+pixelBits & pixelBits::operator|=(const pixelBits & other) {
+  for(size_t w = 0; w < words; w++) { _bits[w] |= other._bits[w]; }
+  return *this;
+}
+
+pixelBits & pixelBits::remove(const pixelBits & other) {
+  for(size_t w = 0; w < words; w++) { _bits[w] &= ~other._bits[w]; }
+  return *this;
+}
+
+pixelBits pixelBits::rectangle(uint8_t colMin, uint8_t colMax, uint8_t rowMin, uint8_t rowMax) {
+  pixelBits region;
+  if(colMax >= columns) colMax = columns-1;
+  if(rowMax >= rows) rowMax = rows-1;
+  for(size_t column = colMin; column <= colMax; column++) {
+    for(size_t row = rowMin; row <= rowMax; row++) { region.set(index(column,row)); }
   }
-};
+  return region;
+}
+
+pixelBits pixelBits::doubleColumn(uint8_t dcol) {
+  pixelBits region;
+  if(2*dcol + 1 >= columns) return region;
+  region.setColumn(2*dcol,true);
+  region.setColumn(2*dcol + 1,true);
+  return region;
+}
+
+pixelBits pixelBits::stride(size_t step, size_t offset) {
+  pixelBits region;
+  if(step == 0) return region;
+  for(size_t i = offset; i < size; i += step) { region.set(i); }
+  return region;
+}
+
+pixelBits pixelBits::checkerboard(uint8_t parity) {
+  pixelBits region;
+  for(size_t column = 0; column < columns; column++) {
+    for(size_t row = (column + parity)%2; row < rows; row += 2) { region.set(index(column,row)); }
+  }
+  return region;
+}
+
+
+/* =========================================================================== */
+
+/** ROC configuration functions **/
+
+rocConfig::rocConfig() : type(0), enable(true), _configured(), _enabled(), _masked() {
+  // Unconfigured pixels default to the maximum trim value:
+  std::fill(_trims, _trims + sizeof(_trims), 0xff);
+  std::fill(_dacValues, _dacValues + sizeof(_dacValues), 0);
+  std::fill(_dacSet, _dacSet + sizeof(_dacSet)/sizeof(_dacSet[0]), false);
+}
+
+bool rocConfig::setPixel(const pixelConfig & config) {
+  if(!pixelBits::valid(config.column, config.row)) return false;
+
+  size_t index = pixelBits::index(config.column, config.row);
+  _configured.set(index);
+  _enabled.set(index, config.enable);
+  _masked.set(index, config.mask);
+  setTrim(index, config.trim);
+  return true;
+}
+
+pixelConfig rocConfig::getPixel(uint8_t column, uint8_t row) const {
+  pixelConfig result;
+  if(!hasPixel(column, row)) return result;
+
+  size_t index = pixelBits::index(column, row);
+  result.column = column;
+  result.row = row;
+  result.trim = getTrim(index);
+  result.mask = _masked.test(index);
+  result.enable = _enabled.test(index);
+  return result;
+}
+
+bool rocConfig::setPixelEnable(uint8_t column, uint8_t row, bool enable) {
+  if(!hasPixel(column, row)) return false;
+  _enabled.set(pixelBits::index(column, row), enable);
+  return true;
+}
+
+bool rocConfig::setPixelMask(uint8_t column, uint8_t row, bool mask) {
+  if(!hasPixel(column, row)) return false;
+  _masked.set(pixelBits::index(column, row), mask);
+  return true;
+}
+
+void rocConfig::setAllPixelsEnable(bool enable) {
+  if(enable) _enabled = _configured;
+  else _enabled.clear();
+}
+
+void rocConfig::setAllPixelsMask(bool mask) {
+  if(mask) _masked = _configured;
+  else _masked.clear();
+}
+
+void rocConfig::setColumnMask(uint8_t column, bool mask) {
+  if(column >= pixelBits::columns) return;
+  _masked.setColumn(column, mask);
+  // Only existing pixels can be masked:
+  _masked &= _configured;
+}
+
+void rocConfig::setPixelsEnable(const pixelBits & region, bool enable) {
+  if(enable) {
+    pixelBits existing = region;
+    existing &= _configured;
+    _enabled |= existing;
+  }
+  else _enabled.remove(region);
+}
+
+void rocConfig::setPixelsMask(const pixelBits & region, bool mask) {
+  if(mask) {
+    pixelBits existing = region;
+    existing &= _configured;
+    _masked |= existing;
+  }
+  else _masked.remove(region);
+}
+
+pixelBits rocConfig::unmaskedPixels() const {
+  pixelBits unmasked = _configured;
+  unmasked.remove(_masked);
+  return unmasked;
+}
+
+void rocConfig::getPixels(const pixelBits & selection, std::vector<pixelConfig> & pixels) const {
+  pixels.reserve(pixels.size() + selection.count());
+  for(pixelBits::iterator px = selection.begin(); px != selection.end(); ++px) {
+    pixels.push_back(getPixel(px.column(), px.row()));
+  }
+}
+
+void rocConfig::setTrim(size_t index, uint8_t trim) {
+  uint8_t & nibbles = _trims[index/2];
+  if(index%2) nibbles = (nibbles & 0x0f) | ((trim & 0xf) << 4);
+  else nibbles = (nibbles & 0xf0) | (trim & 0xf);
+}
+
+bool rocConfig::setDAC(uint8_t reg, uint8_t value) {
+  bool existing = _dacSet[reg];
+  _dacValues[reg] = value;
+  _dacSet[reg] = true;
+  return existing;
+}
+
+std::vector< std::pair<uint8_t,uint8_t> > rocConfig::getDACs() const {
+  std::vector< std::pair<uint8_t,uint8_t> > dacs;
+  for(size_t reg = 0; reg < sizeof(_dacValues); reg++) {
+    if(_dacSet[reg]) dacs.push_back(std::make_pair(static_cast<uint8_t>(reg), _dacValues[reg]));
+  }
+  return dacs;
+}
+
+size_t rocConfig::nDACs() const {
+  return std::count(_dacSet, _dacSet + sizeof(_dacSet)/sizeof(_dacSet[0]), true);
+}
 
 
 /* =========================================================================== */
@@ -83,11 +269,11 @@ void dut::info() {
     // We currently hide the possibility to enable pixels on some ROCs only,
     // so looking at ROC 0 as default is safe:
     LOG(logINFO) << std::setw(2) << roc.size() << " ROCs (" << getNEnabledRocs() 
-		 << " ON) with " << roc.at(0).pixels.size() << " pixelConfigs";
+		 << " ON) with " << roc.at(0).nPixels() << " pixelConfigs";
 
     for(std::vector<rocConfig>::iterator rocIt = roc.begin(); rocIt != roc.end(); rocIt++) {
       LOG(logINFO) << "\tROC " << (int)(rocIt-roc.begin()) << ": " 
-		   << (*rocIt).dacs.size() << " DACs set, Pixels: " 
+		   << (*rocIt).nDACs() << " DACs set, Pixels: " 
 		   << getNMaskedPixels((int)(rocIt-roc.begin())) << " masked, "
 		   << getNEnabledPixels((int)(rocIt-roc.begin())) << " active.";
     }
@@ -98,14 +284,14 @@ int32_t dut::getNEnabledPixels(uint8_t rocid) {
   if (!_initialized || rocid >= roc.size()) return 0;
   // We currently hide the possibility to enable pixels on some ROCs only,
   // so looking at ROC 0 as default is safe:
-  return std::count_if(roc.at(rocid).pixels.begin(),roc.at(rocid).pixels.end(),configEnableSet(true));
+  return roc.at(rocid).nEnabledPixels();
 }
 
 int32_t dut::getNMaskedPixels(uint8_t rocid) {
   if (!_initialized || rocid >= roc.size()) return 0;
   // We currently hide the possibility to enable pixels on some ROCs only,
   // so looking at ROC 0 as default is safe:
-  return std::count_if(roc.at(rocid).pixels.begin(),roc.at(rocid).pixels.end(),configMaskSet(true));
+  return roc.at(rocid).nMaskedPixels();
 }
 
 int32_t dut::getNEnabledRocs() {
@@ -137,10 +323,8 @@ std::vector< pixelConfig > dut::getEnabledPixels(size_t rocid) {
   // Check if DUT is allright and the roc we are looking at exists:
   if (!status() || !(rocid < roc.size())) return result;
 
-  // Search for pixels that have enable set
-  for (std::vector<pixelConfig>::iterator it = roc.at(rocid).pixels.begin(); it != roc.at(rocid).pixels.end(); ++it){
-    if (it->enable) result.push_back(*it);
-  }
+  // Collect the pixels that have enable set
+  roc.at(rocid).getPixels(roc.at(rocid).enabledPixels(), result);
   return result;
 }
 
@@ -166,31 +350,21 @@ std::vector< tbmConfig > dut::getEnabledTbms() {
 }
 
 bool dut::getPixelEnabled(uint8_t column, uint8_t row) {
-  std::vector<pixelConfig>::iterator it = std::find_if(roc.at(0).pixels.begin(),
-						       roc.at(0).pixels.end(),
-						       findPixelXY(column,row));
-  if(it != roc.at(0).pixels.end())
-    return it->enable;
-  return false;
+  if(roc.empty() || !roc.at(0).hasPixel(column,row)) return false;
+  return roc.at(0).enabledPixels().test(pixelBits::index(column,row));
 }
 
 bool dut::getAllPixelEnable(){
  if (!status()) return false;
- // search for pixels that DO NOT have enable set
- std::vector<pixelConfig>::iterator it = std::find_if(roc.at(0).pixels.begin(),
-						      roc.at(0).pixels.end(),
-						      configEnableSet(false));
- if(it != roc.at(0).pixels.end())
-   return false; // found a disabled pixel
- else
-   return true; // all pixels are enabled
+ // all existing pixels are enabled if there are as many enabled as existing ones
+ return (roc.at(0).nEnabledPixels() == roc.at(0).nPixels());
 }
 
 
 bool dut::getModuleEnable(){
  if (!status()) return false;
  // check that we have all 16 ROCs
- if (roc.size()<16) return false;
+ if (roc.size()<MOD_NUMROCS) return false;
  // search for pixels that DO NOT have enable set
  std::vector<rocConfig>::iterator it = std::find_if(roc.begin(),
 						      roc.end(),
@@ -205,14 +379,8 @@ pixelConfig dut::getPixelConfig(size_t rocid, uint8_t column, uint8_t row) {
 
   pixelConfig result; // initialized with 0 by constructor
   if (!status()) return result;
-  // find pixel with specified column and row
-  std::vector<pixelConfig>::iterator it = std::find_if(roc.at(rocid).pixels.begin(),
-						       roc.at(rocid).pixels.end(),
-						       findPixelXY(column,row));
-  // if pixel found, set result accordingly
-  if(it != roc.at(rocid).pixels.end()){
-    result = *it;
-  }
+  // if pixel exists, set result accordingly
+  if(roc.at(rocid).hasPixel(column,row)) result = roc.at(rocid).getPixel(column,row);
   return result;
 }
 
@@ -228,7 +396,7 @@ uint8_t dut::getDAC(size_t rocId, std::string dacName) {
 
     // And get the register value from the dictionary object:
     uint8_t _register = _dict->getRegister(dacName, ROC_REG);
-    return roc[rocId].dacs[_register];
+    return roc[rocId].getDAC(_register);
   }
   // FIXME throw error
   else return 0x0;
@@ -237,13 +405,7 @@ uint8_t dut::getDAC(size_t rocId, std::string dacName) {
 std::vector< std::pair<uint8_t,uint8_t> > dut::getDACs(size_t rocId) {
 
   if(status() && rocId < roc.size()) {
-    std::vector< std::pair<uint8_t,uint8_t> > vec;
-
-    for(std::map< uint8_t,uint8_t >::iterator it = roc.at(rocId).dacs.begin(); 
-	it != roc.at(rocId).dacs.end(); ++it) {
-      vec.push_back(*it);
-    }
-    return vec;
+    return roc.at(rocId).getDACs();
   }
   else return std::vector< std::pair<uint8_t,uint8_t> >();
 }
@@ -252,8 +414,8 @@ void dut::printDACs(size_t rocId) {
 
   if(status() && rocId < roc.size()) {
     LOG(logINFO) << "Printing current DAC settings for ROC " << rocId << ":";
-    for(std::map< uint8_t,uint8_t >::iterator it = roc.at(rocId).dacs.begin(); 
-	it != roc.at(rocId).dacs.end(); ++it) {
+    std::vector< std::pair<uint8_t,uint8_t> > dacs = roc.at(rocId).getDACs();
+    for(std::vector< std::pair<uint8_t,uint8_t> >::iterator it = dacs.begin(); it != dacs.end(); ++it) {
       LOG(logINFO) << "DAC" << (int)it->first << " = " << (int)it->second;
     }
   }
@@ -282,21 +444,15 @@ void dut::maskColumn(uint8_t column, bool mask, int8_t rocid) {
 		     << " to " << (int)mask << " on all ROCs."; 
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // Find all pixels with specified column
-      for(std::vector<pixelConfig>::iterator it = rocit->pixels.begin(); it != rocit->pixels.end(); ++it) {
-	// Set enable bit
-	if(it->column == column) {it->mask = mask;}
-      }
+      // Set mask bit of all pixels with specified column
+      rocit->setColumnMask(column,mask);
     }
   }
   else if(status() && rocid < (int)roc.size()) {
     LOG(logDEBUGAPI) << "Set mask bit of all pixels in column " << (int)column << " to " << (int)mask << " on ROC " << (int)rocid; 
 
-    // Find all pixels with specified column
-    for(std::vector<pixelConfig>::iterator it = roc.at(rocid).pixels.begin(); it != roc.at(rocid).pixels.end(); ++it) {
-      // Set enable bit
-      if(it->column == column) {it->mask = mask;}
-    }
+    // Set mask bit of all pixels with specified column
+    roc.at(rocid).setColumnMask(column,mask);
   }
 }
 
@@ -307,28 +463,16 @@ void dut:: maskPixel(uint8_t column, uint8_t row, bool mask, int8_t rocid) {
 		     << " to " << (int)mask << " on all ROCs."; 
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // Find pixel with specified column and row
-      std::vector<pixelConfig>::iterator it = std::find_if(rocit->pixels.begin(),
-							   rocit->pixels.end(),
-							   findPixelXY(column,row));
-      // Set enable bit
-      if(it != rocit->pixels.end()) {
-	it->mask = mask;
-      } else {
+      // Set mask bit of pixel with specified column and row
+      if(!rocit->setPixelMask(column,row,mask)) {
 	LOG(logWARNING) << "Pixel at column " << (int) column << " and row " << (int) row << " not found for ROC " << (int)(rocit - roc.begin())<< "!" ;
       }
     }
   }
   else if(status() && rocid < (int)roc.size()) {
     LOG(logDEBUGAPI) << "Set mask bit of pixel " << (int)column << ", " << (int)row << " to " << (int)mask << " on ROC " << (int)rocid; 
-    // Find pixel with specified column and row
-    std::vector<pixelConfig>::iterator it = std::find_if(roc.at(rocid).pixels.begin(),
-							 roc.at(rocid).pixels.end(),
-							 findPixelXY(column,row));
-    // Set mask:
-    if(it != roc.at(rocid).pixels.end()){
-      it->mask = mask;
-    } else {
+    // Set mask bit of pixel with specified column and row
+    if(!roc.at(rocid).setPixelMask(column,row,mask)) {
       LOG(logWARNING) << "Pixel at column " << (int) column << " and row " << (int) row << " not found for ROC " << (int)(rocid)<< "!" ;
     }
   }
@@ -344,14 +488,8 @@ void dut::testPixel(uint8_t column, uint8_t row, bool enable, int8_t rocid) {
 		     << " to " << (int)enable << " on all ROCs.";
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // Find pixel with specified column and row
-      std::vector<pixelConfig>::iterator it = std::find_if(rocit->pixels.begin(),
-							   rocit->pixels.end(),
-							   findPixelXY(column,row));
-      // Set enable bit
-      if(it != rocit->pixels.end()) {
-	it->enable = enable;
-      } else {
+      // Set enable bit of pixel with specified column and row
+      if(!rocit->setPixelEnable(column,row,enable)) {
 	LOG(logWARNING) << "Pixel at column " << (int) column << " and row " << (int) row << " not found for ROC " << (int) (rocit - roc.begin())<< "!" ;
       }
     }
@@ -359,14 +497,8 @@ void dut::testPixel(uint8_t column, uint8_t row, bool enable, int8_t rocid) {
   else if(status() && rocid < (int)roc.size()) {
     LOG(logDEBUGAPI) << "Set enable bit of pixel " << (int)column << ", " << (int)row << " to " << (int)enable << " on ROC " << (int)rocid; 
 
-    // Find pixel with specified column and row
-    std::vector<pixelConfig>::iterator it = std::find_if(roc.at(rocid).pixels.begin(),
-							 roc.at(rocid).pixels.end(),
-							 findPixelXY(column,row));
-    // Set mask:
-    if(it != roc.at(rocid).pixels.end()){
-      it->enable = enable;
-    } else {
+    // Set enable bit of pixel with specified column and row
+    if(!roc.at(rocid).setPixelEnable(column,row,enable)) {
       LOG(logWARNING) << "Pixel at column " << (int) column << " and row " << (int) row << " not found for ROC " << (int)(rocid)<< "!" ;
     }
   }
@@ -378,18 +510,14 @@ void dut::maskAllPixels(bool mask, int8_t rocid) {
     LOG(logDEBUGAPI) << "Set mask bit to " << (int)mask << " for all pixels on all ROCs.";
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // loop over all pixel, set enable according to parameter
-      for (std::vector<pixelConfig>::iterator pixelit = rocit->pixels.begin() ; pixelit != rocit->pixels.end(); ++pixelit){
-	pixelit->mask = mask;
-      }
+      // set mask of all pixels according to parameter
+      rocit->setAllPixelsMask(mask);
     }
   }
   else if(status() && rocid < (int)roc.size()) {
     LOG(logDEBUGAPI) << "Set mask bit to " << (int)mask << " for all pixels on ROC " << (int)rocid;
-    // loop over all pixel, set enable according to parameter
-    for (std::vector<pixelConfig>::iterator pixelit = roc.at(rocid).pixels.begin() ; pixelit != roc.at(rocid).pixels.end(); ++pixelit){
-      pixelit->mask = mask;
-    }
+    // set mask of all pixels according to parameter
+    roc.at(rocid).setAllPixelsMask(mask);
   }
 }
 
@@ -402,19 +530,48 @@ void dut::testAllPixels(bool enable, int8_t rocid) {
     LOG(logDEBUGAPI) << "Set enable bit to " << (int)enable << " for all pixels on all ROCs";
     // Loop over all ROCs
     for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
-      // loop over all pixel, set enable according to parameter
-      for (std::vector<pixelConfig>::iterator pixelit = rocit->pixels.begin() ; pixelit != rocit->pixels.end(); ++pixelit){
-	pixelit->enable = enable;
-      }
+      // set enable of all pixels according to parameter
+      rocit->setAllPixelsEnable(enable);
     }
   }
   else if(status() && rocid < (int)roc.size()) {
     LOG(logDEBUGAPI) << "Set enable bit to " << (int)enable << " for all pixels on ROC " << (int)rocid;
-    // loop over all pixel, set enable according to parameter
-    for (std::vector<pixelConfig>::iterator pixelit = roc.at(rocid).pixels.begin() ; pixelit != roc.at(rocid).pixels.end(); ++pixelit){
-      pixelit->enable = enable;
+    // set enable of all pixels according to parameter
+    roc.at(rocid).setAllPixelsEnable(enable);
+  }
+}
+
+void dut::testPixels(const pixelBits & region, bool enable, int8_t rocid) {
+
+  // Testing also means we need to set the mask state accordingly (inverted)
+  maskPixels(region,!enable,rocid);
+
+  if(status() && rocid < 0) {
+    LOG(logDEBUGAPI) << "Set enable bit to " << (int)enable << " for " << region.count() << " pixels on all ROCs";
+    // Loop over all ROCs
+    for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
+      rocit->setPixelsEnable(region,enable);
+    }
+  }
+  else if(status() && rocid < (int)roc.size()) {
+    LOG(logDEBUGAPI) << "Set enable bit to " << (int)enable << " for " << region.count() << " pixels on ROC " << (int)rocid;
+    roc.at(rocid).setPixelsEnable(region,enable);
+  }
+}
+
+void dut::maskPixels(const pixelBits & region, bool mask, int8_t rocid) {
+
+  if(status() && rocid < 0) {
+    LOG(logDEBUGAPI) << "Set mask bit to " << (int)mask << " for " << region.count() << " pixels on all ROCs";
+    // Loop over all ROCs
+    for (std::vector<rocConfig>::iterator rocit = roc.begin() ; rocit != roc.end(); ++rocit){
+      rocit->setPixelsMask(region,mask);
     }
   }
+  else if(status() && rocid < (int)roc.size()) {
+    LOG(logDEBUGAPI) << "Set mask bit to " << (int)mask << " for " << region.count() << " pixels on ROC " << (int)rocid;
+    roc.at(rocid).setPixelsMask(region,mask);
+  }
 }
 
 bool dut::status() {
@@ -0,0 +1,192 @@
+/**
+ * pxar power monitor class implementation
+ */
+
+#include "monitor.h"
+#include "hal.h"
+#include "log.h"
+#include <sys/time.h>
+#include <algorithm>
+
+using namespace pxar;
+
+powerMonitor::powerMonitor(hal * halInstance, size_t capacity) :
+  _hal(halInstance), _ring(capacity),
+  _running(false), _interval(1000000), _phases() {
+
+  pthread_mutex_init(&_mutex, NULL);
+  pthread_cond_init(&_wakeup, NULL);
+  pthread_mutex_init(&_phaseMutex, NULL);
+}
+
+powerMonitor::~powerMonitor() {
+  stop();
+  pthread_mutex_destroy(&_phaseMutex);
+  pthread_cond_destroy(&_wakeup);
+  pthread_mutex_destroy(&_mutex);
+}
+
+bool powerMonitor::start(double rate) {
+
+  if(rate <= 0) {
+    LOG(logERROR) << "Invalid monitor sampling rate " << rate << " Hz.";
+    return false;
+  }
+
+  pthread_mutex_lock(&_mutex);
+  _interval = static_cast<uint32_t>(1000000/rate);
+  if(_running) {
+    // Already sampling, just wake the thread up to apply the new rate:
+    pthread_cond_signal(&_wakeup);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+  }
+
+  _running = true;
+  if(pthread_create(&_thread, NULL, &powerMonitor::run, this) != 0) {
+    _running = false;
+    pthread_mutex_unlock(&_mutex);
+    LOG(logERROR) << "Could not start the monitor thread.";
+    return false;
+  }
+  pthread_mutex_unlock(&_mutex);
+
+  LOG(logDEBUGAPI) << "Monitor sampling testboard power at " << rate << " Hz.";
+  return true;
+}
+
+void powerMonitor::stop() {
+
+  pthread_mutex_lock(&_mutex);
+  if(!_running) {
+    pthread_mutex_unlock(&_mutex);
+    return;
+  }
+  _running = false;
+  pthread_cond_signal(&_wakeup);
+  pthread_mutex_unlock(&_mutex);
+
+  pthread_join(_thread, NULL);
+  LOG(logDEBUGAPI) << "Monitor stopped after " << _ring.written() << " readings.";
+}
+
+bool powerMonitor::running() {
+  pthread_mutex_lock(&_mutex);
+  bool isRunning = _running;
+  pthread_mutex_unlock(&_mutex);
+  return isRunning;
+}
+
+void powerMonitor::markPhase(std::string phase) {
+  pthread_mutex_lock(&_phaseMutex);
+  _phases.push_back(std::make_pair(phase, now()));
+  pthread_mutex_unlock(&_phaseMutex);
+}
+
+void * powerMonitor::run(void * monitor) {
+  static_cast<powerMonitor*>(monitor)->loop();
+  return NULL;
+}
+
+void powerMonitor::loop() {
+
+  pthread_mutex_lock(&_mutex);
+  while(_running) {
+    pthread_mutex_unlock(&_mutex);
+
+    // Take the reading, the RPC calls are serialized with the main thread.
+    // Claim the connection, so running scans pause at their next step:
+    powerReading reading;
+    _hal->claimConnection();
+    try {
+      reading.va = _hal->getTBva();
+      reading.timestamp = now();
+      reading.vd = _hal->getTBvd();
+      reading.ia = _hal->getTBia();
+      reading.id = _hal->getTBid();
+      _hal->releaseConnection();
+      _ring.push(reading);
+    }
+    catch(...) {
+      _hal->releaseConnection();
+      LOG(logERROR) << "Monitor could not read the testboard power, stopping.";
+      pthread_mutex_lock(&_mutex);
+      _running = false;
+      break;
+    }
+
+    pthread_mutex_lock(&_mutex);
+    if(!_running) break;
+
+    // Sleep until the next reading is due or we are woken up:
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    uint64_t usec = static_cast<uint64_t>(tv.tv_usec) + _interval;
+    struct timespec deadline;
+    deadline.tv_sec = tv.tv_sec + usec/1000000;
+    deadline.tv_nsec = (usec%1000000)*1000;
+    pthread_cond_timedwait(&_wakeup, &_mutex, &deadline);
+  }
+  pthread_mutex_unlock(&_mutex);
+}
+
+bool powerMonitor::getLatest(powerReading & reading) const {
+  return _ring.getLatest(reading);
+}
+
+std::vector<powerReading> powerMonitor::getReadings() const {
+  return _ring.getReadings();
+}
+
+std::vector<powerSummary> powerMonitor::getSummaries() const {
+
+  std::vector<powerReading> readings = getReadings();
+
+  pthread_mutex_lock(&_phaseMutex);
+  std::vector< std::pair<std::string, double> > phases = _phases;
+  pthread_mutex_unlock(&_phaseMutex);
+
+  std::vector<powerSummary> summaries;
+  for(size_t i = 0; i < phases.size(); i++) {
+    powerSummary summary;
+    summary.phase = phases.at(i).first;
+    summary.start = phases.at(i).second;
+    summary.stop = (i+1 < phases.size()) ? phases.at(i+1).second : now();
+
+    // Collect the statistics of all readings within this phase:
+    for(std::vector<powerReading>::iterator it = readings.begin(); it != readings.end(); ++it) {
+      if(it->timestamp < summary.start || it->timestamp >= summary.stop) continue;
+
+      if(summary.nReadings == 0) {
+	summary.va.min = summary.va.max = it->va;
+	summary.vd.min = summary.vd.max = it->vd;
+	summary.ia.min = summary.ia.max = it->ia;
+	summary.id.min = summary.id.max = it->id;
+      }
+      summary.va.min = std::min(summary.va.min, it->va); summary.va.max = std::max(summary.va.max, it->va);
+      summary.vd.min = std::min(summary.vd.min, it->vd); summary.vd.max = std::max(summary.vd.max, it->vd);
+      summary.ia.min = std::min(summary.ia.min, it->ia); summary.ia.max = std::max(summary.ia.max, it->ia);
+      summary.id.min = std::min(summary.id.min, it->id); summary.id.max = std::max(summary.id.max, it->id);
+      summary.va.mean += it->va;
+      summary.vd.mean += it->vd;
+      summary.ia.mean += it->ia;
+      summary.id.mean += it->id;
+      summary.nReadings++;
+    }
+
+    if(summary.nReadings > 0) {
+      summary.va.mean /= summary.nReadings;
+      summary.vd.mean /= summary.nReadings;
+      summary.ia.mean /= summary.nReadings;
+      summary.id.mean /= summary.nReadings;
+    }
+    summaries.push_back(summary);
+  }
+  return summaries;
+}
+
+double powerMonitor::now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.;
+}
@@ -0,0 +1,209 @@
+/**
+ * pxar power monitor class header
+ * background sampler for the testboard power supply telemetry
+ */
+
+#ifndef PXAR_MONITOR_H
+#define PXAR_MONITOR_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "api.h"
+
+namespace pxar {
+
+  /** Ring buffer of power readings with one writer and lock-free readers
+   *  Every slot carries a sequence counter which is odd while the slot is
+   *  written, readers discard slots which changed while they were copied.
+   *  Once full, the oldest readings are overwritten.
+   */
+  class powerRing {
+
+  public:
+    /** Create a ring storing up to "capacity" readings
+     */
+    powerRing(size_t capacity) : _ring(NULL), _capacity(capacity), _written(0) {
+      if(_capacity == 0) _capacity = 1;
+      _ring = new slot[_capacity];
+      for(size_t i = 0; i < _capacity; i++) { _ring[i].sequence = 0; }
+    };
+
+    ~powerRing() { delete[] _ring; };
+
+    /** Add a reading to the ring, must only be called by a single writer
+     */
+    void push(const powerReading & reading) {
+      slot & s = _ring[_written % _capacity];
+
+      // Odd sequence number: slot is being written.
+      // The builtins act as full memory barriers:
+      __sync_fetch_and_add(&s.sequence, 1);
+      s.reading = reading;
+      __sync_fetch_and_add(&s.sequence, 1);
+
+      // Publish the new reading:
+      __sync_fetch_and_add(&_written, 1);
+    };
+
+    /** Get the most recent reading, returns false if none is available
+     */
+    bool getLatest(powerReading & reading) const {
+      __sync_synchronize();
+      size_t written = _written;
+      if(written == 0) return false;
+      return readSlot(written - 1, reading);
+    };
+
+    /** Get all readings currently stored in the ring, ordered by time
+     */
+    std::vector<powerReading> getReadings() const {
+      __sync_synchronize();
+      size_t written = _written;
+      size_t first = (written > _capacity) ? (written - _capacity) : 0;
+
+      std::vector<powerReading> readings;
+      readings.reserve(written - first);
+      for(size_t i = first; i < written; i++) {
+	powerReading reading;
+	if(!readSlot(i, reading)) continue;
+	// Slots overwritten since we started reading contain newer data, skip them:
+	if(!readings.empty() && reading.timestamp < readings.back().timestamp) continue;
+	readings.push_back(reading);
+      }
+      return readings;
+    };
+
+    /** Total number of readings written so far
+     */
+    size_t written() const { __sync_synchronize(); return _written; };
+
+    /** Maximum number of readings stored
+     */
+    size_t capacity() const { return _capacity; };
+
+  private:
+    /** One slot of the ring buffer with its sequence counter
+     */
+    struct slot {
+      volatile uint32_t sequence;
+      powerReading reading;
+    };
+
+    /** Copy the given ring slot, returns false if it is being written
+     *  or has been modified during the copy
+     */
+    bool readSlot(size_t position, powerReading & reading) const {
+      const slot & s = _ring[position % _capacity];
+      uint32_t before = s.sequence;
+      __sync_synchronize();
+      if(before & 1) return false;
+
+      reading = s.reading;
+
+      __sync_synchronize();
+      return (before == s.sequence);
+    };
+
+    slot * _ring;
+    size_t _capacity;
+    /** Total number of readings written, the next one goes to _written % _capacity
+     */
+    volatile size_t _written;
+
+    powerRing(const powerRing&);
+    powerRing& operator=(const powerRing&);
+  };
+
+  /** Background sampler for the testboard power telemetry
+   *  A separate thread reads VA, VD, IA and ID from the testboard at a fixed
+   *  rate and stores the readings with timestamps in a powerRing. The
+   *  sampler thread is its only writer, readers do not lock.
+   *
+   *  Readers never access the testboard, they only see the ring content.
+   *
+   *  Scans hold the testboard connection while their replies are in flight.
+   *  The sampler claims the connection for every reading, running scans hand
+   *  it over at their next step, so readings during a scan are taken at step
+   *  boundaries and may be delayed by up to one step.
+   */
+  class powerMonitor {
+
+  public:
+    /** Create a new sampler reading from the given HAL, storing up to
+     *  "capacity" readings before overwriting the oldest ones.
+     */
+    powerMonitor(hal * halInstance, size_t capacity = 4096);
+
+    /** Stops the sampler thread and frees the ring buffer
+     */
+    ~powerMonitor();
+
+    /** Start sampling with the given rate in Hz. If the sampler is already
+     *  running, only the rate is updated.
+     */
+    bool start(double rate);
+
+    /** Stop sampling and wait for the sampler thread to finish
+     */
+    void stop();
+
+    /** Returns true if the sampler thread is running
+     */
+    bool running();
+
+    /** Mark the start of a new test phase, ending the previous one
+     */
+    void markPhase(std::string phase);
+
+    /** Get the most recent reading, returns false if none is available
+     */
+    bool getLatest(powerReading & reading) const;
+
+    /** Get all readings currently stored in the ring, ordered by time
+     */
+    std::vector<powerReading> getReadings() const;
+
+    /** Get the min/max/mean summaries of all marked phases
+     */
+    std::vector<powerSummary> getSummaries() const;
+
+  private:
+    /** Entry point for the sampler thread
+     */
+    static void * run(void * monitor);
+
+    /** Sampling loop executed by the sampler thread
+     */
+    void loop();
+
+    /** Current time in seconds since the epoch
+     */
+    static double now();
+
+    hal * _hal;
+
+    /** Readings taken by the sampler thread
+     */
+    powerRing _ring;
+
+    pthread_t _thread;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _wakeup;
+    bool _running;
+    uint32_t _interval;
+
+    /** Phase names with their start times, protected by _phaseMutex
+     */
+    std::vector< std::pair<std::string, double> > _phases;
+    mutable pthread_mutex_t _phaseMutex;
+
+    powerMonitor(const powerMonitor&);
+    powerMonitor& operator=(const powerMonitor&);
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_MONITOR_H */
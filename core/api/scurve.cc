@@ -0,0 +1,318 @@
+/**
+ * pxar S-curve fitter class implementation
+ */
+
+#include "scurve.h"
+#include "constants.h"
+#include "log.h"
+#include <cmath>
+#include <unistd.h>
+#include <algorithm>
+
+using namespace pxar;
+
+namespace {
+
+  /** Error function approximation (Abramowitz & Stegun 7.1.26, absolute
+   *  error below 1.5e-7) written without branches, so loops calling it can
+   *  be vectorized. The Gaussian exp(-x^2) is passed in since the fit
+   *  needs it for the derivatives as well.
+   */
+  inline double erfApprox(double x, double gauss) {
+    double ax = std::fabs(x);
+    double t = 1./(1. + 0.3275911*ax);
+    double poly = t*(0.254829592 + t*(-0.284496736 + t*(1.421413741 + t*(-1.453152027 + t*1.061405429))));
+    double value = 1. - poly*gauss;
+    return (x < 0) ? -value : value;
+  }
+
+  /** Position at which the curve crosses the given number of readouts in
+   *  direction dir (+1 rising, -1 falling), linearly interpolated. Returns
+   *  false if the curve never crosses the level.
+   */
+  bool crossing(const std::vector<double> & x, const double * y, size_t stride, double level, int dir, double & position) {
+    size_t n = x.size();
+    for(size_t i = 1; i < n; i++) {
+      size_t p = (dir > 0) ? i : n - i;
+      size_t q = (dir > 0) ? i - 1 : n - i - 1;
+      double ya = y[q*stride], yb = y[p*stride];
+      if(ya < level && yb >= level) {
+	position = x[q] + (x[p] - x[q])*(level - ya)/(yb - ya);
+	return true;
+      }
+    }
+    return false;
+  }
+
+}
+
+scurveFitter::scurveFitter(size_t nThreads) :
+  _nThreads(nThreads), _dacs(), _counts(), _results(NULL), _nTriggers(0), _nextBatch(0) {
+
+  if(_nThreads == 0) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    _nThreads = (cores > 0) ? static_cast<size_t>(cores) : 1;
+  }
+  pthread_mutex_init(&_mutex, NULL);
+}
+
+std::vector<scurveResult> scurveFitter::fit(const std::vector< std::pair<uint8_t, std::vector<pixel> > > & data, uint32_t nTriggers) {
+
+  std::vector<scurveResult> results;
+  if(data.empty() || nTriggers == 0) return results;
+
+  // Find all pixels contained in the scan and assign them dense indices,
+  // ordered by ROC, column and row:
+  size_t nRocs = 0;
+  for(std::vector< std::pair<uint8_t, std::vector<pixel> > >::const_iterator point = data.begin(); point != data.end(); ++point) {
+    for(std::vector<pixel>::const_iterator px = point->second.begin(); px != point->second.end(); ++px) {
+      nRocs = std::max(nRocs, static_cast<size_t>(px->roc_id) + 1);
+    }
+  }
+  std::vector<int32_t> index(nRocs*ROC_NUMCOLS*ROC_NUMROWS, -1);
+  for(std::vector< std::pair<uint8_t, std::vector<pixel> > >::const_iterator point = data.begin(); point != data.end(); ++point) {
+    for(std::vector<pixel>::const_iterator px = point->second.begin(); px != point->second.end(); ++px) {
+      if(px->column >= ROC_NUMCOLS || px->row >= ROC_NUMROWS) continue;
+      index[(px->roc_id*ROC_NUMCOLS + px->column)*ROC_NUMROWS + px->row] = 0;
+    }
+  }
+  for(size_t i = 0; i < index.size(); i++) {
+    if(index[i] < 0) continue;
+    index[i] = static_cast<int32_t>(results.size());
+    scurveResult result;
+    result.roc_id = static_cast<uint8_t>(i/(ROC_NUMCOLS*ROC_NUMROWS));
+    result.column = static_cast<uint8_t>((i/ROC_NUMROWS)%ROC_NUMCOLS);
+    result.row = static_cast<uint8_t>(i%ROC_NUMROWS);
+    results.push_back(result);
+  }
+
+  // Structure of arrays: shared DAC values and one row of counts per pixel,
+  // pixels missing in a data point did not respond:
+  size_t nPoints = data.size();
+  _dacs.resize(nPoints);
+  _counts.assign(results.size()*nPoints, 0);
+  for(size_t p = 0; p < nPoints; p++) {
+    _dacs[p] = data[p].first;
+    for(std::vector<pixel>::const_iterator px = data[p].second.begin(); px != data[p].second.end(); ++px) {
+      if(px->column >= ROC_NUMCOLS || px->row >= ROC_NUMROWS) continue;
+      size_t i = index[(px->roc_id*ROC_NUMCOLS + px->column)*ROC_NUMROWS + px->row];
+      _counts[i*nPoints + p] = static_cast<int16_t>(px->value);
+    }
+  }
+
+  _results = &results;
+  _nTriggers = nTriggers;
+  _nextBatch = 0;
+
+  // Distribute the batches over the worker threads:
+  size_t nBatches = (results.size() + SCURVE_BATCH_SIZE - 1)/SCURVE_BATCH_SIZE;
+  size_t nThreads = std::min(_nThreads, nBatches);
+  LOG(logDEBUGAPI) << "Fitting " << results.size() << " S-curves of " << nPoints << " points in "
+		   << nBatches << " batches on " << nThreads << " threads.";
+
+  std::vector<pthread_t> threads;
+  for(size_t t = 1; t < nThreads; t++) {
+    pthread_t thread;
+    if(pthread_create(&thread, NULL, &scurveFitter::run, this) != 0) {
+      LOG(logWARNING) << "Could not start S-curve fit thread, continuing with " << t << " threads.";
+      break;
+    }
+    threads.push_back(thread);
+  }
+  // The calling thread takes its share as well:
+  work();
+  for(std::vector<pthread_t>::iterator thread = threads.begin(); thread != threads.end(); ++thread) {
+    pthread_join(*thread, NULL);
+  }
+
+  _results = NULL;
+  _counts.clear();
+  return results;
+}
+
+void * scurveFitter::run(void * fitter) {
+  static_cast<scurveFitter*>(fitter)->work();
+  return NULL;
+}
+
+void scurveFitter::work() {
+
+  size_t nPixels = _results->size();
+  while(true) {
+    pthread_mutex_lock(&_mutex);
+    size_t first = _nextBatch*SCURVE_BATCH_SIZE;
+    _nextBatch++;
+    pthread_mutex_unlock(&_mutex);
+
+    if(first >= nPixels) break;
+    fitBatch(first);
+  }
+}
+
+void scurveFitter::fitBatch(size_t first) {
+
+  const size_t L = SCURVE_BATCH_SIZE;
+  const double sqrt2 = std::sqrt(2.), sqrtpi = std::sqrt(M_PI);
+  size_t nPoints = _dacs.size();
+  size_t nLanes = std::min(L, _results->size() - first);
+  double n = _nTriggers;
+
+  // Transpose the batch, so the lanes of one point are contiguous. Weights
+  // are the inverse binomial variances estimated from the data:
+  std::vector<double> y(nPoints*L, 0.), weight(nPoints*L, 0.);
+  for(size_t l = 0; l < nLanes; l++) {
+    const int16_t * counts = &_counts[(first + l)*nPoints];
+    for(size_t p = 0; p < nPoints; p++) {
+      double eff = (counts[p] + 0.5)/(n + 1.);
+      y[p*L + l] = counts[p];
+      weight[p*L + l] = 1./(n*eff*(1. - eff));
+    }
+  }
+
+  // Per lane: direction of the curve, start values and pathological cases
+  double dir[L], thr[L], width[L], lambda[L], chi2[L];
+  double a11[L], a12[L], a22[L], b1[L], b2[L];
+  double trialThr[L], trialWidth[L];
+  bool active[L];
+  double step = (nPoints > 1) ? std::fabs(_dacs[nPoints-1] - _dacs[0])/(nPoints - 1) : 1.;
+  double range = (nPoints > 1) ? std::fabs(_dacs[nPoints-1] - _dacs[0]) : 1.;
+
+  for(size_t l = 0; l < L; l++) {
+    dir[l] = 1; thr[l] = 0; width[l] = step; lambda[l] = 1e-3; chi2[l] = HUGE_VAL;
+    a11[l] = a12[l] = a22[l] = b1[l] = b2[l] = 0;
+    active[l] = false;
+    if(l >= nLanes) continue;
+
+    scurveResult & result = (*_results)[first + l];
+    double ymin = y[l], ymax = y[l], front = 0, back = 0;
+    for(size_t p = 0; p < nPoints; p++) {
+      ymin = std::min(ymin, y[p*L + l]);
+      ymax = std::max(ymax, y[p*L + l]);
+      if(2*p < nPoints) front += y[p*L + l];
+      else back += y[p*L + l];
+    }
+
+    if(ymax < n/2) {
+      result.flags |= SCURVE_NO_HITS;
+      continue;
+    }
+    if(ymin >= n/2) {
+      result.flags |= SCURVE_ALWAYS_ON;
+      result.threshold = (front > back) ? _dacs[nPoints-1] : _dacs[0];
+      continue;
+    }
+
+    // Curves losing efficiency with rising DAC are fitted mirrored:
+    if(front > back) {
+      dir[l] = -1;
+      result.flags |= SCURVE_FALLING;
+    }
+    int d = (dir[l] > 0) ? 1 : -1;
+
+    // Start values from the 50% crossing and the 16%/84% points:
+    double t50 = 0, t16 = 0, t84 = 0;
+    crossing(_dacs, &y[l], L, n/2, d, t50);
+    bool has16 = crossing(_dacs, &y[l], L, 0.16*n, d, t16);
+    bool has84 = crossing(_dacs, &y[l], L, 0.84*n, d, t84);
+    thr[l] = t50;
+    if(has16 && has84) width[l] = std::max(std::fabs(t84 - t16)/2, step/2);
+    result.threshold = thr[l];
+    result.width = width[l];
+
+    // Efficiency dropping again after the turn-on:
+    for(size_t p = 0; p < nPoints; p++) {
+      if(d*(_dacs[p] - t84) > step && y[p*L + l] < 0.16*n) result.flags |= SCURVE_NOISY;
+    }
+
+    // Turn-on between two neighbouring points, the width cannot be resolved:
+    bool resolved = false;
+    for(size_t p = 0; p < nPoints; p++) {
+      if(y[p*L + l] > 0.05*n && y[p*L + l] < 0.95*n) resolved = true;
+    }
+    if(!resolved || nPoints < 3) {
+      result.flags |= SCURVE_STEP;
+      continue;
+    }
+    active[l] = true;
+  }
+
+  for(size_t l = 0; l < L; l++) { trialThr[l] = thr[l]; trialWidth[l] = width[l]; }
+
+  // Levenberg-Marquardt iterations, all lanes at once. Every pass evaluates
+  // chi2 and the normal equations at the trial parameters:
+  size_t iteration = 0;
+  bool running = true;
+  for(; iteration < SCURVE_MAX_ITERATIONS && running; iteration++) {
+    double c2[L], s11[L], s12[L], s22[L], r1[L], r2[L], scale[L];
+    for(size_t l = 0; l < L; l++) {
+      c2[l] = s11[l] = s12[l] = s22[l] = r1[l] = r2[l] = 0;
+      scale[l] = dir[l]/(sqrt2*trialWidth[l]);
+    }
+
+    for(size_t p = 0; p < nPoints; p++) {
+      const double x = _dacs[p];
+      const double * yp = &y[p*L];
+      const double * wp = &weight[p*L];
+      for(size_t l = 0; l < L; l++) {
+	double z = (x - trialThr[l])*scale[l];
+	double gauss = std::exp(-z*z);
+	double model = 0.5*n*(1. + erfApprox(z, gauss));
+	double residual = yp[l] - model;
+	// Derivatives of the model by threshold and width:
+	double dm = n*gauss/sqrtpi;
+	double jt = -dm*scale[l];
+	double jw = -dm*z/trialWidth[l];
+	c2[l] += wp[l]*residual*residual;
+	s11[l] += wp[l]*jt*jt;
+	s12[l] += wp[l]*jt*jw;
+	s22[l] += wp[l]*jw*jw;
+	r1[l] += wp[l]*jt*residual;
+	r2[l] += wp[l]*jw*residual;
+      }
+    }
+
+    running = false;
+    for(size_t l = 0; l < nLanes; l++) {
+      if(!active[l]) continue;
+
+      if(c2[l] < chi2[l]) {
+	// Accept the trial parameters:
+	bool converged = (chi2[l] - c2[l] < 1e-6*c2[l]) || (c2[l] < 1e-12);
+	thr[l] = trialThr[l]; width[l] = trialWidth[l]; chi2[l] = c2[l];
+	a11[l] = s11[l]; a12[l] = s12[l]; a22[l] = s22[l]; b1[l] = r1[l]; b2[l] = r2[l];
+	lambda[l] = std::max(lambda[l]/10, 1e-9);
+	if(converged && iteration > 0) { active[l] = false; continue; }
+      }
+      else {
+	lambda[l] *= 10;
+	// No further improvement possible, this is the minimum:
+	if(lambda[l] > 1e8) { active[l] = false; continue; }
+      }
+
+      // Solve the damped 2x2 normal equations for the next trial:
+      double m11 = a11[l]*(1 + lambda[l]), m22 = a22[l]*(1 + lambda[l]);
+      double det = m11*m22 - a12[l]*a12[l];
+      if(det == 0) { active[l] = false; continue; }
+      trialThr[l] = thr[l] + (m22*b1[l] - a12[l]*b2[l])/det;
+      trialWidth[l] = width[l] + (m11*b2[l] - a12[l]*b1[l])/det;
+      if(trialWidth[l] <= 0) trialWidth[l] = width[l]/2;
+      running = true;
+    }
+  }
+
+  // Store the fit results, keeping the estimates for failed fits:
+  for(size_t l = 0; l < nLanes; l++) {
+    scurveResult & result = (*_results)[first + l];
+    if(result.flags & (SCURVE_NO_HITS | SCURVE_ALWAYS_ON | SCURVE_STEP)) continue;
+
+    bool valid = !active[l] && chi2[l] < HUGE_VAL && width[l] < range
+      && thr[l] >= std::min(_dacs[0], _dacs[nPoints-1]) - range && thr[l] <= std::max(_dacs[0], _dacs[nPoints-1]) + range;
+    if(!valid) {
+      result.flags |= SCURVE_NOT_CONVERGED;
+      continue;
+    }
+    result.threshold = thr[l];
+    result.width = width[l];
+    result.chi2ndf = chi2[l]/(nPoints - 2);
+  }
+}
@@ -0,0 +1,76 @@
+/**
+ * pxar S-curve fitter class header
+ * batched error function fits of efficiency versus DAC curves
+ */
+
+#ifndef PXAR_SCURVE_H
+#define PXAR_SCURVE_H
+
+#include <vector>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "api.h"
+
+namespace pxar {
+
+  /** Fitter for the S-curves of many pixels
+   *  Every curve (number of readouts versus DAC value) is fitted with an error
+   *  function, yielding the threshold (50% point) and the width (noise) of the
+   *  pixel.
+   *
+   *  The input is converted to a structure of arrays: one row of readout
+   *  counts per pixel, the DAC values shared by all. The pixels are fitted in
+   *  batches of SCURVE_BATCH_SIZE, with all arithmetic of a batch running over
+   *  contiguous per-lane arrays so the compiler can vectorize it. The batches
+   *  are distributed over a set of worker threads.
+   */
+  class scurveFitter {
+
+  public:
+    /** Create a fitter using nThreads worker threads, 0 selects the number
+     *  of available CPU cores
+     */
+    scurveFitter(size_t nThreads = 0);
+
+    /** Fit the curves of all pixels contained in the scan data (e.g. from
+     *  api::getEfficiencyVsDAC) taken with nTriggers triggers per point.
+     *  Returns one result per pixel, ordered by ROC, column and row.
+     */
+    std::vector<scurveResult> fit(const std::vector< std::pair<uint8_t, std::vector<pixel> > > & data, uint32_t nTriggers);
+
+  private:
+    /** Entry point for the worker threads
+     */
+    static void * run(void * fitter);
+
+    /** Worker loop: fetch batches until all are fitted
+     */
+    void work();
+
+    /** Fit the pixels [first, first + SCURVE_BATCH_SIZE) of the current input
+     */
+    void fitBatch(size_t first);
+
+    size_t _nThreads;
+
+    /** Input of the current fit: DAC values, readout counts (one row of
+     *  _dacs.size() entries per pixel) and the results to fill
+     */
+    std::vector<double> _dacs;
+    std::vector<int16_t> _counts;
+    std::vector<scurveResult> * _results;
+    double _nTriggers;
+
+    /** Next batch to hand out, protected by _mutex
+     */
+    size_t _nextBatch;
+    pthread_mutex_t _mutex;
+
+    scurveFitter(const scurveFitter&);
+    scurveFitter& operator=(const scurveFitter&);
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_SCURVE_H */
@@ -0,0 +1,94 @@
+/**
+ * pxar test station class implementation
+ */
+
+#include "station.h"
+#include "control.h"
+#include "log.h"
+#include <algorithm>
+
+using namespace pxar;
+
+namespace {
+
+  /** The test sequence of one board, run by the thread of that board
+   */
+  class boardTest : public asyncTest {
+  public:
+  boardTest(stationTest & test, api & board, size_t index) : _test(test), _board(board), _index(index) {};
+    bool run() { return _test.run(_board, _index); };
+  private:
+    stationTest & _test;
+    api & _board;
+    size_t _index;
+  };
+
+}
+
+testStation::testStation(std::vector<std::string> usbIds, std::string logLevel) :
+  _boards(), _usbIds(usbIds) {
+
+  // Every board gets its own API instance, the boards are opened one after
+  // the other. If one fails, the ones opened before are closed again:
+  try {
+    for(std::vector<std::string>::iterator id = _usbIds.begin(); id != _usbIds.end(); ++id) {
+      SetLogOutput::SetThreadTag(*id);
+      _boards.push_back(new api(*id, logLevel));
+    }
+  }
+  catch(...) {
+    SetLogOutput::SetThreadTag("");
+    for(std::vector<api*>::iterator board = _boards.begin(); board != _boards.end(); ++board) { delete *board; }
+    throw;
+  }
+  SetLogOutput::SetThreadTag("");
+  LOG(logINFO) << "Test station with " << _boards.size() << " boards ready.";
+}
+
+testStation::~testStation() {
+  for(size_t index = 0; index < _boards.size(); index++) {
+    SetLogOutput::SetThreadTag(_usbIds.at(index));
+    delete _boards.at(index);
+  }
+  SetLogOutput::SetThreadTag("");
+}
+
+std::vector<bool> testStation::run(stationTest & test) {
+
+  std::vector<worker> workers(_boards.size());
+  std::vector<bool> started(_boards.size(), false);
+
+  for(size_t index = 0; index < workers.size(); index++) {
+    workers[index].station = this;
+    workers[index].test = &test;
+    workers[index].index = index;
+    workers[index].success = false;
+    if(pthread_create(&workers[index].thread, NULL, &testStation::runBoard, &workers[index]) != 0) {
+      LOG(logERROR) << "Could not start the thread for board " << _usbIds.at(index) << ".";
+      continue;
+    }
+    started[index] = true;
+  }
+
+  std::vector<bool> success(workers.size(), false);
+  for(size_t index = 0; index < workers.size(); index++) {
+    if(!started[index]) continue;
+    pthread_join(workers[index].thread, NULL);
+    success[index] = workers[index].success;
+  }
+
+  LOG(logDEBUGAPI) << "Test sequence finished on " << std::count(success.begin(), success.end(), true)
+		   << " of " << success.size() << " boards.";
+  return success;
+}
+
+void * testStation::runBoard(void * instance) {
+
+  worker * self = static_cast<worker*>(instance);
+  testStation * station = self->station;
+  SetLogOutput::SetThreadTag(station->_usbIds.at(self->index));
+
+  boardTest test(*self->test, station->board(self->index), self->index);
+  self->success = runGuarded(test);
+  return NULL;
+}
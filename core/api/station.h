@@ -0,0 +1,87 @@
+/**
+ * pxar test station class header
+ * parallel operation of several testboards from one process
+ */
+
+#ifndef PXAR_STATION_H
+#define PXAR_STATION_H
+
+#include <string>
+#include <vector>
+#include <pthread.h>
+
+#include "api.h"
+
+namespace pxar {
+
+  /** Test sequence to run on every board of a test station
+   */
+  class stationTest {
+  public:
+    virtual ~stationTest() {};
+
+    /** Run the sequence on the given board, the index-th of the station.
+     *  Executed concurrently for all boards, each in a thread of its own:
+     *  results have to be stored separately per board index.
+     */
+    virtual bool run(api & board, size_t index) = 0;
+  };
+
+  /** A set of testboards operated in parallel
+   *  Every board gets its own, independent api/hal/dut stack. A test
+   *  sequence is run on all boards at once, one thread per board. All log
+   *  messages of a board are tagged with its USB ID.
+   *
+   *  The log level and output stream are shared by all boards of the
+   *  process, the last board opened sets the level.
+   */
+  class testStation {
+
+  public:
+    /** Open one API instance for each of the given testboard USB IDs
+     */
+    testStation(std::vector<std::string> usbIds, std::string logLevel = "WARNING");
+
+    /** Closes the connections to all boards
+     */
+    ~testStation();
+
+    /** Number of boards of the station
+     */
+    inline size_t size() const { return _boards.size(); };
+
+    /** API instance and USB ID of the given board
+     */
+    inline api & board(size_t index) { return *_boards.at(index); };
+    inline const std::string & usbId(size_t index) const { return _usbIds.at(index); };
+
+    /** Run the test sequence on all boards in parallel and wait for all of
+     *  them to finish. Returns the success of the sequence per board.
+     */
+    std::vector<bool> run(stationTest & test);
+
+  private:
+    /** State of the thread running the test sequence on one board
+     */
+    struct worker {
+      testStation * station;
+      stationTest * test;
+      size_t index;
+      bool success;
+      pthread_t thread;
+    };
+
+    /** Entry point for the board threads
+     */
+    static void * runBoard(void * worker);
+
+    std::vector<api*> _boards;
+    std::vector<std::string> _usbIds;
+
+    testStation(const testStation&);
+    testStation& operator=(const testStation&);
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_STATION_H */
@@ -0,0 +1,210 @@
+/**
+ * pxar scan tensor class header
+ * dense storage of map and scan results
+ */
+
+#ifndef PXAR_TENSOR_H
+#define PXAR_TENSOR_H
+
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <stdint.h>
+
+#include "api.h"
+
+namespace pxar {
+
+  /** Dense storage of the results of a map, DAC scan or DacDac scan
+   *  One value of type T per ROC, pixel and DAC setting, stored contiguously
+   *  and indexed by [roc][column][row][dac1][dac2]: the values of one pixel
+   *  versus the scanned DACs are adjacent. Both DAC ranges are [min, max)
+   *  in steps of one as in the API scans, a map has one step of each.
+   *
+   *  Compared to the vectors of pixels returned by the API, a value needs
+   *  2 (uint16_t, e.g. numbers of readouts) or 4 bytes (int32_t, e.g. pulse
+   *  height sums) instead of 8 plus the vector overhead, and every pixel is
+   *  found without searching. Pixels which have not been measured keep the
+   *  empty value given on construction. It defaults to the largest value of
+   *  T rather than zero, since zero readouts or a zero pulse height sum are
+   *  valid results of a full map; a measured value equal to empty is lost.
+   *
+   *  The tensor is a scanConsumer, so the streaming scans of the API can
+   *  write into it directly.
+   */
+  template <typename T> class scanTensor : public scanConsumer {
+  public:
+  scanTensor(size_t nRocs = 0, uint8_t dac1Min = 0, uint8_t dac1Max = 1, uint8_t dac2Min = 0, uint8_t dac2Max = 1, T empty = std::numeric_limits<T>::max()) :
+    _nRocs(0), _dac1Min(0), _dac1Steps(0), _dac2Min(0), _dac2Steps(0), _empty(empty), _data() {
+      resize(nRocs, dac1Min, dac1Max, dac2Min, dac2Max);
+    };
+
+    /** Change the shape of the tensor, all values are reset to empty
+     */
+    void resize(size_t nRocs, uint8_t dac1Min = 0, uint8_t dac1Max = 1, uint8_t dac2Min = 0, uint8_t dac2Max = 1) {
+      _nRocs = nRocs;
+      _dac1Min = dac1Min;
+      _dac1Steps = (dac1Max > dac1Min) ? dac1Max - dac1Min : 1;
+      _dac2Min = dac2Min;
+      _dac2Steps = (dac2Max > dac2Min) ? dac2Max - dac2Min : 1;
+      _data.assign(_nRocs*pixelBits::columns*pixelBits::rows*_dac1Steps*_dac2Steps, _empty);
+    };
+
+    /** Reset all values to empty, keeping the shape
+     */
+    void clear() { std::fill(_data.begin(), _data.end(), _empty); };
+
+    inline size_t nRocs() const { return _nRocs; };
+    inline size_t dac1Steps() const { return _dac1Steps; };
+    inline size_t dac2Steps() const { return _dac2Steps; };
+    inline uint8_t dac1(size_t step) const { return static_cast<uint8_t>(_dac1Min + step); };
+    inline uint8_t dac2(size_t step) const { return static_cast<uint8_t>(_dac2Min + step); };
+    inline T empty() const { return _empty; };
+
+    /** Returns true if a value has been stored for the pixel at the given DAC steps
+     */
+    inline bool measured(uint8_t roc, uint8_t column, uint8_t row, size_t step1 = 0, size_t step2 = 0) const {
+      return _data[index(roc, column, row, step1, step2)] != _empty;
+    };
+
+    /** Position of a value in the linear storage
+     */
+    inline size_t index(size_t roc, size_t column, size_t row, size_t step1 = 0, size_t step2 = 0) const {
+      return (((roc*pixelBits::columns + column)*pixelBits::rows + row)*_dac1Steps + step1)*_dac2Steps + step2;
+    };
+
+    /** Access the value of a pixel at the given DAC steps
+     */
+    inline T & operator()(uint8_t roc, uint8_t column, uint8_t row, size_t step1 = 0, size_t step2 = 0) {
+      return _data[index(roc, column, row, step1, step2)];
+    };
+    inline const T & operator()(uint8_t roc, uint8_t column, uint8_t row, size_t step1 = 0, size_t step2 = 0) const {
+      return _data[index(roc, column, row, step1, step2)];
+    };
+
+    /** All dac1Steps()*dac2Steps() values of one pixel, the second DAC running fastest
+     */
+    inline T * curve(uint8_t roc, uint8_t column, uint8_t row) { return &_data[index(roc, column, row)]; };
+    inline const T * curve(uint8_t roc, uint8_t column, uint8_t row) const { return &_data[index(roc, column, row)]; };
+
+    /** The linear storage of all values
+     */
+    inline std::vector<T> & data() { return _data; };
+    inline const std::vector<T> & data() const { return _data; };
+
+    /** Store the pixels measured at the given DAC values, pixels outside the
+     *  tensor are ignored
+     */
+    void consume(uint8_t dac1, uint8_t dac2, const std::vector<pixel> & data) {
+      if(dac1 < _dac1Min || dac1 - _dac1Min >= static_cast<int>(_dac1Steps)) return;
+      if(dac2 < _dac2Min || dac2 - _dac2Min >= static_cast<int>(_dac2Steps)) return;
+      store(dac1 - _dac1Min, dac2 - _dac2Min, data);
+    };
+
+    /** Conversion from the results of the API maps, DAC scans and DacDac
+     *  scans. The tensor is resized to the ROCs and DAC ranges of the data.
+     */
+    void fromPixels(const std::vector<pixel> & map) {
+      resize(rocsOf(map));
+      store(0, 0, map);
+    };
+
+    void fromScan(const std::vector< std::pair<uint8_t, std::vector<pixel> > > & scan) {
+      size_t nRocs = 0;
+      for(size_t i = 0; i < scan.size(); i++) { nRocs = std::max(nRocs, rocsOf(scan[i].second)); }
+      if(scan.empty()) { resize(0); return; }
+      resize(nRocs, scan.front().first, static_cast<uint8_t>(scan.back().first + 1));
+      for(size_t i = 0; i < scan.size(); i++) { consume(scan[i].first, 0, scan[i].second); }
+    };
+
+    void fromScan(const std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & scan) {
+      size_t nRocs = 0;
+      for(size_t i = 0; i < scan.size(); i++) { nRocs = std::max(nRocs, rocsOf(scan[i].second.second)); }
+      if(scan.empty()) { resize(0); return; }
+      resize(nRocs, scan.front().first, static_cast<uint8_t>(scan.back().first + 1),
+	     scan.front().second.first, static_cast<uint8_t>(scan.back().second.first + 1));
+      for(size_t i = 0; i < scan.size(); i++) { consume(scan[i].first, scan[i].second.first, scan[i].second.second); }
+    };
+
+    /** Conversion to the result formats of the API, only pixels with a value
+     *  other than empty are returned
+     */
+    void toPixels(std::vector<pixel> & map) const {
+      map.clear();
+      load(0, 0, map);
+    };
+
+    void toScan(std::vector< std::pair<uint8_t, std::vector<pixel> > > & scan) const {
+      scan.resize(_dac1Steps);
+      for(size_t i = 0; i < _dac1Steps; i++) {
+	scan[i].first = dac1(i);
+	scan[i].second.clear();
+	load(i, 0, scan[i].second);
+      }
+    };
+
+    void toScan(std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > & scan) const {
+      scan.resize(_dac1Steps*_dac2Steps);
+      for(size_t i = 0; i < _dac1Steps; i++) {
+	for(size_t j = 0; j < _dac2Steps; j++) {
+	  std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > & block = scan[i*_dac2Steps + j];
+	  block.first = dac1(i);
+	  block.second.first = dac2(j);
+	  block.second.second.clear();
+	  load(i, j, block.second.second);
+	}
+      }
+    };
+
+  private:
+    /** Number of ROCs needed for the given pixels
+     */
+    static size_t rocsOf(const std::vector<pixel> & data) {
+      size_t nRocs = 0;
+      for(std::vector<pixel>::const_iterator px = data.begin(); px != data.end(); ++px) {
+	nRocs = std::max(nRocs, static_cast<size_t>(px->roc_id) + 1);
+      }
+      return nRocs;
+    };
+
+    void store(size_t step1, size_t step2, const std::vector<pixel> & data) {
+      for(std::vector<pixel>::const_iterator px = data.begin(); px != data.end(); ++px) {
+	if(px->roc_id >= _nRocs || px->column >= pixelBits::columns || px->row >= pixelBits::rows) continue;
+	_data[index(px->roc_id, px->column, px->row, step1, step2)] = static_cast<T>(px->value);
+      }
+    };
+
+    void load(size_t step1, size_t step2, std::vector<pixel> & data) const {
+      pixel newpixel;
+      for(size_t roc = 0; roc < _nRocs; roc++) {
+	for(size_t column = 0; column < pixelBits::columns; column++) {
+	  for(size_t row = 0; row < pixelBits::rows; row++) {
+	    const T & value = _data[index(roc, column, row, step1, step2)];
+	    if(value == _empty) continue;
+	    newpixel.roc_id = static_cast<uint8_t>(roc);
+	    newpixel.column = static_cast<uint8_t>(column);
+	    newpixel.row = static_cast<uint8_t>(row);
+	    newpixel.value = static_cast<int32_t>(value);
+	    data.push_back(newpixel);
+	  }
+	}
+      }
+    };
+
+    size_t _nRocs;
+    uint8_t _dac1Min;
+    size_t _dac1Steps;
+    uint8_t _dac2Min;
+    size_t _dac2Steps;
+    T _empty;
+    std::vector<T> _data;
+  };
+
+  /** Tensors for numbers of readouts (efficiencies) and for pulse height sums
+   */
+  typedef scanTensor<uint16_t> countTensor;
+  typedef scanTensor<int32_t> sumTensor;
+
+} //namespace pxar
+
+#endif /* PXAR_TENSOR_H */
@@ -0,0 +1,153 @@
+/**
+ * pxar analog ROC readout decoding implementation
+ */
+
+#include "analog.h"
+#include "log.h"
+
+using namespace pxar;
+
+analogCalibrator::analogCalibrator() :
+  _nEvents(0), _ultraBlackSum(0), _blackSum(0), _addressHistogram(DAQ_ADC_VALUE_MASK + 1, 0) {}
+
+void analogCalibrator::add(const int16_t * samples, size_t size) {
+
+  if(size < ANALOG_HEADER_SIZE) return;
+
+  _nEvents++;
+  _ultraBlackSum += samples[0];
+  _blackSum += samples[1];
+
+  // Collect the five address samples of every hit, skip the pulse heights:
+  for(size_t pos = ANALOG_HEADER_SIZE; pos + ANALOG_HIT_SIZE <= size; pos += ANALOG_HIT_SIZE) {
+    for(size_t i = 0; i < ANALOG_HIT_SIZE - 1; i++) {
+      _addressHistogram[samples[pos + i] + DAQ_ADC_SIGN_BIT]++;
+    }
+  }
+}
+
+bool analogCalibrator::calibrate(analogLevels & levels) const {
+
+  levels.valid = false;
+  if(_nEvents == 0) {
+    LOG(logERROR) << "No events recorded for the analog level calibration.";
+    return false;
+  }
+
+  levels.ultraBlack = static_cast<int16_t>(_ultraBlackSum/static_cast<int64_t>(_nEvents));
+  levels.black = static_cast<int16_t>(_blackSum/static_cast<int64_t>(_nEvents));
+  levels.ubThreshold = static_cast<int16_t>((levels.ultraBlack + levels.black)/2);
+  if(levels.ultraBlack >= levels.black) {
+    LOG(logERROR) << "Ultrablack (" << levels.ultraBlack << ") not below black (" << levels.black << ") level.";
+    return false;
+  }
+
+  // Range of the recorded address samples:
+  size_t first = _addressHistogram.size(), last = 0;
+  uint64_t total = 0;
+  for(size_t bin = 0; bin < _addressHistogram.size(); bin++) {
+    if(_addressHistogram[bin] == 0) continue;
+    if(first > bin) first = bin;
+    last = bin;
+    total += _addressHistogram[bin];
+  }
+  if(total < ANALOG_NUM_LEVELS) {
+    LOG(logERROR) << "Not enough address samples recorded for the analog level calibration.";
+    return false;
+  }
+
+  // Start the level clustering equidistantly across the range:
+  double centers[ANALOG_NUM_LEVELS];
+  for(size_t i = 0; i < ANALOG_NUM_LEVELS; i++) {
+    centers[i] = first + (static_cast<double>(last) - first)*i/(ANALOG_NUM_LEVELS - 1);
+  }
+
+  // One dimensional k-means on the histogram: assign every bin to the nearest
+  // level and move the levels to the mean of their bins until nothing changes:
+  bool changed = true;
+  for(size_t iteration = 0; iteration < 100 && changed; iteration++) {
+    double sum[ANALOG_NUM_LEVELS] = {0};
+    double entries[ANALOG_NUM_LEVELS] = {0};
+
+    size_t nearest = 0;
+    for(size_t bin = 0; bin < _addressHistogram.size(); bin++) {
+      if(_addressHistogram[bin] == 0) continue;
+      // Levels are sorted, so the nearest level never moves backwards:
+      while(nearest + 1 < ANALOG_NUM_LEVELS && (bin - centers[nearest]) > (centers[nearest+1] - bin)) { nearest++; }
+      sum[nearest] += static_cast<double>(bin)*_addressHistogram[bin];
+      entries[nearest] += _addressHistogram[bin];
+    }
+
+    changed = false;
+    for(size_t i = 0; i < ANALOG_NUM_LEVELS; i++) {
+      if(entries[i] == 0) {
+	LOG(logERROR) << "Analog address level " << i << " not populated, cannot calibrate.";
+	return false;
+      }
+      double center = sum[i]/entries[i];
+      if(center != centers[i]) changed = true;
+      centers[i] = center;
+    }
+  }
+
+  // The boundaries are placed half-way between neighbouring levels:
+  for(size_t i = 0; i < ANALOG_NUM_LEVELS - 1; i++) {
+    levels.boundaries[i] = static_cast<int16_t>((centers[i] + centers[i+1])/2 - DAQ_ADC_SIGN_BIT);
+  }
+
+  // Address levels overlapping with the ultrablack would break the header detection:
+  if(levels.boundaries[0] < levels.ubThreshold) {
+    LOG(logERROR) << "Lowest address level overlaps with the ultrablack level.";
+    return false;
+  }
+
+  levels.valid = true;
+  LOG(logDEBUGHAL) << "Analog levels from " << _nEvents << " events: UB " << levels.ultraBlack
+		   << ", B " << levels.black << ", address boundaries "
+		   << levels.boundaries[0] << " " << levels.boundaries[1] << " " << levels.boundaries[2] << " "
+		   << levels.boundaries[3] << " " << levels.boundaries[4];
+  return true;
+}
+
+
+analogDecoder::analogDecoder(const analogLevels & levels) :
+  _levels(levels), _digits() {
+  _digits.reserve(DAQ_ADC_BLOCK_SIZE);
+}
+
+uint8_t analogDecoder::decode(const int16_t * samples, size_t size, uint8_t rocId, std::vector<pixel> & hits) {
+
+  // Every event has to start with the ultrablack of the ROC header:
+  if(size < ANALOG_HEADER_SIZE || samples[0] >= _levels.ubThreshold) return EVENT_NO_TBM_HEADER;
+
+  uint8_t flags = EVENT_OK;
+  if((size - ANALOG_HEADER_SIZE) % ANALOG_HIT_SIZE != 0) flags |= EVENT_BROKEN_HIT;
+
+  // Bin all samples into levels at once, the loop has no branches:
+  _digits.resize(size);
+  for(size_t i = 0; i < size; i++) { _digits[i] = _levels.level(samples[i]); }
+
+  for(size_t pos = ANALOG_HEADER_SIZE; pos + ANALOG_HIT_SIZE <= size; pos += ANALOG_HIT_SIZE) {
+    const uint8_t * d = &_digits[pos];
+
+    // Same address encoding as the digital readout: double column and pixel
+    // address as base 6 digits
+    int32_t c = d[0]*6 + d[1];
+    int32_t r = d[2]*36 + d[3]*6 + d[4];
+    int32_t row = 80 - r/2;
+    int32_t column = 2*c + (r&1);
+    if(column >= ROC_NUMCOLS || row < 0 || row >= ROC_NUMROWS) {
+      flags |= EVENT_BROKEN_HIT;
+      continue;
+    }
+
+    pixel hit;
+    hit.roc_id = rocId;
+    hit.column = static_cast<uint8_t>(column);
+    hit.row = static_cast<uint8_t>(row);
+    hit.value = samples[pos + ANALOG_HIT_SIZE - 1];
+    hits.push_back(hit);
+  }
+
+  return flags;
+}
@@ -0,0 +1,100 @@
+/**
+ * pxar analog ROC readout decoding
+ * this file contains the level tables, their calibration and the decoder
+ * for the ADC readout of analog ROCs (psi46v2, psi46xdb)
+ */
+
+#ifndef PXAR_ANALOG_H
+#define PXAR_ANALOG_H
+
+#include <vector>
+#include <stdint.h>
+#include "api.h"
+#include "constants.h"
+
+namespace pxar {
+
+  /** Convert a raw DTB ADC word into a signed sample value
+   */
+  inline int16_t expandAdcSample(uint16_t word) {
+    int16_t value = static_cast<int16_t>(word & DAQ_ADC_VALUE_MASK);
+    return (word & DAQ_ADC_SIGN_BIT) ? static_cast<int16_t>(value - (DAQ_ADC_VALUE_MASK + 1)) : value;
+  }
+
+  /** Calibrated ADC level table of an analog ROC
+   *  Holds the ultrablack and black levels of the ROC header and the
+   *  boundaries between the six address levels. Address levels are counted
+   *  from the lowest ADC value.
+   */
+  class analogLevels {
+  public:
+  analogLevels() : ultraBlack(0), black(0), ubThreshold(0), valid(false) {
+      for(size_t i = 0; i < ANALOG_NUM_LEVELS-1; i++) { boundaries[i] = 0; }
+    };
+
+    /** Return the address level (0-5) of the given sample. The comparisons
+     *  are summed up without branches, so loops over sample blocks vectorize.
+     */
+    inline uint8_t level(int16_t sample) const {
+      return static_cast<uint8_t>((sample > boundaries[0]) + (sample > boundaries[1]) + (sample > boundaries[2])
+				  + (sample > boundaries[3]) + (sample > boundaries[4]));
+    };
+
+    int16_t ultraBlack;
+    int16_t black;
+    /** Samples below this value are recognized as ultrablack
+     */
+    int16_t ubThreshold;
+    int16_t boundaries[ANALOG_NUM_LEVELS-1];
+    bool valid;
+  };
+
+  /** Learns the analog levels from the readout of a calibration run
+   *  The calibration events should contain hits from pixels spread over the
+   *  ROC, so all six address levels appear in the address samples.
+   */
+  class analogCalibrator {
+  public:
+    analogCalibrator();
+
+    /** Add the samples of one event (starting with the ROC header)
+     */
+    void add(const int16_t * samples, size_t size);
+
+    /** Determine the level table from all events added so far. Returns false
+     *  if the data does not allow to separate all levels.
+     */
+    bool calibrate(analogLevels & levels) const;
+
+    inline size_t events() const { return _nEvents; };
+
+  private:
+    size_t _nEvents;
+    int64_t _ultraBlackSum;
+    int64_t _blackSum;
+    /** Histogram of all address samples, one bin per ADC value
+     */
+    std::vector<uint32_t> _addressHistogram;
+  };
+
+  /** Decoder for the ADC readout of a single analog ROC
+   */
+  class analogDecoder {
+  public:
+    analogDecoder(const analogLevels & levels);
+
+    /** Decode the samples of one event into pixel hits, the hits are appended.
+     *  Returns the event status flags (EVENT_* from constants.h).
+     */
+    uint8_t decode(const int16_t * samples, size_t size, uint8_t rocId, std::vector<pixel> & hits);
+
+  private:
+    analogLevels _levels;
+    /** Scratch buffer for the address levels of all samples
+     */
+    std::vector<uint8_t> _digits;
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_ANALOG_H */
@@ -45,6 +45,10 @@ namespace pxar {
 #define ROC_NUMCOLS 52
 
 
+// --- Module Size ------------------------------------------------------------
+#define MOD_NUMROCS 16
+
+
 // --- ROC Types ---------------------------------------------------------------
 #define ROC_PSI46V2        0x01
 #define ROC_PSI46XDB       0x02
@@ -145,6 +149,120 @@ namespace pxar {
 #define PG_REST  0x1000
 #define PG_SYNC  0x2000
 
+
+// --- HAL scan engine --------------------------------------------------------
+// Timing estimates (in microseconds) used to choose between the firmware DAC
+// scans and the host-side pipelined scans, and between the execution
+// strategies of the test loops. Round trip and queued command are defaults
+// only, hal::MeasureLink replaces them by the values measured when connecting.
+// The others are fixed: the trigger cost is the pattern generator sequence
+// plus the 20us trigger spacing of the calibrate loops, the transfer cost
+// corresponds to the ~25MB/s sustained by the USB link of the DTB.
+#define SCAN_COST_TRIGGER      25   // one calibrate trigger including readout
+#define SCAN_COST_STEP         60   // host-side step: DAC setting, call overhead
+#define SCAN_COST_ROUNDTRIP   250   // one USB round trip
+#define SCAN_COST_COMMAND      10   // one queued command without reply
+#define SCAN_COST_KBYTE        40   // transfer of 1kB of results
+
+// Execution strategies of the test loops, chosen by the loop planner:
+#define LOOP_NONE               0
+#define LOOP_PIXEL              1   // one call per pixel
+#define LOOP_MULTIPIXEL         2   // groups of pixels pulsed in parallel
+#define LOOP_ROC                3   // full ROC maps
+#define LOOP_MODULE             4   // all ROCs of the module at once
+
+// Maximum number of outstanding split-phase requests, limited by the buffer
+// space for the replies on the testboard side:
+#define SCAN_DEPTH_PIXEL       32
+#define SCAN_DEPTH_PIXELSCAN    4
+#define SCAN_DEPTH_MAP          2
+
+// Longest wait (in milliseconds) of a scan for another thread which claimed
+// the testboard connection, e.g. the power monitor:
+#define SCAN_YIELD_TIMEOUT    100
+
+// The firmware threshold search of a single pixel starts this many DAC units
+// before the threshold found in the previous step:
+#define SCAN_THR_MARGIN         4
+
+
+// --- Testboard DAQ data format ----------------------------------------------
+// Module readout via the TBM: every 16bit word carries its identifier in the
+// upper three bits, the payload sits in the lower bits.
+#define DAQ_WORD_ID_MASK    0xe000
+#define DAQ_TBM_HEADER_1    0xa000
+#define DAQ_TBM_HEADER_2    0x8000
+#define DAQ_ROC_HEADER      0x4000
+#define DAQ_ROC_DATA_1      0x0000
+#define DAQ_ROC_DATA_2      0x2000
+#define DAQ_TBM_TRAILER_1   0xe000
+#define DAQ_TBM_TRAILER_2   0xc000
+#define DAQ_TBM_DATA_MASK   0x00ff
+#define DAQ_ROC_DATA_MASK   0x0fff
+
+// Single ROC readout via the DESER160: the ROC header is identified by its
+// payload, the hits follow as pairs of 12bit words.
+#define DAQ_ROC_HEADER_MASK 0x0ff8
+#define DAQ_ROC_HEADER_ID   0x07f8
+
+// ADC readout of analog ROCs: 12bit two's complement samples, the DTB flags
+// the first and the last sample recorded for every trigger:
+#define DAQ_ADC_EVENT_START 0x8000
+#define DAQ_ADC_EVENT_END   0x4000
+#define DAQ_ADC_VALUE_MASK  0x0fff
+#define DAQ_ADC_SIGN_BIT    0x0800
+#define DAQ_ADC_BLOCK_SIZE  100
+
+// Analog ROC readout: ROC header (ultrablack, black, last DAC) followed by
+// five address samples and the pulse height for every hit. The addresses
+// are encoded in six analog levels:
+#define ANALOG_HEADER_SIZE  3
+#define ANALOG_HIT_SIZE     6
+#define ANALOG_NUM_LEVELS   6
+
+// Number of triggers per pulsed pixel when calibrating the analog levels:
+#define ANALOG_CALIBRATION_TRIGGERS 16
+
+// Size of the DAQ buffer on the testboard (in samples) and the block size
+// used to read it:
+#define DAQ_BUFFER_SIZE     10000000
+#define DAQ_READ_SIZE       32768
+
+// Number of times a column of a module map is pulsed before the map is given
+// up, if its readout does not contain exactly one event per trigger:
+#define DAQ_COLUMN_ATTEMPTS 3
+
+// Maximum number of decoded events buffered on the host:
+#define DAQ_QUEUE_SIZE      4096
+
+// Maximum number of raw data chunks waiting for each decoder thread:
+#define DAQ_CHUNK_QUEUE_SIZE 64
+
+// Event status flags set by the event builder, events with any flag set
+// are considered corrupt:
+#define EVENT_OK               0x00
+#define EVENT_NO_TBM_HEADER    0x01
+#define EVENT_NO_TBM_TRAILER   0x02
+#define EVENT_ROC_COUNT        0x04
+#define EVENT_COUNTER_JUMP     0x08
+#define EVENT_BROKEN_HIT       0x10
+#define EVENT_CHANNEL_MISMATCH 0x20
+
+// S-curve fit status flags, curves with any flag but SCURVE_FALLING set
+// could not be fitted reliably:
+#define SCURVE_OK              0x00
+#define SCURVE_NO_HITS         0x01
+#define SCURVE_ALWAYS_ON       0x02
+#define SCURVE_STEP            0x04
+#define SCURVE_NOT_CONVERGED   0x08
+#define SCURVE_FALLING         0x10
+#define SCURVE_NOISY           0x20
+
+// Number of pixels fitted together in one batch and the iteration limit
+// of the S-curve fit:
+#define SCURVE_BATCH_SIZE      8
+#define SCURVE_MAX_ITERATIONS  30
+
 } //namespace pxar
 
 #endif /* PXAR_CONSTANTS_H */
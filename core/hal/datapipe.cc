@@ -0,0 +1,360 @@
+/**
+ * pxar DAQ data pipe implementation
+ */
+
+#include "datapipe.h"
+
+using namespace pxar;
+
+eventBuilder::eventBuilder(eventQueue & queue, bool tbm, uint8_t nRocs, uint8_t rocOffset) :
+  _queue(queue), _tbm(tbm), _nRocs(nRocs), _rocOffset(rocOffset),
+  _current(), _inEvent(false), _rocId(-1), _lastCounter(-1), _raw(0), _haveFirstWord(false),
+  _nWords(0), _nEvents(0), _nCorrupt(0), _analog(NULL), _samples() {}
+
+eventBuilder::~eventBuilder() {
+  delete _analog;
+}
+
+void eventBuilder::setAnalogLevels(const analogLevels & levels) {
+  delete _analog;
+  _analog = new analogDecoder(levels);
+  _tbm = false;
+  _samples.reserve(DAQ_ADC_BLOCK_SIZE);
+}
+
+void eventBuilder::process(const std::vector<uint16_t> & data) {
+  if(!data.empty()) process(&data[0], data.size());
+}
+
+void eventBuilder::process(const uint16_t * data, size_t size) {
+
+  _nWords += size;
+  if(_analog) {
+    processAnalog(data, size);
+    return;
+  }
+
+  for(const uint16_t * word = data; word != data + size; ++word) {
+
+    if(!_tbm) {
+      // Single ROC readout: every ROC header starts a new event,
+      // hits follow as pairs of words.
+      if(((*word) & DAQ_ROC_HEADER_MASK) == DAQ_ROC_HEADER_ID) {
+	if(_inEvent) finish();
+	begin(EVENT_OK);
+	_rocId = 0;
+	_current.nRocHeaders = 1;
+	continue;
+      }
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+
+      if(!_haveFirstWord) { _raw = ((*word) & DAQ_ROC_DATA_MASK) << 12; }
+      else {
+	_raw |= ((*word) & DAQ_ROC_DATA_MASK);
+	if(_rocId < 0) { _current.flags |= EVENT_BROKEN_HIT; }
+	else {
+	  pixel hit;
+	  hit.decodeRaw(_rocOffset,_raw);
+	  _current.pixels.push_back(hit);
+	}
+      }
+      _haveFirstWord = !_haveFirstWord;
+      continue;
+    }
+
+    // Module readout, every word carries its identifier:
+    switch((*word) & DAQ_WORD_ID_MASK) {
+    case DAQ_TBM_HEADER_1:
+      {
+	// A new header before the trailer closes the previous event:
+	if(_inEvent) {
+	  _current.flags |= EVENT_NO_TBM_TRAILER;
+	  finish();
+	}
+	begin(EVENT_OK);
+	_current.header = ((*word) & DAQ_TBM_DATA_MASK) << 8;
+
+	// The first header word holds the 8bit TBM event counter:
+	_current.counter = static_cast<uint8_t>((*word) & DAQ_TBM_DATA_MASK);
+	if(_lastCounter >= 0 && _current.counter != ((_lastCounter + 1) & 0xff)) {
+	  _current.flags |= EVENT_COUNTER_JUMP;
+	}
+	_lastCounter = _current.counter;
+      }
+      break;
+    case DAQ_TBM_HEADER_2:
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+      _current.header |= ((*word) & DAQ_TBM_DATA_MASK);
+      break;
+    case DAQ_ROC_HEADER:
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+      // A pending first hit word without its second word is lost:
+      if(_haveFirstWord) _current.flags |= EVENT_BROKEN_HIT;
+      _haveFirstWord = false;
+      _rocId++;
+      _current.nRocHeaders++;
+      break;
+    case DAQ_ROC_DATA_1:
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+      if(_haveFirstWord) _current.flags |= EVENT_BROKEN_HIT;
+      _raw = ((*word) & DAQ_ROC_DATA_MASK) << 12;
+      _haveFirstWord = true;
+      break;
+    case DAQ_ROC_DATA_2:
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+      // Second hit word without first word, or hit without ROC header:
+      if(!_haveFirstWord || _rocId < 0) {
+	_current.flags |= EVENT_BROKEN_HIT;
+      }
+      else {
+	_raw |= ((*word) & DAQ_ROC_DATA_MASK);
+	pixel hit;
+	hit.decodeRaw(static_cast<uint8_t>(_rocOffset + _rocId),_raw);
+	_current.pixels.push_back(hit);
+      }
+      _haveFirstWord = false;
+      break;
+    case DAQ_TBM_TRAILER_1:
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+      _current.trailer = ((*word) & DAQ_TBM_DATA_MASK) << 8;
+      break;
+    case DAQ_TBM_TRAILER_2:
+      if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+      _current.trailer |= ((*word) & DAQ_TBM_DATA_MASK);
+      finish();
+      break;
+    }
+  }
+}
+
+void eventBuilder::flush() {
+
+  if(!_inEvent) return;
+
+  // The event has not been completed:
+  if(_tbm || _analog) _current.flags |= EVENT_NO_TBM_TRAILER;
+  if(_analog) finishAnalog();
+  else finish();
+}
+
+void eventBuilder::reset() {
+  _current.clear();
+  _inEvent = false;
+  _rocId = -1;
+  _lastCounter = -1;
+  _raw = 0;
+  _haveFirstWord = false;
+  _samples.clear();
+  _nWords = 0;
+  _nEvents = 0;
+  _nCorrupt = 0;
+}
+
+void eventBuilder::begin(uint8_t flags) {
+  _current.clear();
+  _current.flags = flags;
+  _inEvent = true;
+  _rocId = -1;
+  _haveFirstWord = false;
+}
+
+void eventBuilder::finish() {
+
+  if(_haveFirstWord) _current.flags |= EVENT_BROKEN_HIT;
+  if(_tbm && _current.nRocHeaders != _nRocs) _current.flags |= EVENT_ROC_COUNT;
+
+  _nEvents++;
+  if(_current.corrupt()) _nCorrupt++;
+
+  // The event content is moved into the queue, _current is left empty:
+  _queue.push(_current);
+  _inEvent = false;
+  _haveFirstWord = false;
+}
+
+void eventBuilder::processAnalog(const uint16_t * data, size_t size) {
+
+  for(const uint16_t * word = data; word != data + size; ++word) {
+
+    if((*word) & DAQ_ADC_EVENT_START) {
+      // A new event before the end of the previous one:
+      if(_inEvent) {
+	_current.flags |= EVENT_NO_TBM_TRAILER;
+	finishAnalog();
+      }
+      begin(EVENT_OK);
+    }
+    else if(!_inEvent) begin(EVENT_NO_TBM_HEADER);
+
+    _samples.push_back(expandAdcSample(*word));
+    if((*word) & DAQ_ADC_EVENT_END) finishAnalog();
+  }
+}
+
+void eventBuilder::finishAnalog() {
+
+  uint8_t flags = _analog->decode(_samples.empty() ? NULL : &_samples[0], _samples.size(), _rocOffset, _current.pixels);
+  if(!(flags & EVENT_NO_TBM_HEADER)) _current.nRocHeaders = 1;
+  _current.flags |= flags;
+  _samples.clear();
+  finish();
+}
+
+
+channelSplitter::channelSplitter(chunkQueue & channel0, chunkQueue & channel1) :
+  _current(-1), _lastCounter(-1), _nFrames(0) {
+  _channels[0] = &channel0;
+  _channels[1] = &channel1;
+}
+
+void channelSplitter::process(const uint16_t * data, size_t size) {
+
+  // Data before the first TBM header goes to the first channel, its event
+  // builder flags it:
+  const uint16_t * begin = data;
+  int32_t ch = (_current < 0) ? 0 : _current;
+
+  for(const uint16_t * word = data; word != data + size; ++word) {
+    if(((*word) & DAQ_WORD_ID_MASK) != DAQ_TBM_HEADER_1) continue;
+
+    // New frame, the words so far belong to the previous one:
+    _buffers[ch].insert(_buffers[ch].end(), begin, word);
+    begin = word;
+
+    // The second core repeats the event counter of the first one:
+    int32_t counter = (*word) & DAQ_TBM_DATA_MASK;
+    _current = (_current == 0 && counter == _lastCounter) ? 1 : 0;
+    _lastCounter = counter;
+    ch = _current;
+    _nFrames++;
+  }
+  _buffers[ch].insert(_buffers[ch].end(), begin, data + size);
+
+  // Hand the collected data to the decoders, the buffers are left empty:
+  for(size_t i = 0; i < 2; i++) {
+    if(!_buffers[i].empty()) _channels[i]->push(_buffers[i]);
+  }
+}
+
+
+decoderPipeline::decoderPipeline(bool tbm, uint8_t nRocs, uint8_t nChannels, const analogLevels * levels) :
+  _nChannels(nChannels == 2 ? 2 : 1), _splitter(NULL), _ready(true), _finished(false), _nMismatched(0) {
+
+  uint8_t nRocsPerChannel = nRocs/_nChannels;
+  _channels[0] = _channels[1] = NULL;
+  for(uint8_t i = 0; i < _nChannels; i++) {
+    _channels[i] = new channel(tbm, nRocsPerChannel, i*nRocsPerChannel);
+    if(levels) _channels[i]->builder.setAnalogLevels(*levels);
+    _channels[i]->started = (pthread_create(&_channels[i]->thread, NULL, &decoderPipeline::work, _channels[i]) == 0);
+    if(!_channels[i]->started) _ready = false;
+  }
+
+  if(_nChannels == 2) _splitter = new channelSplitter(_channels[0]->chunks, _channels[1]->chunks);
+}
+
+decoderPipeline::~decoderPipeline() {
+  release();
+  finish();
+  delete _splitter;
+  for(uint8_t i = 0; i < _nChannels; i++) { delete _channels[i]; }
+}
+
+void decoderPipeline::process(const std::vector<uint16_t> & data) {
+  if(!data.empty()) process(&data[0], data.size());
+}
+
+void decoderPipeline::process(const uint16_t * data, size_t size) {
+
+  if(_splitter) { _splitter->process(data, size); }
+  else {
+    dataChunk chunk(data, data + size);
+    _channels[0]->chunks.push(chunk);
+  }
+}
+
+void decoderPipeline::release() {
+  for(uint8_t i = 0; i < _nChannels; i++) { _channels[i]->events.close(); }
+}
+
+void decoderPipeline::finish() {
+
+  if(_finished) return;
+  _finished = true;
+
+  // No more data, the workers decode what is left and terminate:
+  for(uint8_t i = 0; i < _nChannels; i++) { _channels[i]->chunks.close(); }
+  for(uint8_t i = 0; i < _nChannels; i++) {
+    if(_channels[i]->started) pthread_join(_channels[i]->thread, NULL);
+  }
+  for(uint8_t i = 0; i < _nChannels; i++) { _channels[i]->events.close(); }
+}
+
+void * decoderPipeline::work(void * ch) {
+
+  channel * self = static_cast<channel*>(ch);
+  dataChunk chunk;
+  while(self->chunks.pop(chunk)) { self->builder.process(chunk); }
+  self->builder.flush();
+  return NULL;
+}
+
+bool decoderPipeline::fetch(channel * ch) {
+  if(!ch->havePending) ch->havePending = ch->events.pop(ch->pending);
+  return ch->havePending;
+}
+
+bool decoderPipeline::pop(event & ev) {
+
+  if(_nChannels == 1) return _channels[0]->events.pop(ev);
+
+  channel * ch0 = _channels[0];
+  channel * ch1 = _channels[1];
+  bool have0 = fetch(ch0);
+  bool have1 = fetch(ch1);
+  if(!have0 && !have1) return false;
+
+  // Events of both cores with the same event number are merged:
+  if(have0 && have1 && ch0->pending.counter == ch1->pending.counter) {
+    ev.swap(ch0->pending);
+    ev.flags |= ch1->pending.flags;
+    ev.nRocHeaders += ch1->pending.nRocHeaders;
+    ev.pixels.insert(ev.pixels.end(), ch1->pending.pixels.begin(), ch1->pending.pixels.end());
+    ch0->havePending = ch1->havePending = false;
+    return true;
+  }
+
+  // Otherwise the channel lagging behind passes on its event alone. The
+  // distance is evaluated modulo 256 to handle the counter wrap-around:
+  channel * single = ch0;
+  if(!have0 || (have1 && static_cast<int8_t>(ch1->pending.counter - ch0->pending.counter) < 0)) single = ch1;
+
+  ev.swap(single->pending);
+  ev.flags |= EVENT_CHANNEL_MISMATCH;
+  single->havePending = false;
+  _nMismatched++;
+  return true;
+}
+
+uint64_t decoderPipeline::words() const {
+  uint64_t n = 0;
+  for(uint8_t i = 0; i < _nChannels; i++) { n += _channels[i]->builder.words(); }
+  return n;
+}
+
+uint64_t decoderPipeline::events() const {
+  uint64_t n = 0;
+  for(uint8_t i = 0; i < _nChannels; i++) { n += _channels[i]->builder.events(); }
+  return n;
+}
+
+uint64_t decoderPipeline::corrupt() const {
+  uint64_t n = 0;
+  for(uint8_t i = 0; i < _nChannels; i++) { n += _channels[i]->builder.corrupt(); }
+  return n;
+}
+
+uint64_t decoderPipeline::dropped() {
+  uint64_t n = 0;
+  for(uint8_t i = 0; i < _nChannels; i++) { n += _channels[i]->events.dropped(); }
+  return n;
+}
@@ -0,0 +1,388 @@
+/**
+ * pxar DAQ data pipe
+ * this file contains the event builder splitting the raw testboard DAQ
+ * stream into events and the queue handing them to the consumers
+ */
+
+#ifndef PXAR_DATAPIPE_H
+#define PXAR_DATAPIPE_H
+
+#include <vector>
+#include <deque>
+#include <stdint.h>
+#include <pthread.h>
+#include "api.h"
+#include "constants.h"
+#include "analog.h"
+
+namespace pxar {
+
+  /** Class for a single decoded DAQ event
+   *  Contains the TBM header and trailer payloads, the TBM event counter,
+   *  the number of ROC headers seen, the status flags (EVENT_* from
+   *  constants.h) and the decoded pixel hits.
+   */
+  class event {
+  public:
+  event() : header(0), trailer(0), counter(0), nRocHeaders(0), flags(EVENT_OK), pixels() {};
+
+    /** Returns true if any of the consistency checks failed for this event
+     */
+    inline bool corrupt() const { return flags != EVENT_OK; };
+
+    /** Reset the event, keeping the allocated pixel storage
+     */
+    inline void clear() {
+      header = 0; trailer = 0; counter = 0; nRocHeaders = 0; flags = EVENT_OK;
+      pixels.clear();
+    };
+
+    /** Exchange the content with another event without copying the pixels
+     */
+    inline void swap(event & other) {
+      std::swap(header, other.header);
+      std::swap(trailer, other.trailer);
+      std::swap(counter, other.counter);
+      std::swap(nRocHeaders, other.nRocHeaders);
+      std::swap(flags, other.flags);
+      pixels.swap(other.pixels);
+    };
+
+    uint16_t header;
+    uint16_t trailer;
+    uint8_t counter;
+    uint8_t nRocHeaders;
+    uint8_t flags;
+    std::vector<pixel> pixels;
+  };
+
+  /** Bounded, thread-safe FIFO queue
+   *  Producers block while the queue is full, consumers block while it is
+   *  empty. After closing the queue, producers no longer block (elements which
+   *  do not fit anymore are dropped) and consumers receive the remaining
+   *  elements before pop() returns false.
+   *  Elements are moved in and out with their swap() member function, so large
+   *  payloads such as pixel vectors are never copied.
+   */
+  template <typename T> class boundedQueue {
+  public:
+  boundedQueue(size_t capacity = DAQ_QUEUE_SIZE) : _elements(), _capacity(capacity), _closed(false), _dropped(0) {
+      if(_capacity == 0) _capacity = 1;
+      pthread_mutex_init(&_mutex, NULL);
+      pthread_cond_init(&_notEmpty, NULL);
+      pthread_cond_init(&_notFull, NULL);
+    };
+
+    ~boundedQueue() {
+      pthread_cond_destroy(&_notFull);
+      pthread_cond_destroy(&_notEmpty);
+      pthread_mutex_destroy(&_mutex);
+    };
+
+    /** Append an element, its content is moved into the queue. Returns false
+     *  if the element had to be dropped.
+     */
+    bool push(T & element) {
+      pthread_mutex_lock(&_mutex);
+      while(!_closed && _elements.size() >= _capacity) { pthread_cond_wait(&_notFull, &_mutex); }
+
+      // A closed queue does not block the producer anymore, surplus elements are dropped:
+      if(_elements.size() >= _capacity) {
+	_dropped++;
+	pthread_mutex_unlock(&_mutex);
+	return false;
+      }
+
+      _elements.push_back(T());
+      _elements.back().swap(element);
+      pthread_cond_signal(&_notEmpty);
+      pthread_mutex_unlock(&_mutex);
+      return true;
+    };
+
+    /** Take the oldest element, waiting for one to arrive. Returns false if the
+     *  queue is closed and empty.
+     */
+    bool pop(T & element) {
+      pthread_mutex_lock(&_mutex);
+      while(!_closed && _elements.empty()) { pthread_cond_wait(&_notEmpty, &_mutex); }
+      return take(element);
+    };
+
+    /** Take the oldest element without waiting, returns false if none is available
+     */
+    bool tryPop(T & element) {
+      pthread_mutex_lock(&_mutex);
+      return take(element);
+    };
+
+    /** Close the queue, waking up all waiting producers and consumers
+     */
+    void close() {
+      pthread_mutex_lock(&_mutex);
+      _closed = true;
+      pthread_cond_broadcast(&_notEmpty);
+      pthread_cond_broadcast(&_notFull);
+      pthread_mutex_unlock(&_mutex);
+    };
+
+    /** Remove all elements and reopen the queue
+     */
+    void reset() {
+      pthread_mutex_lock(&_mutex);
+      _elements.clear();
+      _closed = false;
+      _dropped = 0;
+      pthread_cond_broadcast(&_notFull);
+      pthread_mutex_unlock(&_mutex);
+    };
+
+    size_t size() {
+      pthread_mutex_lock(&_mutex);
+      size_t n = _elements.size();
+      pthread_mutex_unlock(&_mutex);
+      return n;
+    };
+
+    uint64_t dropped() {
+      pthread_mutex_lock(&_mutex);
+      uint64_t n = _dropped;
+      pthread_mutex_unlock(&_mutex);
+      return n;
+    };
+
+  private:
+    /** Move the front element out, called with the mutex locked
+     */
+    bool take(T & element) {
+      if(_elements.empty()) {
+	pthread_mutex_unlock(&_mutex);
+	return false;
+      }
+      element.swap(_elements.front());
+      _elements.pop_front();
+      pthread_cond_signal(&_notFull);
+      pthread_mutex_unlock(&_mutex);
+      return true;
+    };
+
+    std::deque<T> _elements;
+    size_t _capacity;
+    bool _closed;
+    uint64_t _dropped;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _notEmpty;
+    pthread_cond_t _notFull;
+
+    boundedQueue(const boundedQueue&);
+    boundedQueue& operator=(const boundedQueue&);
+  };
+
+  /** Queue of decoded events
+   */
+  typedef boundedQueue<event> eventQueue;
+
+  /** Chunk of raw DAQ data words and the queue passing them to the decoders
+   */
+  typedef std::vector<uint16_t> dataChunk;
+  typedef boundedQueue<dataChunk> chunkQueue;
+
+  /** Event builder for the raw testboard DAQ data stream
+   *  Splits the stream into events and checks their consistency:
+   *  - module readout: TBM header and trailer have to enclose every event,
+   *    the number of ROC headers has to match the number of ROCs and the
+   *    TBM event counter has to increase by one from event to event.
+   *  - single ROC readout: every ROC header starts a new event.
+   *  Corrupt events are flagged and passed on, the stream is never stopped.
+   *  The data may be handed over in arbitrary chunks, incomplete events are
+   *  kept until the next chunk arrives.
+   */
+  class eventBuilder {
+  public:
+    eventBuilder(eventQueue & queue, bool tbm = true, uint8_t nRocs = MOD_NUMROCS, uint8_t rocOffset = 0);
+    ~eventBuilder();
+
+    /** Switch the builder to the ADC readout of a single analog ROC, the
+     *  samples are decoded with the given level table
+     */
+    void setAnalogLevels(const analogLevels & levels);
+
+    /** Process the next chunk of raw DAQ data
+     */
+    void process(const std::vector<uint16_t> & data);
+    void process(const uint16_t * data, size_t size);
+
+    /** Hand out the pending (incomplete) event at the end of the stream
+     */
+    void flush();
+
+    /** Forget the pending event, the counter history and all statistics
+     */
+    void reset();
+
+    inline uint64_t words() const { return _nWords; };
+    inline uint64_t events() const { return _nEvents; };
+    inline uint64_t corrupt() const { return _nCorrupt; };
+
+  private:
+    /** Start a new event with the given status flags
+     */
+    void begin(uint8_t flags);
+
+    /** Check the finished event and pass it to the queue
+     */
+    void finish();
+
+    /** Process ADC samples of an analog ROC, the DTB flags the first and last
+     *  sample of every event
+     */
+    void processAnalog(const uint16_t * data, size_t size);
+
+    /** Decode the collected samples of the current analog event and finish it
+     */
+    void finishAnalog();
+
+    eventQueue & _queue;
+    bool _tbm;
+    uint8_t _nRocs;
+    uint8_t _rocOffset;
+
+    event _current;
+    bool _inEvent;
+    int32_t _rocId;
+    int32_t _lastCounter;
+    uint32_t _raw;
+    bool _haveFirstWord;
+
+    uint64_t _nWords;
+    uint64_t _nEvents;
+    uint64_t _nCorrupt;
+
+    /** Decoder and sample buffer for analog ROCs, NULL for digital readout
+     */
+    analogDecoder * _analog;
+    std::vector<int16_t> _samples;
+
+    eventBuilder(const eventBuilder&);
+    eventBuilder& operator=(const eventBuilder&);
+  };
+
+  /** Splitter for the module readout of the two TBM cores
+   *  Both TBM cores send their own frames (TBM header, the headers and hits of
+   *  their ROCs, TBM trailer) for every trigger. The frames arrive one after
+   *  the other in the DAQ stream and are routed to the two channel queues
+   *  without decoding their content. Both cores send the same event counter:
+   *  a frame repeating the counter of the previous (first core) frame belongs
+   *  to the second core, every other frame starts a new event on the first
+   *  core. A lost or extra frame thus only affects its own event, which the
+   *  merge stage flags as channel mismatch.
+   */
+  class channelSplitter {
+  public:
+    channelSplitter(chunkQueue & channel0, chunkQueue & channel1);
+
+    /** Route the next chunk of raw DAQ data to the channels
+     */
+    void process(const uint16_t * data, size_t size);
+
+    inline uint64_t frames() const { return _nFrames; };
+
+  private:
+    chunkQueue * _channels[2];
+    dataChunk _buffers[2];
+    int32_t _current;
+    int32_t _lastCounter;
+    uint64_t _nFrames;
+  };
+
+  /** Multi-threaded decoding pipeline for the DAQ stream
+   *  With two channels the frames of the two TBM cores are split up and
+   *  decoded by one worker thread per core, each with its own event builder.
+   *  The merge stage re-aligns the events of both channels by their TBM event
+   *  number. Events missing on one of the channels are passed on alone and
+   *  flagged with EVENT_CHANNEL_MISMATCH.
+   *  With a single channel one worker thread decodes the full stream. If a
+   *  level table is given, the stream is decoded as ADC readout of an analog
+   *  ROC.
+   */
+  class decoderPipeline {
+  public:
+    /** Create the pipeline and start the worker threads. nRocs is the total
+     *  number of ROCs, the ROCs are shared equally among the channels.
+     *  Check ready() before use, the pipeline is unusable if a worker thread
+     *  could not be started.
+     */
+    decoderPipeline(bool tbm, uint8_t nRocs, uint8_t nChannels = 1, const analogLevels * levels = NULL);
+
+    /** Finishes decoding and stops the worker threads
+     */
+    ~decoderPipeline();
+
+    /** Hand the next chunk of raw DAQ data to the decoders
+     */
+    void process(const std::vector<uint16_t> & data);
+    void process(const uint16_t * data, size_t size);
+
+    /** Stop blocking the workers on full event queues, surplus events are
+     *  dropped from now on. Buffered events can still be fetched.
+     */
+    void release();
+
+    /** End of the data stream: decode the pending data, hand out the last
+     *  events and wait for the worker threads to finish.
+     */
+    void finish();
+
+    /** Fetch the next merged event, waiting for one to arrive if none is
+     *  buffered. Returns false if the pipeline is finished and all events
+     *  have been read.
+     */
+    bool pop(event & ev);
+
+    inline bool ready() const { return _ready; };
+    inline uint8_t channels() const { return _nChannels; };
+    uint64_t words() const;
+    uint64_t events() const;
+    uint64_t corrupt() const;
+    uint64_t dropped();
+    inline uint64_t mismatched() const { return _nMismatched; };
+
+  private:
+    /** One decoding channel with its input, output, builder and worker thread
+     */
+    struct channel {
+    channel(bool tbm, uint8_t nRocs, uint8_t rocOffset) :
+      chunks(DAQ_CHUNK_QUEUE_SIZE), events(DAQ_QUEUE_SIZE), builder(events, tbm, nRocs, rocOffset),
+	started(false), pending(), havePending(false) {};
+      chunkQueue chunks;
+      eventQueue events;
+      eventBuilder builder;
+      pthread_t thread;
+      bool started;
+      event pending;
+      bool havePending;
+    };
+
+    /** Entry point and decoding loop of the worker threads
+     */
+    static void * work(void * ch);
+
+    /** Make sure the given channel has a pending event for the merge stage,
+     *  returns false if the channel is finished
+     */
+    bool fetch(channel * ch);
+
+    uint8_t _nChannels;
+    channel * _channels[2];
+    channelSplitter * _splitter;
+    bool _ready;
+    bool _finished;
+    uint64_t _nMismatched;
+
+    decoderPipeline(const decoderPipeline&);
+    decoderPipeline& operator=(const decoderPipeline&);
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_DATAPIPE_H */
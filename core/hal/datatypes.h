@@ -0,0 +1,661 @@
+/**
+ * pxar HAL data types
+ * this file contains the data containers used internally by the HAL
+ * to store and convert the testboard results, the parameter sets for
+ * the HAL test functions and the output sinks they write to
+ */
+
+#ifndef PXAR_DATATYPES_H
+#define PXAR_DATATYPES_H
+
+#include <vector>
+#include <map>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
+#include "api.h"
+#include "constants.h"
+
+namespace pxar {
+
+  /** Class for dense storage of full ROC calibration results
+   *  The number of readouts and the pulse height sum are stored as linear
+   *  arrays of ROC_NUMCOLS*ROC_NUMROWS entries, the pixel coordinates are
+   *  given implicitly by the position (column*ROC_NUMROWS + row).
+   *
+   *  The storage is allocated once and can directly be handed to the RPC
+   *  calls, which refill it without reallocation. Conversion to sparse
+   *  pixel vectors only happens on demand.
+   */
+  class rocMap {
+  public:
+  rocMap() : nReadouts(ROC_NUMCOLS*ROC_NUMROWS,0), PHsum(ROC_NUMCOLS*ROC_NUMROWS,0) {};
+
+    /** Reset all values to zero without releasing the storage
+     */
+    inline void clear() {
+      nReadouts.resize(ROC_NUMCOLS*ROC_NUMROWS);
+      PHsum.resize(ROC_NUMCOLS*ROC_NUMROWS);
+      std::fill(nReadouts.begin(), nReadouts.end(), 0);
+      std::fill(PHsum.begin(), PHsum.end(), 0);
+    };
+
+    /** Return the linear position of the given pixel
+     */
+    static inline size_t index(uint8_t column, uint8_t row) {
+      return column*ROC_NUMROWS + row;
+    };
+
+    /** Append all pixels of the map to the given pixel vector, the value is
+     *  either the number of readouts (efficiency) or the pulse height sum.
+     */
+    inline void toPixels(uint8_t rocId, bool efficiency, std::vector<pixel> &data) const {
+      size_t entries = efficiency ? nReadouts.size() : PHsum.size();
+      reserveFor(data, entries);
+
+      pixel newpixel;
+      newpixel.roc_id = rocId;
+      for(size_t i = 0; i < entries; i++) {
+	newpixel.column = i/ROC_NUMROWS;
+	newpixel.row = i%ROC_NUMROWS;
+	newpixel.value = efficiency ? static_cast<int32_t>(nReadouts[i]) : PHsum[i];
+	data.push_back(newpixel);
+      }
+    };
+
+    /** Append all pixels of the map to the given calibration vector, keeping
+     *  both the number of readouts and the pulse height sum.
+     */
+    inline void toCalibrations(uint8_t rocId, std::vector<pixelCalibration> &data) const {
+      size_t entries = std::min(nReadouts.size(), PHsum.size());
+      reserveFor(data, entries);
+
+      pixelCalibration newpixel;
+      newpixel.roc_id = rocId;
+      for(size_t i = 0; i < entries; i++) {
+	newpixel.column = i/ROC_NUMROWS;
+	newpixel.row = i%ROC_NUMROWS;
+	newpixel.nhits = nReadouts[i];
+	newpixel.phsum = PHsum[i];
+	data.push_back(newpixel);
+      }
+    };
+
+    /** Make room for the given number of additional entries. The storage
+     *  grows geometrically, so appending the maps of all ROCs of a module
+     *  to one data block does not copy the block once per ROC.
+     */
+    template <typename T> static inline void reserveFor(std::vector<T> &data, size_t entries) {
+      size_t needed = data.size() + entries;
+      if(needed > data.capacity()) data.reserve(std::max(needed, 2*data.capacity()));
+    }
+
+    std::vector<int16_t> nReadouts;
+    std::vector<int32_t> PHsum;
+  };
+
+  /** Parameter set for the calibrate map functions (pixel, ROC and module)
+   *  Every call returns exactly one data block.
+   */
+  class calibrateParameters {
+  public:
+  calibrateParameters(int32_t flags_ = 0, int32_t nTriggers_ = 16) :
+    flags(flags_), nTriggers(nTriggers_) {};
+    inline size_t blocks() const { return 1; };
+    /** Calibrate passes per data block, and whether they can be pipelined
+     */
+    inline size_t probes() const { return 1; };
+    inline bool pipelined() const { return true; };
+    int32_t flags;
+    int32_t nTriggers;
+  };
+
+  /** Parameter set for the DAC scan functions
+   *  The DAC range is [dacMin, dacMax) in steps of dacStep, one data block
+   *  per DAC value.
+   */
+  class dacScanParameters {
+  public:
+  dacScanParameters(uint8_t dacReg_ = 0, uint8_t dacMin_ = 0, uint8_t dacMax_ = 0, int32_t flags_ = 0, int32_t nTriggers_ = 16, uint8_t dacStep_ = 1) :
+    dacReg(dacReg_), dacMin(dacMin_), dacMax(dacMax_), dacStep(dacStep_ > 0 ? dacStep_ : 1), flags(flags_), nTriggers(nTriggers_) {};
+    inline size_t blocks() const { return (dacMax > dacMin) ? (dacMax - dacMin + dacStep - 1)/dacStep : 0; };
+    /** DAC value of the given block
+     */
+    inline uint8_t dac(size_t block) const { return static_cast<uint8_t>(dacMin + block*dacStep); };
+    inline size_t probes() const { return 1; };
+    inline bool pipelined() const { return true; };
+    uint8_t dacReg;
+    uint8_t dacMin;
+    uint8_t dacMax;
+    uint8_t dacStep;
+    int32_t flags;
+    int32_t nTriggers;
+  };
+
+  /** Parameter set for the DAC-DAC scan functions
+   *  Both DAC ranges are [dacMin, dacMax) in steps of dacStep, one data block
+   *  per DAC pair with the second DAC running fastest.
+   */
+  class dacDacScanParameters {
+  public:
+  dacDacScanParameters(uint8_t dac1Reg_ = 0, uint8_t dac1Min_ = 0, uint8_t dac1Max_ = 0,
+		       uint8_t dac2Reg_ = 0, uint8_t dac2Min_ = 0, uint8_t dac2Max_ = 0,
+		       int32_t flags_ = 0, int32_t nTriggers_ = 16,
+		       uint8_t dac1Step_ = 1, uint8_t dac2Step_ = 1) :
+    dac1Reg(dac1Reg_), dac1Min(dac1Min_), dac1Max(dac1Max_), dac1Step(dac1Step_ > 0 ? dac1Step_ : 1),
+      dac2Reg(dac2Reg_), dac2Min(dac2Min_), dac2Max(dac2Max_), dac2Step(dac2Step_ > 0 ? dac2Step_ : 1),
+      flags(flags_), nTriggers(nTriggers_) {};
+    inline size_t blocks() const { return dac1Steps()*dac2Steps(); };
+    inline size_t dac1Steps() const { return (dac1Max > dac1Min) ? (dac1Max - dac1Min + dac1Step - 1)/dac1Step : 0; };
+    inline size_t dac2Steps() const { return (dac2Max > dac2Min) ? (dac2Max - dac2Min + dac2Step - 1)/dac2Step : 0; };
+    inline uint8_t dac1(size_t step) const { return static_cast<uint8_t>(dac1Min + step*dac1Step); };
+    inline uint8_t dac2(size_t step) const { return static_cast<uint8_t>(dac2Min + step*dac2Step); };
+    inline size_t block(uint8_t dac1, uint8_t dac2) const { return ((dac1 - dac1Min)/dac1Step)*dac2Steps() + (dac2 - dac2Min)/dac2Step; };
+    inline size_t probes() const { return 1; };
+    inline bool pipelined() const { return true; };
+    uint8_t dac1Reg;
+    uint8_t dac1Min;
+    uint8_t dac1Max;
+    uint8_t dac1Step;
+    uint8_t dac2Reg;
+    uint8_t dac2Min;
+    uint8_t dac2Max;
+    uint8_t dac2Step;
+    int32_t flags;
+    int32_t nTriggers;
+  };
+
+  /** Parameter set for the threshold functions
+   *  The threshold is searched in the DAC thrReg (named thrName in the DUT
+   *  configuration) within [thrMin, thrMax], both bounds included: the
+   *  lowest (rising edge, FLAG_THRSCAN_RISING) or highest (falling edge) DAC
+   *  value at which a pixel responds to at least half of the triggers.
+   *  Optionally the thresholds are measured for every value of one or two
+   *  further DACs (scan), with one data block per DAC setting. Without
+   *  further DACs a single block is returned.
+   */
+  class thresholdParameters {
+  public:
+  thresholdParameters(uint8_t thrReg_ = ROC_DAC_Vcal, uint8_t thrMin_ = 0, uint8_t thrMax_ = 255, int32_t flags_ = 0, int32_t nTriggers_ = 16) :
+    thrName("vcal"), thrReg(thrReg_), thrMin(thrMin_), thrMax(thrMax_), flags(flags_), nTriggers(nTriggers_), nScanDacs(0), scan() {};
+
+    /** Measure the thresholds for every value of the given DAC
+     */
+    inline void scanDac(uint8_t dacReg, uint8_t dacMin, uint8_t dacMax) {
+      scan = dacDacScanParameters(dacReg, dacMin, dacMax, 0, 0, 1, flags, nTriggers);
+      nScanDacs = 1;
+    };
+
+    /** Measure the thresholds for every pair of values of the given DACs,
+     *  the second DAC running fastest
+     */
+    inline void scanDacDac(uint8_t dac1Reg, uint8_t dac1Min, uint8_t dac1Max, uint8_t dac2Reg, uint8_t dac2Min, uint8_t dac2Max) {
+      scan = dacDacScanParameters(dac1Reg, dac1Min, dac1Max, dac2Reg, dac2Min, dac2Max, flags, nTriggers);
+      nScanDacs = 2;
+    };
+
+    inline size_t blocks() const { return (nScanDacs == 0) ? 1 : (nScanDacs == 1) ? scan.dac1Steps() : scan.blocks(); };
+    inline uint8_t dac1(size_t block) const { return scan.dac1((nScanDacs == 2) ? block/scan.dac2Steps() : block); };
+    inline uint8_t dac2(size_t block) const { return scan.dac2(block%scan.dac2Steps()); };
+
+    /** Number of readouts from which a pixel counts as responding
+     */
+    inline int32_t level() const { return (nTriggers + 1)/2; };
+
+    /** Calibrate passes per data block: the probes of a bisection over the
+     *  full threshold range. Every probe needs the result of the previous
+     *  one, so the passes cannot be pipelined.
+     */
+    inline size_t probes() const {
+      size_t range = (thrMax >= thrMin) ? thrMax - thrMin + 1 : 1;
+      size_t n = 1;
+      while((static_cast<size_t>(1) << (n - 1)) < range) n++;
+      return n;
+    };
+    inline bool pipelined() const { return false; };
+    inline bool rising() const { return (flags & FLAG_THRSCAN_RISING); };
+
+    std::string thrName;
+    uint8_t thrReg;
+    uint8_t thrMin;
+    uint8_t thrMax;
+    int32_t flags;
+    int32_t nTriggers;
+    uint8_t nScanDacs;
+    dacDacScanParameters scan;
+  };
+
+  /** Single command of a DUT programming plan
+   *  The meaning of the address fields depends on the command type.
+   */
+  class programmingCommand {
+  public:
+    enum commandType {
+      TBM_REGISTER,  // device: TBM id, address: register, value: register value
+      ROC_DAC,       // device: ROC id, address: DAC register, value: DAC value
+      ROC_MASK,      // device: ROC id, mask all pixels of the ROC
+      PIXEL_TRIM,    // device: ROC id, column/row: pixel, value: trim bits (unmasks the pixel)
+      PIXEL_MASK     // device: ROC id, column/row: pixel
+    };
+
+  programmingCommand(commandType type_, uint8_t device_, uint8_t address_ = 0, uint8_t row_ = 0, uint8_t value_ = 0) :
+    type(type_), device(device_), address(address_), row(row_), value(value_) {};
+    commandType type;
+    uint8_t device;
+    uint8_t address;
+    uint8_t row;
+    uint8_t value;
+  };
+
+  /** Programming plan for a full DUT
+   *  Collects all TBM register, ROC DAC, mask and trim commands needed to
+   *  configure the DUT, so they can be sent to the testboard in one go.
+   */
+  class programmingPlan {
+  public:
+  programmingPlan() : commands(), nTbmCommands(0) {};
+
+    inline void addTbmRegister(uint8_t tbmId, uint8_t regId, uint8_t regValue) {
+      commands.push_back(programmingCommand(programmingCommand::TBM_REGISTER, tbmId, regId, 0, regValue));
+      nTbmCommands++;
+    };
+
+    inline void addRocDac(uint8_t rocId, uint8_t dacId, uint8_t dacValue) {
+      commands.push_back(programmingCommand(programmingCommand::ROC_DAC, rocId, dacId, 0, dacValue));
+    };
+
+    inline void addRocMask(uint8_t rocId) {
+      commands.push_back(programmingCommand(programmingCommand::ROC_MASK, rocId));
+    };
+
+    inline void addPixelTrim(uint8_t rocId, uint8_t column, uint8_t row, uint8_t trim) {
+      commands.push_back(programmingCommand(programmingCommand::PIXEL_TRIM, rocId, column, row, trim));
+    };
+
+    inline void addPixelMask(uint8_t rocId, uint8_t column, uint8_t row) {
+      commands.push_back(programmingCommand(programmingCommand::PIXEL_MASK, rocId, column, row));
+    };
+
+    inline bool hasTbmCommands() const { return nTbmCommands > 0; };
+    inline void clear() { commands.clear(); nTbmCommands = 0; };
+
+    /** Returns the final value of every TBM register set by the plan, as it
+     *  should read back after programming. Registers may be written more
+     *  than once, clear and inject are commands which read back empty.
+     */
+    inline std::map<uint8_t,uint8_t> tbmRegisters() const {
+      std::map<uint8_t,uint8_t> registers;
+      for(std::vector<programmingCommand>::const_iterator cmd = commands.begin(); cmd != commands.end(); ++cmd) {
+	if(cmd->type != programmingCommand::TBM_REGISTER) continue;
+	if((cmd->address & 0x0f) == TBM_REG_CLEAR_INJECT) continue;
+	registers[cmd->address] = cmd->value;
+      }
+      return registers;
+    };
+
+    std::vector<programmingCommand> commands;
+
+  private:
+    size_t nTbmCommands;
+  };
+
+  /** Execution order of the single pixel calls of several ROCs
+   *  The pixels of all ROCs are grouped by double column. Within a double
+   *  column the ROCs take turns pixel by pixel (round robin), so consecutive
+   *  requests go to different ROCs as long as more than one ROC has pixels
+   *  left in that double column.
+   *
+   *  The firmware enables and disables the column of a pixel on every
+   *  CalibratePixel call, so the order does not change the number of column
+   *  switches on the ROCs, only the sequence of ROCs in the request pipeline.
+   */
+  class pixelSchedule {
+  public:
+    class entry {
+    public:
+    entry(uint8_t roc_, uint8_t column_, uint8_t row_) : roc(roc_), column(column_), row(row_) {};
+      uint8_t roc;
+      uint8_t column;
+      uint8_t row;
+    };
+
+  pixelSchedule() : entries() {};
+
+    /** Append the pixels of a ROC
+     */
+    inline void add(uint8_t rocId, const pixelBits & pixels) {
+      entries.reserve(entries.size() + pixels.count());
+      for(pixelBits::iterator px = pixels.begin(); px != pixels.end(); ++px) {
+	entries.push_back(entry(rocId, px.column(), px.row()));
+      }
+    };
+
+    /** Order the pixels by double column and interleave the ROCs within
+     *  every double column
+     */
+    inline void build() {
+      std::sort(entries.begin(), entries.end(), earlier);
+
+      std::vector<entry> ordered;
+      ordered.reserve(entries.size());
+      std::vector<size_t> next, stop;
+      for(size_t begin = 0, end = 0; begin < entries.size(); begin = end) {
+	// Range of this double column and the first pixel of every ROC in it:
+	next.clear();
+	stop.clear();
+	for(end = begin; end < entries.size() && entries[end].column/2 == entries[begin].column/2; end++) {
+	  if(end > begin && entries[end].roc == entries[end-1].roc) continue;
+	  if(end > begin) stop.push_back(end);
+	  next.push_back(end);
+	}
+	stop.push_back(end);
+
+	// Take one pixel of every ROC with pixels left per turn:
+	for(size_t left = end - begin; left > 0; ) {
+	  for(size_t r = 0; r < next.size(); r++) {
+	    if(next[r] == stop[r]) continue;
+	    ordered.push_back(entries[next[r]++]);
+	    left--;
+	  }
+	}
+      }
+      entries.swap(ordered);
+    };
+
+    std::vector<entry> entries;
+
+  private:
+    static inline bool earlier(const entry & a, const entry & b) {
+      if(a.column/2 != b.column/2) return a.column/2 < b.column/2;
+      if(a.roc != b.roc) return a.roc < b.roc;
+      if(a.column != b.column) return a.column < b.column;
+      return a.row < b.row;
+    };
+  };
+
+  /** Compiled Pattern Generator program
+   *  Holds the PG commands (pattern and delay) in the order of their PG
+   *  memory addresses together with a content hash (FNV-1a over the
+   *  commands), so identical programs are recognized cheaply.
+   */
+  class pgProgram {
+  public:
+  pgProgram() : commands(), hash(2166136261u) {};
+  pgProgram(const std::vector<std::pair<uint16_t,uint8_t> > & pg_setup) : commands(), hash(2166136261u) {
+      commands.reserve(pg_setup.size());
+      for(std::vector<std::pair<uint16_t,uint8_t> >::const_iterator it = pg_setup.begin(); it != pg_setup.end(); ++it) {
+	uint16_t cmd = (*it).first | (*it).second;
+	commands.push_back(cmd);
+	hash = (hash ^ (cmd & 0xff))*16777619u;
+	hash = (hash ^ (cmd >> 8))*16777619u;
+      }
+    };
+
+    inline bool operator==(const pgProgram & other) const {
+      return hash == other.hash && commands == other.commands;
+    };
+    inline bool empty() const { return commands.empty(); };
+
+    /** Returns the PG memory addresses whose content differs from this
+     *  program and which have to be written to load it
+     */
+    inline std::vector<size_t> diff(const std::vector<uint16_t> & memory) const {
+      std::vector<size_t> addresses;
+      for(size_t addr = 0; addr < commands.size(); addr++) {
+	if(addr < memory.size() && memory[addr] == commands[addr]) continue;
+	addresses.push_back(addr);
+      }
+      return addresses;
+    };
+
+    std::vector<uint16_t> commands;
+    uint32_t hash;
+  };
+
+  /** Interface for the output of the HAL test functions
+   *  The test functions push their results block by block (e.g. one block per
+   *  DAC value) into the sink instead of returning newly allocated vectors.
+   *  Data from consecutive calls for different ROCs or pixels is merged into
+   *  the same blocks in calling order.
+   *
+   *  Calibration functions always deliver both the number of readouts and the
+   *  pulse height sum, the sink decides which information to keep.
+   */
+  class pixelSink {
+  public:
+    virtual ~pixelSink() {};
+
+    /** Prepare the sink to receive the given number of data blocks
+     */
+    virtual void prepare(size_t nBlocks) = 0;
+
+    /** Add a single pixel with one measured value to the given data block
+     */
+    virtual void push(size_t block, const pixel & px) = 0;
+
+    /** Add the calibration result of a single pixel to the given data block
+     */
+    virtual void push(size_t block, const pixelCalibration & px) = 0;
+
+    /** Add a full ROC map to the given data block
+     */
+    virtual void push(size_t block, uint8_t rocId, const rocMap & map) {
+      std::vector<pixelCalibration> data;
+      map.toCalibrations(rocId, data);
+      for(std::vector<pixelCalibration>::iterator it = data.begin(); it != data.end(); ++it) { push(block,*it); }
+    };
+  };
+
+  /** Access to the data vector of one block in the different result formats:
+   *  plain vectors (maps), pairs with a DAC value (DAC scans) and pairs of
+   *  two DAC values (DAC-DAC scans)
+   */
+  template <typename T> inline std::vector<T> & blockData(std::vector<T> & block) { return block; }
+  template <typename T> inline std::vector<T> & blockData(std::pair<uint8_t, std::vector<T> > & block) { return block.second; }
+  template <typename T> inline std::vector<T> & blockData(std::pair<uint8_t, std::pair<uint8_t, std::vector<T> > > & block) { return block.second.second; }
+
+  /** Output sink writing directly into caller-provided storage, one element
+   *  of the result vector per block (see blockData for the formats)
+   *  Of the calibration results either the number of readouts (efficiency) or
+   *  the pulse height sum is stored as pixel value.
+   *
+   *  Existing block vectors are cleared but keep their capacity, so a caller
+   *  repeating a test reuses its storage. Otherwise every block receiving
+   *  data is allocated once for the expected number of pixels.
+   */
+  template <typename B = std::vector<pixel> > class blockSink : public pixelSink {
+  public:
+  blockSink(std::vector<B> & data, bool efficiency = false, size_t expected = 0) : _data(data), _efficiency(efficiency), _expected(expected) {};
+
+    void prepare(size_t nBlocks) {
+      _data.resize(nBlocks);
+      for(typename std::vector<B>::iterator it = _data.begin(); it != _data.end(); ++it) { blockData(*it).clear(); }
+    };
+
+    void push(size_t block, const pixel & px) {
+      target(block).push_back(px);
+    };
+
+    void push(size_t block, const pixelCalibration & px) {
+      pixel newpixel;
+      newpixel.roc_id = px.roc_id;
+      newpixel.column = px.column;
+      newpixel.row = px.row;
+      newpixel.value = _efficiency ? static_cast<int32_t>(px.nhits) : px.phsum;
+      target(block).push_back(newpixel);
+    };
+
+    void push(size_t block, uint8_t rocId, const rocMap & map) {
+      map.toPixels(rocId, _efficiency, target(block));
+    };
+
+  private:
+    inline std::vector<pixel> & target(size_t block) {
+      std::vector<pixel> & data = blockData(_data.at(block));
+      if(data.capacity() < _expected) data.reserve(_expected);
+      return data;
+    };
+
+    std::vector<B> & _data;
+    bool _efficiency;
+    size_t _expected;
+  };
+
+  /** DAC values of the given data block of a DAC scan (second value 0) and
+   *  of a DAC-DAC scan
+   */
+  inline std::pair<uint8_t, uint8_t> blockDacs(const dacScanParameters & parameter, size_t block) {
+    return std::make_pair(parameter.dac(block), static_cast<uint8_t>(0));
+  }
+  inline std::pair<uint8_t, uint8_t> blockDacs(const dacDacScanParameters & parameter, size_t block) {
+    return std::make_pair(parameter.dac1(block/parameter.dac2Steps()), parameter.dac2(block%parameter.dac2Steps()));
+  }
+
+  /** Output sink handing the data of a scan to a consumer while it is taken
+   *  Pixels of one ROC pushed consecutively to the same data block are collected into
+   *  one chunk, a full ROC map is a chunk of its own. Each chunk is handed
+   *  to the consumer with the DAC values of its block as soon as the next
+   *  block starts, so only one chunk (at most one ROC) is held in memory.
+   *  The data of one block can arrive in several chunks, e.g. one per ROC,
+   *  or one per pixel for single pixel tests.
+   */
+  template <typename P> class streamSink : public pixelSink {
+  public:
+  streamSink(scanConsumer & consumer, const P & parameter, bool efficiency = false) :
+    _consumer(consumer), _parameter(parameter), _efficiency(efficiency), _block(0), _chunk() {};
+
+    void prepare(size_t) {
+      _chunk.clear();
+      _block = 0;
+    };
+
+    void push(size_t block, const pixel & px) {
+      if(!_chunk.empty() && (block != _block || px.roc_id != _chunk.back().roc_id)) flush();
+      _block = block;
+      _chunk.push_back(px);
+    };
+
+    void push(size_t block, const pixelCalibration & px) {
+      pixel newpixel;
+      newpixel.roc_id = px.roc_id;
+      newpixel.column = px.column;
+      newpixel.row = px.row;
+      newpixel.value = _efficiency ? static_cast<int32_t>(px.nhits) : px.phsum;
+      push(block, newpixel);
+    };
+
+    void push(size_t block, uint8_t rocId, const rocMap & map) {
+      flush();
+      _block = block;
+      map.toPixels(rocId, _efficiency, _chunk);
+      flush();
+    };
+
+    /** Hand the collected chunk to the consumer, to be called after the
+     *  last push of the test
+     */
+    void flush() {
+      if(_chunk.empty()) return;
+      std::pair<uint8_t, uint8_t> dacs = blockDacs(_parameter, _block);
+      _consumer.consume(dacs.first, dacs.second, _chunk);
+      _chunk.clear();
+    };
+
+  private:
+    scanConsumer & _consumer;
+    const P & _parameter;
+    bool _efficiency;
+    size_t _block;
+    std::vector<pixel> _chunk;
+  };
+
+  /** Output sink writing directly into caller-provided storage, as blockSink
+   *  but keeping both the number of readouts and the pulse height sum.
+   *  Single-valued pixels are stored as one readout with the pixel value as
+   *  pulse height.
+   */
+  template <typename B = std::vector<pixelCalibration> > class calibrationSink : public pixelSink {
+  public:
+  calibrationSink(std::vector<B> & data, size_t expected = 0) : _data(data), _expected(expected) {};
+
+    void prepare(size_t nBlocks) {
+      _data.resize(nBlocks);
+      for(typename std::vector<B>::iterator it = _data.begin(); it != _data.end(); ++it) { blockData(*it).clear(); }
+    };
+
+    void push(size_t block, const pixel & px) {
+      pixelCalibration newpixel;
+      newpixel.roc_id = px.roc_id;
+      newpixel.column = px.column;
+      newpixel.row = px.row;
+      newpixel.nhits = 1;
+      newpixel.phsum = px.value;
+      target(block).push_back(newpixel);
+    };
+
+    void push(size_t block, const pixelCalibration & px) {
+      target(block).push_back(px);
+    };
+
+    void push(size_t block, uint8_t rocId, const rocMap & map) {
+      map.toCalibrations(rocId, target(block));
+    };
+
+  private:
+    inline std::vector<pixelCalibration> & target(size_t block) {
+      std::vector<pixelCalibration> & data = blockData(_data.at(block));
+      if(data.capacity() < _expected) data.reserve(_expected);
+      return data;
+    };
+
+    std::vector<B> & _data;
+    size_t _expected;
+  };
+
+  /** Sink passing on only the pixels enabled for the test to another sink
+   *  Allows running the ROC and module functions, which measure every pixel,
+   *  on partially enabled ROCs. ROCs without enabled pixels set are passed
+   *  on completely.
+   */
+  class filterSink : public pixelSink {
+  public:
+  filterSink(pixelSink & target) : _target(target), _enabled() {};
+
+    /** Restrict the given ROC to the given pixels
+     */
+    void select(uint8_t rocId, const pixelBits & pixels) { _enabled[rocId] = pixels; };
+
+    void prepare(size_t nBlocks) { _target.prepare(nBlocks); };
+
+    void push(size_t block, const pixel & px) {
+      if(passes(px.roc_id, px.column, px.row)) _target.push(block, px);
+    };
+
+    void push(size_t block, const pixelCalibration & px) {
+      if(passes(px.roc_id, px.column, px.row)) _target.push(block, px);
+    };
+
+    void push(size_t block, uint8_t rocId, const rocMap & map) {
+      if(_enabled.find(rocId) == _enabled.end()) {
+	_target.push(block, rocId, map);
+	return;
+      }
+      std::vector<pixelCalibration> data;
+      map.toCalibrations(rocId, data);
+      for(std::vector<pixelCalibration>::iterator it = data.begin(); it != data.end(); ++it) { push(block, *it); }
+    };
+
+  private:
+    inline bool passes(uint8_t rocId, uint8_t column, uint8_t row) const {
+      std::map<uint8_t, pixelBits>::const_iterator roc = _enabled.find(rocId);
+      if(roc == _enabled.end()) return true;
+      return pixelBits::valid(column, row) && roc->second.test(pixelBits::index(column, row));
+    };
+
+    pixelSink & _target;
+    std::map<uint8_t, pixelBits> _enabled;
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_DATATYPES_H */
@@ -2,14 +2,30 @@
 #include "log.h"
 #include "rpc_impl.h"
 #include "constants.h"
+#include "control.h"
 #include <fstream>
+#include <algorithm>
+#include <deque>
+#include <cstdlib>
+#include <sys/time.h>
+#include <errno.h>
 
 using namespace pxar;
 
-hal::hal(std::string name) {
+hal::hal(std::string name) :
+  _linkRoundtrip(SCAN_COST_ROUNDTRIP), _linkCommand(SCAN_COST_COMMAND), _control(NULL), _claims(0), _pipelined(false), _daqPipeline(NULL), _daqRunning(false) {
 
   // Reset the state of the HAL instance:
   _initialized = false;
+  _powered = false;
+  _deser160phase = 4;
+  pthread_mutex_init(&_daqMutex, NULL);
+  pthread_mutex_init(&_claimMutex, NULL);
+  pthread_cond_init(&_claimReleased, NULL);
+
+  // Preallocate the storage for map results and trim vectors:
+  _modulemaps.resize(MOD_NUMROCS);
+  _trimbuffer.reserve(ROC_NUMCOLS*ROC_NUMROWS);
 
   // Get a new CTestboard class instance:
   _testboard = new CTestboard();
@@ -27,6 +43,9 @@ hal::hal(std::string name) {
       // Check if all RPC calls are matched:
       CheckCompatibility();
 
+      // Calibrate the cost estimates to this connection:
+      MeasureLink();
+
       // ...and do the obligatory welcome LED blink:
       _testboard->Welcome();
       _testboard->Flush();
@@ -53,7 +72,14 @@ hal::hal(std::string name) {
 
 hal::~hal() {
   // Shut down and close the testboard connection on destruction of HAL object:
-  
+
+  // Stop a running data acquisition:
+  daqStop();
+  delete _daqPipeline;
+  pthread_mutex_destroy(&_daqMutex);
+  pthread_cond_destroy(&_claimReleased);
+  pthread_mutex_destroy(&_claimMutex);
+
   // Turn High Voltage off:
   _testboard->HVoff();
 
@@ -92,6 +118,8 @@ void hal::initTestboard(std::map<uint8_t,uint8_t> sig_delays, std::vector<std::p
     if(sigIt->first == SIG_DESER160PHASE) {
       LOG(logDEBUGHAL) << "Set DTB deser160 phase to value " << (int)sigIt->second;
       _testboard->Daq_Select_Deser160(sigIt->second);
+      // Store the phase for later DAQ setups:
+      _deser160phase = sigIt->second;
     }
     else {
       LOG(logDEBUGHAL) << "Set DTB delay " << (int)sigIt->first << " to value " << (int)sigIt->second;
@@ -104,28 +132,61 @@ void hal::initTestboard(std::map<uint8_t,uint8_t> sig_delays, std::vector<std::p
   LOG(logDEBUGHAL) << "Testboard delays set.";
 
 
-  // Set up Pattern Generator:
-  SetupPatternGenerator(pg_setup);
+  // Set up Pattern Generator, the test program is kept for later use:
+  DefinePatternGenerator("test", pg_setup);
+  SelectPatternGenerator("test");
 
   // We are ready for operations now, mark the HAL as initialized:
   _initialized = true;
 }
 
 void hal::SetupPatternGenerator(std::vector<std::pair<uint16_t,uint8_t> > pg_setup) {
+  UploadPatternGenerator(pgProgram(pg_setup));
+}
+
+void hal::DefinePatternGenerator(std::string name, std::vector<std::pair<uint16_t,uint8_t> > pg_setup) {
+  LOG(logDEBUGHAL) << "Defining PG program \"" << name << "\" with " << pg_setup.size() << " commands";
+  _pgPrograms[name] = pgProgram(pg_setup);
+}
+
+bool hal::SelectPatternGenerator(std::string name) {
+
+  std::map<std::string, pgProgram>::const_iterator program = _pgPrograms.find(name);
+  if(program == _pgPrograms.end()) {
+    LOG(logERROR) << "PG program \"" << name << "\" is not defined.";
+    return false;
+  }
+
+  LOG(logDEBUGHAL) << "Selecting PG program \"" << name << "\"";
+  UploadPatternGenerator(program->second);
+  return true;
+}
 
-  // Write the (sorted!) PG patterns into adjacent register addresses:
-  uint8_t addr = 0;
-  for(std::vector<std::pair<uint16_t,uint8_t> >::iterator it = pg_setup.begin(); it != pg_setup.end(); ++it) {
-    uint16_t cmd = (*it).first | (*it).second;
+void hal::UploadPatternGenerator(const pgProgram & program) {
+
+  // The program is already loaded, nothing to do:
+  if(program == _pgLoaded) {
+    LOG(logDEBUGHAL) << "PG program (hash " << std::hex << program.hash << std::dec << ") already loaded.";
+    return;
+  }
+
+  // Write the (sorted!) PG patterns into adjacent register addresses, but
+  // only where the PG memory content differs:
+  std::vector<size_t> addresses = program.diff(_pgMemory);
+  for(std::vector<size_t>::iterator addr = addresses.begin(); addr != addresses.end(); ++addr) {
+    uint16_t cmd = program.commands[*addr];
     LOG(logDEBUGHAL) << "Setting PG cmd " << std::hex << cmd << std::dec 
-		     << " (addr " << (int)addr << " pat " << std::hex << (int)(*it).first << std::dec
-		     << " del " << (int)(*it).second << ")";
-    _testboard->Pg_SetCmd(addr, cmd);
-    addr++;
+		     << " (addr " << *addr << " pat " << std::hex << (cmd & 0xff00) << std::dec
+		     << " del " << (cmd & 0x00ff) << ")";
+    _testboard->Pg_SetCmd(static_cast<uint16_t>(*addr), cmd);
   }
+  LOG(logDEBUGHAL) << "Wrote " << addresses.size() << " of " << program.commands.size() << " PG commands.";
 
   // Since the last delay is known to be zero we don't have to overwrite the rest of the address range - 
   // the Pattern generator will stop automatically at that point.
+  if(_pgMemory.size() < program.commands.size()) { _pgMemory.resize(program.commands.size()); }
+  std::copy(program.commands.begin(), program.commands.end(), _pgMemory.begin());
+  _pgLoaded = program;
 }
 
 bool hal::flashTestboard(std::ifstream& flashFile) {
@@ -197,42 +258,96 @@ bool hal::flashTestboard(std::ifstream& flashFile) {
   return false;
 }
 
-void hal::initTBM(uint8_t tbmId, std::map< uint8_t,uint8_t > regVector) {
+bool hal::programDUT(const programmingPlan & plan) {
+
+  LOG(logDEBUGHAL) << "Programming DUT with plan of " << plan.commands.size() << " commands.";
 
   // Turn on the output power of the testboard if not already done:
-  LOG(logDEBUGHAL) << "Turn testboard ouput power on.";
-  _testboard->Pon();
-  mDelay(400);
+  if(!_powered) Pon();
 
-  // Turn the TBM on:
-  _testboard->tbm_Enable(true);
-  // FIXME BEat: 31 is default hub address for the new modules:
-  _testboard->mod_Addr(31);
-  _testboard->Flush();
+  // Turn the TBM on if there is one to program:
+  if(plan.hasTbmCommands()) {
+    _testboard->tbm_Enable(true);
+    // FIXME BEat: 31 is default hub address for the new modules:
+    _testboard->mod_Addr(31);
+  }
 
-  // Programm all registers according to the configuration data:
-  LOG(logDEBUGHAL) << "Setting register vector for TBM " << (int)tbmId << ".";
-  tbmSetRegs(tbmId,regVector);
-  mDelay(300);
-  
-}
+  try {
+    // Emit all commands without flushing, the I2C address is only updated
+    // when the target ROC changes:
+    size_t nCommands[programmingCommand::PIXEL_MASK+1] = {0, 0, 0, 0, 0};
+    int32_t currentRoc = -1;
+    _rocIds.clear();
+    for(std::vector<programmingCommand>::const_iterator cmd = plan.commands.begin(); cmd != plan.commands.end(); ++cmd) {
+
+      if(cmd->type != programmingCommand::TBM_REGISTER && cmd->device != currentRoc) {
+	_testboard->roc_I2cAddr(cmd->device);
+	currentRoc = cmd->device;
+	// Remember the programmed ROCs, the module readout follows their order:
+	if(std::find(_rocIds.begin(), _rocIds.end(), cmd->device) == _rocIds.end()) _rocIds.push_back(cmd->device);
+      }
 
-void hal::initROC(uint8_t rocId, std::map< uint8_t,uint8_t > dacVector) {
+      switch(cmd->type) {
+      case programmingCommand::TBM_REGISTER:
+	_testboard->tbm_Set(cmd->address,cmd->value);
+	break;
+      case programmingCommand::ROC_DAC:
+	_testboard->roc_SetDAC(cmd->address,cmd->value);
+	break;
+      case programmingCommand::ROC_MASK:
+	_testboard->roc_Chip_Mask();
+	break;
+      case programmingCommand::PIXEL_TRIM:
+	_testboard->roc_Pix_Trim(cmd->address,cmd->row,cmd->value);
+	StoreTrim(cmd->device,cmd->address,cmd->row,cmd->value);
+	break;
+      case programmingCommand::PIXEL_MASK:
+	_testboard->roc_Pix_Mask(cmd->address,cmd->row);
+	break;
+      }
+      nCommands[cmd->type]++;
+    }
 
-  // Turn on the output power of the testboard if not already done:
-  LOG(logDEBUGHAL) << "Turn testboard ouput power on.";
-  _testboard->Pon();
-  mDelay(400);
+    // Send everything with one flush, the status reply returns once the
+    // testboard has executed all queued commands:
+    _testboard->GetStatus();
+    LOG(logDEBUGHAL) << "DUT programming sent: " << nCommands[programmingCommand::TBM_REGISTER] << " TBM registers, "
+		     << nCommands[programmingCommand::ROC_DAC] << " DACs, " << nCommands[programmingCommand::ROC_MASK] << " ROC masks, "
+		     << nCommands[programmingCommand::PIXEL_TRIM] << " pixel trims and " << nCommands[programmingCommand::PIXEL_MASK]
+		     << " pixel masks for " << _rocIds.size() << " ROCs.";
+
+    // The ROC registers are write-only, only the TBM registers can be read
+    // back and compared to the plan:
+    if(!VerifyTbmRegisters(plan)) return false;
+  }
+  catch(CRpcError &e) {
+    e.What();
+    LOG(logERROR) << "Transfer of the DUT programming plan failed.";
+    return false;
+  }
+  return true;
+}
 
-  // Set the I2C address of the ROC we are configuring right now:
-  _testboard->roc_I2cAddr(rocId);
-  mDelay(300);
+bool hal::VerifyTbmRegisters(const programmingPlan & plan) {
+
+  std::map<uint8_t,uint8_t> registers = plan.tbmRegisters();
 
-  // Programm all DAC registers according to the configuration data:
-  LOG(logDEBUGHAL) << "Setting DAC vector for ROC " << (int)rocId << ".";
-  rocSetDACs(rocId,dacVector);
-  mDelay(300);
+  size_t nFailed = 0;
+  for(std::map<uint8_t,uint8_t>::iterator reg = registers.begin(); reg != registers.end(); ++reg) {
+    uint8_t value = 0;
+    if(!_testboard->tbm_Get(reg->first,value)) {
+      LOG(logERROR) << "Could not read back TBM register 0x" << std::hex << (int)reg->first << std::dec << ".";
+      nFailed++;
+    }
+    else if(value != reg->second) {
+      LOG(logERROR) << "TBM register 0x" << std::hex << (int)reg->first << " reads back 0x" << (int)value
+		    << " instead of 0x" << (int)reg->second << std::dec << ".";
+      nFailed++;
+    }
+  }
 
+  LOG(logDEBUGHAL) << "Verified " << registers.size() - nFailed << " of " << registers.size() << " TBM registers.";
+  return (nFailed == 0);
 }
 
 void hal::PrintInfo() {
@@ -401,20 +516,6 @@ void hal::setTBvd(double VD) {
 }
 
 
-bool hal::rocSetDACs(uint8_t rocId, std::map< uint8_t, uint8_t > dacPairs) {
-
-  // Iterate over all DAC id/value pairs and set the DAC
-  for(std::map< uint8_t,uint8_t >::iterator it = dacPairs.begin(); it != dacPairs.end(); ++it) {
-    // One of the DAC settings had an issue, abort:
-    if(!rocSetDAC(rocId, it->first, it->second)) return false;
-  }
-
-  // Send all queued commands to the testboard:
-  _testboard->Flush();
-  // Everything went all right:
-  return true;
-}
-
 bool hal::rocSetDAC(uint8_t rocId, uint8_t dacId, uint8_t dacValue) {
 
   // Make sure we are writing to the correct ROC by setting the I2C address:
@@ -425,20 +526,6 @@ bool hal::rocSetDAC(uint8_t rocId, uint8_t dacId, uint8_t dacValue) {
   return true;
 }
 
-bool hal::tbmSetRegs(uint8_t tbmId, std::map< uint8_t, uint8_t > regPairs) {
-
-  // Iterate over all register id/value pairs and set them
-  for(std::map< uint8_t,uint8_t >::iterator it = regPairs.begin(); it != regPairs.end(); ++it) {
-    // One of the register settings had an issue, abort:
-    if(!tbmSetReg(tbmId, it->first, it->second)) return false;
-  }
-
-  // Send all queued commands to the testboard:
-  _testboard->Flush();
-  // Everything went all right:
-  return true;
-}
-
 bool hal::tbmSetReg(uint8_t tbmId, uint8_t regId, uint8_t regValue) {
 
   // Make sure we are writing to the correct TBM by setting its sddress:
@@ -455,7 +542,7 @@ bool hal::tbmSetReg(uint8_t tbmId, uint8_t regId, uint8_t regValue) {
   return true;
 }
 
-void hal::RocSetMask(uint8_t rocid, bool mask, std::vector<pixelConfig> pixels) {
+void hal::RocSetMask(uint8_t rocid, bool mask, const rocConfig * config) {
 
   _testboard->roc_I2cAddr(rocid);
   
@@ -469,17 +556,19 @@ void hal::RocSetMask(uint8_t rocid, bool mask, std::vector<pixelConfig> pixels)
     // We really want to enable that full thing:
     LOG(logDEBUGHAL) << "Updating mask bits & trim values of ROC " << (int)rocid;
 
-    // Prepare configuration of the pixels, linearize vector:
-    std::vector<int8_t> trim;
-    // Set default trim value to 15:
-    for(size_t i = 0; i < ROC_NUMCOLS*ROC_NUMROWS; i++) { trim.push_back(15); }
-    for(std::vector<pixelConfig>::iterator pxIt = pixels.begin(); pxIt != pixels.end(); ++pxIt) {
-      size_t position = (*pxIt).column*ROC_NUMROWS + (*pxIt).row;
-      trim[position] = (*pxIt).trim;
+    // Prepare configuration of the pixels, linearize vector.
+    // Set default trim value to 15, reusing the preallocated buffer:
+    _trimbuffer.assign(ROC_NUMCOLS*ROC_NUMROWS,15);
+    if(config != NULL) {
+      const pixelBits & configured = config->configuredPixels();
+      for(pixelBits::iterator px = configured.begin(); px != configured.end(); ++px) {
+	_trimbuffer[px.index()] = config->getTrim(px.index());
+      }
     }
 
     // Trim the whole ROC:
-    _testboard->TrimChip(trim);
+    _testboard->TrimChip(_trimbuffer);
+    _trims[rocid] = _trimbuffer;
   }
 }
 
@@ -497,299 +586,1343 @@ void hal::PixelSetMask(uint8_t rocid, uint8_t column, uint8_t row, bool mask, ui
     LOG(logDEBUGHAL) << "Trimming pixel " << (int)column << "," << (int)row 
 		     << " (" << (int)trim << ")";
     _testboard->roc_Pix_Trim(column,row,trim);
+    StoreTrim(rocid,column,row,trim);
   }
 }
 
+void hal::StoreTrim(uint8_t rocid, uint8_t column, uint8_t row, uint8_t trim) {
+  std::vector<int8_t> & trims = _trims[rocid];
+  if(trims.empty()) trims.assign(ROC_NUMCOLS*ROC_NUMROWS,15);
+  trims.at(rocMap::index(column,row)) = trim;
+}
+
+uint8_t hal::PixelTrim(uint8_t rocid, uint8_t column, uint8_t row) {
+  std::map<uint8_t, std::vector<int8_t> >::const_iterator trims = _trims.find(rocid);
+  if(trims == _trims.end() || trims->second.empty()) return 15;
+  return trims->second.at(rocMap::index(column,row));
+}
+
 
 // ---------------- TEST FUNCTIONS ----------------------
 
-std::vector< std::vector<pixel> >* hal::RocCalibrateMap(uint8_t rocid, std::vector<int32_t> parameter) {
+void hal::RocCalibrateMap(uint8_t rocid, const calibrateParameters & parameter, pixelSink & sink) {
 
-  int32_t flags = parameter.at(0);
-  int32_t nTriggers = parameter.at(1);
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
 
   LOG(logDEBUGHAL) << "Called RocCalibrateMap with flags " << (int)flags << ", running " << nTriggers << " triggers.";
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
-  std::vector<int16_t> nReadouts;
-  std::vector<int32_t> PHsum;
 
   // Set the correct ROC I2C address:
   _testboard->roc_I2cAddr(rocid);
 
-  // Call the RPC command:
-  int status = _testboard->CalibrateMap(nTriggers, nReadouts, PHsum);
+  // Call the RPC command, results are written directly into the preallocated map:
+  int status = _testboard->CalibrateMap(nTriggers, _rocmap.nReadouts, _rocmap.PHsum);
   LOG(logDEBUGHAL) << "Function returns: " << status;
-  LOG(logDEBUGHAL) << "Data size: nReadouts " << nReadouts.size() << ", PHsum " << PHsum.size();
+  LOG(logDEBUGHAL) << "Data size: nReadouts " << _rocmap.nReadouts.size() << ", PHsum " << _rocmap.PHsum.size();
 
-  // Decide over what we get back in the value field:
-  if(flags & FLAG_INTERNAL_GET_EFFICIENCY) {
-    result->push_back(delinearize(rocid,nReadouts));
-    LOG(logDEBUGHAL) << "Returning nReadouts for efficiency measurement.";
-  }
-  else {
-    result->push_back(delinearize(rocid,PHsum));
-    LOG(logDEBUGHAL) << "Returning PHsum for pulse height averaging.";
-  }
+  // Hand both nReadouts and PHsum to the sink, it selects what to return:
+  sink.push(0, rocid, _rocmap);
+}
+
+void hal::RocCalibrateDacScan(uint8_t rocid, const dacScanParameters & parameter, pixelSink & sink) {
+
+  int32_t dacreg = parameter.dacReg;
+  int32_t dacmin = parameter.dacMin;
+  int32_t dacmax = parameter.dacMax;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called RocCalibrateDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Scanning DAC " << dacreg << " from " << dacmin << " to " << dacmax;
+
+  // Step the DAC and take one full ROC map per DAC value:
+  RocScanPipelined(rocid, nTriggers, ScanSteps(parameter), sink);
+}
 
-  return result;
+void hal::RocCalibrateDacDacScan(uint8_t rocid, const dacDacScanParameters & parameter, pixelSink & sink) {
+
+  int32_t dac1reg = parameter.dac1Reg;
+  int32_t dac1min = parameter.dac1Min;
+  int32_t dac1max = parameter.dac1Max;
+  int32_t dac2reg = parameter.dac2Reg;
+  int32_t dac2min = parameter.dac2Min;
+  int32_t dac2max = parameter.dac2Max;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called RocCalibrateDacDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Scanning field DAC " << dac1reg << " " << dac1min << "-" << dac1max 
+		   << ", DAC " << dac2reg << " " << dac2min << "-" << dac2max;
+
+  // Step both DACs, the second one running fastest, and take one full ROC map per DAC pair:
+  RocScanPipelined(rocid, nTriggers, ScanSteps(parameter), sink);
 }
 
-std::vector< std::vector<pixel> >* hal::PixelCalibrateMap(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+void hal::PixelCalibrateMap(uint8_t rocid, uint8_t column, uint8_t row, const calibrateParameters & parameter, pixelSink & sink) {
 
-  int32_t flags = parameter.at(0);
-  int32_t nTriggers = parameter.at(1);
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
 
   LOG(logDEBUGHAL) << "Called PixelCalibrateMap with flags " << (int)flags << ", running " << nTriggers << " triggers.";
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
-  int16_t nReadouts;
-  int32_t PHsum;
-  std::vector<pixel> data;
 
-  // Set the correct ROC I2C address:
-  _testboard->roc_I2cAddr(rocid);
+  // Send the request, the reply is pushed to block 0 of the sink once it
+  // arrives (right away without an open pipeline). Queued requests keep the
+  // connection, other threads only get it in between two pixels:
+  YieldConnection(false);
+  QueuePixelRequest(pixelRequest(pixelRequest::MEASUREMENT, rocid, column, row, sink));
+  try {
+    _testboard->roc_I2cAddr(rocid);
+    _testboard->CalibratePixel_Send(nTriggers, column, row);
+    CollectPixelRequests(SCAN_DEPTH_PIXEL);
+  }
+  catch(...) {
+    AbortPixelRequests();
+    throw;
+  }
+}
 
-  // Call the RPC command:
-  int status = _testboard->CalibratePixel(nTriggers, column, row, nReadouts, PHsum);
-  LOG(logDEBUGHAL) << "Function returns: " << status;
+void hal::PixelCalibrateDacScan(uint8_t rocid, uint8_t column, uint8_t row, const dacScanParameters & parameter, pixelSink & sink) {
 
-  pixel newpixel;
-  newpixel.column = column;
-  newpixel.row = row;
-  newpixel.roc_id = rocid;
+  int32_t dacreg = parameter.dacReg;
+  int32_t dacmin = parameter.dacMin;
+  int32_t dacmax = parameter.dacMax;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
 
-  // Decide over what we get back in the value field:
-  if(flags & FLAG_INTERNAL_GET_EFFICIENCY) {
-    newpixel.value =  static_cast<int32_t>(nReadouts);
-    LOG(logDEBUGHAL) << "Returning nReadouts for efficiency measurement.";
+  LOG(logDEBUGHAL) << "Called PixelCalibrateDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Scanning DAC " << dacreg << " from " << dacmin << " to " << dacmax;
+
+  // The firmware always scans all values starting from zero, the host-side
+  // scan only the requested ones:
+  if(!FirmwareScanCheaper(dacmax, parameter.blocks(), nTriggers)) {
+    PixelScanPipelined(rocid, column, row, nTriggers, ScanSteps(parameter), sink);
+    return;
   }
-  else {
-    newpixel.value =  static_cast<int32_t>(PHsum);
-    LOG(logDEBUGHAL) << "Returning PHsum for pulse height averaging.";
+
+  // The reply is unpacked to the requested DAC values once it arrives:
+  pixelRequest request(pixelRequest::DACSCAN, rocid, column, row, sink);
+  request.scan = &parameter;
+  YieldConnection(false);
+  QueuePixelRequest(request);
+  try {
+    _testboard->roc_I2cAddr(rocid);
+    _testboard->CalibrateDacScan_Send(nTriggers, column, row, dacreg, dacmax);
+    CollectPixelRequests(SCAN_DEPTH_PIXELSCAN);
+  }
+  catch(...) {
+    AbortPixelRequests();
+    throw;
   }
+}
+
+void hal::PixelCalibrateDacDacScan(uint8_t rocid, uint8_t column, uint8_t row, const dacDacScanParameters & parameter, pixelSink & sink) {
 
-  data.push_back(newpixel);
-  result->push_back(data);
+  int32_t dac1reg = parameter.dac1Reg;
+  int32_t dac1min = parameter.dac1Min;
+  int32_t dac1max = parameter.dac1Max;
+  int32_t dac2reg = parameter.dac2Reg;
+  int32_t dac2min = parameter.dac2Min;
+  int32_t dac2max = parameter.dac2Max;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
 
-  return result;
+  LOG(logDEBUGHAL) << "Called PixelCalibrateDacDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Scanning field DAC " << dac1reg << " " << dac1min << "-" << dac1max 
+		   << ", DAC " << dac2reg << " " << dac2min << "-" << dac2max;
+
+  // The firmware always scans both DACs starting from zero, the host-side
+  // scan only the requested values:
+  if(!FirmwareScanCheaper(dac1max*dac2max, parameter.blocks(), nTriggers)) {
+    PixelScanPipelined(rocid, column, row, nTriggers, ScanSteps(parameter), sink);
+    return;
+  }
+
+  // The reply is unpacked to the requested DAC pairs once it arrives:
+  pixelRequest request(pixelRequest::DACDACSCAN, rocid, column, row, sink);
+  request.dacdac = &parameter;
+  YieldConnection(false);
+  QueuePixelRequest(request);
+  try {
+    _testboard->roc_I2cAddr(rocid);
+    _testboard->CalibrateDacDacScan_Send(nTriggers, column, row, dac1reg, dac1max, dac2reg, dac2max);
+    CollectPixelRequests(SCAN_DEPTH_PIXELSCAN);
+  }
+  catch(...) {
+    AbortPixelRequests();
+    throw;
+  }
 }
 
-template <typename T>
-std::vector<pixel> hal::delinearize(uint8_t rocId, std::vector<T> tvec) {
 
-  // Loop over the full roc, since we have full-matrix readout:
-  std::vector<pixel> data;
-  int column = 0, row = 0;
+void hal::MultiPixelCalibrateMap(uint8_t rocid, const std::vector<pixelConfig> & pixels, const calibrateParameters & parameter, pixelSink & sink) {
 
-  for(typename std::vector<T>::iterator it = tvec.begin(); it < tvec.end(); ++it) {
-    pixel newpixel;
-    newpixel.column = column;
-    newpixel.row = row;
-    newpixel.roc_id = rocId;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called MultiPixelCalibrateMap with flags " << (int)flags << ", running " << nTriggers << " triggers on " << pixels.size() << " pixels.";
+
+  // Pulse the pixels in parallel groups:
+  MultiPixelCalibrateLoop(rocid, pixels, flags, nTriggers);
 
-    newpixel.value = static_cast<int32_t>(*it);
-    data.push_back(newpixel);
+  // Hand both nReadouts and PHsum to the sink, in the order the pixels were given:
+  for(std::vector<pixelConfig>::const_iterator px = pixels.begin(); px != pixels.end(); ++px) {
+    size_t position = rocMap::index(px->column,px->row);
+    pixelCalibration newpixel;
+    newpixel.column = px->column;
+    newpixel.row = px->row;
+    newpixel.roc_id = rocid;
+    newpixel.nhits = _rocmap.nReadouts.at(position);
+    newpixel.phsum = _rocmap.PHsum.at(position);
+    sink.push(0, newpixel);
+  }
+}
+
+void hal::MultiPixelCalibrateDacScan(uint8_t rocid, const std::vector<pixelConfig> & pixels, const dacScanParameters & parameter, pixelSink & sink) {
+
+  int32_t dacreg = parameter.dacReg;
+  int32_t dacmin = parameter.dacMin;
+  int32_t dacmax = parameter.dacMax;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called MultiPixelCalibrateDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers on " << pixels.size() << " pixels.";
+  LOG(logDEBUGHAL) << "Scanning DAC " << dacreg << " from " << dacmin << " to " << dacmax;
 
-    // Translate linear vectors into 2D pixel addresses:
-    row++;
-    if(row >= ROC_NUMROWS) {
-      row = 0;
-      column++;
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    if(Cancelled()) break;
+    _testboard->roc_I2cAddr(rocid);
+    _testboard->roc_SetDAC(dacreg,parameter.dac(block));
+
+    // Pulse the pixels in parallel groups:
+    MultiPixelCalibrateLoop(rocid, pixels, flags, nTriggers);
+
+    // Hand both nReadouts and PHsum to the sink, in the order the pixels were given:
+    for(std::vector<pixelConfig>::const_iterator px = pixels.begin(); px != pixels.end(); ++px) {
+      size_t position = rocMap::index(px->column,px->row);
+      pixelCalibration newpixel;
+      newpixel.column = px->column;
+      newpixel.row = px->row;
+      newpixel.roc_id = rocid;
+      newpixel.nhits = _rocmap.nReadouts.at(position);
+      newpixel.phsum = _rocmap.PHsum.at(position);
+      sink.push(block, newpixel);
     }
+    Progress(1);
   }
+}
+
+
+void hal::ModuleCalibrateMap(const calibrateParameters & parameter, pixelSink & sink) {
+
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called ModuleCalibrateMap with flags " << (int)flags << ", running " << nTriggers << " triggers.";
 
-  return data;
+  // Pulse all ROCs in parallel:
+  if(!ModuleCalibrateLoop(flags, nTriggers)) return;
+
+  // Hand the maps of all ROCs to the sink, all in one block:
+  for(size_t k = 0; k < _rocIds.size(); k++) {
+    sink.push(0, _rocIds[k], _modulemaps.at(k));
+  }
 }
 
-std::vector< std::vector<pixel> >* hal::PixelCalibrateDacScan(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+void hal::ModuleCalibrateDacScan(const dacScanParameters & parameter, pixelSink & sink) {
 
-  int32_t dacreg = parameter.at(0);
-  int32_t dacmin = parameter.at(1);
-  int32_t dacmax = parameter.at(2);
-  int32_t flags = parameter.at(3);
-  int32_t nTriggers = parameter.at(4);
+  int32_t dacreg = parameter.dacReg;
+  int32_t dacmin = parameter.dacMin;
+  int32_t dacmax = parameter.dacMax;
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
 
-  LOG(logDEBUGHAL) << "Called PixelCalibrateDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Called ModuleCalibrateDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
   LOG(logDEBUGHAL) << "Scanning DAC " << dacreg << " from " << dacmin << " to " << dacmax;
 
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
-  std::vector<int16_t> nReadouts;
-  std::vector<int32_t> PHsum;
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    if(Cancelled()) break;
+    // Set the DAC on all ROCs of the module:
+    for(size_t k = 0; k < _rocIds.size(); k++) {
+      _testboard->roc_I2cAddr(_rocIds[k]);
+      _testboard->roc_SetDAC(dacreg,parameter.dac(block));
+    }
+
+    if(!ModuleCalibrateLoop(flags, nTriggers)) break;
+
+    // One block per DAC value, containing the pixels of all ROCs:
+    for(size_t k = 0; k < _rocIds.size(); k++) {
+      sink.push(block, _rocIds[k], _modulemaps.at(k));
+    }
+    Progress(_rocIds.size());
+  }
+}
+
+void hal::RocThresholdMap(uint8_t rocid, const thresholdParameters & parameter, pixelSink & sink) {
+
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called RocThresholdMap with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+  LOG(logDEBUGHAL) << "Searching thresholds of DAC " << (int)parameter.thrReg << " from " << (int)parameter.thrMin
+		   << " to " << (int)parameter.thrMax << (parameter.rising() ? " (rising edge)" : " (falling edge)");
 
   // Set the correct ROC I2C address:
   _testboard->roc_I2cAddr(rocid);
 
-  // FIXME no DACMIN usage possible right now.
+  thresholdSearch search(ROC_NUMCOLS*ROC_NUMROWS, parameter.thrMin, parameter.thrMax, parameter.level(), parameter.rising());
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    SetThresholdScanDacs(parameter, block);
+
+    // Every probe measures all pixels, each of them uses what narrows down its threshold:
+    search.start();
+    uint8_t value;
+    while(!Cancelled() && search.next(value)) {
+      _testboard->roc_SetDAC(parameter.thrReg, value);
+      int status = _testboard->CalibrateMap(nTriggers, _rocmap.nReadouts, _rocmap.PHsum);
+      LOG(logDEBUGHAL) << "Probe at " << (int)value << ": function returns " << status;
+      search.update(value, _rocmap.nReadouts);
+    }
+    if(Cancelled()) break;
+    LOG(logDEBUGHAL) << "Block " << block << ": thresholds found with " << search.nProbes() << " probes.";
 
-  // Call the RPC command:
-  int status = _testboard->CalibrateDacScan(nTriggers, column, row, dacreg, dacmax, nReadouts, PHsum);
-  LOG(logDEBUGHAL) << "Function returns: " << status;
-  LOG(logDEBUGHAL) << "Data size: nReadouts " << nReadouts.size() << ", PHsum " << PHsum.size();
+    PushThresholds(rocid, search, block, sink);
+    Progress(1);
+  }
+}
+
+void hal::MultiPixelThresholdMap(uint8_t rocid, const std::vector<pixelConfig> & pixels, const thresholdParameters & parameter, pixelSink & sink) {
+
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+
+  LOG(logDEBUGHAL) << "Called MultiPixelThresholdMap with flags " << (int)flags << ", running " << nTriggers << " triggers on " << pixels.size() << " pixels.";
+
+  std::vector<size_t> positions;
+  positions.reserve(pixels.size());
+  for(std::vector<pixelConfig>::const_iterator px = pixels.begin(); px != pixels.end(); ++px) {
+    positions.push_back(rocMap::index(px->column,px->row));
+  }
+
+  thresholdSearch search(ROC_NUMCOLS*ROC_NUMROWS, parameter.thrMin, parameter.thrMax, parameter.level(), parameter.rising());
+  std::vector<pixelConfig> probed;
+  probed.reserve(pixels.size());
+
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    _testboard->roc_I2cAddr(rocid);
+    SetThresholdScanDacs(parameter, block);
+
+    search.start(positions);
+    uint8_t value;
+    while(!Cancelled() && search.next(value)) {
+      _testboard->roc_I2cAddr(rocid);
+      _testboard->roc_SetDAC(parameter.thrReg, value);
+
+      // Only pulse the pixels which learn something from this probe:
+      probed.clear();
+      for(std::vector<pixelConfig>::const_iterator px = pixels.begin(); px != pixels.end(); ++px) {
+	if(search.probes(rocMap::index(px->column,px->row), value)) probed.push_back(*px);
+      }
+      MultiPixelCalibrateLoop(rocid, probed, flags, nTriggers);
+      search.update(value, _rocmap.nReadouts);
+    }
+    if(Cancelled()) break;
+    LOG(logDEBUGHAL) << "Block " << block << ": thresholds found with " << search.nProbes() << " probes.";
+
+    // Hand the thresholds to the sink, in the order the pixels were given:
+    for(std::vector<pixelConfig>::const_iterator px = pixels.begin(); px != pixels.end(); ++px) {
+      int16_t threshold = search.threshold(rocMap::index(px->column,px->row));
+      if(threshold < 0) continue;
+      pixel newpixel;
+      newpixel.column = px->column;
+      newpixel.row = px->row;
+      newpixel.roc_id = rocid;
+      newpixel.value = threshold;
+      sink.push(block, newpixel);
+    }
+    Progress(1);
+  }
+}
+
+void hal::PixelThresholdMap(uint8_t rocid, uint8_t column, uint8_t row, const thresholdParameters & parameter, pixelSink & sink) {
+
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
+  bool rising = parameter.rising();
+
+  LOG(logDEBUGHAL) << "Called PixelThresholdMap with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+
+  // The search needs every reply before the next probe, so it cannot be
+  // pipelined. Collect the outstanding requests first:
+  CollectPixelRequests(0);
+
+  // Set the correct ROC I2C address:
+  _testboard->roc_I2cAddr(rocid);
+
+  thresholdSearch search(1, parameter.thrMin, parameter.thrMax, parameter.level(), rising);
+  size_t range = (parameter.thrMax >= parameter.thrMin) ? parameter.thrMax - parameter.thrMin + 1 : 1;
+  size_t bisections = parameter.probes();
+  int16_t threshold = -1;
+
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    SetThresholdScanDacs(parameter, block);
+
+    // The firmware walks through the DAC values with a single round trip,
+    // the host-side bisection needs one round trip per probe:
+    size_t fwSteps = (threshold < 0) ? range/2 : 2*SCAN_THR_MARGIN;
+    if(FirmwareScanCheaper(fwSteps, bisections, nTriggers, bisections)) {
+      int32_t start = rising ? parameter.thrMin : parameter.thrMax;
+      if(threshold >= 0) {
+	start = rising ? std::max<int32_t>(threshold - SCAN_THR_MARGIN, parameter.thrMin)
+	  : std::min<int32_t>(threshold + SCAN_THR_MARGIN, parameter.thrMax);
+      }
+      int32_t result = _testboard->PixelThreshold(column, row, start, rising ? 1 : -1, parameter.level(), nTriggers,
+						  parameter.thrReg, (flags & FLAG_XTALK) ? 1 : 0, (flags & FLAG_USE_CALS) ? 1 : 0,
+						  PixelTrim(rocid, column, row));
+      LOG(logDEBUGHAL) << "Firmware threshold search from " << start << " returns " << result;
+      search.seed(0, static_cast<int16_t>(result));
+    }
+    else {
+      search.start();
+      uint8_t value;
+      while(search.next(value)) {
+	int16_t nReadouts;
+	int32_t PHsum;
+	_testboard->roc_SetDAC(parameter.thrReg, value);
+	_testboard->CalibratePixel(nTriggers, column, row, nReadouts, PHsum);
+	search.update(value, 0, nReadouts);
+      }
+      LOG(logDEBUGHAL) << "Host-side threshold search took " << search.nProbes() << " probes.";
+    }
+
+    threshold = search.threshold(0);
+    if(threshold < 0) continue;
 
-  //FIXME no DACMIN setting possible, starting at 0 all the time:
-  //  for (int i=dacmin;i<dacmax;i++) {
-  for(int i=0; i < dacmax; i++) {
-    std::vector<pixel> data;
     pixel newpixel;
     newpixel.column = column;
     newpixel.row = row;
     newpixel.roc_id = rocid;
+    newpixel.value = threshold;
+    sink.push(block, newpixel);
+  }
+}
+
+void hal::ModuleThresholdMap(const thresholdParameters & parameter, pixelSink & sink) {
+
+  int32_t flags = parameter.flags;
+  int32_t nTriggers = parameter.nTriggers;
 
-    // Decide over what we get back in the value field:
-    if(flags & FLAG_INTERNAL_GET_EFFICIENCY) {
-      // FIXME not nice, not safe:
-      newpixel.value =  static_cast<int32_t>(nReadouts[i]);
+  LOG(logDEBUGHAL) << "Called ModuleThresholdMap with flags " << (int)flags << ", running " << nTriggers << " triggers.";
+
+  size_t nRocs = _rocIds.size();
+  std::vector<thresholdSearch> searches(nRocs, thresholdSearch(ROC_NUMCOLS*ROC_NUMROWS, parameter.thrMin, parameter.thrMax,
+							       parameter.level(), parameter.rising()));
+  std::vector<uint8_t> values(nRocs);
+  std::vector<bool> probing(nRocs);
+
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    for(size_t k = 0; k < nRocs; k++) {
+      _testboard->roc_I2cAddr(_rocIds[k]);
+      SetThresholdScanDacs(parameter, block);
+      searches.at(k).start();
     }
-    else {
-      // FIXME not nice, not safe:
-      newpixel.value =  static_cast<int32_t>(PHsum[i]);
+
+    // Every ROC probes its own threshold DAC value, all are pulsed together
+    // until the last ROC has found all of its thresholds:
+    size_t rounds = 0;
+    bool complete = true;
+    while(!Cancelled()) {
+      bool running = false;
+      for(size_t k = 0; k < nRocs; k++) {
+	uint8_t value;
+	probing[k] = searches.at(k).next(value);
+	if(!probing[k]) continue;
+	values[k] = value;
+	running = true;
+	_testboard->roc_I2cAddr(_rocIds[k]);
+	_testboard->roc_SetDAC(parameter.thrReg, value);
+      }
+      if(!running) break;
+
+      if(!ModuleCalibrateLoop(flags, nTriggers)) {
+	complete = false;
+	break;
+      }
+      for(size_t k = 0; k < nRocs; k++) {
+	if(probing[k]) searches.at(k).update(values[k], _modulemaps.at(k).nReadouts);
+      }
+      rounds++;
     }
-    data.push_back(newpixel);
-    result->push_back(data);
+    if(!complete || Cancelled()) break;
+    LOG(logDEBUGHAL) << "Block " << block << ": thresholds of all ROCs found in " << rounds << " rounds.";
+
+    for(size_t k = 0; k < nRocs; k++) {
+      PushThresholds(_rocIds[k], searches.at(k), block, sink);
+    }
+    Progress(nRocs);
   }
+}
 
-  return result;
+void hal::SetThresholdScanDacs(const thresholdParameters & parameter, size_t block) {
+  if(parameter.nScanDacs > 0) _testboard->roc_SetDAC(parameter.scan.dac1Reg, parameter.dac1(block));
+  if(parameter.nScanDacs > 1) _testboard->roc_SetDAC(parameter.scan.dac2Reg, parameter.dac2(block));
 }
 
-std::vector< std::vector<pixel> >* hal::PixelCalibrateDacDacScan(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+void hal::PushThresholds(uint8_t rocid, const thresholdSearch & search, size_t block, pixelSink & sink) {
 
-  int32_t dac1reg = parameter.at(0);
-  int32_t dac1min = parameter.at(1);
-  int32_t dac1max = parameter.at(2);
-  int32_t dac2reg = parameter.at(3);
-  int32_t dac2min = parameter.at(4);
-  int32_t dac2max = parameter.at(5);
-  int32_t flags = parameter.at(6);
-  int32_t nTriggers = parameter.at(7);
+  pixel newpixel;
+  newpixel.roc_id = rocid;
+  for(size_t i = 0; i < ROC_NUMCOLS*ROC_NUMROWS; i++) {
+    int16_t threshold = search.threshold(i);
+    if(threshold < 0) continue;
+    newpixel.column = i/ROC_NUMROWS;
+    newpixel.row = i%ROC_NUMROWS;
+    newpixel.value = threshold;
+    sink.push(block, newpixel);
+  }
+}
 
-  LOG(logDEBUGHAL) << "Called PixelCalibrateDacDacScan with flags " << (int)flags << ", running " << nTriggers << " triggers.";
-  LOG(logDEBUGHAL) << "Scanning field DAC " << dac1reg << " " << dac1min << "-" << dac1max 
-		   << ", DAC " << dac2reg << " " << dac2min << "-" << dac2max;
+bool hal::ModuleCalibrateLoop(int32_t flags, int32_t nTriggers) {
+
+  // Reset the preallocated maps of all ROCs:
+  size_t nRocs = _rocIds.size();
+  if(_modulemaps.size() < nRocs) _modulemaps.resize(nRocs);
+  for(size_t k = 0; k < nRocs; k++) { _modulemaps.at(k).clear(); }
+
+  // Set up the DAQ for the TBM readout:
+  _testboard->Daq_Open(DAQ_BUFFER_SIZE);
+  _testboard->Daq_Select_Deser160(_deser160phase);
+  _testboard->uDelay(100);
+  _testboard->Daq_Start();
+  _testboard->uDelay(100);
+
+  std::vector<uint16_t> data;
+  std::vector<pixel> hits;
+  std::vector<size_t> events;
+  size_t expected = static_cast<size_t>(ROC_NUMROWS*nTriggers);
+  bool complete = true;
+  for(uint8_t column = 0; column < ROC_NUMCOLS; column++) {
+    if(Cancelled()) {
+      complete = false;
+      break;
+    }
+
+    // Every trigger yields one TBM event, so event k belongs to the pulsed row
+    // k/nTriggers. With events missing or in excess the hits cannot be assigned
+    // to their rows, the column is pulsed again:
+    size_t nEvents = 0;
+    for(uint8_t attempt = 1; attempt <= DAQ_COLUMN_ATTEMPTS; attempt++) {
+      ModulePulseColumn(column, flags, nTriggers);
+      daqReadAll(data);
+      nEvents = decodeModuleReadout(data, hits, events);
+      LOG(logDEBUGHAL) << "Column " << (int)column << ": " << data.size() << " words, " << nEvents << " events, " << hits.size() << " hits decoded.";
+      if(nEvents == expected) break;
+      LOG(logWARNING) << "Column " << (int)column << ": read " << nEvents << " events instead of " << expected
+		      << " (attempt " << (int)attempt << " of " << DAQ_COLUMN_ATTEMPTS << ").";
+    }
+    if(nEvents != expected) {
+      LOG(logCRITICAL) << "Readout of column " << (int)column << " failed repeatedly, aborting the module map.";
+      complete = false;
+      break;
+    }
+
+    // Sort the hits into the ROC maps. Only hits in the pulsed pixel count,
+    // everything else is noise or crosstalk:
+    for(size_t i = 0; i < hits.size(); i++) {
+      const pixel & hit = hits[i];
+      if(hit.roc_id >= nRocs || hit.column != column || hit.row != events[i]/nTriggers) continue;
+      size_t position = rocMap::index(hit.column,hit.row);
+      _modulemaps.at(hit.roc_id).nReadouts.at(position)++;
+      _modulemaps.at(hit.roc_id).PHsum.at(position) += hit.value;
+    }
+  }
+
+  _testboard->Daq_Stop();
+  _testboard->Daq_Close();
+  return complete;
+}
 
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
-  std::vector<int16_t> nReadouts;
-  std::vector<int32_t> PHsum;
+void hal::ModulePulseColumn(uint8_t column, int32_t flags, int32_t nTriggers) {
+
+  // Enable the column on all ROCs:
+  for(size_t k = 0; k < _rocIds.size(); k++) {
+    _testboard->roc_I2cAddr(_rocIds[k]);
+    _testboard->roc_Col_Enable(column, true);
+  }
+
+  for(uint8_t row = 0; row < ROC_NUMROWS; row++) {
+    // Set the calibrate bit of the same pixel on all ROCs...
+    for(size_t k = 0; k < _rocIds.size(); k++) {
+      _testboard->roc_I2cAddr(_rocIds[k]);
+      _testboard->roc_Pix_Cal(column, row, (flags & FLAG_USE_CALS));
+    }
+
+    // ...and trigger them all at once:
+    for(int32_t k = 0; k < nTriggers; k++) {
+      _testboard->Pg_Single();
+      _testboard->uDelay(20);
+    }
+
+    for(size_t k = 0; k < _rocIds.size(); k++) {
+      _testboard->roc_I2cAddr(_rocIds[k]);
+      _testboard->roc_ClrCal();
+    }
+  }
+
+  for(size_t k = 0; k < _rocIds.size(); k++) {
+    _testboard->roc_I2cAddr(_rocIds[k]);
+    _testboard->roc_Col_Enable(column, false);
+  }
+}
+
+void hal::MultiPixelCalibrateLoop(uint8_t rocid, const std::vector<pixelConfig> & pixels, int32_t flags, int32_t nTriggers) {
+
+  // Reset the preallocated map:
+  _rocmap.clear();
+
+  // Split the pixels into groups which can be pulsed at the same time:
+  std::vector< std::vector<pixelConfig> > groups = MultiPixelGroups(pixels);
+  LOG(logDEBUGHAL) << "Pulsing " << pixels.size() << " pixels in " << groups.size() << " groups.";
 
   // Set the correct ROC I2C address:
   _testboard->roc_I2cAddr(rocid);
 
-  // FIXME no DACMIN usage possible right now.
+  // Set up the DAQ for the single ROC readout:
+  _testboard->Daq_Open(DAQ_BUFFER_SIZE);
+  _testboard->Daq_Select_Deser160(_deser160phase);
+  _testboard->uDelay(100);
+  _testboard->Daq_Start();
+  _testboard->uDelay(100);
 
-  // Call the RPC command:
-  int status = _testboard->CalibrateDacDacScan(nTriggers, column, row, dac1reg, dac1max, dac2reg, dac2max, nReadouts, PHsum);
-  LOG(logDEBUGHAL) << "Function returns: " << status;
-  LOG(logDEBUGHAL) << "Data size: nReadouts " << nReadouts.size() << ", PHsum " << PHsum.size();
-
-  //FIXME no DACMIN setting possible, starting at 0 all the time:
-  //  for (int i=dac1min;i<dac1max;i++) {
-  for(int i=0; i < dac1max; i++) {
-    //FIXME no DACMIN setting possible, starting at 0 all the time:
-    //for(int j=dac2min; j < dac2max; j++) {
-    for(int j=0; j < dac2max; j++) {
-      std::vector<pixel> data;
-      pixel newpixel;
-      newpixel.column = column;
-      newpixel.row = row;
-      newpixel.roc_id = rocid;
+  std::vector<uint16_t> data;
+  // Lookup table for the pixels pulsed in the current group:
+  std::vector<bool> pulsed(ROC_NUMCOLS*ROC_NUMROWS, false);
 
-      // Decide over what we get back in the value field:
-      if(flags & FLAG_INTERNAL_GET_EFFICIENCY) {
-	// FIXME not nice, not safe:
-	newpixel.value =  static_cast<int32_t>(nReadouts[i]);
+  for(std::vector< std::vector<pixelConfig> >::iterator group = groups.begin(); group != groups.end(); ++group) {
+
+    // Enable the columns and set the calibrate bits of all pixels in this group:
+    for(std::vector<pixelConfig>::iterator px = group->begin(); px != group->end(); ++px) {
+      _testboard->roc_Col_Enable(px->column, true);
+      _testboard->roc_Pix_Cal(px->column, px->row, (flags & FLAG_USE_CALS));
+      pulsed[rocMap::index(px->column,px->row)] = true;
+    }
+
+    // ...and trigger them all at once:
+    for(int32_t k = 0; k < nTriggers; k++) {
+      _testboard->Pg_Single();
+      _testboard->uDelay(20);
+    }
+
+    _testboard->roc_ClrCal();
+    for(std::vector<pixelConfig>::iterator px = group->begin(); px != group->end(); ++px) {
+      _testboard->roc_Col_Enable(px->column, false);
+    }
+
+    // Read back the data of this group and assign the hits to the pulsed pixels
+    // via their decoded addresses, everything else is noise or crosstalk:
+    daqReadAll(data);
+    std::vector<pixel> hits = decodeRocReadout(rocid,data);
+    LOG(logDEBUGHAL) << "Group of " << group->size() << " pixels: " << data.size() << " words, " << hits.size() << " hits decoded.";
+
+    for(std::vector<pixel>::iterator it = hits.begin(); it != hits.end(); ++it) {
+      if(it->column >= ROC_NUMCOLS || it->row >= ROC_NUMROWS) continue;
+      size_t position = rocMap::index(it->column,it->row);
+      if(!pulsed[position]) continue;
+      _rocmap.nReadouts[position]++;
+      _rocmap.PHsum[position] += it->value;
+    }
+
+    for(std::vector<pixelConfig>::iterator px = group->begin(); px != group->end(); ++px) {
+      pulsed[rocMap::index(px->column,px->row)] = false;
+    }
+  }
+
+  _testboard->Daq_Stop();
+  _testboard->Daq_Close();
+}
+
+std::vector< std::vector<pixelConfig> > hal::MultiPixelGroups(const std::vector<pixelConfig> & pixels) {
+
+  // Sort the pixels into queues per double column. The pixels are taken from
+  // the front of the queues, which a deque erases in constant time:
+  std::vector< std::deque<pixelConfig> > dcols(ROC_NUMCOLS/2);
+  for(std::vector<pixelConfig>::const_iterator px = pixels.begin(); px != pixels.end(); ++px) {
+    if(px->column >= ROC_NUMCOLS || px->row >= ROC_NUMROWS) continue;
+    dcols.at(px->column/2).push_back(*px);
+  }
+
+  std::vector< std::vector<pixelConfig> > groups;
+  size_t remaining = 0;
+  for(std::vector< std::deque<pixelConfig> >::iterator dc = dcols.begin(); dc != dcols.end(); ++dc) { remaining += dc->size(); }
+
+  while(remaining > 0) {
+    std::vector<pixelConfig> group;
+    int lastrow = -1;
+
+    // Take at most one pixel per double column. The first double column with
+    // pixels left always contributes, so every group makes progress:
+    for(std::vector< std::deque<pixelConfig> >::iterator dc = dcols.begin(); dc != dcols.end(); ++dc) {
+      std::deque<pixelConfig>::iterator px = dc->begin();
+      // Keep a distance of two rows to the pixel in the neighbouring double column:
+      while(px != dc->end() && lastrow >= 0 && std::abs(static_cast<int>(px->row) - lastrow) < 2) { ++px; }
+
+      if(px == dc->end()) { lastrow = -1; continue; }
+      lastrow = px->row;
+      group.push_back(*px);
+      dc->erase(px);
+      remaining--;
+    }
+    groups.push_back(group);
+  }
+
+  return groups;
+}
+
+std::vector<hal::scanStep> hal::ScanSteps(const dacScanParameters & parameter) {
+
+  std::vector<scanStep> steps;
+  steps.reserve(parameter.blocks());
+  for(size_t block = 0; block < parameter.blocks(); block++) {
+    steps.push_back(scanStep(parameter.dacReg, parameter.dac(block), true));
+  }
+  return steps;
+}
+
+std::vector<hal::scanStep> hal::ScanSteps(const dacDacScanParameters & parameter) {
+
+  std::vector<scanStep> steps;
+  steps.reserve(parameter.dac1Steps()*(parameter.dac2Steps() + 1));
+  for(size_t i = 0; i < parameter.dac1Steps(); i++) {
+    steps.push_back(scanStep(parameter.dac1Reg, parameter.dac1(i), false));
+    for(size_t j = 0; j < parameter.dac2Steps(); j++) {
+      steps.push_back(scanStep(parameter.dac2Reg, parameter.dac2(j), true));
+    }
+  }
+  return steps;
+}
+
+bool hal::FirmwareScanCheaper(size_t fwSteps, size_t hostSteps, int32_t nTriggers, size_t hostRoundtrips) {
+
+  // The firmware scan runs all values from zero in a single call, the
+  // host-side scan pays the DAC setting and call overhead for every step:
+  uint64_t firmware = static_cast<uint64_t>(fwSteps)*nTriggers*SCAN_COST_TRIGGER + _linkRoundtrip;
+  uint64_t host = static_cast<uint64_t>(hostSteps)*(nTriggers*SCAN_COST_TRIGGER + SCAN_COST_STEP) + hostRoundtrips*_linkRoundtrip;
+  LOG(logDEBUGHAL) << "Scan cost estimate: firmware " << firmware << ", host-side " << host;
+  return firmware <= host;
+}
+
+void hal::MeasureLink() {
+
+  // Time a few calls which only wait for their (tiny) reply:
+  const int calls = 8;
+  timeval start, stop;
+  gettimeofday(&start, NULL);
+  for(int i = 0; i < calls; i++) { _testboard->GetRpcCallCount(); }
+  gettimeofday(&stop, NULL);
+
+  int64_t elapsed = static_cast<int64_t>(stop.tv_sec - start.tv_sec)*1000000 + (stop.tv_usec - start.tv_usec);
+  if(elapsed > 0) _linkRoundtrip = std::max<uint64_t>(elapsed/calls, 1);
+
+  // Queue commands without reply and wait for one reply at their end, the
+  // time beyond the round trip is spent on the queued commands:
+  const int commands = 64;
+  gettimeofday(&start, NULL);
+  for(int i = 0; i < commands; i++) { _testboard->uDelay(0); }
+  _testboard->GetRpcCallCount();
+  gettimeofday(&stop, NULL);
+
+  elapsed = static_cast<int64_t>(stop.tv_sec - start.tv_sec)*1000000 + (stop.tv_usec - start.tv_usec);
+  if(elapsed > static_cast<int64_t>(_linkRoundtrip)) _linkCommand = std::max<uint64_t>((elapsed - _linkRoundtrip)/commands, 1);
+  LOG(logDEBUGHAL) << "Testboard round trip time: " << _linkRoundtrip << " us, " << _linkCommand << " us per queued command";
+}
+
+void hal::setTestControl(testControl * control) {
+  _control = control;
+}
+
+bool hal::Cancelled() {
+  return (_control != NULL && _control->cancelled());
+}
+
+void hal::Progress(size_t steps) {
+  if(_control != NULL) _control->advance(steps);
+}
+
+uint64_t hal::EstimateLoopCost(uint8_t strategy, const std::vector<pixelConfig> & pixels, size_t blocks, size_t probes, bool pipelined,
+			       int32_t nTriggers, uint8_t nRocs) {
+
+  if(strategy != LOOP_MULTIPIXEL) return EstimateLoopCost(strategy, pixels.size(), blocks, probes, pipelined, nTriggers, nRocs);
+
+  // Every group is triggered by the host and read back with one round trip,
+  // the columns and calibrate bits of every pixel are set and cleared:
+  uint64_t passes = blocks*probes;
+  uint64_t nPixels = pixels.size();
+  uint64_t groups = MultiPixelGroups(pixels).size();
+  return passes*(groups*(nTriggers*(SCAN_COST_TRIGGER + 2*_linkCommand) + _linkRoundtrip) + 3*nPixels*_linkCommand);
+}
+
+uint64_t hal::EstimateLoopCost(uint8_t strategy, size_t nPixels, size_t blocks, size_t probes, bool pipelined,
+			       int32_t nTriggers, uint8_t nRocs) {
+
+  // Size of one ROC map transfer (number of readouts and pulse height sum):
+  uint64_t mapTransfer = ROC_NUMCOLS*ROC_NUMROWS*(sizeof(int16_t) + sizeof(int32_t))*SCAN_COST_KBYTE/1024;
+  uint64_t passes = blocks*probes;
+  // A pass which needs the result of the previous one waits for its reply:
+  uint64_t wait = pipelined ? 0 : _linkRoundtrip;
+
+  switch(strategy) {
+  case LOOP_PIXEL:
+    // The firmware pulses the pixels one by one, pipelined calls only pay the
+    // call overhead:
+    return passes*static_cast<uint64_t>(nPixels)*(nTriggers*SCAN_COST_TRIGGER + SCAN_COST_STEP + wait) + _linkRoundtrip;
+
+  case LOOP_ROC:
+    // The firmware pulses every pixel of the ROC, one map per pass is transferred:
+    return passes*(ROC_NUMCOLS*ROC_NUMROWS*nTriggers*SCAN_COST_TRIGGER + mapTransfer + SCAN_COST_STEP + wait) + _linkRoundtrip;
+
+  case LOOP_MODULE:
+    {
+      // All ROCs are pulsed at the same time by the host, setting the calibrate
+      // bits takes four commands per ROC and pixel. Every column is read back
+      // with one round trip, every trigger yields one TBM event with a ROC
+      // header and one hit (three words) per ROC:
+      uint64_t pixels = ROC_NUMCOLS*ROC_NUMROWS;
+      uint64_t eventBytes = 2*(4 + 3*nRocs);
+      uint64_t pulses = pixels*(nTriggers*SCAN_COST_TRIGGER + 4*nRocs*_linkCommand);
+      uint64_t readout = ROC_NUMCOLS*_linkRoundtrip + pixels*nTriggers*eventBytes*SCAN_COST_KBYTE/1024;
+      return passes*(pulses + readout + nRocs*SCAN_COST_STEP);
+    }
+
+  default:
+    return 0;
+  }
+}
+
+void hal::PixelScanPipelined(uint8_t rocid, uint8_t column, uint8_t row, int32_t nTriggers, const std::vector<scanStep> & steps, pixelSink & sink) {
+
+  // The measurements of a scan are always pipelined, also when the caller
+  // did not open a pipeline:
+  bool pipelined = _pipelined;
+  _pipelined = true;
+
+  size_t block = 0;
+  _testboard->Lock();
+  try {
+    _testboard->roc_I2cAddr(rocid);
+    for(std::vector<scanStep>::const_iterator step = steps.begin(); step != steps.end(); ++step) {
+      _testboard->roc_SetDAC(step->reg, step->value);
+      if(!step->measure) continue;
+
+      // Let other threads (e.g. the power monitor) in between two steps:
+      YieldConnection(true);
+      pixelRequest request(pixelRequest::MEASUREMENT, rocid, column, row, sink);
+      request.block = block++;
+      QueuePixelRequest(request);
+      _testboard->CalibratePixel_Send(nTriggers, column, row);
+      CollectPixelRequests(SCAN_DEPTH_PIXEL);
+    }
+  }
+  catch(...) {
+    _testboard->Unlock();
+    AbortPixelRequests();
+    throw;
+  }
+  _testboard->Unlock();
+
+  if(!pipelined) endPipeline();
+}
+
+void hal::beginPipeline() {
+  LOG(logDEBUGHAL) << "Opening request pipeline.";
+  _pipelined = true;
+}
+
+void hal::endPipeline() {
+
+  // Collect everything still in flight:
+  _pipelined = false;
+  try { CollectPixelRequests(0); }
+  catch(...) {
+    AbortPixelRequests();
+    throw;
+  }
+  LOG(logDEBUGHAL) << "Request pipeline closed.";
+}
+
+void hal::QueuePixelRequest(const pixelRequest & request) {
+  _testboard->Lock();
+  _pixelRequests.push_back(request);
+}
+
+void hal::CollectPixelRequests(size_t maxPending) {
+
+  if(!_pipelined) maxPending = 0;
+
+  while(_pixelRequests.size() > maxPending) {
+    pixelRequest & request = _pixelRequests.front();
+
+    pixelCalibration newpixel;
+    newpixel.column = request.column;
+    newpixel.row = request.row;
+    newpixel.roc_id = request.rocid;
+
+    if(request.type == pixelRequest::MEASUREMENT) {
+      int16_t nReadouts;
+      int32_t PHsum;
+      int status = _testboard->CalibratePixel_Receive(nReadouts, PHsum);
+      LOG(logDEBUGHAL) << "Function returns: " << status;
+
+      // Hand both nReadouts and PHsum to the sink, it selects what to return:
+      newpixel.nhits = nReadouts;
+      newpixel.phsum = PHsum;
+      request.sink->push(request.block, newpixel);
+    }
+    else if(request.type == pixelRequest::DACSCAN) {
+      int status = _testboard->CalibrateDacScan_Receive(_rocmap.nReadouts, _rocmap.PHsum);
+      LOG(logDEBUGHAL) << "Firmware scan returns: " << status;
+
+      // Only return the requested part of the scan, block 0 corresponds to dacmin:
+      for(size_t block = 0; block < request.scan->blocks(); block++) {
+	newpixel.nhits = _rocmap.nReadouts.at(request.scan->dac(block));
+	newpixel.phsum = _rocmap.PHsum.at(request.scan->dac(block));
+	request.sink->push(block, newpixel);
       }
-      else {
-	// FIXME not nice, not safe:
-	newpixel.value =  static_cast<int32_t>(PHsum[i]);
+    }
+    else {
+      int status = _testboard->CalibrateDacDacScan_Receive(_rocmap.nReadouts, _rocmap.PHsum);
+      LOG(logDEBUGHAL) << "Firmware scan returns: " << status;
+
+      // Only return the requested part of the scan, the second DAC runs fastest:
+      const dacDacScanParameters & parameter = *request.dacdac;
+      for(size_t i = 0; i < parameter.dac1Steps(); i++) {
+	for(size_t j = 0; j < parameter.dac2Steps(); j++) {
+	  size_t position = parameter.dac1(i)*parameter.dac2Max + parameter.dac2(j);
+	  newpixel.nhits = _rocmap.nReadouts.at(position);
+	  newpixel.phsum = _rocmap.PHsum.at(position);
+	  request.sink->push(i*parameter.dac2Steps() + j, newpixel);
+	}
+      }
+    }
+
+    _pixelRequests.pop_front();
+    _testboard->Unlock();
+  }
+}
+
+void hal::AbortPixelRequests() {
+
+  LOG(logERROR) << "Dropping " << _pixelRequests.size() << " outstanding requests.";
+  for(; !_pixelRequests.empty(); _pixelRequests.pop_front()) { _testboard->Unlock(); }
+  _pipelined = false;
+}
+
+void hal::RocScanPipelined(uint8_t rocid, int32_t nTriggers, const std::vector<scanStep> & steps, pixelSink & sink) {
+
+  size_t pending = 0, block = 0;
+
+  // Set the correct ROC I2C address:
+  _testboard->roc_I2cAddr(rocid);
+
+  // Hold the connection, so no other thread can read one of our replies. It is
+  // only handed over between two maps once all pending maps are received:
+  _testboard->Lock();
+  try {
+    for(std::vector<scanStep>::const_iterator step = steps.begin(); step != steps.end(); ++step) {
+      // Stop requesting maps when cancelled, the pending ones are still received:
+      if(Cancelled()) break;
+      _testboard->roc_SetDAC(step->reg, step->value);
+      if(!step->measure) continue;
+
+      // Receive the pending maps before another thread gets the connection:
+      if(ConnectionClaimed()) {
+	for(; pending > 0; pending--) {
+	  int status = _testboard->CalibrateMap_Receive(_rocmap.nReadouts, _rocmap.PHsum);
+	  LOG(logDEBUGHAL) << "Block " << block << ": function returns " << status;
+	  sink.push(block++, rocid, _rocmap);
+	  Progress(1);
+	}
+	YieldConnection(true);
+      }
+
+      // The DAC setting is queued behind the running map, so the next map is
+      // requested before the previous one is received:
+      _testboard->CalibrateMap_Send(nTriggers);
+      pending++;
+
+      if(pending < SCAN_DEPTH_MAP) continue;
+      int status = _testboard->CalibrateMap_Receive(_rocmap.nReadouts, _rocmap.PHsum);
+      LOG(logDEBUGHAL) << "Block " << block << ": function returns " << status;
+      sink.push(block++, rocid, _rocmap);
+      Progress(1);
+      pending--;
+    }
+
+    for(; pending > 0; pending--) {
+      int status = _testboard->CalibrateMap_Receive(_rocmap.nReadouts, _rocmap.PHsum);
+      LOG(logDEBUGHAL) << "Block " << block << ": function returns " << status;
+      sink.push(block++, rocid, _rocmap);
+      Progress(1);
+    }
+  }
+  catch(...) {
+    _testboard->Unlock();
+    throw;
+  }
+  _testboard->Unlock();
+}
+
+void hal::daqReadAll(std::vector<uint16_t> &data) {
+
+  data.clear();
+  std::vector<uint16_t> block;
+  uint32_t remaining = 0;
+
+  // Read blocks until the DTB reports an empty buffer:
+  do {
+    _testboard->Daq_Read(block, DAQ_READ_SIZE, remaining);
+    data.insert(data.end(), block.begin(), block.end());
+  } while(remaining > 0 && !block.empty());
+}
+
+std::vector<pixel> hal::decodeRocReadout(uint8_t rocid, std::vector<uint16_t> &data) {
+
+  std::vector<pixel> hits;
+  bool header = false;
+  bool first = true;
+  uint32_t raw = 0;
+
+  for(std::vector<uint16_t>::iterator it = data.begin(); it != data.end(); ++it) {
+    if(((*it) & DAQ_ROC_HEADER_MASK) == DAQ_ROC_HEADER_ID) {
+      // New ROC header, hits follow as pairs of words:
+      header = true;
+      first = true;
+      continue;
+    }
+
+    // Data without preceding ROC header cannot be assigned:
+    if(!header) continue;
+
+    if(first) { raw = ((*it) & DAQ_ROC_DATA_MASK) << 12; }
+    else {
+      raw |= ((*it) & DAQ_ROC_DATA_MASK);
+      pixel hit;
+      hit.decodeRaw(rocid,raw);
+      hits.push_back(hit);
+    }
+    first = !first;
+  }
+
+  return hits;
+}
+
+size_t hal::decodeModuleReadout(std::vector<uint16_t> &data, std::vector<pixel> &hits, std::vector<size_t> &events) {
+
+  hits.clear();
+  events.clear();
+  size_t nEvents = 0;
+  int32_t rocid = -1;
+  uint32_t raw = 0;
+
+  for(std::vector<uint16_t>::iterator it = data.begin(); it != data.end(); ++it) {
+    switch((*it) & DAQ_WORD_ID_MASK) {
+    case DAQ_TBM_HEADER_1:
+      // New event, restart the ROC counting:
+      nEvents++;
+      rocid = -1;
+      break;
+    case DAQ_ROC_HEADER:
+      rocid++;
+      break;
+    case DAQ_ROC_DATA_1:
+      raw = ((*it) & DAQ_ROC_DATA_MASK) << 12;
+      break;
+    case DAQ_ROC_DATA_2:
+      {
+	raw |= ((*it) & DAQ_ROC_DATA_MASK);
+	// Hits without preceding ROC header cannot be assigned:
+	if(rocid < 0) break;
+	pixel hit;
+	hit.decodeRaw(rocid,raw);
+	hits.push_back(hit);
+	events.push_back(nEvents-1);
       }
-      data.push_back(newpixel);
-      result->push_back(data);
+      break;
+    default:
+      // TBM header and trailer data words carry no pixel information:
+      break;
     }
   }
 
-  return result;
+  return nEvents;
 }
 
 
-std::vector< std::vector<pixel> >* hal::DummyPixelTestSkeleton(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter) {
+bool hal::RocCalibrateAnalogLevels(uint8_t rocid, int32_t nTriggers) {
+
+  LOG(logDEBUGHAL) << "Calibrating analog levels of ROC " << static_cast<int>(rocid) << ".";
+
+  // Set the correct ROC I2C address:
+  _testboard->roc_I2cAddr(rocid);
+
+  daqSelectAdc();
+  _testboard->uDelay(100);
+  _testboard->Daq_Start();
+  _testboard->uDelay(100);
+
+  // Pulse one pixel per column, with rows chosen such that all address
+  // levels appear in the readout:
+  for(uint8_t column = 0; column < ROC_NUMCOLS; column++) {
+    uint8_t row = (column*7) % ROC_NUMROWS;
+    _testboard->roc_Col_Enable(column, true);
+    _testboard->roc_Pix_Cal(column, row, false);
+    for(int32_t k = 0; k < nTriggers; k++) {
+      _testboard->Pg_Single();
+      _testboard->uDelay(20);
+    }
+    _testboard->roc_ClrCal();
+    _testboard->roc_Col_Enable(column, false);
+  }
+
+  std::vector<uint16_t> data;
+  daqReadAll(data);
+  _testboard->Daq_Stop();
+  _testboard->Daq_Close();
+  _testboard->Flush();
+
+  // Split the samples into events and learn the levels:
+  analogCalibrator calibrator;
+  std::vector<int16_t> samples;
+  for(std::vector<uint16_t>::iterator it = data.begin(); it != data.end(); ++it) {
+    if((*it) & DAQ_ADC_EVENT_START) samples.clear();
+    samples.push_back(expandAdcSample(*it));
+    if((*it) & DAQ_ADC_EVENT_END) calibrator.add(&samples[0], samples.size());
+  }
+
+  LOG(logDEBUGHAL) << "Recorded " << data.size() << " ADC samples in " << calibrator.events() << " events.";
+  return calibrator.calibrate(_analoglevels[rocid]);
+}
+
+void hal::daqSelectAdc() {
+
+  // Route the ROC output to the ADC and sample a fixed block per trigger,
+  // starting with the token:
+  _testboard->SignalProbeADC(PROBEA_SDATA1, GAIN_1);
+  _testboard->Daq_Open(DAQ_BUFFER_SIZE);
+  _testboard->Daq_Select_ADC(DAQ_ADC_BLOCK_SIZE, 1, 4, 6);
+}
+
+bool hal::daqStart(bool tbm, uint8_t nRocs, uint8_t nChannels, bool analog, uint8_t analogRoc) {
+
+  pthread_mutex_lock(&_daqMutex);
+  if(_daqRunning) {
+    pthread_mutex_unlock(&_daqMutex);
+    LOG(logERROR) << "DAQ is already running.";
+    return false;
+  }
+
+  LOG(logDEBUGHAL) << "Starting new DAQ session with " << static_cast<int>(nRocs)
+		   << (tbm ? " ROCs behind TBM, " : " ROC(s), no TBM, ")
+		   << static_cast<int>(nChannels) << " decoder channel(s).";
+
+  // Analog ROCs are decoded with the levels calibrated for them:
+  std::map<uint8_t,analogLevels>::const_iterator levels = _analoglevels.find(analogRoc);
+  if(analog && (levels == _analoglevels.end() || !levels->second.valid)) {
+    pthread_mutex_unlock(&_daqMutex);
+    LOG(logERROR) << "Analog readout levels of ROC " << static_cast<int>(analogRoc) << " have not been calibrated.";
+    return false;
+  }
+
+  // Fresh decoder pipeline, drop all events left from previous sessions:
+  delete _daqPipeline;
+  _daqPipeline = new decoderPipeline(tbm, nRocs, nChannels, analog ? &levels->second : NULL);
+  if(!_daqPipeline->ready()) {
+    delete _daqPipeline;
+    _daqPipeline = NULL;
+    pthread_mutex_unlock(&_daqMutex);
+    LOG(logERROR) << "Could not start the DAQ decoder threads.";
+    return false;
+  }
+
+  if(analog) { daqSelectAdc(); }
+  else {
+    _testboard->Daq_Open(DAQ_BUFFER_SIZE);
+    _testboard->Daq_Select_Deser160(_deser160phase);
+  }
+  _testboard->uDelay(100);
+  _testboard->Daq_Start();
+  _testboard->uDelay(100);
+  _testboard->Flush();
+
+  _daqRunning = true;
+  if(pthread_create(&_daqThread, NULL, &hal::daqRun, this) != 0) {
+    _daqRunning = false;
+    pthread_mutex_unlock(&_daqMutex);
+    LOG(logERROR) << "Could not start the DAQ reader thread.";
+    _testboard->Daq_Stop();
+    _testboard->Daq_Close();
+    return false;
+  }
+  pthread_mutex_unlock(&_daqMutex);
+  return true;
+}
+
+bool hal::daqEvent(event & ev) {
+  if(!_daqPipeline) return false;
+  return _daqPipeline->pop(ev);
+}
+
+void hal::daqTrigger(uint32_t nTrig) {
+
+  for(uint32_t k = 0; k < nTrig; k++) {
+    _testboard->Pg_Single();
+    _testboard->uDelay(20);
+  }
+  _testboard->Flush();
+}
+
+bool hal::daqStop() {
+
+  pthread_mutex_lock(&_daqMutex);
+  if(!_daqRunning) {
+    pthread_mutex_unlock(&_daqMutex);
+    return false;
+  }
+  _daqRunning = false;
+  pthread_mutex_unlock(&_daqMutex);
+
+  // Stop the data taking on the DTB, the reader thread drains the buffer:
+  _testboard->Daq_Stop();
+  _testboard->Flush();
+
+  // Do not block the decoders on full queues anymore, consumers still
+  // receive the buffered events:
+  _daqPipeline->release();
+  pthread_join(_daqThread, NULL);
+
+  _testboard->Daq_Close();
+  _testboard->Flush();
+
+  LOG(logDEBUGHAL) << "DAQ stopped: " << _daqPipeline->words() << " words, "
+		   << _daqPipeline->events() << " events, "
+		   << _daqPipeline->corrupt() << " corrupt, "
+		   << _daqPipeline->dropped() << " dropped, "
+		   << _daqPipeline->mismatched() << " unmatched between channels.";
+  return true;
+}
+
+void * hal::daqRun(void * halInstance) {
+  static_cast<hal*>(halInstance)->daqLoop();
+  return NULL;
+}
+
+void hal::daqLoop() {
+
+  std::vector<uint16_t> block;
+  block.reserve(DAQ_READ_SIZE);
+
+  while(true) {
+    pthread_mutex_lock(&_daqMutex);
+    bool running = _daqRunning;
+    pthread_mutex_unlock(&_daqMutex);
+    if(!running) break;
+
+    // Nothing arrived, give the main thread some time to trigger:
+    if(daqProcessBlock(block) == 0) mDelay(1);
+  }
+
+  // Drain the data still stored on the DTB and hand out the last events:
+  while(daqProcessBlock(block) > 0) {}
+  _daqPipeline->finish();
+}
+
+size_t hal::daqProcessBlock(std::vector<uint16_t> &block) {
+
+  uint32_t remaining = 0;
+  try {
+    _testboard->Daq_Read(block, DAQ_READ_SIZE, remaining);
+  }
+  catch(CRpcError &e) {
+    e.What();
+    LOG(logERROR) << "DAQ reader could not read the testboard buffer.";
+    return 0;
+  }
+
+  _daqPipeline->process(block);
+  return block.size();
+}
+
+
+void hal::DummyPixelTestSkeleton(uint8_t rocid, uint8_t column, uint8_t row, const dacScanParameters & parameter, pixelSink & sink) {
 
   LOG(logDEBUGHAL) << "Called DummyPixelTestSkeleton routine";
   // pack some random data
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
   // we 'scan' dac values
-  int32_t dacreg = parameter.at(0);
-  int32_t dacmin = parameter.at(1);
-  int32_t dacmax = parameter.at(2);
+  int32_t dacreg = parameter.dacReg;
+  int32_t dacmin = parameter.dacMin;
+  int32_t dacmax = parameter.dacMax;
 
   LOG(logDEBUGHAL) << "\"scanning\" DAC " << dacreg << " from " << dacmin << " to " << dacmax;
-  for (int i=dacmin;i<dacmax;i++) {
-    std::vector<pixel> dacscan;
+  for (size_t block=0;block<parameter.blocks();block++) {
+    int i = parameter.dac(block);
     pixel newpixel;
     newpixel.column = column;
     newpixel.row = row;
     newpixel.roc_id = rocid;
     newpixel.value = rocid*column+row*i;
-    dacscan.push_back(newpixel);
-    result->push_back(dacscan);
+    sink.push(block, newpixel);
   }
-  return result;
 }
 
-std::vector< std::vector<pixel> >* hal::DummyRocTestSkeleton(uint8_t rocid, std::vector<int32_t> parameter) {
+void hal::DummyRocTestSkeleton(uint8_t rocid, const dacScanParameters & parameter, pixelSink & sink) {
 
   LOG(logDEBUGHAL) << "Called DummyRocTestSkeleton routine";
   // pack some random data
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
   // we 'scan' dac values
-  int32_t dacreg = parameter.at(0);
-  int32_t dacmin = parameter.at(1);
-  int32_t dacmax = parameter.at(2);
+  int32_t dacreg = parameter.dacReg;
+  int32_t dacmin = parameter.dacMin;
+  int32_t dacmax = parameter.dacMax;
 
   LOG(logDEBUGHAL) << "\"scanning\" DAC " << dacreg << " from " << dacmin << " to " << dacmax;
-  for (int i=dacmin;i<dacmax;i++){
-    std::vector<pixel> dacscan;
+  for (size_t block=0;block<parameter.blocks();block++){
+    int i = parameter.dac(block);
     // over the full roc
-    for (int column=0;column<52;column++){
-      for (int row=0;row<80;row++){
+    for (int column=0;column<ROC_NUMCOLS;column++){
+      for (int row=0;row<ROC_NUMROWS;row++){
 	pixel newpixel;
 	newpixel.column = column;
 	newpixel.row = row;
 	newpixel.roc_id = rocid;
 	newpixel.value = rocid*column+row*i;
-	dacscan.push_back(newpixel);
+	sink.push(block, newpixel);
       }
     }
-    result->push_back(dacscan);
   }
-  return result;
 }
 
-std::vector< std::vector<pixel> >* hal::DummyModuleTestSkeleton(std::vector<int32_t> parameter){
+void hal::DummyModuleTestSkeleton(const dacScanParameters & parameter, pixelSink & sink){
   LOG(logDEBUGHAL) << " called DummyModuleTestSkeleton routine";
   // pack some random data
-  std::vector< std::vector<pixel> >* result = new std::vector< std::vector<pixel> >();
-  for (int rocid=0;rocid<16;rocid++){
+  for (int rocid=0;rocid<MOD_NUMROCS;rocid++){
     // we 'scan' dac values
-    int32_t dacreg = parameter.at(0);
-    int32_t dacmin = parameter.at(1);
-    int32_t dacmax = parameter.at(2);
+    int32_t dacreg = parameter.dacReg;
+    int32_t dacmin = parameter.dacMin;
+    int32_t dacmax = parameter.dacMax;
 
     LOG(logDEBUGHAL) << "\"scanning\" DAC " << dacreg << " from " << dacmin << " to " << dacmax;
-    for (int i=dacmin;i<dacmax;i++) {
-      std::vector<pixel> dacscan;
+    for (size_t block=0;block<parameter.blocks();block++) {
+      int i = parameter.dac(block);
       // over the full roc
-      for (int column=0;column<52;column++){
-	for (int row=0;row<80;row++){
+      for (int column=0;column<ROC_NUMCOLS;column++){
+	for (int row=0;row<ROC_NUMROWS;row++){
 	  pixel newpixel;
 	  newpixel.column = column;
 	  newpixel.row = row;
 	  newpixel.roc_id = rocid;
 	  newpixel.value = rocid*column+row*i;
-	  dacscan.push_back(newpixel);
+	  sink.push(block, newpixel);
 	}
       }
-      result->push_back(dacscan);
     }
   }
-  return result;
 }
 
 
@@ -852,15 +1985,19 @@ void hal::HVoff() {
 }
  
 void hal::Pon() {
-  // Turn on DUT power and execute (flush):
+  // Turn on DUT power and execute (flush), then wait for the DUT to settle:
+  LOG(logDEBUGHAL) << "Turn testboard ouput power on.";
   _testboard->Pon();
   _testboard->Flush();
+  mDelay(400);
+  _powered = true;
 }
 
 void hal::Poff() {
   // Turn off DUT power and execute (flush):
   _testboard->Poff();
   _testboard->Flush();
+  _powered = false;
 }
 
 
@@ -890,3 +2027,54 @@ void hal::SignalProbeA2(uint8_t signal) {
   _testboard->uDelay(100);
   _testboard->Flush();
 }
+
+void hal::claimConnection() {
+  pthread_mutex_lock(&_claimMutex);
+  _claims++;
+  pthread_mutex_unlock(&_claimMutex);
+}
+
+void hal::releaseConnection() {
+  pthread_mutex_lock(&_claimMutex);
+  if(_claims > 0) _claims--;
+  pthread_cond_broadcast(&_claimReleased);
+  pthread_mutex_unlock(&_claimMutex);
+}
+
+bool hal::ConnectionClaimed() {
+  pthread_mutex_lock(&_claimMutex);
+  bool claimed = (_claims > 0);
+  pthread_mutex_unlock(&_claimMutex);
+  return claimed;
+}
+
+void hal::YieldConnection(bool locked) {
+
+  if(!ConnectionClaimed()) return;
+
+  // Replies in flight would be read by the claiming thread, collect them first:
+  try { CollectPixelRequests(0); }
+  catch(...) {
+    AbortPixelRequests();
+    throw;
+  }
+
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  uint64_t usec = static_cast<uint64_t>(tv.tv_usec) + SCAN_YIELD_TIMEOUT*1000;
+  struct timespec deadline;
+  deadline.tv_sec = tv.tv_sec + usec/1000000;
+  deadline.tv_nsec = (usec%1000000)*1000;
+
+  if(locked) _testboard->Unlock();
+  pthread_mutex_lock(&_claimMutex);
+  while(_claims > 0) {
+    // The claiming thread cannot get the connection if our caller holds it as well:
+    if(pthread_cond_timedwait(&_claimReleased, &_claimMutex, &deadline) == ETIMEDOUT) {
+      LOG(logDEBUGHAL) << "Connection claim not released in time, continuing.";
+      break;
+    }
+  }
+  pthread_mutex_unlock(&_claimMutex);
+  if(locked) _testboard->Lock();
+}
@@ -3,6 +3,10 @@
 
 #include "rpc_impl.h"
 #include "api.h"
+#include "datatypes.h"
+#include "datapipe.h"
+#include "threshold.h"
+#include <deque>
 
 namespace pxar {
 
@@ -37,16 +41,16 @@ namespace pxar {
      */
     bool flashTestboard(std::ifstream& flashFile);
 
-    /** Initialize attached TBMs with their settings and configuration
+    /** Program the full DUT according to the given programming plan
+     *  Powers the testboard output if it is off and emits all TBM register,
+     *  ROC DAC, mask and trim commands into the write buffer. I2C addresses
+     *  are only set when the target device changes. Everything is sent with
+     *  a single flush, the number of commands executed is reported once the
+     *  testboard replies. The TBM registers are read back and compared to the
+     *  plan, the ROC registers cannot be read back. Returns false if the
+     *  transfer or the TBM verification fails.
      */
-    void initTBM(uint8_t tbmId, std::map< uint8_t,uint8_t > regVector);
-
-    /** Initialize attached ROCs with their settings and configuration
-     *  This is the startup-routine for single ROCs. It first powers up the
-     *  testboard output if necessary, sets the ROC's I2C address and then
-     *  programs all DAC registers for the given ROC.
-     */
-    void initROC(uint8_t rocId, std::map< uint8_t,uint8_t > dacVector);
+    bool programDUT(const programmingPlan & plan);
 
     /** turn off HV
      */
@@ -56,11 +60,11 @@ namespace pxar {
      */
     void HVon();
 
-    /** turn on power
+    /** turn on power, waits for the DUT to settle
      */
     void Pon();
 
-    /** turn off power
+    /** turn off power, the DUT has to be programmed again
      */
     void Poff();
 
@@ -68,24 +72,27 @@ namespace pxar {
      */
     bool rocSetDAC(uint8_t rocId, uint8_t dacId, uint8_t dacValue);
 
-    /** Set all DACs on a specific ROC rocId
-     *  DACs are provided as map of uint8_t,uint8_t pairs  with DAC Id and DAC value.
-     */
-    bool rocSetDACs(uint8_t rocId, std::map< uint8_t, uint8_t > dacPairs);
-
     /** Set a register on a specific TBM tbmId
      */
     bool tbmSetReg(uint8_t tbmId, uint8_t regId, uint8_t regValue);
 
-    /** Set all registers on a specific TBM tbmId
-     *  registers are provided as map of uint8_t,uint8_t pairs with Reg Id and value.
-     */
-    bool tbmSetRegs(uint8_t tbmId, std::map< uint8_t, uint8_t > regPairs);
-
     /** Function to set and update the pattern generator command list on the DTB
+     *  Only commands differing from the program currently loaded in the PG
+     *  memory are written, an identical program is not uploaded at all.
      */
     void SetupPatternGenerator(std::vector<std::pair<uint16_t,uint8_t> > pg_setup);
 
+    /** Store a (verified) pattern generator command list under the given
+     *  name for later use with SelectPatternGenerator. An existing program
+     *  with the same name is replaced.
+     */
+    void DefinePatternGenerator(std::string name, std::vector<std::pair<uint16_t,uint8_t> > pg_setup);
+
+    /** Load the named pattern generator program into the PG memory, returns
+     *  false if no program with this name has been defined
+     */
+    bool SelectPatternGenerator(std::string name);
+
     // TESTBOARD GET COMMANDS
     /** Read the testboard analog current
      */
@@ -123,45 +130,202 @@ namespace pxar {
 
 
     // TEST COMMANDS
-    std::vector< std::vector<pixel> >* DummyPixelTestSkeleton(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
-    std::vector< std::vector<pixel> >* DummyRocTestSkeleton(uint8_t rocid, std::vector<int32_t> parameter);
-    std::vector< std::vector<pixel> >* DummyModuleTestSkeleton(std::vector<int32_t> parameter);
+    // All test functions push their results into the given output sink, the
+    // data blocks are defined by the parameter set (e.g. one per DAC value).
+    void DummyPixelTestSkeleton(uint8_t rocid, uint8_t column, uint8_t row, const dacScanParameters & parameter, pixelSink & sink);
+    void DummyRocTestSkeleton(uint8_t rocid, const dacScanParameters & parameter, pixelSink & sink);
+    void DummyModuleTestSkeleton(const dacScanParameters & parameter, pixelSink & sink);
 
     //FIXME DEBUG
     int32_t PH(int32_t col, int32_t row, int32_t trim, int16_t nTriggers);
 
     /** Function to return ROC maps of calibration pulses
      *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
-     *  Private flags allow selection of output value (pulse height or efficiency)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
      */
-    std::vector< std::vector<pixel> >* RocCalibrateMap(uint8_t rocid, std::vector<int32_t> parameter);
+    void RocCalibrateMap(uint8_t rocid, const calibrateParameters & parameter, pixelSink & sink);
+
+    /** Function to scan a given DAC for all pixels of a ROC
+     *  The DAC is stepped on the host and a full ROC map is taken for each DAC value.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void RocCalibrateDacScan(uint8_t rocid, const dacScanParameters & parameter, pixelSink & sink);
+
+    /** Function to scan two given DAC ranges for all pixels of a ROC
+     *  Both DACs are stepped on the host and a full ROC map is taken for each DAC pair.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void RocCalibrateDacDacScan(uint8_t rocid, const dacDacScanParameters & parameter, pixelSink & sink);
 
     /** Function to return "Pixel maps" of calibration pulses, i.e. pinging a single pixel.
      *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
-     *  Private flags allow selection of output value (pulse height or efficiency)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void PixelCalibrateMap(uint8_t rocid, uint8_t column, uint8_t row, const calibrateParameters & parameter, pixelSink & sink);
+
+    /** Function to return "Pixel maps" of calibration pulses for a set of pixels of one ROC
+     *  Several pixels are pulsed in parallel (at most one per double column) and the
+     *  hits are assigned to the pixels via their decoded addresses.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
      */
-    std::vector< std::vector<pixel> >* PixelCalibrateMap(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
+    void MultiPixelCalibrateMap(uint8_t rocid, const std::vector<pixelConfig> & pixels, const calibrateParameters & parameter, pixelSink & sink);
+
+    /** Function to scan a given DAC for a set of pixels of one ROC
+     *  Several pixels are pulsed in parallel (at most one per double column) for every DAC value.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void MultiPixelCalibrateDacScan(uint8_t rocid, const std::vector<pixelConfig> & pixels, const dacScanParameters & parameter, pixelSink & sink);
 
     /** Function to scan a given DAC for a pixel
      *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
-     *  Private flags allow selection of output value (pulse height or efficiency)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
      */
-    std::vector< std::vector<pixel> >* PixelCalibrateDacScan(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
+    void PixelCalibrateDacScan(uint8_t rocid, uint8_t column, uint8_t row, const dacScanParameters & parameter, pixelSink & sink);
 
     /** Function to scan two given DAC ranges for a pixel
      *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
-     *  Private flags allow selection of output value (pulse height or efficiency)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void PixelCalibrateDacDacScan(uint8_t rocid, uint8_t column, uint8_t row, const dacDacScanParameters & parameter, pixelSink & sink);
+
+    /** Function to return ROC maps of calibration pulses for all ROCs of a module at once.
+     *  All ROCs are pulsed in the same trigger sequence and read out via the TBM, the
+     *  data block contains the pixels of all ROCs.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void ModuleCalibrateMap(const calibrateParameters & parameter, pixelSink & sink);
+
+    /** Function to scan a given DAC for all pixels of all ROCs of a module at once.
+     *  The result contains one data block per DAC value with the pixels of all ROCs.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  Both the number of readouts and the pulse height sum are passed to the sink
+     */
+    void ModuleCalibrateDacScan(const dacScanParameters & parameter, pixelSink & sink);
+
+    /** Function to measure the thresholds of all pixels of a ROC
+     *  The thresholds are found by a batched bisection: every probe sets the
+     *  threshold DAC once and takes a full ROC map. With further DACs scanned,
+     *  each search starts from the thresholds of the previous DAC setting.
+     *  Public flags contain possibility to route the calibrate pulse via the sensor (FLAG_USE_CALS)
+     *  The pixel value is the threshold, pixels without threshold in range are skipped
+     */
+    void RocThresholdMap(uint8_t rocid, const thresholdParameters & parameter, pixelSink & sink);
+
+    /** Function to measure the thresholds of a set of pixels of one ROC
+     *  As RocThresholdMap, but only the pixels which still profit from a probe
+     *  are pulsed, several of them in parallel.
+     *  The pixel value is the threshold, pixels without threshold in range are skipped
+     */
+    void MultiPixelThresholdMap(uint8_t rocid, const std::vector<pixelConfig> & pixels, const thresholdParameters & parameter, pixelSink & sink);
+
+    /** Function to measure the threshold of a single pixel
+     *  Uses the firmware threshold search (PixelThreshold) if it is expected to be
+     *  faster than the host-side bisection, e.g. for few triggers or when starting
+     *  close to the threshold of the previous DAC setting.
+     *  The pixel value is the threshold, the pixel is skipped if there is none in range
+     */
+    void PixelThresholdMap(uint8_t rocid, uint8_t column, uint8_t row, const thresholdParameters & parameter, pixelSink & sink);
+
+    /** Function to measure the thresholds of all pixels of all ROCs of a module at once.
+     *  Every ROC gets its own threshold DAC value per probe, so all ROCs are
+     *  searched in parallel with the same trigger sequence.
+     *  The pixel value is the threshold, pixels without threshold in range are skipped
      */
-    std::vector< std::vector<pixel> >* PixelCalibrateDacDacScan(uint8_t rocid, uint8_t column, uint8_t row, std::vector<int32_t> parameter);
+    void ModuleThresholdMap(const thresholdParameters & parameter, pixelSink & sink);
 
-    /** Mask all pixels on a specific ROC rocId
+    /** Open a pipeline for the following single pixel test functions
+     *  PixelCalibrateMap, PixelCalibrateDacScan and PixelCalibrateDacDacScan
+     *  only send their requests and return. The replies are collected in
+     *  request order and pushed to the sinks while further requests are sent,
+     *  with a bounded number of requests in flight. Sinks and parameters of
+     *  the calls have to stay valid until the pipeline is closed.
      */
-    void RocSetMask(uint8_t rocid, bool mask, std::vector<pixelConfig> pixels = std::vector<pixelConfig>());
+    void beginPipeline();
+
+    /** Collect all outstanding replies and close the pipeline
+     */
+    void endPipeline();
+
+    /** Attach the control of the running test (NULL for none). The test
+     *  functions report their progress per data block to it and stop after
+     *  the current data block if the test is cancelled.
+     */
+    void setTestControl(testControl * control);
+
+    /** Estimate the run time (in microseconds) of a test with the given
+     *  number of data blocks and triggers, executed with the given strategy
+     *  (LOOP_*) on the enabled pixels of one ROC. Every block takes the given
+     *  number of calibrate passes (probes), passes which are not pipelined
+     *  wait for their reply. For LOOP_MODULE nRocs ROCs are read out in
+     *  parallel. The estimate uses the measured link timing.
+     */
+    uint64_t EstimateLoopCost(uint8_t strategy, const std::vector<pixelConfig> & pixels, size_t blocks, size_t probes, bool pipelined,
+			      int32_t nTriggers, uint8_t nRocs = 1);
+
+    /** As above for the strategies which only depend on the number of
+     *  pixels (all but LOOP_MULTIPIXEL, which returns 0)
+     */
+    uint64_t EstimateLoopCost(uint8_t strategy, size_t nPixels, size_t blocks, size_t probes, bool pipelined,
+			      int32_t nTriggers, uint8_t nRocs = 1);
+
+    /** Mask all pixels on a specific ROC rocId, or unmask them and trim the
+     *  configured pixels of the given ROC configuration (all others to 15)
+     */
+    void RocSetMask(uint8_t rocid, bool mask, const rocConfig * config = NULL);
 
     /** Mask the specified pixel on ROC rocId
      */
     void PixelSetMask(uint8_t rocid, uint8_t column, uint8_t row, bool mask, uint8_t trim = 15);
 
+
+    // DAQ FUNCTIONS
+
+    /** Calibrate the analog readout levels of the given (analog) ROC. A set of
+     *  pixels spread over the ROC is pulsed nTriggers times each, the ultrablack,
+     *  black and address levels are learned from the recorded ADC samples and
+     *  stored for this ROC.
+     */
+    bool RocCalibrateAnalogLevels(uint8_t rocid, int32_t nTriggers);
+
+    /** Start a data acquisition. A reader thread continuously fetches the DTB
+     *  DAQ buffer and hands the data to the decoder pipeline, which splits it
+     *  into events. For module readout (tbm = true) every event is expected to
+     *  carry nRocs ROC headers. With nChannels = 2 the frames of the two TBM
+     *  cores are decoded in parallel and merged by event number. An analog ROC
+     *  (analogRoc) is read out via the DTB ADC and decoded with its calibrated
+     *  levels.
+     */
+    bool daqStart(bool tbm, uint8_t nRocs, uint8_t nChannels = 1, bool analog = false, uint8_t analogRoc = 0);
+
+    /** Fetch the oldest buffered event, waiting for one to arrive if none is
+     *  buffered. Returns false if the DAQ has been stopped and all events have
+     *  been read.
+     */
+    bool daqEvent(event & ev);
+
+    /** Fire the programmed pattern generator sequence nTrig times
+     */
+    void daqTrigger(uint32_t nTrig = 1);
+
+    /** Stop the running data acquisition. Events still buffered in the queue
+     *  can be fetched with daqEvent() afterwards.
+     */
+    bool daqStop();
+
+    /** Claim the testboard connection for the calls of another thread, e.g.
+     *  the power monitor. Scans hold the connection while replies are in
+     *  flight; they collect their outstanding replies at the next step or
+     *  data block and wait up to SCAN_YIELD_TIMEOUT ms until the claim is
+     *  released. Every claim has to be released again.
+     */
+    void claimConnection();
+    void releaseConnection();
+
   private:
 
     /** Private instance of the testboard RPC interface, routes all
@@ -174,6 +338,20 @@ namespace pxar {
      */
     bool _initialized;
 
+    /** Power state of the testboard output as set by Pon() and Poff()
+     */
+    bool _powered;
+
+    /** Read back all TBM registers of the plan and compare them to the
+     *  planned values, returns false if any differs
+     */
+    bool VerifyTbmRegisters(const programmingPlan & plan);
+
+    /** Phase of the DTB deserializer for the digital ROC readout,
+     *  stored from the testboard initialization
+     */
+    uint8_t _deser160phase;
+
     /** Print the info block with software and firmware versions,
      *  MAC and USB ids etc. read from the connected testboard
      */
@@ -214,10 +392,233 @@ namespace pxar {
     void setTBvd(double VD);
 
 
-    /** Helper template function to compact and pack linear vectors into
-     *  pixel struct vectors
+    /** Preallocated storage for full ROC maps, reused by all map calls
+     */
+    rocMap _rocmap;
+
+    /** Preallocated storage for the ROC maps of a full module
+     */
+    std::vector<rocMap> _modulemaps;
+
+    /** Preallocated linear trim vector for programming full ROCs
+     */
+    std::vector<int8_t> _trimbuffer;
+
+    /** I2C addresses of the programmed ROCs, in the order the TBM reads them out
+     */
+    std::vector<uint8_t> _rocIds;
+
+    /** Helper function to pulse all pixels of all programmed ROCs in parallel
+     *  and read them out through the TBM. The number of readouts and the pulse
+     *  height sum are stored in the preallocated module maps, map k belongs to
+     *  the ROC _rocIds[k]. Returns false if a column could not be read out
+     *  completely or the test was cancelled, the maps are incomplete then.
+     */
+    bool ModuleCalibrateLoop(int32_t flags, int32_t nTriggers);
+
+    /** Helper function to pulse all pixels of one column on all programmed ROCs,
+     *  nTriggers times each
+     */
+    void ModulePulseColumn(uint8_t column, int32_t flags, int32_t nTriggers);
+
+    /** Helper function to pulse the given pixels of one ROC, several at a time,
+     *  and read them out via the DESER160. The number of readouts and the pulse
+     *  height sum are stored in the preallocated ROC map.
+     */
+    void MultiPixelCalibrateLoop(uint8_t rocid, const std::vector<pixelConfig> & pixels, int32_t flags, int32_t nTriggers);
+
+    /** Helper function to split a set of pixels into groups which can be pulsed in
+     *  parallel: at most one pixel per double column, with pixels in neighbouring
+     *  double columns at least two rows apart to avoid crosstalk.
+     */
+    std::vector< std::vector<pixelConfig> > MultiPixelGroups(const std::vector<pixelConfig> & pixels);
+
+    /** Helper function to decode single ROC readout data (ROC header followed by
+     *  its hits) read via the DESER160 into pixel hits.
+     */
+    std::vector<pixel> decodeRocReadout(uint8_t rocid, std::vector<uint16_t> &data);
+
+    /** Single step of a host-side scan: set a DAC and, if requested, take a
+     *  measurement afterwards
+     */
+    struct scanStep {
+    scanStep(uint8_t reg_, uint8_t value_, bool measure_) : reg(reg_), value(value_), measure(measure_) {};
+      uint8_t reg;
+      uint8_t value;
+      bool measure;
+    };
+
+    /** Helper function to build the host-side scan steps for a DAC scan
+     */
+    std::vector<scanStep> ScanSteps(const dacScanParameters & parameter);
+
+    /** Helper function to build the host-side scan steps for a DAC-DAC scan,
+     *  the first DAC is only written when its value changes
+     */
+    std::vector<scanStep> ScanSteps(const dacDacScanParameters & parameter);
+
+    /** Cost model for pixel scans: returns true if the firmware scan over
+     *  fwSteps DAC values is expected to be faster than the host-side scan
+     *  over hostSteps values with the given number of round trips
+     */
+    bool FirmwareScanCheaper(size_t fwSteps, size_t hostSteps, int32_t nTriggers, size_t hostRoundtrips = 1);
+
+    /** Measure the round trip time of the testboard connection and the
+     *  time per queued command for the cost estimates (in microseconds)
+     */
+    void MeasureLink();
+    uint64_t _linkRoundtrip;
+    uint64_t _linkCommand;
+
+    /** Control of the running test, NULL if none is attached
+     */
+    testControl * _control;
+
+    /** Returns true if the running test has been cancelled
+     */
+    bool Cancelled();
+
+    /** Report the given number of finished steps to the test control
+     */
+    void Progress(size_t steps);
+
+    /** Returns true if another thread claimed the testboard connection
+     */
+    bool ConnectionClaimed();
+
+    /** Hand the connection to claiming threads: collects all outstanding
+     *  pixel requests and waits for the claims to be released. A caller
+     *  holding the RPC lock once (locked) releases it for the wait.
+     */
+    void YieldConnection(bool locked);
+
+    /** Number of connection claims of other threads, protected by _claimMutex
+     */
+    size_t _claims;
+    pthread_mutex_t _claimMutex;
+    pthread_cond_t _claimReleased;
+
+    /** Outstanding request of a single pixel test: the type of the call,
+     *  the pixel and where its reply goes. Single measurements are pushed to
+     *  the given data block, firmware scans are unpacked with their parameters.
+     */
+    struct pixelRequest {
+      enum requestType { MEASUREMENT, DACSCAN, DACDACSCAN };
+    pixelRequest(requestType type_, uint8_t rocid_, uint8_t column_, uint8_t row_, pixelSink & sink_) :
+      type(type_), rocid(rocid_), column(column_), row(row_), block(0), scan(NULL), dacdac(NULL), sink(&sink_) {};
+      requestType type;
+      uint8_t rocid;
+      uint8_t column;
+      uint8_t row;
+      size_t block;
+      const dacScanParameters * scan;
+      const dacDacScanParameters * dacdac;
+      pixelSink * sink;
+    };
+
+    /** Register a request before it is sent. Every outstanding request holds
+     *  the testboard connection, so no other thread can read its reply.
+     */
+    void QueuePixelRequest(const pixelRequest & request);
+
+    /** Receive replies until at most maxPending requests are outstanding
+     *  (none if no pipeline is open) and push them to their sinks
+     */
+    void CollectPixelRequests(size_t maxPending);
+
+    /** Drop all outstanding requests after a communication error and
+     *  release the testboard connection
+     */
+    void AbortPixelRequests();
+
+    /** Outstanding requests in the order they were sent and the pipeline state
+     */
+    std::deque<pixelRequest> _pixelRequests;
+    bool _pipelined;
+
+    /** Host-side scan engine for single pixels: the DAC settings and
+     *  CalibratePixel requests of consecutive steps are sent without waiting
+     *  for the replies, measurement n is pushed to data block n
+     */
+    void PixelScanPipelined(uint8_t rocid, uint8_t column, uint8_t row, int32_t nTriggers, const std::vector<scanStep> & steps, pixelSink & sink);
+
+    /** Host-side scan engine for full ROCs: as PixelScanPipelined, with the
+     *  CalibrateMap of the next step requested before the previous map is
+     *  received. The measurements are pushed to the sink as consecutive blocks.
+     */
+    void RocScanPipelined(uint8_t rocid, int32_t nTriggers, const std::vector<scanStep> & steps, pixelSink & sink);
+
+    /** Helper function to set the further DACs of a threshold scan for the
+     *  given data block on the currently addressed ROC
+     */
+    void SetThresholdScanDacs(const thresholdParameters & parameter, size_t block);
+
+    /** Helper function to hand the thresholds found for a full ROC to the sink
+     */
+    void PushThresholds(uint8_t rocid, const thresholdSearch & search, size_t block, pixelSink & sink);
+
+    /** Trim values of all pixels as last programmed, used by the firmware
+     *  routines which set the trim bits themselves
+     */
+    std::map<uint8_t, std::vector<int8_t> > _trims;
+    void StoreTrim(uint8_t rocid, uint8_t column, uint8_t row, uint8_t trim);
+    uint8_t PixelTrim(uint8_t rocid, uint8_t column, uint8_t row);
+
+    /** Helper function to read all data currently stored in the DTB DAQ buffer
+     */
+    void daqReadAll(std::vector<uint16_t> &data);
+
+    /** Helper function to decode module readout data (TBM header, ROC headers
+     *  with their hits, TBM trailer) into pixel hits. ROC ids are assigned by the
+     *  order of the ROC headers within the TBM event, the index of the event
+     *  of every hit is stored in events. Returns the number of TBM events.
+     */
+    size_t decodeModuleReadout(std::vector<uint16_t> &data, std::vector<pixel> &hits, std::vector<size_t> &events);
+
+    /** Helper function to upload a compiled program to the Pattern Generator,
+     *  skipping all commands which are already in place
+     */
+    void UploadPatternGenerator(const pgProgram & program);
+
+    /** Named pattern generator programs, the program currently running on
+     *  the testboard and a shadow copy of the PG memory (empty if unknown)
+     */
+    std::map<std::string, pgProgram> _pgPrograms;
+    pgProgram _pgLoaded;
+    std::vector<uint16_t> _pgMemory;
+
+    /** Decoder pipeline of the current data acquisition, kept after stopping
+     *  the DAQ until all buffered events have been fetched
+     */
+    decoderPipeline * _daqPipeline;
+
+    /** Calibrated readout levels for analog ROCs, by ROC id
+     */
+    std::map<uint8_t,analogLevels> _analoglevels;
+
+    /** Helper function to set up the DTB ADC for the readout of analog ROCs
+     */
+    void daqSelectAdc();
+
+    /** DAQ reader thread and its run flag, protected by _daqMutex
+     */
+    pthread_t _daqThread;
+    pthread_mutex_t _daqMutex;
+    bool _daqRunning;
+
+    /** Entry point for the DAQ reader thread
+     */
+    static void * daqRun(void * halInstance);
+
+    /** Reader loop executed by the DAQ reader thread: read the DTB buffer and
+     *  hand the data to the event builder until the DAQ is stopped
+     */
+    void daqLoop();
+
+    /** Read the DTB DAQ buffer once and pass the data to the decoder pipeline,
+     *  returns the number of words read
      */
-    template <typename T> std::vector<pixel> delinearize(uint8_t rocId, std::vector<T> tvec);
+    size_t daqProcessBlock(std::vector<uint16_t> &block);
 
   };
 
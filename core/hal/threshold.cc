@@ -0,0 +1,105 @@
+/**
+ * pxar threshold search implementation
+ */
+
+#include "threshold.h"
+#include <algorithm>
+
+using namespace pxar;
+
+thresholdSearch::thresholdSearch(size_t nPixels, uint8_t thrMin, uint8_t thrMax, int32_t level, bool rising) :
+  _thrMin(thrMin), _thrMax(std::max(thrMin, thrMax)), _range(_thrMax - _thrMin + 1), _level(level), _rising(rising),
+  _pixels(), _below(nPixels, -1), _above(nPixels, _range), _seed(nPixels, -1), _guesses(_range, 0), _nProbes(0) {}
+
+void thresholdSearch::start() {
+
+  std::vector<size_t> pixels(_below.size());
+  for(size_t pixel = 0; pixel < pixels.size(); pixel++) { pixels[pixel] = pixel; }
+  start(pixels);
+}
+
+void thresholdSearch::start(const std::vector<size_t> & pixels) {
+
+  _pixels = pixels;
+  _nProbes = 0;
+
+  // Keep the results of the previous search as seeds:
+  for(std::vector<size_t>::const_iterator pixel = _pixels.begin(); pixel != _pixels.end(); ++pixel) {
+    _seed[*pixel] = (_above[*pixel] < _range) ? _above[*pixel] : -1;
+    _below[*pixel] = -1;
+    _above[*pixel] = _range;
+  }
+}
+
+int16_t thresholdSearch::guess(size_t pixel) const {
+
+  int16_t below = _below[pixel], above = _above[pixel], seed = _seed[pixel];
+
+  if(seed >= 0) {
+    // Try the seed itself first:
+    if(below < seed && seed < above) return seed;
+    // The threshold moved up, search upwards with doubling distance:
+    if(above == _range && below >= seed) return std::min<int16_t>(2*below - seed + 1, _range - 1);
+    // The threshold moved down, search downwards with doubling distance:
+    if(below == -1 && above <= seed) return std::max<int16_t>(2*above - seed - 1, 0);
+  }
+
+  // Plain bisection of the interval:
+  return below + (above - below)/2;
+}
+
+bool thresholdSearch::next(uint8_t & value) {
+
+  // Collect the preferred probe positions of all unfinished pixels:
+  std::fill(_guesses.begin(), _guesses.end(), 0);
+  size_t open = 0;
+  for(std::vector<size_t>::const_iterator pixel = _pixels.begin(); pixel != _pixels.end(); ++pixel) {
+    if(_above[*pixel] - _below[*pixel] <= 1) continue;
+    _guesses[guess(*pixel)]++;
+    open++;
+  }
+  if(open == 0) return false;
+
+  // Probe the median, so at least half of the unfinished pixels profit:
+  size_t sum = 0;
+  int16_t median = 0;
+  for(; median < _range; median++) {
+    sum += _guesses[median];
+    if(2*sum >= open) break;
+  }
+
+  value = dac(median);
+  _nProbes++;
+  return true;
+}
+
+bool thresholdSearch::probes(size_t pixel, uint8_t value) const {
+  int16_t pos = position(value);
+  return _below[pixel] < pos && pos < _above[pixel];
+}
+
+void thresholdSearch::update(uint8_t value, const std::vector<int16_t> & nReadouts) {
+  for(std::vector<size_t>::const_iterator pixel = _pixels.begin(); pixel != _pixels.end(); ++pixel) {
+    update(value, *pixel, nReadouts[*pixel]);
+  }
+}
+
+void thresholdSearch::update(uint8_t value, size_t pixel, int32_t nReadouts) {
+
+  // Only measurements inside the interval carry new information:
+  int16_t pos = position(value);
+  if(pos <= _below[pixel] || pos >= _above[pixel]) return;
+
+  if(nReadouts >= _level) _above[pixel] = pos;
+  else _below[pixel] = pos;
+}
+
+void thresholdSearch::seed(size_t pixel, int16_t threshold) {
+  bool valid = (threshold >= _thrMin && threshold <= _thrMax);
+  _below[pixel] = -1;
+  _above[pixel] = valid ? position(static_cast<uint8_t>(threshold)) : _range;
+}
+
+int16_t thresholdSearch::threshold(size_t pixel) const {
+  return (_above[pixel] < _range) ? dac(_above[pixel]) : -1;
+}
@@ -0,0 +1,113 @@
+/**
+ * pxar threshold search
+ * this file contains the batched bisection used to find the thresholds of
+ * many pixels at once: every probe sets the threshold DAC to one value and
+ * measures all pixels, each pixel narrows down its own threshold interval
+ * with the measurements it can use
+ */
+
+#ifndef PXAR_THRESHOLD_H
+#define PXAR_THRESHOLD_H
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+namespace pxar {
+
+  /** Threshold search for a set of pixels sharing the threshold DAC
+   *  A pixel is above threshold if it responds to at least level triggers.
+   *  For a rising edge the threshold is the lowest DAC value above
+   *  threshold, for a falling edge the highest one. The search assumes the
+   *  response to be monotonic in the DAC.
+   *
+   *  The thresholds found by one search are the starting points of the
+   *  next one, so repeated searches (e.g. threshold versus another DAC)
+   *  only need a few probes around the previous values.
+   */
+  class thresholdSearch {
+  public:
+    /** Prepare the search for nPixels pixels (e.g. the linear positions of a
+     *  rocMap) with thresholds within [thrMin, thrMax], both bounds included
+     */
+    thresholdSearch(size_t nPixels, uint8_t thrMin, uint8_t thrMax, int32_t level, bool rising);
+
+    /** Start a new search for all pixels
+     */
+    void start();
+
+    /** Start a new search for the given pixels only
+     */
+    void start(const std::vector<size_t> & pixels);
+
+    /** Get the next DAC value to probe, returns false when the thresholds of
+     *  all pixels are known
+     */
+    bool next(uint8_t & value);
+
+    /** Returns true if the measurement of the given pixel at the given DAC
+     *  value narrows down its threshold, all other pixels can be skipped
+     */
+    bool probes(size_t pixel, uint8_t value) const;
+
+    /** Update all pixels of the search with their number of readouts at the
+     *  probed DAC value, indexed by pixel
+     */
+    void update(uint8_t value, const std::vector<int16_t> & nReadouts);
+
+    /** Update a single pixel with its number of readouts at the probed DAC value
+     */
+    void update(uint8_t value, size_t pixel, int32_t nReadouts);
+
+    /** Set the threshold of the given pixel as if it had been found by a
+     *  search, e.g. to seed the next search with an external measurement
+     */
+    void seed(size_t pixel, int16_t threshold);
+
+    /** Threshold of the given pixel, -1 if none was found in the range
+     */
+    int16_t threshold(size_t pixel) const;
+
+    /** Number of DAC values probed in the last search
+     */
+    inline size_t nProbes() const { return _nProbes; };
+
+  private:
+    /** Conversion between DAC values and the internal search coordinate,
+     *  which always rises towards the threshold
+     */
+    inline int16_t position(uint8_t value) const { return _rising ? value - _thrMin : _thrMax - value; };
+    inline uint8_t dac(int16_t position) const { return static_cast<uint8_t>(_rising ? _thrMin + position : _thrMax - position); };
+
+    /** Preferred probe position of a pixel: around its seed if there is
+     *  one, the middle of its interval otherwise
+     */
+    int16_t guess(size_t pixel) const;
+
+    uint8_t _thrMin;
+    uint8_t _thrMax;
+    int16_t _range;
+    int32_t _level;
+    bool _rising;
+
+    /** Pixels of the current search
+     */
+    std::vector<size_t> _pixels;
+
+    /** Per pixel: highest position known below threshold (-1 if none), lowest
+     *  position known above threshold (_range if none) and the result of the
+     *  previous search (-1 if none)
+     */
+    std::vector<int16_t> _below;
+    std::vector<int16_t> _above;
+    std::vector<int16_t> _seed;
+
+    /** Scratch histogram of the preferred probe positions
+     */
+    std::vector<uint32_t> _guesses;
+    size_t _nProbes;
+  };
+
+} //namespace pxar
+
+#endif /* PXAR_THRESHOLD_H */
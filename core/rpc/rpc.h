@@ -16,14 +16,46 @@
 #define RPC_PROFILING LOG(pxar::logDEBUGRPC) << " called.";
 #endif
 
+// All RPC calls of one connection are serialized by a recursive mutex, so
+// e.g. a monitoring thread can safely interleave its calls with the main
+// thread. Recursive locking allows a caller to hold the connection across
+// several calls; the pipelined scans of the HAL do so while replies are in
+// flight and hand it over to claiming threads between their steps.
 #ifdef RPC_MULTITHREADING
 #include <boost/thread.hpp>
-#define RPC_THREAD boost::mutex m_sync;
-#define RPC_THREAD_LOCK boost::lock_guard<boost::mutex> lock(m_sync);
+#define RPC_THREAD boost::recursive_mutex m_sync;
+#define RPC_THREAD_LOCK boost::lock_guard<boost::recursive_mutex> lock(m_sync);
 #define RPC_THREAD_UNLOCK
 #else
-#define RPC_THREAD
-#define RPC_THREAD_LOCK
+#include <pthread.h>
+
+class rpcMutex
+{
+	pthread_mutex_t m;
+public:
+	rpcMutex()
+	{
+		pthread_mutexattr_t attr;
+		pthread_mutexattr_init(&attr);
+		pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+		pthread_mutex_init(&m, &attr);
+		pthread_mutexattr_destroy(&attr);
+	}
+	~rpcMutex() { pthread_mutex_destroy(&m); }
+	void lock() { pthread_mutex_lock(&m); }
+	void unlock() { pthread_mutex_unlock(&m); }
+};
+
+class rpcLock
+{
+	rpcMutex &m;
+public:
+	rpcLock(rpcMutex &mutex) : m(mutex) { m.lock(); }
+	~rpcLock() { m.unlock(); }
+};
+
+#define RPC_THREAD rpcMutex m_sync;
+#define RPC_THREAD_LOCK rpcLock lock(m_sync);
 #define RPC_THREAD_UNLOCK
 #endif
 
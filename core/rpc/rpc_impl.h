@@ -13,6 +13,11 @@ class CTestboard
 public:
 	CRpcIo& GetIo() { return *rpc_io; }
 
+	// Hold the connection across several calls, e.g. to collect the replies
+	// of split-phase calls without other threads interfering:
+	void Lock() { m_sync.lock(); }
+	void Unlock() { m_sync.unlock(); }
+
 	CTestboard() { 
 	  RPC_INIT rpc_io = &usb;
 	}
@@ -66,8 +71,8 @@ public:
 	const char * ConnectionError()
 	{ return usb.GetErrorMsg(usb.GetLastError()); }
 
-	void Flush() { rpc_io->Flush(); }
-	void Clear() { rpc_io->Clear(); }
+	void Flush() { RPC_THREAD_LOCK rpc_io->Flush(); }
+	void Clear() { RPC_THREAD_LOCK rpc_io->Clear(); }
 
 
 	// === DTB identification ================================================
@@ -228,4 +233,18 @@ public:
 	RPC_EXPORT int8_t CalibrateMap(int16_t nTriggers, vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum);
 	RPC_EXPORT int8_t TrimChip(vector<int8_t> &trim);
 
+	// === split-phase calls (host side only, see rpc_pipeline.cpp) ==========
+	// The request is only queued, the reply has to be collected later with the
+	// matching _Receive function. Replies arrive in the order of the requests,
+	// the caller has to hold the connection (Lock) until all are collected.
+
+	void CalibratePixel_Send(int16_t nTriggers, int16_t col, int16_t row);
+	int8_t CalibratePixel_Receive(int16_t &nReadouts, int32_t &PHsum);
+	void CalibrateMap_Send(int16_t nTriggers);
+	int8_t CalibrateMap_Receive(vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum);
+	void CalibrateDacScan_Send(int16_t nTriggers, int16_t col, int16_t row, int16_t dacReg1, int16_t dacRange1);
+	int8_t CalibrateDacScan_Receive(vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum);
+	void CalibrateDacDacScan_Send(int16_t nTriggers, int16_t col, int16_t row, int16_t dacReg1, int16_t dacRange1, int16_t dacReg2, int16_t dacRange2);
+	int8_t CalibrateDacDacScan_Receive(vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum);
+
 };
@@ -0,0 +1,152 @@
+// rpc_pipeline.cpp
+// Split-phase variants of selected RPC calls. The message format is the
+// same as for the generated calls in rpc_calls.cpp, only sending the
+// request and receiving the reply are separated, so several requests can
+// be queued before the first reply is read.
+
+#include "rpc_impl.h"
+
+// Index of the calls in CTestboard::rpc_cmdName:
+#define RPC_ID_CALIBRATEPIXEL      87
+#define RPC_ID_CALIBRATEDACSCAN    88
+#define RPC_ID_CALIBRATEDACDACSCAN 89
+#define RPC_ID_CALIBRATEMAP        90
+
+void CTestboard::CalibratePixel_Send(int16_t nTriggers, int16_t col, int16_t row)
+{ RPC_PROFILING
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEPIXEL);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	msg.Create(rpc_clientCallId);
+	msg.Put_INT16(nTriggers);
+	msg.Put_INT16(col);
+	msg.Put_INT16(row);
+	// Placeholders for the return parameters:
+	msg.Put_INT16(0);
+	msg.Put_INT32(0);
+	msg.Send(*rpc_io);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEPIXEL); throw; };
+}
+
+int8_t CTestboard::CalibratePixel_Receive(int16_t &nReadouts, int32_t &PHsum)
+{ RPC_PROFILING
+	int8_t rpc_par0;
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEPIXEL);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	rpc_io->Flush();
+	msg.Receive(*rpc_io);
+	msg.Check(rpc_clientCallId,7);
+	rpc_par0 = msg.Get_INT8();
+	nReadouts = msg.Get_INT16();
+	PHsum = msg.Get_INT32();
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEPIXEL); throw; };
+	return rpc_par0;
+}
+
+void CTestboard::CalibrateMap_Send(int16_t nTriggers)
+{ RPC_PROFILING
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEMAP);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	msg.Create(rpc_clientCallId);
+	msg.Put_INT16(nTriggers);
+	msg.Send(*rpc_io);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEMAP); throw; };
+}
+
+int8_t CTestboard::CalibrateMap_Receive(vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum)
+{ RPC_PROFILING
+	int8_t rpc_par0;
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEMAP);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	rpc_io->Flush();
+	msg.Receive(*rpc_io);
+	msg.Check(rpc_clientCallId,1);
+	rpc_par0 = msg.Get_INT8();
+	rpc_Receive(*rpc_io, nReadouts);
+	rpc_Receive(*rpc_io, PHsum);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEMAP); throw; };
+	return rpc_par0;
+}
+
+void CTestboard::CalibrateDacScan_Send(int16_t nTriggers, int16_t col, int16_t row, int16_t dacReg1, int16_t dacRange1)
+{ RPC_PROFILING
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEDACSCAN);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	msg.Create(rpc_clientCallId);
+	msg.Put_INT16(nTriggers);
+	msg.Put_INT16(col);
+	msg.Put_INT16(row);
+	msg.Put_INT16(dacReg1);
+	msg.Put_INT16(dacRange1);
+	msg.Send(*rpc_io);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEDACSCAN); throw; };
+}
+
+int8_t CTestboard::CalibrateDacScan_Receive(vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum)
+{ RPC_PROFILING
+	int8_t rpc_par0;
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEDACSCAN);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	rpc_io->Flush();
+	msg.Receive(*rpc_io);
+	msg.Check(rpc_clientCallId,1);
+	rpc_par0 = msg.Get_INT8();
+	rpc_Receive(*rpc_io, nReadouts);
+	rpc_Receive(*rpc_io, PHsum);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEDACSCAN); throw; };
+	return rpc_par0;
+}
+
+void CTestboard::CalibrateDacDacScan_Send(int16_t nTriggers, int16_t col, int16_t row, int16_t dacReg1, int16_t dacRange1, int16_t dacReg2, int16_t dacRange2)
+{ RPC_PROFILING
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEDACDACSCAN);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	msg.Create(rpc_clientCallId);
+	msg.Put_INT16(nTriggers);
+	msg.Put_INT16(col);
+	msg.Put_INT16(row);
+	msg.Put_INT16(dacReg1);
+	msg.Put_INT16(dacRange1);
+	msg.Put_INT16(dacReg2);
+	msg.Put_INT16(dacRange2);
+	msg.Send(*rpc_io);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEDACDACSCAN); throw; };
+}
+
+int8_t CTestboard::CalibrateDacDacScan_Receive(vectorR<int16_t> &nReadouts, vectorR<int32_t> &PHsum)
+{ RPC_PROFILING
+	int8_t rpc_par0;
+	try {
+	uint16_t rpc_clientCallId = rpc_GetCallId(RPC_ID_CALIBRATEDACDACSCAN);
+	RPC_THREAD_LOCK
+	rpcMessage msg;
+	rpc_io->Flush();
+	msg.Receive(*rpc_io);
+	msg.Check(rpc_clientCallId,1);
+	rpc_par0 = msg.Get_INT8();
+	rpc_Receive(*rpc_io, nReadouts);
+	rpc_Receive(*rpc_io, PHsum);
+	RPC_THREAD_UNLOCK
+	} catch (CRpcError &e) { e.SetFunction(RPC_ID_CALIBRATEDACDACSCAN); throw; };
+	return rpc_par0;
+}
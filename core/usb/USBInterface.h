@@ -13,6 +13,8 @@
 
 #ifdef HAVE_LIBFTDI
 #include <ftdi.h>
+#include <pthread.h>
+#include <semaphore.h>
 #else
 #include <ftd2xx.h>
 #endif
@@ -35,6 +37,19 @@ class CUSB : public CRpcIo
 
 #ifndef HAVE_LIBFTDI
   FT_HANDLE ftHandle;
+#else
+  // All libftdi state belongs to the connection, so several testboards can
+  // be used from one process. There is no non-blocking read in libftdi, a
+  // reader thread per connection fills the ring buffer read_buffer.
+  struct ftdi_context *ftdic;
+  pthread_t readerthread;
+  sem_t buf_data, buf_space;
+  unsigned char *read_buffer;
+  volatile int32_t head, tail;
+
+  static void *Reader(void *usb);
+  void AddToBuffer(unsigned char c);
+  uint32_t FindAllUSB(struct ftdi_device_list **devlist);
 #endif
 
   uint32_t enumPos, enumCount;
@@ -13,19 +13,19 @@
 #include <pthread.h> 
 #include <semaphore.h>
 
-static struct ftdi_context ftdic;
-
-// the read buffer needs to be accessable outside of our USB class
+// size of the ring buffer of every connection
 #define BUFSIZE 0x200000
-static pthread_t readerthread;
-static sem_t buf_data, buf_space;
-static unsigned char read_buffer[BUFSIZE];
-static int32_t head, tail; // read buffer is used as ring buffer
 
 // cleanup is threaded to include a timeout on the calls to the device that sometimes hang
-pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_t usbclose_thread, usbdeinit_thread;
-volatile bool usbclose_done, usbdeinit_done;
+static pthread_mutex_t cleanup_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// one cleanup call: if it times out, the thread is abandoned and frees the call itself
+struct cleanupCall {
+  struct ftdi_context *handle;
+  void (*function)(struct ftdi_context *);
+  bool done;
+  bool abandoned;
+};
 
 const int32_t productID_FT232H = 0x6014; // new testboard FTDI chip product id (FT232H)
 const int32_t productID_OLD = 0x6001; //  single channel devices (R Chips) used in older test boards
@@ -33,7 +33,7 @@ const int32_t vendorID = 0x0403; // Future Technology Devices International, Ltd
 
 using namespace std;
 
-static void add_to_buf (unsigned char c) {
+void CUSB::AddToBuffer(unsigned char c) {
     int32_t nh;
 
     sem_wait (&buf_space);
@@ -49,11 +49,12 @@ static void add_to_buf (unsigned char c) {
     sem_post (&buf_data);
 }
 
-static void *reader (void *arg) {
+void *CUSB::Reader(void *arg) {
   // there is no non-blocking read command implemented in libftdi ->
-  // therefore we use multithreading and a static buffer to emulate
+  // therefore we use multithreading and a ring buffer to emulate
   // non-blocking calls
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
+    CUSB *usb = (CUSB *)(arg);
+    struct ftdi_context *handle = usb->ftdic;
     unsigned char buf[0x1000];
     int32_t br, i;
 
@@ -67,32 +68,63 @@ static void *reader (void *arg) {
       }
       if (br > 0){
 	for (i=0; i<br; i++){
-	  add_to_buf (buf[i]);
+	  usb->AddToBuffer(buf[i]);
 	}
       }
     }
     return NULL;
 }
 
-static void *usbclose (void *arg) {
-  // on some circumstances, the ftdi_usb_close() call hangs;
+static void usbclose (struct ftdi_context *handle) { ftdi_usb_close(handle); }
+static void usbdeinit (struct ftdi_context *handle) { ftdi_deinit(handle); }
+
+static void *cleanup (void *arg) {
+  // on some circumstances, the ftdi_usb_close() and ftdi_deinit() calls hang;
   // this is a workaround to implement a timeout
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    ftdi_usb_close(handle);
-    pthread_mutex_lock(&cleanup_mutex); usbclose_done = true; pthread_mutex_unlock(&cleanup_mutex);
+    cleanupCall *call = (cleanupCall *)(arg);
+    call->function(call->handle);
+    pthread_mutex_lock(&cleanup_mutex);
+    bool abandoned = call->abandoned;
+    call->done = true;
+    pthread_mutex_unlock(&cleanup_mutex);
+    if (abandoned) delete call;
     return NULL;
 }
 
-static void *usbdeinit (void *arg) {
-  // on some circumstances, the ftdi_deinit() call hangs;
-  // this is a workaround to implement a timeout
-    struct ftdi_context *handle = (struct ftdi_context *)(arg);
-    ftdi_deinit(handle);
-    pthread_mutex_lock(&cleanup_mutex); usbdeinit_done = true; pthread_mutex_unlock(&cleanup_mutex);
-    return NULL;
+// run a cleanup call with a timeout of one second, returns false if it timed out
+static bool cleanupWithTimeout (void (*function)(struct ftdi_context *), struct ftdi_context *handle) {
+  cleanupCall *call = new cleanupCall;
+  call->handle = handle;
+  call->function = function;
+  call->done = false;
+  call->abandoned = false;
+
+  pthread_t thread;
+  if (pthread_create (&thread, NULL, cleanup, call) != 0) {
+    delete call;
+    return false;
+  }
+  pthread_detach(thread);
+
+  bool done = false;
+  for (int time = 0; time<1000;time++){
+    usleep(1000); // wait 1ms
+    // check status and break if the call returned
+    pthread_mutex_lock(&cleanup_mutex);
+    done = call->done;
+    pthread_mutex_unlock(&cleanup_mutex);
+    if (done) break;
+  }
+
+  pthread_mutex_lock(&cleanup_mutex);
+  done = call->done;
+  if (!done) call->abandoned = true;
+  pthread_mutex_unlock(&cleanup_mutex);
+  if (done) delete call;
+  return done;
 }
 
-uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
+uint32_t CUSB::FindAllUSB(struct ftdi_device_list ** devlist){
   int status;
   uint32_t nDevices = 0;
   struct ftdi_device_list *  	devlist_atb;
@@ -102,7 +134,7 @@ uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
   // This first checks explicitly for DTB boards, then for ATB ones and merges the device lists
 
   // DTB
-  status =  ftdi_usb_find_all(&ftdic, devlist,vendorID,productID_FT232H);
+  status =  ftdi_usb_find_all(ftdic, devlist,vendorID,productID_FT232H);
   if( status < 0) {
     return status;
   }
@@ -111,7 +143,7 @@ uint32_t FindAllUSB(struct ftdi_device_list ** devlist){
   }
 
   // ATB
-  status =  ftdi_usb_find_all(&ftdic, &devlist_atb,vendorID,productID_OLD);
+  status =  ftdi_usb_find_all(ftdic, &devlist_atb,vendorID,productID_OLD);
   if( status < 0) {
     return status;
   }
@@ -134,7 +166,10 @@ CUSB::CUSB(){
       isUSB_open = false;
       ftdiStatus = 0;
       enumPos = enumCount = 0;
-      ftdiStatus = ftdi_init(&ftdic);
+      read_buffer = new unsigned char[BUFSIZE];
+      head = tail = 0;
+      ftdic = new struct ftdi_context;
+      ftdiStatus = ftdi_init(ftdic);
       if ( ftdiStatus < 0)
 	{
 	  cout <<  "USBInterface constructor: ftdi_init failed" << endl;
@@ -144,25 +179,16 @@ CUSB::CUSB(){
 
 CUSB::~CUSB(){ 
   if (isUSB_open) Close(); 
-  pthread_mutex_lock(&cleanup_mutex); usbdeinit_done = false; pthread_mutex_unlock(&cleanup_mutex);
-  // create cleanup thread to allow timeout freeing the USB handle (might hang sometimes)
-  pthread_create (&usbdeinit_thread, NULL, usbdeinit, &ftdic);
-  bool done = false;
-  for (int time = 0; time<1000;time++){
-    usleep(1000); // wait 1ms
-    // check status and break if usbdevice is closed
-    pthread_mutex_lock(&cleanup_mutex); 
-    if (usbdeinit_done) {
-      // cout << " DEBUG: successfully free'd usb handle connection " << endl;
-      done = true;    }
-    pthread_mutex_unlock(&cleanup_mutex);
-    if (done) break;  }
-  //if (!done) cout << " WARNING: freeing the USB handle timed out! " << endl;
+  // use a cleanup thread to allow timeout freeing the USB handle (might hang sometimes)
+  // the context of a hanging call is left to the abandoned thread
+  if (cleanupWithTimeout(usbdeinit, ftdic)) delete ftdic;
+  //else cout << " WARNING: freeing the USB handle timed out! " << endl;
+  delete[] read_buffer;
 }
 
 const char* CUSB::GetErrorMsg()
 {
-  return ftdi_get_error_string(&ftdic);
+  return ftdi_get_error_string(ftdic);
 }
 
 
@@ -203,7 +229,7 @@ bool CUSB::EnumNext(char name[])
   
   char manufacturer[128], description[128], serial[128];
 
-  if ((ftdiStatus = ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
+  if ((ftdiStatus = ftdi_usb_get_strings(ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
     {
       std::cout << " USBInterface::EnumNext(): Error polling USB device number " << enumPos << std::endl;
       return EXIT_FAILURE;
@@ -235,7 +261,7 @@ bool CUSB::Enum(char name[], uint32_t pos)
   for (uint32_t i=0; i<pos; i++) devlist = devlist->next;
   
   char manufacturer[128], description[128], serial[128];
-  if ((ftdiStatus = ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
+  if ((ftdiStatus = ftdi_usb_get_strings(ftdic,devlist->dev, manufacturer, 128, description, 128, serial, 128)) < 0)
     {
       std::cout << " USBInterface::EnumNext(): Error polling USB device number " << pos << std::endl;
       return EXIT_FAILURE;
@@ -274,7 +300,7 @@ bool CUSB::Open(char serialNumber[])
   for (int32_t i=0; i<ndevices; i++) {
     char manufacturer[128], description[128], serial[128];
     if ((ftdiStatus = 
-	 ftdi_usb_get_strings(&ftdic,devlist->dev, manufacturer, 
+	 ftdi_usb_get_strings(ftdic,devlist->dev, manufacturer, 
 			      128, description, 128, serial, 128)) < 0){
       std::cout << " USBInterface::Open(): Error polling USB device number " << i << std::endl;
       devlist = devlist->next;
@@ -289,7 +315,7 @@ bool CUSB::Open(char serialNumber[])
       // found the device
       std::cout << " USBInterface::Open(): found device with serial " << serial << std::endl;
       // now open it
-      ftdiStatus = ftdi_usb_open_dev(&ftdic, devlist->dev);
+      ftdiStatus = ftdi_usb_open_dev(ftdic, devlist->dev);
       if( ftdiStatus < 0) {
 	/* maybe the ftdi_sio and usbserial kernel modules are attached to the device */
 	/* try to detach them using the libusb library directly */
@@ -313,7 +339,7 @@ bool CUSB::Open(char serialNumber[])
 	libusb_close(handle);
 
 	// now open it again
-	ftdiStatus = ftdi_usb_open_dev(&ftdic, devlist->dev);
+	ftdiStatus = ftdi_usb_open_dev(ftdic, devlist->dev);
 	if( ftdiStatus < 0) {
 	  std::cout << " Warning: FTDI returned status code " << ftdiStatus << ", will try to detach ftdi_sio and usbserial kernel modules " << std::endl;
 	  ftdi_list_free(&devlist);
@@ -333,13 +359,13 @@ bool CUSB::Open(char serialNumber[])
   }
 
   //std::cout << " resetting mode for FTDI chip " << std::endl;
-  int32_t status =  ftdi_set_bitmode(&ftdic, 0xFF, 0x40);
+  int32_t status =  ftdi_set_bitmode(ftdic, 0xFF, 0x40);
   if (status < 0){
     std::cout << " ERROR issuing reset: return code " << status << std::endl;
   }
   usleep(10000); // wait 10 ms
   //std::cout << " setting bit mode for FTDI chip " << std::endl;
-  status =  ftdi_set_bitmode(&ftdic, 0xFF, 0x40);
+  status =  ftdi_set_bitmode(ftdic, 0xFF, 0x40);
   if (status < 0){
     std::cout << " ERROR setting bit mode: return code " << status << std::endl;
   }
@@ -347,7 +373,8 @@ bool CUSB::Open(char serialNumber[])
   // init threads for client-side data buffering
   sem_init (&buf_data, 0, 0);
   sem_init (&buf_space, 0, BUFSIZE);
-  pthread_create (&readerthread, NULL, reader, &ftdic);
+  head = tail = 0;
+  pthread_create (&readerthread, NULL, Reader, this);
 
   return true;
 }
@@ -362,21 +389,9 @@ void CUSB::Close(){
   sem_destroy (&buf_data);
   sem_destroy (&buf_space);
   usleep(10000);
-  // set the flag (lock mutex first)
-  pthread_mutex_lock(&cleanup_mutex); usbclose_done = false; pthread_mutex_unlock(&cleanup_mutex);
-  // create cleanup thread to allow timeout on call to device (might hang)
-  pthread_create (&usbclose_thread, NULL, usbclose, &ftdic);
-  bool done = false;
-  for (int time = 0; time<1000;time++){
-    usleep(1000); // wait 1ms
-    // check status and break if usbdevice is closed
-    pthread_mutex_lock(&cleanup_mutex);  // lock mutex
-    if (usbclose_done) {
-      //cout << " DEBUG: successfully closed usb connection " << endl;
-      done = true; }
-    pthread_mutex_unlock(&cleanup_mutex); // unlock mutex
-    if (done) break;}
-  //if (!done) cout << " WARNING: closing the USB connection timed out! " << endl;
+  // use a cleanup thread to allow timeout on call to device (might hang)
+  cleanupWithTimeout(usbclose, ftdic);
+  //if timed out: cout << " WARNING: closing the USB connection timed out! " << endl;
   isUSB_open = 0;
 }
 
@@ -407,7 +422,7 @@ void CUSB::Flush()
 
   if( !bytesToWrite) return;
 
-  ftdiStatus = ftdi_write_data(&ftdic, m_bufferW, bytesToWrite);
+  ftdiStatus = ftdi_write_data(ftdic, m_bufferW, bytesToWrite);
 
   if( ftdiStatus < 0)  throw CRpcError(CRpcError::WRITE_ERROR);
   if( ftdiStatus != bytesToWrite) { 
@@ -470,7 +485,7 @@ void CUSB::Clear()
 {
   if( !isUSB_open) return;
 
-  ftdiStatus = ftdi_usb_purge_buffers(&ftdic);
+  ftdiStatus = ftdi_usb_purge_buffers(ftdic);
 
   // drain our buffer.
   while (head != tail) {
@@ -494,7 +509,7 @@ bool CUSB::Show()
   cout << "  - max timeout for read calls set to " << m_timeout << "ms" << endl;
 
   unsigned char latency;
-  if (ftdi_get_latency_timer(&ftdic,&latency)==0)  cout << "  - FTDI latency timer set to " << (int) latency << endl;
+  if (ftdi_get_latency_timer(ftdic,&latency)==0)  cout << "  - FTDI latency timer set to " << (int) latency << endl;
   cout << "  - data waiting in local read buffer: " << !(tail == head) << endl;
   
 
@@ -11,6 +11,7 @@
 #include <cstdio>
 #include <stdint.h>
 #include <string.h>
+#include <pthread.h>
 
 namespace pxar {
 
@@ -66,6 +67,10 @@ namespace pxar {
     std::ostringstream& pxarLog<T>::Get(TLogLevel level, std::string file, std::string function, uint32_t line) {
     os << "[" << NowTime() << "] ";
     os << std::setw(8) << ToString(level) << ": ";
+
+    // Messages of threads working for a specific board carry its tag:
+    std::string tag = T::ThreadTag();
+    if(!tag.empty()) os << "[" << tag << "] ";
     
     // For debug levels we want also function name and line number printed:
     if (level != logINFO && level != logWARNING && level != logQUIET)
@@ -124,6 +129,16 @@ namespace pxar {
   public:
     static FILE*& Stream();
     static void Output(const std::string& msg);
+
+    /** Tag for all messages of the calling thread, e.g. the testboard
+     *  it works with when several boards are operated in parallel
+     */
+    static void SetThreadTag(const std::string& tag);
+    static std::string ThreadTag();
+  private:
+    static pthread_key_t TagKey();
+    static pthread_key_t CreateTagKey();
+    static void DeleteTag(void* tag);
   };
 
   inline FILE*& SetLogOutput::Stream()
@@ -141,6 +156,37 @@ namespace pxar {
     fflush(pStream);
   }
 
+  inline void SetLogOutput::SetThreadTag(const std::string& tag)
+  {
+    pthread_key_t key = TagKey();
+    delete static_cast<std::string*>(pthread_getspecific(key));
+    pthread_setspecific(key, tag.empty() ? NULL : new std::string(tag));
+  }
+
+  inline std::string SetLogOutput::ThreadTag()
+  {
+    std::string* tag = static_cast<std::string*>(pthread_getspecific(TagKey()));
+    return tag ? *tag : std::string();
+  }
+
+  inline pthread_key_t SetLogOutput::TagKey()
+  {
+    static pthread_key_t key = CreateTagKey();
+    return key;
+  }
+
+  inline pthread_key_t SetLogOutput::CreateTagKey()
+  {
+    pthread_key_t key;
+    pthread_key_create(&key, &SetLogOutput::DeleteTag);
+    return key;
+  }
+
+  inline void SetLogOutput::DeleteTag(void* tag)
+  {
+    delete static_cast<std::string*>(tag);
+  }
+
 typedef pxarLog<SetLogOutput> Log;
 
 #define __FILE_NAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
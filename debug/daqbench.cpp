@@ -0,0 +1,119 @@
+/**
+ * pxar event builder benchmark
+ * feeds a synthetic module readout stream through the decoder pipeline
+ * and measures the throughput, no testboard needed
+ */
+
+#include <iostream>
+#include <cstdlib>
+#include <vector>
+#include <algorithm>
+#include <sys/time.h>
+#include <pthread.h>
+#include "datapipe.h"
+
+using namespace pxar;
+
+void * produce(void * arg) {
+  std::pair<decoderPipeline*, std::vector<uint16_t>*> * input = static_cast<std::pair<decoderPipeline*, std::vector<uint16_t>*>*>(arg);
+  std::vector<uint16_t> & stream = *input->second;
+  for(size_t pos = 0; pos < stream.size(); pos += DAQ_READ_SIZE) {
+    size_t size = std::min(static_cast<size_t>(DAQ_READ_SIZE), stream.size() - pos);
+    input->first->process(&stream[pos], size);
+  }
+  input->first->finish();
+  return NULL;
+}
+
+double now() {
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.;
+}
+
+int main(int argc, char* argv[]) {
+
+  uint32_t nEvents = (argc > 1) ? atoi(argv[1]) : 200000;
+  uint32_t hitsPerRoc = (argc > 2) ? atoi(argv[2]) : 2;
+  uint8_t nChannels = (argc > 3) ? atoi(argv[3]) : 2;
+  // Every n-th event gets one of the possible defects:
+  uint32_t defectRate = 100;
+  uint8_t nRocsPerCore = MOD_NUMROCS/2;
+
+  // Generate the synthetic TBM stream, both TBM cores send one frame per trigger:
+  std::vector<uint16_t> stream;
+  stream.reserve(nEvents*2*(4 + nRocsPerCore*(1 + 2*hitsPerRoc)));
+  uint32_t nDefects = 0;
+  uint8_t counter = 0;
+  srand(42);
+
+  for(uint32_t i = 0; i < nEvents; i++) {
+    uint32_t defect = (i % defectRate == defectRate - 1) ? (i/defectRate)%3 + 1 : 0;
+    if(defect) nDefects++;
+
+    // Skipped event number:
+    if(defect == 1) counter++;
+
+    for(uint8_t core = 0; core < 2; core++) {
+      stream.push_back(DAQ_TBM_HEADER_1 | counter);
+      stream.push_back(DAQ_TBM_HEADER_2 | 0x10);
+
+      for(uint8_t roc = 0; roc < nRocsPerCore; roc++) {
+	// Missing ROC header on the second core:
+	if(defect == 2 && core == 1 && roc == 3) continue;
+	stream.push_back(DAQ_ROC_HEADER);
+	for(uint32_t h = 0; h < hitsPerRoc; h++) {
+	  stream.push_back(DAQ_ROC_DATA_1 | (rand() & DAQ_ROC_DATA_MASK));
+	  stream.push_back(DAQ_ROC_DATA_2 | (rand() & DAQ_ROC_DATA_MASK));
+	}
+      }
+
+      // Missing trailer on the first core:
+      if(defect == 3 && core == 0) continue;
+      stream.push_back(DAQ_TBM_TRAILER_1);
+      stream.push_back(DAQ_TBM_TRAILER_2);
+    }
+    counter++;
+  }
+
+  std::cout << "Generated " << nEvents << " events in " << stream.size()
+	    << " words, " << nDefects << " with defects." << std::endl;
+
+  // With a single channel, every TBM core frame is decoded as separate event
+  // and the event number checks do not apply, only the timing is compared.
+  uint8_t nRocs = (nChannels == 2) ? MOD_NUMROCS : nRocsPerCore;
+  decoderPipeline pipeline(true, nRocs, nChannels);
+
+  // Build the events in DAQ-sized chunks while the main thread consumes them:
+  double start = now();
+  pthread_t producer;
+  std::pair<decoderPipeline*, std::vector<uint16_t>*> input(&pipeline, &stream);
+  pthread_create(&producer, NULL, &produce, &input);
+
+  uint64_t events = 0, corrupt = 0, pixels = 0;
+  event ev;
+  while(pipeline.pop(ev)) {
+    events++;
+    if(ev.corrupt()) corrupt++;
+    pixels += ev.pixels.size();
+  }
+  pthread_join(producer, NULL);
+  double elapsed = now() - start;
+
+  std::cout << "Decoded " << pipeline.events() << " frames (" << pipeline.corrupt() << " corrupt) on "
+	    << static_cast<int>(nChannels) << " channel(s), consumed " << events << " events ("
+	    << corrupt << " corrupt, " << pipeline.mismatched() << " unmatched) with "
+	    << pixels << " pixels." << std::endl;
+  std::cout << "Time: " << elapsed << " s, "
+	    << stream.size()*sizeof(uint16_t)/elapsed/1e6 << " MB/s, "
+	    << events/elapsed << " events/s" << std::endl;
+
+  // Every defect has to be flagged, and the events following a defect are not
+  // allowed to be affected:
+  if(nChannels == 2 && (events != nEvents || corrupt != nDefects)) {
+    std::cout << "Mismatch: expected " << nEvents << " events, "
+	      << nDefects << " of them corrupt." << std::endl;
+    return 1;
+  }
+  return 0;
+}
@@ -47,6 +47,8 @@ PixMonitor::PixMonitor(TGGroupFrame *f, PixGui *pixGui) {
 
   f->AddFrame(fMonitorFrame, new TGLayoutHints(kLHintsTop,2,2,2,2));
 
+  // -- readings are taken by the API in the background, Update() only reads them
+  if (fGui->getApi()) fGui->getApi()->startMonitor(1.);
 }
 
 
@@ -84,8 +86,11 @@ void PixMonitor::handleButtons(Int_t id) {
 void PixMonitor::Update() {
   static float ia(0.), id(0.); 
   if (fGui->getApi()) {
-    ia = fGui->getApi()->getTBia();
-    id = fGui->getApi()->getTBid();
+    pxar::powerReading reading;
+    if (fGui->getApi()->getMonitorReading(reading)) {
+      ia = reading.ia;
+      id = reading.id;
+    }
   } else {
     ia += 1.0; 
     id += 1.0; 
@@ -0,0 +1,39 @@
+/**
+ * pxar unit test helpers
+ * minimal checks for the tests of the core library, every test is a plain
+ * executable returning non-zero if any of its checks failed
+ */
+
+#ifndef PXAR_TEST_CHECK_H
+#define PXAR_TEST_CHECK_H
+
+#include <iostream>
+#include <cmath>
+
+namespace pxar {
+
+  /** Number of failed checks of the running test program
+   */
+  static int failedChecks = 0;
+
+  /** Print the summary of the test program and return its exit code
+   */
+  inline int testResult(const char * name) {
+    if(failedChecks == 0) std::cout << name << ": all checks passed." << std::endl;
+    else std::cout << name << ": " << failedChecks << " checks failed." << std::endl;
+    return (failedChecks == 0) ? 0 : 1;
+  }
+
+} //namespace pxar
+
+#define CHECK(condition)						\
+  do {									\
+    if(!(condition)) {							\
+      std::cout << __FILE__ << ":" << __LINE__ << ": check failed: " << #condition << std::endl; \
+      pxar::failedChecks++;						\
+    }									\
+  } while(0)
+
+#define CHECK_CLOSE(value, expected, tolerance) CHECK(std::fabs((value) - (expected)) <= (tolerance))
+
+#endif /* PXAR_TEST_CHECK_H */
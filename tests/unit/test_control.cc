@@ -0,0 +1,106 @@
+/**
+ * pxar test control tests
+ * progress, cancellation and completion of a test running in a worker thread
+ */
+
+#include <vector>
+#include <stdexcept>
+#include <pthread.h>
+#include <unistd.h>
+#include "control.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  /** Handle driven by the test itself, in place of the API and HAL
+   */
+  class testDriver : public testControl {
+  public:
+    testDriver(testProgress * callback = NULL) : testControl(callback) {};
+    using testControl::begin;
+    using testControl::plan;
+    using testControl::advance;
+    using testControl::reach;
+    using testControl::finish;
+  };
+
+  class progressLog : public testProgress {
+  public:
+    progressLog() : reports() {};
+    void progress(size_t done, size_t total) { reports.push_back(std::make_pair(done, total)); };
+    std::vector< std::pair<size_t,size_t> > reports;
+  };
+
+  /** Worker running steps until it is cancelled, like a scan over DAC values
+   */
+  void * worker(void * handle) {
+    testDriver * control = static_cast<testDriver*>(handle);
+    control->plan(1000000);
+    while(!control->cancelled()) {
+      control->advance(1);
+      usleep(100);
+    }
+    control->finish(false);
+    return NULL;
+  }
+
+  class throwingTest : public asyncTest {
+  public:
+    bool run() { throw std::runtime_error("testboard gone"); };
+  };
+
+  class passingTest : public asyncTest {
+  public:
+    bool run() { return true; };
+  };
+
+}
+
+int main() {
+
+  // Progress is reported to the callback and clamped to the planned steps:
+  progressLog log;
+  testDriver control(&log);
+  control.begin();
+  CHECK(control.running() && !control.cancelled());
+  control.plan(4);
+  control.advance(1);
+  control.reach(3);
+  control.reach(2);
+  control.advance(5);
+  CHECK(control.done() == 4 && control.total() == 4);
+  CHECK(log.reports.size() == 4 && log.reports[0].first == 0 && log.reports[1].first == 1
+	&& log.reports[2].first == 3 && log.reports[3].first == 4 && log.reports[3].second == 4);
+  control.finish(true);
+  CHECK(!control.running());
+  CHECK(control.wait());
+
+  // A new test resets the handle:
+  control.begin();
+  CHECK(control.running() && control.done() == 0 && control.total() == 0);
+  control.finish(false);
+  CHECK(!control.wait());
+
+  // Cancel a test running in another thread, wait returns once it stopped:
+  testDriver async;
+  async.begin();
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, worker, &async) == 0);
+  while(async.done() < 10) { usleep(100); }
+  async.cancel();
+  CHECK(async.cancelled());
+  CHECK(!async.wait());
+  CHECK(!async.running());
+  CHECK(async.done() >= 10 && async.done() < async.total());
+  pthread_join(thread, NULL);
+
+  // Exceptions of a test make it fail instead of leaving the thread:
+  throwingTest failing;
+  CHECK(!runGuarded(failing));
+  passingTest passing;
+  CHECK(runGuarded(passing));
+
+  return testResult("test_control");
+}
@@ -0,0 +1,231 @@
+/**
+ * pxar event builder tests
+ * builds events from synthetic module and single ROC readout streams
+ */
+
+#include <vector>
+#include <algorithm>
+#include "datapipe.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  /** Append the two data words of a hit, encoded as read out from a digital ROC
+   */
+  void addHit(std::vector<uint16_t> & stream, uint8_t column, uint8_t row, uint8_t value) {
+    uint32_t c = column/2;
+    uint32_t r = 2*(80 - row) + (column & 1);
+    uint32_t raw = ((c/6) << 21) | ((c%6) << 18) | ((r/36) << 15) | (((r/6)%6) << 12) | ((r%6) << 9)
+      | (value & 0x0f) | ((value & 0xf0) << 1);
+    stream.push_back(DAQ_ROC_DATA_1 | ((raw >> 12) & DAQ_ROC_DATA_MASK));
+    stream.push_back(DAQ_ROC_DATA_2 | (raw & DAQ_ROC_DATA_MASK));
+  }
+
+  void addHeader(std::vector<uint16_t> & stream, uint8_t counter) {
+    stream.push_back(DAQ_TBM_HEADER_1 | counter);
+    stream.push_back(DAQ_TBM_HEADER_2 | 0x10);
+  }
+
+  void addTrailer(std::vector<uint16_t> & stream) {
+    stream.push_back(DAQ_TBM_TRAILER_1);
+    stream.push_back(DAQ_TBM_TRAILER_2);
+  }
+
+  /** Complete TBM frame of nRocs ROCs, ROC hitRoc has one hit
+   */
+  void addFrame(std::vector<uint16_t> & stream, uint8_t counter, uint8_t nRocs, uint8_t hitRoc, uint8_t column, uint8_t row, uint8_t value) {
+    addHeader(stream, counter);
+    for(uint8_t roc = 0; roc < nRocs; roc++) {
+      stream.push_back(DAQ_ROC_HEADER);
+      if(roc == hitRoc) addHit(stream, column, row, value);
+    }
+    addTrailer(stream);
+  }
+
+  bool hasPixel(const event & ev, size_t i, uint8_t roc, uint8_t column, uint8_t row, int32_t value) {
+    if(i >= ev.pixels.size()) return false;
+    const pixel & px = ev.pixels[i];
+    return px.roc_id == roc && px.column == column && px.row == row && px.value == value;
+  }
+
+  /** Feed the stream to the builder in chunks of the given size
+   */
+  void feed(eventBuilder & builder, const std::vector<uint16_t> & stream, size_t chunk) {
+    for(size_t pos = 0; pos < stream.size(); pos += chunk) {
+      builder.process(&stream[pos], std::min(chunk, stream.size() - pos));
+    }
+  }
+
+}
+
+int main() {
+
+  // Module readout: the hits belong to the ROC of the last ROC header, also
+  // when the stream is cut in between any two words:
+  std::vector<uint16_t> stream;
+  addHeader(stream, 7);
+  stream.push_back(DAQ_ROC_HEADER);
+  addHit(stream, 3, 7, 100);
+  stream.push_back(DAQ_ROC_HEADER);
+  stream.push_back(DAQ_ROC_HEADER);
+  addHit(stream, 51, 0, 255);
+  addHit(stream, 0, 79, 1);
+  addTrailer(stream);
+
+  for(size_t chunk = 1; chunk <= stream.size(); chunk++) {
+    eventQueue queue;
+    eventBuilder builder(queue, true, 3, 4);
+    feed(builder, stream, chunk);
+    event ev;
+    CHECK(queue.tryPop(ev));
+    CHECK(!ev.corrupt());
+    CHECK(ev.counter == 7);
+    CHECK(ev.nRocHeaders == 3);
+    CHECK(ev.pixels.size() == 3);
+    CHECK(hasPixel(ev, 0, 4, 3, 7, 100));
+    CHECK(hasPixel(ev, 1, 6, 51, 0, 255));
+    CHECK(hasPixel(ev, 2, 6, 0, 79, 1));
+    CHECK(!queue.tryPop(ev));
+  }
+
+  // Defects are flagged on the affected event only:
+  {
+    stream.clear();
+    addFrame(stream, 0, 2, 0, 1, 1, 10);
+    // Event counter jumps from 0 to 2:
+    addFrame(stream, 2, 2, 0, 1, 1, 10);
+    // Missing ROC header:
+    addFrame(stream, 3, 1, 0, 1, 1, 10);
+    // Missing trailer, closed by the next header:
+    addHeader(stream, 4);
+    stream.push_back(DAQ_ROC_HEADER);
+    stream.push_back(DAQ_ROC_HEADER);
+    // Second hit word without the first one:
+    addHeader(stream, 5);
+    stream.push_back(DAQ_ROC_HEADER);
+    stream.push_back(DAQ_ROC_DATA_2);
+    stream.push_back(DAQ_ROC_HEADER);
+    addTrailer(stream);
+    addFrame(stream, 6, 2, 1, 1, 1, 10);
+    // Hit before the TBM header:
+    addHit(stream, 1, 1, 10);
+    addTrailer(stream);
+    // Incomplete last event:
+    addHeader(stream, 7);
+
+    uint8_t expected[] = {EVENT_OK, EVENT_COUNTER_JUMP, EVENT_ROC_COUNT, EVENT_NO_TBM_TRAILER, EVENT_BROKEN_HIT, EVENT_OK,
+			  EVENT_NO_TBM_HEADER | EVENT_ROC_COUNT | EVENT_BROKEN_HIT, EVENT_NO_TBM_TRAILER | EVENT_ROC_COUNT};
+    size_t nExpected = sizeof(expected)/sizeof(expected[0]);
+
+    eventQueue queue;
+    eventBuilder builder(queue, true, 2);
+    builder.process(stream);
+    builder.flush();
+    CHECK(builder.events() == nExpected);
+    CHECK(builder.corrupt() == nExpected - 2);
+
+    event ev;
+    for(size_t i = 0; i < nExpected; i++) {
+      CHECK(queue.tryPop(ev));
+      CHECK(ev.flags == expected[i]);
+    }
+    CHECK(!queue.tryPop(ev));
+  }
+
+  // Single ROC readout: every ROC header starts a new event:
+  {
+    stream.clear();
+    stream.push_back(DAQ_ROC_HEADER_ID);
+    addHit(stream, 10, 20, 30);
+    addHit(stream, 11, 21, 31);
+    stream.push_back(DAQ_ROC_HEADER_ID);
+    stream.push_back(DAQ_ROC_HEADER_ID);
+    addHit(stream, 12, 22, 32);
+
+    eventQueue queue;
+    eventBuilder builder(queue, false, 1, 5);
+    feed(builder, stream, 3);
+    builder.flush();
+
+    event ev;
+    CHECK(queue.tryPop(ev));
+    CHECK(!ev.corrupt() && ev.pixels.size() == 2);
+    CHECK(hasPixel(ev, 0, 5, 10, 20, 30));
+    CHECK(hasPixel(ev, 1, 5, 11, 21, 31));
+    CHECK(queue.tryPop(ev));
+    CHECK(!ev.corrupt() && ev.pixels.empty());
+    CHECK(queue.tryPop(ev));
+    CHECK(!ev.corrupt() && ev.pixels.size() == 1);
+    CHECK(hasPixel(ev, 0, 5, 12, 22, 32));
+    CHECK(!queue.tryPop(ev));
+  }
+
+  // Both TBM cores decoded in parallel: the frames are merged by their event
+  // counter, the ROCs of the second core follow those of the first one:
+  {
+    stream.clear();
+    for(uint8_t counter = 0; counter < 20; counter++) {
+      addFrame(stream, counter, 2, 1, counter, 1, 10);
+      addFrame(stream, counter, 2, 0, counter, 2, 20);
+    }
+
+    decoderPipeline pipeline(true, 4, 2);
+    for(size_t pos = 0; pos < stream.size(); pos += 5) {
+      pipeline.process(&stream[pos], std::min(static_cast<size_t>(5), stream.size() - pos));
+    }
+    pipeline.finish();
+
+    event ev;
+    for(uint8_t counter = 0; counter < 20; counter++) {
+      CHECK(pipeline.pop(ev));
+      CHECK(ev.counter == counter);
+      CHECK(ev.flags == EVENT_OK);
+      CHECK(ev.nRocHeaders == 4);
+      CHECK(ev.pixels.size() == 2);
+      CHECK(hasPixel(ev, 0, 1, counter, 1, 10));
+      CHECK(hasPixel(ev, 1, 2, counter, 2, 20));
+    }
+    CHECK(!pipeline.pop(ev));
+    CHECK(pipeline.events() == 40);
+    CHECK(pipeline.mismatched() == 0);
+  }
+
+  // A lost frame of either core only affects its own event, the following
+  // frames are routed by their event counter again:
+  {
+    stream.clear();
+    for(uint8_t counter = 0; counter < 10; counter++) {
+      if(counter != 6) addFrame(stream, counter, 2, 1, counter, 1, 10);
+      if(counter != 3) addFrame(stream, counter, 2, 0, counter, 2, 20);
+    }
+
+    decoderPipeline pipeline(true, 4, 2);
+    CHECK(pipeline.ready());
+    for(size_t pos = 0; pos < stream.size(); pos += 3) {
+      pipeline.process(&stream[pos], std::min(static_cast<size_t>(3), stream.size() - pos));
+    }
+    pipeline.finish();
+
+    event ev;
+    for(uint8_t counter = 0; counter < 10; counter++) {
+      CHECK(pipeline.pop(ev));
+      CHECK(ev.counter == counter);
+      if(counter == 3 || counter == 6) {
+	CHECK(ev.flags == EVENT_CHANNEL_MISMATCH);
+	CHECK(ev.nRocHeaders == 2);
+	CHECK(ev.pixels.size() == 1);
+	continue;
+      }
+      // The channel which lost the frame sees its counter jump:
+      CHECK(ev.flags == ((counter == 4 || counter == 7) ? EVENT_COUNTER_JUMP : EVENT_OK));
+      CHECK(hasPixel(ev, 0, 1, counter, 1, 10));
+      CHECK(hasPixel(ev, 1, 2, counter, 2, 20));
+    }
+    CHECK(!pipeline.pop(ev));
+    CHECK(pipeline.mismatched() == 2);
+  }
+
+  return testResult("eventbuilder");
+}
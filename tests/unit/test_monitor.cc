@@ -0,0 +1,95 @@
+/**
+ * pxar power ring tests
+ * ordering, overwriting and consistency of the lock-free reading buffer
+ */
+
+#include <vector>
+#include <pthread.h>
+#include "monitor.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  powerReading makeReading(double t) {
+    powerReading reading;
+    reading.timestamp = t;
+    reading.va = t + 1;
+    reading.vd = t + 2;
+    reading.ia = t + 3;
+    reading.id = t + 4;
+    return reading;
+  }
+
+  bool consistent(const powerReading & r) {
+    return r.va == r.timestamp + 1 && r.vd == r.timestamp + 2
+      && r.ia == r.timestamp + 3 && r.id == r.timestamp + 4;
+  }
+
+  const size_t nConcurrent = 200000;
+
+  void * writer(void * ring) {
+    powerRing * r = static_cast<powerRing*>(ring);
+    for(size_t i = 1; i <= nConcurrent; i++) { r->push(makeReading(i)); }
+    return NULL;
+  }
+
+}
+
+int main() {
+
+  // Empty ring:
+  powerRing ring(4);
+  powerReading latest;
+  CHECK(!ring.getLatest(latest));
+  CHECK(ring.getReadings().empty());
+  CHECK(ring.capacity() == 4);
+
+  // Partially filled ring returns all readings in order:
+  ring.push(makeReading(1));
+  ring.push(makeReading(2));
+  ring.push(makeReading(3));
+  CHECK(ring.getLatest(latest) && latest.timestamp == 3);
+  std::vector<powerReading> readings = ring.getReadings();
+  CHECK(readings.size() == 3);
+  for(size_t i = 0; i < readings.size(); i++) { CHECK(readings[i].timestamp == i + 1 && consistent(readings[i])); }
+
+  // Full ring keeps the newest readings only:
+  for(size_t t = 4; t <= 10; t++) { ring.push(makeReading(t)); }
+  CHECK(ring.written() == 10);
+  readings = ring.getReadings();
+  CHECK(readings.size() == 4);
+  for(size_t i = 0; i < readings.size(); i++) { CHECK(readings[i].timestamp == i + 7); }
+  CHECK(ring.getLatest(latest) && latest.timestamp == 10);
+
+  // A zero capacity still stores the latest reading:
+  powerRing single(0);
+  single.push(makeReading(5));
+  CHECK(single.capacity() == 1 && single.getLatest(latest) && latest.timestamp == 5);
+
+  // Readers running alongside the writer never see torn or unordered readings:
+  powerRing shared(16);
+  pthread_t thread;
+  CHECK(pthread_create(&thread, NULL, writer, &shared) == 0);
+  size_t torn = 0, unordered = 0;
+  double last = 0;
+  while(shared.written() < nConcurrent) {
+    if(shared.getLatest(latest)) {
+      if(!consistent(latest)) torn++;
+      if(latest.timestamp < last) unordered++;
+      last = latest.timestamp;
+    }
+    readings = shared.getReadings();
+    for(size_t i = 0; i < readings.size(); i++) {
+      if(!consistent(readings[i])) torn++;
+      if(i > 0 && readings[i].timestamp <= readings[i-1].timestamp) unordered++;
+    }
+  }
+  pthread_join(thread, NULL);
+  CHECK(torn == 0);
+  CHECK(unordered == 0);
+  CHECK(shared.getLatest(latest) && latest.timestamp == nConcurrent);
+
+  return testResult("test_monitor");
+}
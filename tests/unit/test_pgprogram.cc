@@ -0,0 +1,71 @@
+/**
+ * pxar pattern generator program tests
+ * content hash and PG memory difference of compiled programs
+ */
+
+#include <vector>
+#include "datatypes.h"
+#include "constants.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  std::vector<std::pair<uint16_t,uint8_t> > makeSetup(uint8_t calDelay) {
+    std::vector<std::pair<uint16_t,uint8_t> > pg_setup;
+    pg_setup.push_back(std::make_pair(PG_RESR, 25));
+    pg_setup.push_back(std::make_pair(PG_CAL, calDelay));
+    pg_setup.push_back(std::make_pair(PG_TRG, 16));
+    pg_setup.push_back(std::make_pair(PG_TOK, 0));
+    return pg_setup;
+  }
+
+}
+
+int main() {
+
+  // Commands combine pattern and delay, identical setups give identical programs:
+  pgProgram program(makeSetup(106));
+  CHECK(program.commands.size() == 4);
+  CHECK(program.commands[1] == (PG_CAL | 106));
+  CHECK(program.commands[3] == PG_TOK);
+  CHECK(program == pgProgram(makeSetup(106)));
+  CHECK(program.hash == pgProgram(makeSetup(106)).hash);
+
+  // A different delay changes hash and program:
+  pgProgram other(makeSetup(105));
+  CHECK(other.hash != program.hash);
+  CHECK(!(other == program));
+
+  // The empty program differs from every other one:
+  pgProgram empty;
+  CHECK(empty.empty() && !program.empty());
+  CHECK(!(empty == program));
+
+  // Empty PG memory: every address has to be written
+  std::vector<uint16_t> memory;
+  std::vector<size_t> addresses = program.diff(memory);
+  CHECK(addresses.size() == 4);
+  for(size_t i = 0; i < addresses.size(); i++) { CHECK(addresses[i] == i); }
+
+  // Loaded program: nothing to write
+  memory = program.commands;
+  CHECK(program.diff(memory).empty());
+
+  // Only the changed calibrate delay is written:
+  addresses = other.diff(memory);
+  CHECK(addresses.size() == 1 && addresses[0] == 1);
+
+  // Longer programs write the addresses beyond the loaded memory,
+  // stale commands after the end of a shorter program are left alone:
+  std::vector<std::pair<uint16_t,uint8_t> > longer = makeSetup(106);
+  longer.back().second = 10;
+  longer.push_back(std::make_pair(PG_TOK, 0));
+  addresses = pgProgram(longer).diff(memory);
+  CHECK(addresses.size() == 2 && addresses[0] == 3 && addresses[1] == 4);
+  std::vector<uint16_t> longMemory = pgProgram(longer).commands;
+  CHECK(pgProgram(makeSetup(106)).diff(longMemory).size() == 1);
+
+  return testResult("test_pgprogram");
+}
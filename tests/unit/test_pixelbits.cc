@@ -0,0 +1,123 @@
+/**
+ * pxar pixel set tests
+ * pixel bitsets, their regions and the pixel configuration of a ROC
+ */
+
+#include <vector>
+#include "api.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  /** Unmasked and disabled pixel with the given trim value
+   */
+  pixelConfig makeConfig(uint8_t column, uint8_t row, uint8_t trim) {
+    pixelConfig config;
+    config.column = column;
+    config.row = row;
+    config.trim = trim;
+    config.mask = false;
+    return config;
+  }
+
+}
+
+int main() {
+
+  // Single bits, counting and iteration in index order:
+  pixelBits bits;
+  CHECK(bits.count() == 0);
+  CHECK(bits.begin() == bits.end());
+  bits.set(pixelBits::index(51, 79));
+  bits.set(pixelBits::index(0, 0));
+  bits.set(pixelBits::index(1, 31));
+  bits.set(pixelBits::index(1, 32));
+  CHECK(bits.count() == 4);
+  CHECK(bits.test(pixelBits::index(1, 31)) && !bits.test(pixelBits::index(1, 30)));
+  std::vector<size_t> indices;
+  for(pixelBits::iterator px = bits.begin(); px != bits.end(); ++px) { indices.push_back(px.index()); }
+  CHECK(indices.size() == 4);
+  for(size_t i = 1; i < indices.size(); i++) { CHECK(indices[i-1] < indices[i]); }
+  pixelBits::iterator last = bits.begin();
+  for(size_t i = 1; i < indices.size(); i++) { ++last; }
+  CHECK(last.column() == 51 && last.row() == 79);
+  bits.set(pixelBits::index(1, 31), false);
+  CHECK(bits.count() == 3);
+
+  pixelBits full;
+  full.fill();
+  CHECK(full.count() == pixelBits::size);
+  full.invert();
+  CHECK(full.count() == 0);
+  full.setColumn(7, true);
+  CHECK(full.count() == pixelBits::rows);
+  CHECK(full.begin().column() == 7 && full.begin().row() == 0);
+
+  // Regions include both limits and are clipped to the ROC:
+  pixelBits rect = pixelBits::rectangle(2, 4, 10, 11);
+  CHECK(rect.count() == 6);
+  CHECK(rect.test(pixelBits::index(2, 10)) && rect.test(pixelBits::index(4, 11)));
+  CHECK(!rect.test(pixelBits::index(5, 11)) && !rect.test(pixelBits::index(4, 12)));
+  CHECK(pixelBits::rectangle(50, 200, 78, 200).count() == 2*2);
+
+  pixelBits dcol = pixelBits::doubleColumn(3);
+  CHECK(dcol.count() == 2*pixelBits::rows);
+  CHECK(dcol.test(pixelBits::index(6, 0)) && dcol.test(pixelBits::index(7, 79)));
+  CHECK(!dcol.test(pixelBits::index(5, 79)) && !dcol.test(pixelBits::index(8, 0)));
+  CHECK(pixelBits::doubleColumn(26).count() == 0);
+
+  pixelBits every = pixelBits::stride(4, 1);
+  CHECK(every.count() == pixelBits::size/4);
+  CHECK(every.begin().index() == 1);
+  CHECK(++every.begin() != every.end() && (++every.begin()).index() == 5);
+
+  pixelBits even = pixelBits::checkerboard(0), odd = pixelBits::checkerboard(1);
+  CHECK(even.count() == pixelBits::size/2 && odd.count() == pixelBits::size/2);
+  CHECK(even.test(pixelBits::index(0, 0)) && odd.test(pixelBits::index(0, 1)) && odd.test(pixelBits::index(1, 0)));
+
+  // Combinations:
+  pixelBits both = even;
+  both |= odd;
+  CHECK(both.count() == pixelBits::size);
+  both &= rect;
+  CHECK(both.count() == rect.count());
+  both.remove(even);
+  CHECK(both.count() == 3);
+  pixelBits none = even;
+  none &= odd;
+  CHECK(none.count() == 0);
+
+  // Regions applied to a ROC only change the configured pixels:
+  rocConfig roc;
+  CHECK(!roc.setPixel(makeConfig(52, 0, 0)));
+  for(uint8_t column = 0; column < 10; column++) {
+    for(uint8_t row = 0; row < 10; row++) { CHECK(roc.setPixel(makeConfig(column, row, (column + row)%16))); }
+  }
+  CHECK(roc.nPixels() == 100);
+  CHECK(roc.nEnabledPixels() == 0);
+  CHECK(roc.nMaskedPixels() == 0);
+
+  roc.setPixelsEnable(pixelBits::doubleColumn(0), true);
+  CHECK(roc.nEnabledPixels() == 20);
+  roc.setPixelsEnable(pixelBits::rectangle(0, 0, 0, 79), false);
+  CHECK(roc.nEnabledPixels() == 10);
+  CHECK(roc.enabledPixels().begin().column() == 1);
+
+  roc.setPixelsMask(pixelBits::checkerboard(1), true);
+  CHECK(roc.nMaskedPixels() == 50);
+  CHECK(roc.getPixel(0, 1).mask && !roc.getPixel(0, 0).mask);
+  CHECK(roc.unmaskedPixels().count() == 50);
+  CHECK(roc.getTrim(pixelBits::index(3, 4)) == 7);
+
+  std::vector<pixelConfig> pixels;
+  roc.getPixels(roc.enabledPixels(), pixels);
+  CHECK(pixels.size() == 10);
+  for(size_t i = 0; i < pixels.size(); i++) {
+    CHECK(pixels[i].column == 1 && pixels[i].row == i && pixels[i].enable);
+    CHECK(pixels[i].trim == (1 + i)%16);
+  }
+
+  return testResult("pixelbits");
+}
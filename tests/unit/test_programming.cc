@@ -0,0 +1,49 @@
+/**
+ * pxar DUT programming plan tests
+ * collection of the programming commands and the expected TBM registers
+ */
+
+#include <map>
+#include "datatypes.h"
+#include "check.h"
+
+using namespace pxar;
+
+int main() {
+
+  // ROC only plans do not need the TBM:
+  programmingPlan plan;
+  plan.addRocDac(0, 0x01, 8);
+  plan.addRocMask(0);
+  plan.addPixelTrim(0, 12, 34, 7);
+  plan.addPixelMask(1, 51, 79);
+  CHECK(!plan.hasTbmCommands());
+  CHECK(plan.tbmRegisters().empty());
+  CHECK(plan.commands.size() == 4);
+
+  // Commands keep their order and fields:
+  const programmingCommand & dac = plan.commands[0];
+  CHECK(dac.type == programmingCommand::ROC_DAC && dac.device == 0 && dac.address == 0x01 && dac.value == 8);
+  const programmingCommand & trim = plan.commands[2];
+  CHECK(trim.type == programmingCommand::PIXEL_TRIM && trim.address == 12 && trim.row == 34 && trim.value == 7);
+  const programmingCommand & mask = plan.commands[3];
+  CHECK(mask.type == programmingCommand::PIXEL_MASK && mask.device == 1 && mask.address == 51 && mask.row == 79);
+
+  // The last write of a TBM register counts, clear and inject do not read back:
+  plan.addTbmRegister(0, 0xE0, 0x81);
+  plan.addTbmRegister(0, 0xE2, 0xC0);
+  plan.addTbmRegister(0, 0xE0 | TBM_REG_CLEAR_INJECT, 0x10);
+  plan.addTbmRegister(0, 0xE0, 0x01);
+  CHECK(plan.hasTbmCommands());
+  std::map<uint8_t,uint8_t> registers = plan.tbmRegisters();
+  CHECK(registers.size() == 2);
+  CHECK(registers[0xE0] == 0x01);
+  CHECK(registers[0xE2] == 0xC0);
+  CHECK(registers.find(0xE0 | TBM_REG_CLEAR_INJECT) == registers.end());
+
+  // Clearing empties the plan:
+  plan.clear();
+  CHECK(plan.commands.empty() && !plan.hasTbmCommands());
+
+  return testResult("test_programming");
+}
@@ -0,0 +1,63 @@
+/**
+ * pxar ROC map tests
+ * linear pixel storage and its conversion to pixel and calibration vectors
+ */
+
+#include <vector>
+#include "datatypes.h"
+#include "check.h"
+
+using namespace pxar;
+
+int main() {
+
+  // Full ROC storage, pixels ordered by column then row:
+  rocMap map;
+  CHECK(map.nReadouts.size() == ROC_NUMCOLS*ROC_NUMROWS);
+  CHECK(map.PHsum.size() == ROC_NUMCOLS*ROC_NUMROWS);
+  CHECK(rocMap::index(0, 0) == 0);
+  CHECK(rocMap::index(0, 1) == 1);
+  CHECK(rocMap::index(1, 0) == ROC_NUMROWS);
+  CHECK(rocMap::index(ROC_NUMCOLS-1, ROC_NUMROWS-1) == ROC_NUMCOLS*ROC_NUMROWS - 1);
+
+  map.nReadouts[rocMap::index(3, 7)] = 10;
+  map.PHsum[rocMap::index(3, 7)] = 1234;
+  map.nReadouts[rocMap::index(51, 79)] = 2;
+  map.PHsum[rocMap::index(51, 79)] = -5;
+
+  // Efficiency and pulse height maps contain every pixel with its coordinates:
+  std::vector<pixel> data;
+  map.toPixels(4, true, data);
+  CHECK(data.size() == ROC_NUMCOLS*ROC_NUMROWS);
+  const pixel & px = data[rocMap::index(3, 7)];
+  CHECK(px.roc_id == 4 && px.column == 3 && px.row == 7 && px.value == 10);
+  CHECK(data[rocMap::index(51, 79)].value == 2);
+  CHECK(data[rocMap::index(0, 0)].value == 0);
+
+  // Maps of further ROCs are appended:
+  map.toPixels(5, false, data);
+  CHECK(data.size() == 2*ROC_NUMCOLS*ROC_NUMROWS);
+  const pixel & ph = data[ROC_NUMCOLS*ROC_NUMROWS + rocMap::index(51, 79)];
+  CHECK(ph.roc_id == 5 && ph.column == 51 && ph.row == 79 && ph.value == -5);
+
+  // Calibrations keep both values:
+  std::vector<pixelCalibration> calibrations;
+  map.toCalibrations(2, calibrations);
+  CHECK(calibrations.size() == ROC_NUMCOLS*ROC_NUMROWS);
+  const pixelCalibration & cal = calibrations[rocMap::index(3, 7)];
+  CHECK(cal.roc_id == 2 && cal.column == 3 && cal.row == 7 && cal.nhits == 10 && cal.phsum == 1234);
+  CHECK_CLOSE(cal.meanPulseheight(), 123.4, 1e-9);
+
+  // Storage grows geometrically when appending:
+  std::vector<pixel> grown(10);
+  grown.reserve(100);
+  rocMap::reserveFor(grown, 150);
+  CHECK(grown.capacity() >= 200);
+
+  // Clearing keeps the size and resets the values:
+  map.clear();
+  CHECK(map.nReadouts.size() == ROC_NUMCOLS*ROC_NUMROWS);
+  CHECK(map.nReadouts[rocMap::index(3, 7)] == 0 && map.PHsum[rocMap::index(51, 79)] == 0);
+
+  return testResult("test_rocmap");
+}
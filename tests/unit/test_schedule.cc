@@ -0,0 +1,80 @@
+/**
+ * pxar pixel schedule tests
+ * ordering of the single pixel calls of several ROCs by double column
+ */
+
+#include <vector>
+#include "datatypes.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  pixelBits makeBits(const uint8_t (*pixels)[2], size_t n) {
+    pixelBits bits;
+    for(size_t i = 0; i < n; i++) { bits.set(pixelBits::index(pixels[i][0], pixels[i][1])); }
+    return bits;
+  }
+
+  bool isEntry(const pixelSchedule & schedule, size_t i, uint8_t roc, uint8_t column, uint8_t row) {
+    if(i >= schedule.entries.size()) return false;
+    const pixelSchedule::entry & e = schedule.entries[i];
+    return e.roc == roc && e.column == column && e.row == row;
+  }
+
+}
+
+int main() {
+
+  // Double columns in ascending order, the ROCs take turns within each of them:
+  const uint8_t roc0[][2] = {{40, 4}, {3, 5}, {3, 1}, {2, 3}, {10, 0}, {11, 2}};
+  const uint8_t roc1[][2] = {{41, 1}, {3, 1}, {2, 7}};
+  pixelSchedule schedule;
+  schedule.add(1, makeBits(roc1, 3));
+  schedule.add(0, makeBits(roc0, 6));
+  schedule.build();
+
+  CHECK(schedule.entries.size() == 9);
+  CHECK(isEntry(schedule, 0, 0, 2, 3));
+  CHECK(isEntry(schedule, 1, 1, 2, 7));
+  CHECK(isEntry(schedule, 2, 0, 3, 1));
+  CHECK(isEntry(schedule, 3, 1, 3, 1));
+  CHECK(isEntry(schedule, 4, 0, 3, 5));
+  CHECK(isEntry(schedule, 5, 0, 10, 0));
+  CHECK(isEntry(schedule, 6, 0, 11, 2));
+  CHECK(isEntry(schedule, 7, 0, 40, 4));
+  CHECK(isEntry(schedule, 8, 1, 41, 1));
+
+  // Full ROCs: every double column is finished before the next one starts,
+  // the ROCs alternate call by call and every pixel is scheduled once:
+  pixelBits all;
+  all.fill();
+  pixelSchedule full;
+  for(uint8_t roc = 0; roc < 3; roc++) { full.add(roc, all); }
+  full.build();
+  CHECK(full.entries.size() == 3*pixelBits::size);
+
+  std::vector<pixelBits> seen(3);
+  bool ordered = true, alternating = true, unique = true;
+  for(size_t i = 0; i < full.entries.size(); i++) {
+    const pixelSchedule::entry & e = full.entries[i];
+    if(seen[e.roc].test(pixelBits::index(e.column, e.row))) unique = false;
+    seen[e.roc].set(pixelBits::index(e.column, e.row));
+    if(i == 0) continue;
+    const pixelSchedule::entry & previous = full.entries[i-1];
+    if(e.column/2 < previous.column/2) ordered = false;
+    if(e.roc != (previous.roc + 1)%3) alternating = false;
+  }
+  CHECK(ordered);
+  CHECK(alternating);
+  CHECK(unique);
+
+  // Nothing to schedule:
+  pixelSchedule empty;
+  empty.add(0, pixelBits());
+  empty.build();
+  CHECK(empty.entries.empty());
+
+  return testResult("schedule");
+}
@@ -0,0 +1,91 @@
+/**
+ * pxar S-curve fitter tests
+ * fits synthetic error function curves with known threshold and width
+ */
+
+#include <vector>
+#include <cmath>
+#include "scurve.h"
+#include "constants.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  /** Number of readouts of an ideal pixel at the given DAC value
+   */
+  int32_t readouts(double dac, double threshold, double width, uint32_t nTriggers, bool rising) {
+    double z = (dac - threshold)/(std::sqrt(2.)*width);
+    double efficiency = 0.5*(1. + erf(rising ? z : -z));
+    return static_cast<int32_t>(efficiency*nTriggers + 0.5);
+  }
+
+  void addPixel(std::vector< std::pair<uint8_t, std::vector<pixel> > > & scan, uint8_t roc, uint8_t column, uint8_t row,
+		double threshold, double width, uint32_t nTriggers, bool rising = true) {
+    for(size_t p = 0; p < scan.size(); p++) {
+      int32_t value = readouts(scan[p].first, threshold, width, nTriggers, rising);
+      if(value == 0) continue;
+      pixel px;
+      px.roc_id = roc;
+      px.column = column;
+      px.row = row;
+      px.value = value;
+      scan[p].second.push_back(px);
+    }
+  }
+
+}
+
+int main() {
+
+  const uint32_t nTriggers = 50;
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > scan;
+  for(uint8_t dac = 0; dac < 100; dac++) { scan.push_back(std::make_pair(dac, std::vector<pixel>())); }
+
+  // More pixels than one batch, on two ROCs and added out of order:
+  const size_t nPixels = 3*SCURVE_BATCH_SIZE + 1;
+  for(size_t i = nPixels; i > 0; i--) {
+    size_t pixel = i - 1;
+    addPixel(scan, static_cast<uint8_t>(pixel%2), static_cast<uint8_t>(pixel/2), 5, 30. + pixel, 2. + 0.1*pixel, nTriggers);
+  }
+  // A falling curve and a pixel responding at all DAC values:
+  addPixel(scan, 2, 10, 10, 60., 3., nTriggers, false);
+  addPixel(scan, 2, 11, 11, -50., 1., nTriggers);
+
+  scurveFitter fitter(2);
+  std::vector<scurveResult> results = fitter.fit(scan, nTriggers);
+  CHECK(results.size() == nPixels + 2);
+  if(results.size() != nPixels + 2) return testResult("scurve");
+
+  // Results are ordered by ROC, column and row:
+  for(size_t i = 1; i < results.size(); i++) {
+    CHECK(results[i-1].roc_id < results[i].roc_id
+	  || (results[i-1].roc_id == results[i].roc_id && results[i-1].column < results[i].column));
+  }
+
+  for(size_t i = 0; i < results.size(); i++) {
+    const scurveResult & result = results[i];
+    if(result.roc_id == 2) continue;
+    size_t pixel = 2*result.column + result.roc_id;
+    CHECK(result.flags == SCURVE_OK);
+    CHECK_CLOSE(result.threshold, 30. + pixel, 0.3);
+    CHECK_CLOSE(result.width, 2. + 0.1*pixel, 0.3);
+  }
+
+  const scurveResult & falling = results[nPixels];
+  CHECK(falling.column == 10 && falling.row == 10);
+  CHECK(falling.flags & SCURVE_FALLING);
+  CHECK(!(falling.flags & ~SCURVE_FALLING));
+  CHECK_CLOSE(falling.threshold, 60., 0.3);
+  CHECK_CLOSE(falling.width, 3., 0.3);
+
+  const scurveResult & on = results[nPixels + 1];
+  CHECK(on.flags & SCURVE_ALWAYS_ON);
+
+  // Nothing to fit:
+  CHECK(fitter.fit(std::vector< std::pair<uint8_t, std::vector<pixel> > >(), nTriggers).empty());
+  CHECK(fitter.fit(scan, 0).empty());
+
+  return testResult("scurve");
+}
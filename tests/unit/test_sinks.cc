@@ -0,0 +1,203 @@
+/**
+ * pxar output sink tests
+ * storage, value selection and forwarding of the HAL test function results
+ */
+
+#include <vector>
+#include "datatypes.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  pixel makePixel(uint8_t roc, uint8_t column, uint8_t row, int32_t value) {
+    pixel px;
+    px.roc_id = roc;
+    px.column = column;
+    px.row = row;
+    px.value = value;
+    return px;
+  }
+
+  pixelCalibration makeCalibration(uint8_t roc, uint8_t column, uint8_t row, int16_t nhits, int32_t phsum) {
+    pixelCalibration px;
+    px.roc_id = roc;
+    px.column = column;
+    px.row = row;
+    px.nhits = nhits;
+    px.phsum = phsum;
+    return px;
+  }
+
+  /** Consumer recording every chunk it receives
+   */
+  class chunkLog : public scanConsumer {
+  public:
+    chunkLog() : dac1(), dac2(), chunks() {};
+    void consume(uint8_t d1, uint8_t d2, const std::vector<pixel> & data) {
+      dac1.push_back(d1);
+      dac2.push_back(d2);
+      chunks.push_back(data);
+    };
+    std::vector<uint8_t> dac1;
+    std::vector<uint8_t> dac2;
+    std::vector< std::vector<pixel> > chunks;
+  };
+
+  void checkBlockSink() {
+
+    // One pixel vector per block, calibrations keep the selected value:
+    std::vector< std::vector<pixel> > data;
+    blockSink<> efficiency(data, true);
+    efficiency.prepare(3);
+    CHECK(data.size() == 3);
+    efficiency.push(0, makePixel(0, 1, 2, 5));
+    efficiency.push(2, makeCalibration(1, 3, 4, 7, 700));
+    CHECK(data[0].size() == 1 && data[0][0].value == 5);
+    CHECK(data[1].empty());
+    CHECK(data[2].size() == 1 && data[2][0].roc_id == 1 && data[2][0].column == 3 && data[2][0].row == 4);
+    CHECK(data[2].size() == 1 && data[2][0].value == 7);
+
+    std::vector< std::vector<pixel> > ph;
+    blockSink<> pulseheight(ph);
+    pulseheight.prepare(1);
+    pulseheight.push(0, makeCalibration(1, 3, 4, 7, 700));
+    CHECK(ph[0].size() == 1 && ph[0][0].value == 700);
+
+    // Full ROC maps are appended to the block:
+    rocMap map;
+    map.nReadouts[rocMap::index(10, 20)] = 3;
+    efficiency.push(0, 2, map);
+    CHECK(data[0].size() == 1 + ROC_NUMCOLS*ROC_NUMROWS);
+    CHECK(data[0][1 + rocMap::index(10, 20)].roc_id == 2 && data[0][1 + rocMap::index(10, 20)].value == 3);
+  }
+
+  void checkCalibrationSink() {
+
+    // Calibrations are stored unchanged, plain pixels as one readout:
+    std::vector< std::vector<pixelCalibration> > data;
+    calibrationSink<> sink(data);
+    sink.prepare(2);
+    CHECK(data.size() == 2);
+    sink.push(1, makeCalibration(0, 5, 6, 10, 1234));
+    sink.push(1, makePixel(0, 7, 8, 99));
+    CHECK(data[0].empty());
+    CHECK(data[1].size() == 2);
+    CHECK(data[1].size() == 2 && data[1][0].nhits == 10 && data[1][0].phsum == 1234);
+    CHECK(data[1].size() == 2 && data[1][1].column == 7 && data[1][1].nhits == 1 && data[1][1].phsum == 99);
+
+    rocMap map;
+    map.nReadouts[rocMap::index(1, 1)] = 4;
+    map.PHsum[rocMap::index(1, 1)] = 400;
+    sink.push(0, 3, map);
+    CHECK(data[0].size() == ROC_NUMCOLS*ROC_NUMROWS);
+    CHECK(data[0][rocMap::index(1, 1)].roc_id == 3 && data[0][rocMap::index(1, 1)].nhits == 4);
+    CHECK_CLOSE(data[0][rocMap::index(1, 1)].meanPulseheight(), 100, 1e-9);
+  }
+
+  void checkBlockFormats() {
+
+    // DAC scan blocks keep their DAC value, the pixel vector is filled:
+    std::vector< std::pair<uint8_t, std::vector<pixel> > > scan(2);
+    scan[0].first = 10;
+    scan[1].first = 11;
+    blockSink< std::pair<uint8_t, std::vector<pixel> > > scanSink(scan);
+    scanSink.prepare(2);
+    scanSink.push(1, makePixel(0, 1, 1, 42));
+    CHECK(scan[0].first == 10 && scan[0].second.empty());
+    CHECK(scan[1].first == 11 && scan[1].second.size() == 1 && scan[1].second[0].value == 42);
+
+    // DAC-DAC scan blocks:
+    std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > dacdac;
+    calibrationSink< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixelCalibration> > > > dacdacSink(dacdac);
+    dacdacSink.prepare(4);
+    dacdacSink.push(3, makeCalibration(0, 2, 2, 1, 50));
+    CHECK(dacdac.size() == 4 && dacdac[3].second.second.size() == 1 && dacdac[3].second.second[0].phsum == 50);
+
+    // Repeating a test reuses the storage of the previous run:
+    std::vector< std::vector<pixel> > data;
+    blockSink<> sink(data, false, 100);
+    sink.prepare(1);
+    sink.push(0, makePixel(0, 0, 0, 1));
+    CHECK(data[0].capacity() >= 100);
+    const pixel * storage = &data[0][0];
+    sink.prepare(1);
+    CHECK(data[0].empty() && data[0].capacity() >= 100);
+    sink.push(0, makePixel(0, 0, 1, 2));
+    CHECK(data[0].size() == 1 && &data[0][0] == storage);
+  }
+
+  void checkFilterSink() {
+
+    // Only enabled pixels of restricted ROCs pass, other ROCs pass completely:
+    std::vector< std::vector<pixelCalibration> > data;
+    calibrationSink<> target(data);
+    filterSink filter(target);
+    pixelBits enabled;
+    enabled.set(pixelBits::index(5, 6));
+    enabled.set(pixelBits::index(10, 20));
+    filter.select(1, enabled);
+
+    filter.prepare(2);
+    CHECK(data.size() == 2);
+    filter.push(0, makePixel(1, 5, 6, 1));
+    filter.push(0, makePixel(1, 5, 7, 1));
+    filter.push(0, makeCalibration(1, 10, 20, 2, 20));
+    filter.push(0, makeCalibration(0, 5, 7, 3, 30));
+    CHECK(data[0].size() == 3);
+    CHECK(data[0].size() == 3 && data[0][0].row == 6 && data[0][1].column == 10 && data[0][2].roc_id == 0);
+
+    // Maps of restricted ROCs are reduced to the enabled pixels:
+    rocMap map;
+    filter.push(1, 1, map);
+    CHECK(data[1].size() == 2);
+    filter.push(1, 0, map);
+    CHECK(data[1].size() == 2 + ROC_NUMCOLS*ROC_NUMROWS);
+  }
+
+  void checkStreamSink() {
+
+    // Chunks are split at block and ROC changes and carry the DAC values:
+    chunkLog log;
+    dacScanParameters scan(0x19, 20, 30, 0, 10, 5);
+    streamSink<dacScanParameters> sink(log, scan, true);
+    sink.prepare(scan.blocks());
+    sink.push(0, makePixel(0, 1, 1, 5));
+    sink.push(0, makePixel(0, 1, 2, 6));
+    sink.push(0, makePixel(1, 1, 1, 7));
+    sink.push(1, makeCalibration(1, 2, 2, 8, 800));
+    CHECK(log.chunks.size() == 2);
+    sink.flush();
+    CHECK(log.chunks.size() == 3);
+    CHECK(log.chunks.size() == 3 && log.chunks[0].size() == 2 && log.chunks[1].size() == 1 && log.chunks[2].size() == 1);
+    CHECK(log.dac1.size() == 3 && log.dac1[0] == 20 && log.dac1[1] == 20 && log.dac1[2] == 25);
+    CHECK(log.chunks.size() == 3 && log.chunks[2][0].value == 8);
+
+    // A ROC map is a chunk of its own, DAC-DAC blocks give both values:
+    chunkLog dacdacLog;
+    dacDacScanParameters dacdac(0x19, 0, 4, 0x1a, 10, 13);
+    streamSink<dacDacScanParameters> dacdacSink(dacdacLog, dacdac);
+    dacdacSink.prepare(dacdac.blocks());
+    dacdacSink.push(4, makePixel(0, 3, 3, 1));
+    rocMap map;
+    dacdacSink.push(5, 2, map);
+    dacdacSink.flush();
+    CHECK(dacdacLog.chunks.size() == 2);
+    CHECK(dacdacLog.dac1.size() == 2 && dacdacLog.dac1[0] == 1 && dacdacLog.dac2[0] == 11);
+    CHECK(dacdacLog.dac1.size() == 2 && dacdacLog.dac1[1] == 1 && dacdacLog.dac2[1] == 12);
+    CHECK(dacdacLog.chunks.size() == 2 && dacdacLog.chunks[1].size() == ROC_NUMCOLS*ROC_NUMROWS);
+  }
+
+}
+
+int main() {
+
+  checkBlockSink();
+  checkCalibrationSink();
+  checkBlockFormats();
+  checkFilterSink();
+  checkStreamSink();
+
+  return testResult("test_sinks");
+}
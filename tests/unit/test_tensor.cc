@@ -0,0 +1,127 @@
+/**
+ * pxar scan tensor tests
+ * round trips of maps and scans through the dense tensor storage
+ */
+
+#include <vector>
+#include "tensor.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  pixel makePixel(uint8_t roc, uint8_t column, uint8_t row, int32_t value) {
+    pixel px;
+    px.roc_id = roc;
+    px.column = column;
+    px.row = row;
+    px.value = value;
+    return px;
+  }
+
+  bool samePixels(const std::vector<pixel> & a, const std::vector<pixel> & b) {
+    if(a.size() != b.size()) return false;
+    for(size_t i = 0; i < a.size(); i++) {
+      if(a[i].roc_id != b[i].roc_id || a[i].column != b[i].column || a[i].row != b[i].row || a[i].value != b[i].value) return false;
+    }
+    return true;
+  }
+
+}
+
+int main() {
+
+  // Measured zeros survive the round trip, unmeasured pixels stay empty.
+  // The pixels are given in tensor order (ROC, column, row):
+  std::vector<pixel> map;
+  map.push_back(makePixel(0, 0, 0, 0));
+  map.push_back(makePixel(0, 0, 1, 5));
+  map.push_back(makePixel(0, 51, 79, 0));
+  map.push_back(makePixel(2, 10, 10, 65534));
+
+  countTensor counts;
+  counts.fromPixels(map);
+  CHECK(counts.nRocs() == 3);
+  CHECK(counts.measured(0, 0, 0));
+  CHECK(counts(0, 0, 0) == 0);
+  CHECK(counts.measured(0, 51, 79));
+  CHECK(!counts.measured(0, 0, 2));
+  CHECK(!counts.measured(1, 0, 0));
+  CHECK(counts(1, 0, 0) == counts.empty());
+
+  std::vector<pixel> out;
+  counts.toPixels(out);
+  CHECK(samePixels(map, out));
+
+  sumTensor sums;
+  sums.fromPixels(map);
+  sums.toPixels(out);
+  CHECK(samePixels(map, out));
+
+  // Clearing keeps the shape but forgets all values:
+  counts.clear();
+  CHECK(counts.nRocs() == 3);
+  CHECK(!counts.measured(0, 0, 0));
+  counts.toPixels(out);
+  CHECK(out.empty());
+
+  // DAC scan, the values of one pixel are adjacent:
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > scan;
+  for(uint8_t dac = 10; dac < 15; dac++) {
+    std::vector<pixel> point;
+    point.push_back(makePixel(1, 4, 2, dac - 10));
+    scan.push_back(std::make_pair(dac, point));
+  }
+  countTensor curve;
+  curve.fromScan(scan);
+  CHECK(curve.dac1Steps() == 5);
+  CHECK(curve.dac1(0) == 10 && curve.dac1(4) == 14);
+  for(size_t step = 0; step < 5; step++) { CHECK(curve.curve(1, 4, 2)[step] == step); }
+
+  std::vector< std::pair<uint8_t, std::vector<pixel> > > scanOut;
+  curve.toScan(scanOut);
+  CHECK(scanOut.size() == scan.size());
+  for(size_t i = 0; i < scan.size() && i < scanOut.size(); i++) {
+    CHECK(scanOut[i].first == scan[i].first);
+    CHECK(samePixels(scan[i].second, scanOut[i].second));
+  }
+
+  // DacDac scan, the second DAC runs fastest:
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > dacdac;
+  for(uint8_t dac1 = 0; dac1 < 3; dac1++) {
+    for(uint8_t dac2 = 5; dac2 < 7; dac2++) {
+      std::vector<pixel> point;
+      point.push_back(makePixel(0, 7, 8, 10*dac1 + dac2));
+      dacdac.push_back(std::make_pair(dac1, std::make_pair(dac2, point)));
+    }
+  }
+  sumTensor field;
+  field.fromScan(dacdac);
+  CHECK(field.dac1Steps() == 3 && field.dac2Steps() == 2);
+  CHECK(field(0, 7, 8, 2, 1) == 26);
+
+  std::vector< std::pair<uint8_t, std::pair<uint8_t, std::vector<pixel> > > > dacdacOut;
+  field.toScan(dacdacOut);
+  CHECK(dacdacOut.size() == dacdac.size());
+  for(size_t i = 0; i < dacdac.size() && i < dacdacOut.size(); i++) {
+    CHECK(dacdacOut[i].first == dacdac[i].first);
+    CHECK(dacdacOut[i].second.first == dacdac[i].second.first);
+    CHECK(samePixels(dacdac[i].second.second, dacdacOut[i].second.second));
+  }
+
+  // As consumer of a streaming scan, data outside the tensor is ignored:
+  countTensor stream(1, 20, 22);
+  std::vector<pixel> chunk(1, makePixel(0, 1, 1, 0));
+  stream.consume(19, 0, chunk);
+  stream.consume(21, 0, chunk);
+  stream.consume(22, 0, chunk);
+  chunk[0].roc_id = 1;
+  stream.consume(20, 0, chunk);
+  CHECK(!stream.measured(0, 1, 1, 0));
+  CHECK(stream.measured(0, 1, 1, 1));
+  stream.toPixels(out);
+  CHECK(out.empty());
+
+  return testResult("tensor");
+}
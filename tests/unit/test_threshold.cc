@@ -0,0 +1,100 @@
+/**
+ * pxar threshold search tests
+ * runs the batched bisection against ideal pixels with known thresholds
+ */
+
+#include <vector>
+#include "threshold.h"
+#include "check.h"
+
+using namespace pxar;
+
+namespace {
+
+  /** Number of readouts of an ideal pixel at the given DAC value, pixels
+   *  with a threshold outside [0, 255] never respond
+   */
+  int16_t readouts(uint8_t value, int32_t threshold, bool rising, int16_t nTriggers) {
+    bool above = rising ? (value >= threshold) : (value <= threshold);
+    return above ? nTriggers : 0;
+  }
+
+  /** Run a full search for the given thresholds, returns the thresholds found
+   */
+  std::vector<int16_t> search(thresholdSearch & search, const std::vector<int32_t> & thresholds, bool rising) {
+    std::vector<int16_t> nReadouts(thresholds.size());
+    search.start();
+    uint8_t value;
+    while(search.next(value)) {
+      for(size_t i = 0; i < thresholds.size(); i++) { nReadouts[i] = readouts(value, thresholds[i], rising, 10); }
+      search.update(value, nReadouts);
+    }
+    std::vector<int16_t> found(thresholds.size());
+    for(size_t i = 0; i < thresholds.size(); i++) { found[i] = search.threshold(i); }
+    return found;
+  }
+
+}
+
+int main() {
+
+  // Thresholds at both ends of the full DAC range, which includes 255:
+  std::vector<int32_t> thresholds;
+  thresholds.push_back(0);
+  thresholds.push_back(1);
+  thresholds.push_back(128);
+  thresholds.push_back(254);
+  thresholds.push_back(255);
+
+  for(int edge = 0; edge < 2; edge++) {
+    bool rising = (edge == 0);
+    thresholdSearch full(thresholds.size(), 0, 255, 5, rising);
+    std::vector<int16_t> found = search(full, thresholds, rising);
+    for(size_t i = 0; i < thresholds.size(); i++) { CHECK(found[i] == thresholds[i]); }
+    // A bisection of 256 values needs 8 probes per pixel, and the pixels share them:
+    CHECK(full.nProbes() <= 8*thresholds.size());
+  }
+
+  // A limited range includes both limits, thresholds outside are not found:
+  std::vector<int32_t> limited;
+  limited.push_back(9);
+  limited.push_back(10);
+  limited.push_back(20);
+  limited.push_back(21);
+  thresholdSearch range(limited.size(), 10, 20, 5, true);
+  std::vector<int16_t> found = search(range, limited, true);
+  CHECK(found[0] == 10);
+  CHECK(found[1] == 10);
+  CHECK(found[2] == 20);
+  CHECK(found[3] == -1);
+
+  // A single value range:
+  thresholdSearch single(1, 42, 42, 5, true);
+  CHECK(search(single, std::vector<int32_t>(1, 42), true)[0] == 42);
+  CHECK(search(single, std::vector<int32_t>(1, 43), true)[0] == -1);
+
+  // The previous thresholds seed the next search, small shifts need fewer probes:
+  std::vector<int32_t> shifted(thresholds.size());
+  thresholdSearch seeded(thresholds.size(), 0, 255, 5, true);
+  search(seeded, thresholds, true);
+  size_t unseeded = seeded.nProbes();
+  for(size_t i = 0; i < thresholds.size(); i++) { shifted[i] = (thresholds[i] < 255) ? thresholds[i] + 1 : 255; }
+  found = search(seeded, shifted, true);
+  for(size_t i = 0; i < thresholds.size(); i++) { CHECK(found[i] == shifted[i]); }
+  CHECK(seeded.nProbes() < unseeded);
+
+  // A single pixel moving by one DAC unit needs the seed and its neighbour:
+  thresholdSearch pixel(1, 0, 255, 5, true);
+  search(pixel, std::vector<int32_t>(1, 100), true);
+  CHECK(search(pixel, std::vector<int32_t>(1, 101), true)[0] == 101);
+  CHECK(pixel.nProbes() == 2);
+
+  // External seeds are used as threshold, also at the upper limit:
+  thresholdSearch external(2, 0, 255, 5, false);
+  external.seed(0, 255);
+  external.seed(1, 256);
+  CHECK(external.threshold(0) == 255);
+  CHECK(external.threshold(1) == -1);
+
+  return testResult("threshold");
+}